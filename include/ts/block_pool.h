@@ -0,0 +1,20 @@
+#ifndef TS_BLOCK_POOL_H_
+#define TS_BLOCK_POOL_H_
+
+#include <cstddef>
+
+
+namespace ts {
+
+// Allocates a block of at least byte_count bytes aligned as operator new does.
+// Blocks of up to 2048 bytes are recycled through per-thread caches which exchange batches of blocks
+// with a shared pool, short-lived objects (future states, coroutine frames) do not touch the heap
+// in the steady state. Bigger blocks go to the heap.
+void* allocate_pooled_block(size_t byte_count);
+
+// byte_count must be the value the block has been allocated with.
+void free_pooled_block(void* p, size_t byte_count) noexcept;
+
+} // namespace ts
+
+#endif // TS_BLOCK_POOL_H_
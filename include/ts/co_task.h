@@ -0,0 +1,368 @@
+#ifndef TS_CO_TASK_H_
+#define TS_CO_TASK_H_
+
+// Stackless coroutine tasks. They need C++20 coroutines (/std:c++latest, -std=c++20),
+// the header is empty otherwise. The rest of the library does not depend on it.
+
+#if defined(__cpp_impl_coroutine)
+
+#define TS_HAS_COROUTINES 1
+
+#include <cassert>
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "ts/block_pool.h"
+#include "ts/future.h"
+#include "ts/task_func.h"
+#include "ts/task_system.h"
+
+
+namespace ts {
+
+template<typename T = void>
+class co_task;
+
+// co_task_promise_base keeps the part of a co_task's promise which does not depend on the result type.
+// Coroutine frames are allocated from the block pool.
+class co_task_promise_base {
+public:
+
+	// Resumes the awaiting coroutine, if any, without growing the stack (symmetric transfer).
+	struct final_awaiter final {
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+
+		template<typename Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+		{
+			const std::coroutine_handle<> continuation = handle.promise().continuation_;
+			return (continuation) ? continuation : std::noop_coroutine();
+		}
+
+		void await_resume() const noexcept {}
+	};
+
+
+	static void* operator new(size_t byte_count)
+	{
+		return allocate_pooled_block(byte_count);
+	}
+
+	static void operator delete(void* p, size_t byte_count) noexcept
+	{
+		free_pooled_block(p, byte_count);
+	}
+
+	// co_task is lazy, it starts when it is awaited or spawned.
+	std::suspend_always initial_suspend() const noexcept
+	{
+		return {};
+	}
+
+	final_awaiter final_suspend() const noexcept
+	{
+		return {};
+	}
+
+	void unhandled_exception() noexcept
+	{
+		p_exception_ = std::current_exception();
+	}
+
+	void set_continuation(std::coroutine_handle<> continuation) noexcept
+	{
+		continuation_ = continuation;
+	}
+
+protected:
+
+	void rethrow_if_exception() const
+	{
+		if (p_exception_) std::rethrow_exception(p_exception_);
+	}
+
+private:
+
+	std::coroutine_handle<>	continuation_;
+	std::exception_ptr		p_exception_;
+};
+
+template<typename T>
+class co_task_promise final : public co_task_promise_base {
+public:
+
+	~co_task_promise() noexcept
+	{
+		if (has_value_) p_value()->~T();
+	}
+
+
+	co_task<T> get_return_object() noexcept;
+
+	template<typename U>
+	void return_value(U&& value)
+	{
+		new(&storage_) T(std::forward<U>(value));
+		has_value_ = true;
+	}
+
+	// Moves the result out or rethrows the exception of the coroutine.
+	T take_value()
+	{
+		rethrow_if_exception();
+		assert(has_value_);
+		return std::move(*p_value());
+	}
+
+private:
+
+	T* p_value() noexcept
+	{
+		return reinterpret_cast<T*>(&storage_);
+	}
+
+
+	typename std::aligned_storage<sizeof(T), alignof(T)>::type storage_;
+	bool has_value_ = false;
+};
+
+template<>
+class co_task_promise<void> final : public co_task_promise_base {
+public:
+
+	co_task<void> get_return_object() noexcept;
+
+	void return_void() const noexcept {}
+
+	void take_value()
+	{
+		rethrow_if_exception();
+	}
+};
+
+// co_task<T> is a stackless coroutine which produces T. Unlike a fiber a suspended co_task holds only
+// its frame (a pooled block). A co_task starts when it is awaited by another coroutine (it runs inline
+// in the awaiting coroutine's thread) or spawned with ts::spawn. Inside a co_task use
+// co_await ts::co_wait_for(counter), co_await future and co_await co_task instead of the blocking calls.
+template<typename T>
+class co_task final {
+public:
+
+	using promise_type = co_task_promise<T>;
+	using handle_t = std::coroutine_handle<promise_type>;
+
+
+	co_task() noexcept = default;
+
+	explicit co_task(handle_t handle) noexcept
+		: handle_(handle)
+	{}
+
+	co_task(co_task&& t) noexcept
+		: handle_(std::exchange(t.handle_, nullptr))
+	{}
+
+	co_task& operator=(co_task&& t) noexcept
+	{
+		if (this == &t) return *this;
+
+		if (handle_) handle_.destroy();
+		handle_ = std::exchange(t.handle_, nullptr);
+		return *this;
+	}
+
+	co_task(const co_task&) = delete;
+	co_task& operator=(const co_task&) = delete;
+
+	~co_task() noexcept
+	{
+		if (handle_) handle_.destroy();
+	}
+
+
+	bool valid() const noexcept
+	{
+		return bool(handle_);
+	}
+
+	// Starts the task and suspends the awaiting coroutine until the task completes.
+	auto operator co_await() && noexcept
+	{
+		struct awaiter final {
+			bool await_ready() const noexcept
+			{
+				return false;
+			}
+
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+			{
+				handle.promise().set_continuation(awaiting);
+				return handle;
+			}
+
+			T await_resume()
+			{
+				return handle.promise().take_value();
+			}
+
+
+			handle_t handle;
+		};
+
+		assert(handle_);
+		return awaiter{ handle_ };
+	}
+
+private:
+
+	handle_t handle_;
+};
+
+// Returned by ts::co_wait_for. Resumes the coroutine in a new task once the counter reaches zero.
+class counter_awaiter final {
+public:
+
+	explicit counter_awaiter(const std::atomic_size_t& wait_counter) noexcept
+		: p_wait_counter_(&wait_counter)
+	{}
+
+
+	bool await_ready() const noexcept
+	{
+		return (p_wait_counter_->load() == 0);
+	}
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		run_when_zero(*p_wait_counter_, [handle] { handle.resume(); });
+	}
+
+	void await_resume() const noexcept {}
+
+private:
+
+	const std::atomic_size_t* p_wait_counter_;
+};
+
+// co_await ts::co_wait_for(counter) suspends the current co_task until the counter reaches zero.
+inline counter_awaiter co_wait_for(const std::atomic_size_t& wait_counter) noexcept
+{
+	return counter_awaiter(wait_counter);
+}
+
+// co_await future suspends the current co_task until the result is ready and returns it (future::get).
+template<typename T>
+inline auto operator co_await(future<T>& f) noexcept
+{
+	struct awaiter final {
+		bool await_ready() const noexcept
+		{
+			return r_future.is_ready();
+		}
+
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			run_when_zero(r_future.wait_counter(), [handle] { handle.resume(); });
+		}
+
+		T await_resume()
+		{
+			return r_future.get();
+		}
+
+
+		future<T>& r_future;
+	};
+
+	assert(f.valid());
+	return awaiter{ f };
+}
+
+template<typename T>
+inline auto operator co_await(future<T>&& f) noexcept
+{
+	return operator co_await(f);
+}
+
+// detached_co_task is a coroutine nobody awaits, its frame is destroyed when it completes.
+struct detached_co_task final {
+	struct promise_type final : public co_task_promise_base {
+		detached_co_task get_return_object() noexcept
+		{
+			return detached_co_task{ std::coroutine_handle<promise_type>::from_promise(*this) };
+		}
+
+		std::suspend_never final_suspend() const noexcept
+		{
+			return {};
+		}
+
+		void return_void() const noexcept {}
+	};
+
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+// Runs the task and passes its result to the future state.
+template<typename T>
+detached_co_task run_co_task(co_task<T> task, future_state<T>* p_state)
+{
+	try {
+		if constexpr (std::is_void<T>::value) {
+			co_await std::move(task);
+		}
+		else {
+			p_state->emplace_value(co_await std::move(task));
+		}
+	}
+	catch (...) {
+		p_state->set_exception(std::current_exception());
+	}
+
+	p_state->complete();
+	p_state->release();
+}
+
+// Spawns the task and returns the future of its result. The task starts in a new ts task,
+// it resumes in the tasks spawned by the counters and futures it awaits.
+template<typename T>
+inline future<T> spawn(co_task<T> task, task_priority priority = task_priority::normal)
+{
+	assert(task.valid());
+
+	future_state<T>* p_state = future_state_base::create<future_state<T>>();
+	future<T> f(p_state);
+
+	// the coroutine holds its own reference until the state is complete.
+	p_state->add_ref();
+	const std::coroutine_handle<> handle = run_co_task(std::move(task), p_state).handle;
+	run(make_task_func([handle] { handle.resume(); }), priority);
+
+	return f;
+}
+
+// ----- co_task_promise -----
+
+template<typename T>
+inline co_task<T> co_task_promise<T>::get_return_object() noexcept
+{
+	return co_task<T>(std::coroutine_handle<co_task_promise>::from_promise(*this));
+}
+
+inline co_task<void> co_task_promise<void>::get_return_object() noexcept
+{
+	return co_task<void>(std::coroutine_handle<co_task_promise>::from_promise(*this));
+}
+
+} // namespace ts
+
+#endif // defined(__cpp_impl_coroutine)
+
+#endif // TS_CO_TASK_H_
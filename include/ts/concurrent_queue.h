@@ -39,22 +39,38 @@ public:
 	template<typename U>
 	void push(U&& v);
 
+	// Pushes all the values under one lock.
 	template<typename InputIt>
 	void push(InputIt b, InputIt e);
 
+	// Pushes count values under one lock, the i-th value is make_value(i).
+	// Returns false and pushes nothing if there is not enough room for all of them.
+	template<typename MakeValue>
+	bool try_emplace_bulk(size_t count, MakeValue make_value);
+
 	// Tries to pop a value from the queue. If the queue is empty returns false and leaves out_v unchanged.
 	bool try_pop(T& out_v);
 
+	// Pops at most out_count_limit values under one lock. Returns the number of popped values.
+	size_t try_pop_bulk(T* p_out, size_t out_count_limit);
+
 	// Blocks if the queue empty and it's allowed to wait (wait_allowed == true).
 	bool wait_pop(T& out_v);
 
 
 private:
 
+	// Wakes as many waiters as there are new values. Must be called after the lock has been released.
+	void notify(size_t value_count, size_t waiter_count);
+
+
 	ring_buffer<T>			queue_;
 	mutable std::mutex		mutex_;
 	std::condition_variable not_empty_condition_;
 	std::atomic_bool		wait_allowed_;
+
+	// The number of threads blocked in wait_pop, guarded by mutex_.
+	size_t					waiter_count_ = 0;
 };
 
 
@@ -92,28 +108,32 @@ template<typename T>
 template<typename... Args>
 void concurrent_queue<T>::emplace(Args&&... args)
 {
+	size_t waiter_count;
 	{
 		std::lock_guard<std::mutex> lock(mutex_);
 		bool res = queue_.try_emplace(std::forward<Args>(args)...);
 		assert(res);
+		waiter_count = waiter_count_;
 	}
 
-	not_empty_condition_.notify_one();
+	notify(1, waiter_count);
 }
 
 template<typename T>
 template<typename U>
 void concurrent_queue<T>::push(U&& v)
 {
-	static_assert(std::is_same<T, std::remove_reference<U>::type>::value, "U must be implicitly convertible to T.");
+	static_assert(std::is_same<T, typename std::remove_reference<U>::type>::value, "U must be implicitly convertible to T.");
 
+	size_t waiter_count;
 	{
 		std::lock_guard<std::mutex> lock(mutex_);
 		bool res = queue_.try_push(std::forward<U>(v));
 		assert(res);
+		waiter_count = waiter_count_;
 	}
 
-	not_empty_condition_.notify_one();
+	notify(1, waiter_count);
 }
 
 template<typename T>
@@ -121,17 +141,42 @@ template<typename InputIt>
 void concurrent_queue<T>::push(InputIt b, InputIt e)
 {
 	using trait = std::iterator_traits<InputIt>;
-	static_assert(std::is_same<T, trait::value_type>::value, "InputIt::value_type must be implicitly convertible to T.");
+	static_assert(std::is_same<T, typename trait::value_type>::value, "InputIt::value_type must be implicitly convertible to T.");
 	
+	size_t count = 0;
+	size_t waiter_count;
 	{
 		std::lock_guard<std::mutex> lock(mutex_);
-		for (InputIt i = b; i != e; ++i) {
-			bool res = queue_.try_push(std::forward<trait::reference>(*i));
+		for (InputIt i = b; i != e; ++i, ++count) {
+			bool res = queue_.try_push(std::forward<typename trait::reference>(*i));
+			assert(res);
+		}
+
+		waiter_count = waiter_count_;
+	}
+
+	notify(count, waiter_count);
+}
+
+template<typename T>
+template<typename MakeValue>
+bool concurrent_queue<T>::try_emplace_bulk(size_t count, MakeValue make_value)
+{
+	size_t waiter_count;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (queue_.size_limit() - queue_.size() < count) return false;
+
+		for (size_t i = 0; i < count; ++i) {
+			bool res = queue_.try_push(make_value(i));
 			assert(res);
 		}
+
+		waiter_count = waiter_count_;
 	}
 
-	not_empty_condition_.notify_all();
+	notify(count, waiter_count);
+	return true;
 }
 
 template<typename T>
@@ -143,18 +188,48 @@ bool concurrent_queue<T>::try_pop(T& out_v)
 	return queue_.try_pop(out_v);
 }
 
+template<typename T>
+size_t concurrent_queue<T>::try_pop_bulk(T* p_out, size_t out_count_limit)
+{
+	assert(p_out);
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	size_t count = 0;
+	while (count < out_count_limit && queue_.try_pop(p_out[count]))
+		++count;
+
+	return count;
+}
+
 template<typename T>
 bool concurrent_queue<T>::wait_pop(T& out_v)
 {
 	// We wait while the queue_ is empty and waiting is allowed.
 	std::unique_lock<std::mutex> lock(mutex_);
+	++waiter_count_;
 	not_empty_condition_.wait(lock, [this] { return !(queue_.empty() && wait_allowed_); });
+	--waiter_count_;
 
 	if (queue_.empty()) return false;
 
 	return queue_.try_pop(out_v);
 }
 
+template<typename T>
+void concurrent_queue<T>::notify(size_t value_count, size_t waiter_count)
+{
+	if (waiter_count == 0) return;
+
+	if (value_count >= waiter_count) {
+		not_empty_condition_.notify_all();
+		return;
+	}
+
+	for (size_t i = 0; i < value_count; ++i)
+		not_empty_condition_.notify_one();
+}
+
 } // namespace ts
 
 #endif // TS_CONCURRENCY_QUEUE_H_
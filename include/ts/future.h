@@ -0,0 +1,458 @@
+#ifndef TS_FUTURE_H_
+#define TS_FUTURE_H_
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <exception>
+#include <iterator>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "ts/block_pool.h"
+#include "ts/task_func.h"
+#include "ts/task_system.h"
+
+
+namespace ts {
+
+template<typename T>
+class future;
+
+// future_state_base is the result type independent part of a future shared state.
+// The state is ready when its wait counter reaches zero. The owners of a state (futures, the task which
+// computes the result, continuations) hold references to it, the last one destroys the state.
+class future_state_base {
+public:
+
+	future_state_base(future_state_base&&) = delete;
+	future_state_base& operator=(future_state_base&&) = delete;
+
+
+	// Constructs a State in a pooled block, async/then calls do not touch the heap in the steady state.
+	// The caller gets one reference.
+	template<typename State>
+	static State* create();
+
+	void add_ref() noexcept
+	{
+		ref_count_.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void release() noexcept;
+
+	bool is_ready() const noexcept
+	{
+		return (wait_counter_ == 0);
+	}
+
+	std::atomic_size_t& wait_counter() noexcept
+	{
+		return wait_counter_;
+	}
+
+	const std::exception_ptr& exception() const noexcept
+	{
+		return p_exception_;
+	}
+
+	void set_exception(std::exception_ptr p_exception) noexcept
+	{
+		p_exception_ = std::move(p_exception);
+	}
+
+	// Makes the state ready: spawns the continuation and resumes the fibers which wait for the state.
+	// Must be called once the result or the exception has been stored. The caller must hold a reference.
+	void complete();
+
+	// Sets the task which is spawned when the state becomes ready, right away if it is ready already.
+	// A state has at most one continuation.
+	void set_continuation(task_func&& func, task_priority priority);
+
+protected:
+
+	future_state_base() noexcept = default;
+
+	virtual ~future_state_base() noexcept = default;
+
+private:
+
+	enum class continuation_state : uint8_t {
+		none,
+		attached,
+		completed
+	};
+
+
+	std::atomic_size_t					wait_counter_{ 1 };
+	std::atomic<uint32_t>				ref_count_{ 1 };
+	std::atomic<continuation_state>		continuation_state_{ continuation_state::none };
+	task_priority						continuation_priority_ = task_priority::normal;
+	task_func							continuation_;
+	std::exception_ptr					p_exception_;
+	size_t								byte_count_ = 0;
+};
+
+// future_state keeps either the result of type T or an exception.
+template<typename T>
+class future_state : public future_state_base {
+public:
+
+	~future_state() noexcept override
+	{
+		if (has_value_) p_value()->~T();
+	}
+
+
+	// Stores the value func() returns or the exception it throws.
+	template<typename F>
+	void invoke(F& func) noexcept
+	{
+		try {
+			emplace_value(func());
+		}
+		catch (...) {
+			set_exception(std::current_exception());
+		}
+	}
+
+	template<typename... Args>
+	void emplace_value(Args&&... args)
+	{
+		assert(!has_value_);
+		new(&storage_) T(std::forward<Args>(args)...);
+		has_value_ = true;
+	}
+
+	T& value() noexcept
+	{
+		assert(has_value_);
+		return *p_value();
+	}
+
+	// Moves the value out or rethrows the exception.
+	T take_value()
+	{
+		if (exception()) std::rethrow_exception(exception());
+		return std::move(value());
+	}
+
+private:
+
+	T* p_value() noexcept
+	{
+		return reinterpret_cast<T*>(&storage_);
+	}
+
+
+	typename std::aligned_storage<sizeof(T), alignof(T)>::type storage_;
+	bool has_value_ = false;
+};
+
+template<>
+class future_state<void> : public future_state_base {
+public:
+
+	template<typename F>
+	void invoke(F& func) noexcept
+	{
+		try {
+			func();
+		}
+		catch (...) {
+			set_exception(std::current_exception());
+		}
+	}
+
+	void take_value()
+	{
+		if (exception()) std::rethrow_exception(exception());
+	}
+};
+
+// when_all_state completes when all the futures it keeps are ready.
+template<typename T>
+class when_all_state final : public future_state<std::vector<future<T>>> {
+public:
+
+	// Completes the state when called the last time.
+	void arrive()
+	{
+		if (pending_count.fetch_sub(1) == 1)
+			this->complete();
+	}
+
+
+	std::atomic_size_t pending_count{ 0 };
+};
+
+// The type of the value returned by a continuation F of future<T>.
+template<typename F, typename T>
+struct continuation_result {
+	using type = decltype(std::declval<F&>()(std::declval<T>()));
+};
+
+template<typename F>
+struct continuation_result<F, void> {
+	using type = decltype(std::declval<F&>()());
+};
+
+// A fiber-aware std::future. get() suspends the current fiber, the thread goes on running other tasks.
+// Results are produced by ts::async, future::then and ts::when_all.
+template<typename T>
+class future final {
+public:
+
+	using value_type = T;
+
+
+	future() noexcept = default;
+
+	// Adopts a reference to the state.
+	explicit future(future_state<T>* p_state) noexcept
+		: p_state_(p_state)
+	{}
+
+	future(future&& f) noexcept
+		: p_state_(f.p_state_)
+	{
+		f.p_state_ = nullptr;
+	}
+
+	future& operator=(future&& f) noexcept
+	{
+		if (this == &f) return *this;
+
+		reset();
+		p_state_ = f.p_state_;
+		f.p_state_ = nullptr;
+		return *this;
+	}
+
+	future(const future&) = delete;
+	future& operator=(const future&) = delete;
+
+	~future() noexcept
+	{
+		reset();
+	}
+
+
+	bool valid() const noexcept
+	{
+		return (p_state_ != nullptr);
+	}
+
+	bool is_ready() const noexcept
+	{
+		assert(valid());
+		return p_state_->is_ready();
+	}
+
+	// The counter reaches zero when the result is ready. It can be passed to ts::wait_any/ts::wait_all.
+	const std::atomic_size_t& wait_counter() const noexcept
+	{
+		assert(valid());
+		return p_state_->wait_counter();
+	}
+
+	// Suspends the current fiber until the result is ready.
+	void wait() const
+	{
+		wait_for(wait_counter());
+	}
+
+	// Suspends the current fiber until the result is ready and moves the result out.
+	// Rethrows the exception the computation has thrown. The future becomes invalid.
+	T get();
+
+	// Returns the future of func(result). func is spawned as a task with the given priority when this
+	// future becomes ready, no fiber waits for it. If the computation has thrown, func is not called and
+	// the exception is passed to the returned future. The future becomes invalid.
+	template<typename F>
+	future<typename continuation_result<typename std::decay<F>::type, T>::type>
+	then(F&& func, task_priority priority = task_priority::normal);
+
+	void reset() noexcept
+	{
+		if (!p_state_) return;
+
+		p_state_->release();
+		p_state_ = nullptr;
+	}
+
+private:
+
+	template<typename U>
+	friend future<std::vector<future<U>>> when_all(std::vector<future<U>> futures);
+
+
+	future_state<T>* p_state_ = nullptr;
+};
+
+
+// Calls func with the result of the source state, stores the result of func into the destination state.
+template<typename F, typename T, typename R>
+inline void invoke_continuation(F& func, future_state<T>& src, future_state<R>& dest) noexcept
+{
+	if (src.exception()) {
+		dest.set_exception(src.exception());
+		return;
+	}
+
+	auto invoke_func = [&func, &src] { return func(std::move(src.value())); };
+	dest.invoke(invoke_func);
+}
+
+template<typename F, typename R>
+inline void invoke_continuation(F& func, future_state<void>& src, future_state<R>& dest) noexcept
+{
+	if (src.exception()) {
+		dest.set_exception(src.exception());
+		return;
+	}
+
+	dest.invoke(func);
+}
+
+// Spawns func as a task and returns the future of its result.
+template<typename F>
+inline future<typename continuation_result<typename std::decay<F>::type, void>::type>
+async(F&& func, task_priority priority = task_priority::normal)
+{
+	using result_t = typename continuation_result<typename std::decay<F>::type, void>::type;
+
+	future_state<result_t>* p_state = future_state_base::create<future_state<result_t>>();
+	future<result_t> f(p_state);
+
+	// the task holds its own reference until the state is complete.
+	p_state->add_ref();
+	run(make_task_func([p_state, func = std::forward<F>(func)]() mutable {
+		p_state->invoke(func);
+		p_state->complete();
+		p_state->release();
+	}), priority);
+
+	return f;
+}
+
+// Returns a future which becomes ready when all the futures are ready. The result keeps the futures.
+template<typename T>
+inline future<std::vector<future<T>>> when_all(std::vector<future<T>> futures)
+{
+	when_all_state<T>* p_all = future_state_base::create<when_all_state<T>>();
+	future<std::vector<future<T>>> f(p_all);
+
+	// one extra arrival keeps the state pending until all the continuations have been set.
+	p_all->pending_count = futures.size() + 1;
+	p_all->emplace_value(std::move(futures));
+
+	for (future<T>& ft : p_all->value()) {
+		assert(ft.valid());
+
+		p_all->add_ref();
+		ft.p_state_->set_continuation(make_task_func([p_all] {
+			p_all->arrive();
+			p_all->release();
+		}), task_priority::normal);
+	}
+
+	p_all->arrive();
+	return f;
+}
+
+template<typename InputIt>
+inline future<std::vector<typename std::iterator_traits<InputIt>::value_type>> when_all(InputIt b, InputIt e)
+{
+	using future_t = typename std::iterator_traits<InputIt>::value_type;
+	return when_all(std::vector<future_t>(std::make_move_iterator(b), std::make_move_iterator(e)));
+}
+
+// ----- future_state_base -----
+
+template<typename State>
+inline State* future_state_base::create()
+{
+	static_assert(alignof(State) <= alignof(std::max_align_t), "Over-aligned future results are not supported.");
+
+	void* p = allocate_pooled_block(sizeof(State));
+	State* p_state = new(p) State();
+	p_state->byte_count_ = sizeof(State);
+	return p_state;
+}
+
+inline void future_state_base::release() noexcept
+{
+	if (ref_count_.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+	const size_t byte_count = byte_count_;
+	this->~future_state_base();
+	free_pooled_block(this, byte_count);
+}
+
+inline void future_state_base::complete()
+{
+	const continuation_state prev = continuation_state_.exchange(continuation_state::completed);
+	if (prev == continuation_state::attached)
+		run(&continuation_, 1, continuation_priority_);
+
+	decrement_wait_counter(wait_counter_);
+}
+
+inline void future_state_base::set_continuation(task_func&& func, task_priority priority)
+{
+	assert(!continuation_);
+
+	continuation_ = std::move(func);
+	continuation_priority_ = priority;
+
+	continuation_state expected = continuation_state::none;
+	if (continuation_state_.compare_exchange_strong(expected, continuation_state::attached)) return;
+
+	// the state is complete already.
+	assert(expected == continuation_state::completed);
+	run(&continuation_, 1, continuation_priority_);
+}
+
+// ----- future -----
+
+template<typename T>
+inline T future<T>::get()
+{
+	wait();
+
+	const future f = std::move(*this);
+	return f.p_state_->take_value();
+}
+
+template<typename T>
+template<typename F>
+inline future<typename continuation_result<typename std::decay<F>::type, T>::type>
+future<T>::then(F&& func, task_priority priority)
+{
+	using result_t = typename continuation_result<typename std::decay<F>::type, T>::type;
+	assert(valid());
+
+	future_state<result_t>* p_next = future_state_base::create<future_state<result_t>>();
+	future<result_t> f(p_next);
+
+	// the continuation takes over the reference of this future and holds one more to the next state.
+	future_state<T>* p_state = p_state_;
+	p_state_ = nullptr;
+	p_next->add_ref();
+
+	p_state->set_continuation(make_task_func([p_state, p_next, func = std::forward<F>(func)]() mutable {
+		invoke_continuation(func, *p_state, *p_next);
+		p_state->release();
+		p_next->complete();
+		p_next->release();
+	}), priority);
+
+	return f;
+}
+
+} // namespace ts
+
+#endif // TS_FUTURE_H_
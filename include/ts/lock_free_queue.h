@@ -0,0 +1,389 @@
+#ifndef TS_LOCK_FREE_QUEUE_H_
+#define TS_LOCK_FREE_QUEUE_H_
+
+#include <cassert>
+#include <cstdint>
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "ts/futex.h"
+#include "ts/utility.h"
+
+
+namespace ts {
+
+// lock_free_queue is a bounded multi-producer multi-consumer queue (D. Vyukov's algorithm).
+// It has the same interface as concurrent_queue but push/pop never take a lock.
+//
+// Each slot has a sequence number which tells whether the slot is ready to be written or read
+// at the given position. Positions are 64-bit counters which never wrap in practice,
+// so a slow thread can't mistake a reused slot for the one it has seen before (no ABA problem).
+// Only wait_pop may block, it uses a futex when the queue is empty.
+template<typename T>
+class lock_free_queue final {
+public:
+
+	// size_limit is rounded up to the next power of two.
+	explicit lock_free_queue(size_t size_limit);
+
+	lock_free_queue(const lock_free_queue&) = delete;
+	lock_free_queue& operator=(const lock_free_queue&) = delete;
+
+	~lock_free_queue() noexcept;
+
+
+	// The value is approximate if the queue is accessed concurrently.
+	bool empty() const noexcept
+	{
+		return (size() == 0);
+	}
+
+	// The value is approximate if the queue is accessed concurrently.
+	size_t size() const noexcept
+	{
+		const uint64_t push_pos = push_pos_.load(std::memory_order_relaxed);
+		const uint64_t pop_pos = pop_pos_.load(std::memory_order_relaxed);
+		return (push_pos > pop_pos) ? size_t(push_pos - pop_pos) : 0;
+	}
+
+	size_t size_limit() const noexcept
+	{
+		return mask_ + 1;
+	}
+
+	bool wait_allowed() const noexcept
+	{
+		return wait_allowed_;
+	}
+
+	void set_wait_allowed(bool flag);
+
+	// Returns false if the queue is full.
+	template<typename... Args>
+	bool try_emplace(Args&&... args);
+
+	// Returns false if the queue is full.
+	template<typename U>
+	bool try_push(U&& v);
+
+	template<typename... Args>
+	void emplace(Args&&... args);
+
+	template<typename U>
+	void push(U&& v);
+
+	// Reserves the slots for all the values at once.
+	template<typename InputIt>
+	void push(InputIt b, InputIt e);
+
+	// Reserves count slots with one CAS and constructs the i-th value from make_value(i) right in its slot.
+	// Returns false and pushes nothing if there is not enough room for all of them.
+	template<typename MakeValue>
+	bool try_emplace_bulk(size_t count, MakeValue make_value);
+
+	// Tries to pop a value from the queue. If the queue is empty returns false and leaves out_v unchanged.
+	bool try_pop(T& out_v);
+
+	// Claims at most out_count_limit published values with one CAS. Returns the number of popped values.
+	size_t try_pop_bulk(T* p_out, size_t out_count_limit);
+
+	// Blocks if the queue empty and it's allowed to wait (wait_allowed == true).
+	bool wait_pop(T& out_v);
+
+private:
+
+	struct slot final {
+		std::atomic<uint64_t>	sequence;
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+		T* p_value() noexcept
+		{
+			return reinterpret_cast<T*>(&storage);
+		}
+	};
+
+
+	// Wakes at most count waiters.
+	void notify(size_t count);
+
+
+	alignas(cache_line_byte_count) std::atomic<uint64_t>	push_pos_;
+	alignas(cache_line_byte_count) std::atomic<uint64_t>	pop_pos_;
+	alignas(cache_line_byte_count) std::atomic<uint32_t>	wait_epoch_;
+	std::atomic<uint32_t>									waiter_count_;
+	std::atomic_bool										wait_allowed_;
+	alignas(cache_line_byte_count) std::unique_ptr<slot[]>	slots_;
+	size_t													mask_;
+};
+
+
+template<typename T>
+lock_free_queue<T>::lock_free_queue(size_t size_limit)
+	: push_pos_(0),
+	pop_pos_(0),
+	wait_epoch_(0),
+	waiter_count_(0),
+	wait_allowed_(true),
+	slots_(new slot[next_power_of_two(size_limit)]),
+	mask_(next_power_of_two(size_limit) - 1)
+{
+	assert(size_limit > 0);
+
+	for (size_t i = 0; i <= mask_; ++i)
+		slots_[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+template<typename T>
+lock_free_queue<T>::~lock_free_queue() noexcept
+{
+	// destroy the values which are still in the queue.
+	for (uint64_t pos = pop_pos_; pos != push_pos_; ++pos)
+		slots_[pos & mask_].p_value()->~T();
+}
+
+template<typename T>
+void lock_free_queue<T>::set_wait_allowed(bool flag)
+{
+	bool prev = wait_allowed_.exchange(flag);
+
+	// notify all only if flag is false and the previous value was true.
+	if (!flag && prev != flag) {
+		wait_epoch_.fetch_add(1);
+		futex_wake_all(wait_epoch_);
+	}
+}
+
+template<typename T>
+template<typename... Args>
+bool lock_free_queue<T>::try_emplace(Args&&... args)
+{
+	uint64_t pos = push_pos_.load(std::memory_order_relaxed);
+	slot* p_slot;
+
+	while (true) {
+		p_slot = &slots_[pos & mask_];
+		const uint64_t seq = p_slot->sequence.load(std::memory_order_acquire);
+		const int64_t diff = int64_t(seq - pos);
+
+		if (diff == 0) {
+			// the slot is free, try to claim it.
+			if (push_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+		}
+		else if (diff < 0) {
+			// the slot still holds the value pushed one lap ago, the queue is full.
+			return false;
+		}
+		else {
+			pos = push_pos_.load(std::memory_order_relaxed);
+		}
+	}
+
+	new(&p_slot->storage) T{ std::forward<Args>(args)... };
+	p_slot->sequence.store(pos + 1, std::memory_order_release);
+
+	notify(1);
+	return true;
+}
+
+template<typename T>
+template<typename U>
+bool lock_free_queue<T>::try_push(U&& v)
+{
+	static_assert(std::is_same<T, typename std::decay<U>::type>::value, "U must be implicitly convertible to T.");
+	return try_emplace(std::forward<U>(v));
+}
+
+template<typename T>
+template<typename... Args>
+void lock_free_queue<T>::emplace(Args&&... args)
+{
+	bool res = try_emplace(std::forward<Args>(args)...);
+	assert(res);
+}
+
+template<typename T>
+template<typename U>
+void lock_free_queue<T>::push(U&& v)
+{
+	bool res = try_push(std::forward<U>(v));
+	assert(res);
+}
+
+template<typename T>
+template<typename InputIt>
+void lock_free_queue<T>::push(InputIt b, InputIt e)
+{
+	using trait = std::iterator_traits<InputIt>;
+	static_assert(std::is_same<T, typename trait::value_type>::value, "InputIt::value_type must be implicitly convertible to T.");
+	static_assert(std::is_base_of<std::forward_iterator_tag, typename trait::iterator_category>::value,
+		"InputIt must be a forward iterator, the values are counted before they are pushed.");
+
+	InputIt it = b;
+	bool res = try_emplace_bulk(size_t(std::distance(b, e)), [&it](size_t) {
+		return T(std::forward<typename trait::reference>(*it++));
+	});
+	assert(res);
+}
+
+template<typename T>
+template<typename MakeValue>
+bool lock_free_queue<T>::try_emplace_bulk(size_t count, MakeValue make_value)
+{
+	if (count == 0) return true;
+	if (count > size_limit()) return false;
+
+	uint64_t pos = push_pos_.load(std::memory_order_relaxed);
+
+	while (true) {
+		// A free slot stays free until its position is claimed through push_pos_,
+		// so if all the count slots are free now they are still free after a successful CAS.
+		size_t free_count = 0;
+		int64_t diff = 0;
+		for (; free_count < count; ++free_count) {
+			const uint64_t p = pos + free_count;
+			diff = int64_t(slots_[p & mask_].sequence.load(std::memory_order_acquire) - p);
+			if (diff != 0) break;
+		}
+
+		if (free_count == count) {
+			if (push_pos_.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) break;
+		}
+		else if (diff < 0) {
+			// a slot still holds the value pushed one lap ago, not enough room.
+			return false;
+		}
+		else {
+			pos = push_pos_.load(std::memory_order_relaxed);
+		}
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		slot& s = slots_[(pos + i) & mask_];
+		new(&s.storage) T(make_value(i));
+		s.sequence.store(pos + i + 1, std::memory_order_release);
+	}
+
+	notify(count);
+	return true;
+}
+
+template<typename T>
+bool lock_free_queue<T>::try_pop(T& out_v)
+{
+	uint64_t pos = pop_pos_.load(std::memory_order_relaxed);
+	slot* p_slot;
+
+	while (true) {
+		p_slot = &slots_[pos & mask_];
+		const uint64_t seq = p_slot->sequence.load(std::memory_order_acquire);
+		const int64_t diff = int64_t(seq - (pos + 1));
+
+		if (diff == 0) {
+			// the slot holds a value, try to claim it.
+			if (pop_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+		}
+		else if (diff < 0) {
+			// the value has not been published yet, the queue is empty.
+			return false;
+		}
+		else {
+			pos = pop_pos_.load(std::memory_order_relaxed);
+		}
+	}
+
+	T* p_value = p_slot->p_value();
+	out_v = std::move(*p_value);
+	p_value->~T();
+
+	// the slot is free for the push which comes one lap later.
+	p_slot->sequence.store(pos + mask_ + 1, std::memory_order_release);
+	return true;
+}
+
+template<typename T>
+size_t lock_free_queue<T>::try_pop_bulk(T* p_out, size_t out_count_limit)
+{
+	assert(p_out);
+
+	uint64_t pos = pop_pos_.load(std::memory_order_relaxed);
+	size_t count;
+
+	while (true) {
+		// A published value stays in its slot until its position is claimed through pop_pos_.
+		count = 0;
+		int64_t diff = 0;
+		for (; count < out_count_limit; ++count) {
+			const uint64_t p = pos + count;
+			diff = int64_t(slots_[p & mask_].sequence.load(std::memory_order_acquire) - (p + 1));
+			if (diff != 0) break;
+		}
+
+		if (count == 0 && diff < 0) return 0; // the queue is empty
+
+		if (count > 0) {
+			if (pop_pos_.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) break;
+		}
+		else {
+			pos = pop_pos_.load(std::memory_order_relaxed);
+		}
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		slot& s = slots_[(pos + i) & mask_];
+		T* p_value = s.p_value();
+		p_out[i] = std::move(*p_value);
+		p_value->~T();
+		s.sequence.store(pos + i + mask_ + 1, std::memory_order_release);
+	}
+
+	return count;
+}
+
+template<typename T>
+bool lock_free_queue<T>::wait_pop(T& out_v)
+{
+	while (true) {
+		if (try_pop(out_v)) return true;
+		if (!wait_allowed_) return false;
+
+		// slow path: register as a waiter and recheck the queue before going to sleep.
+		// A push which does not see the waiter is seen by the try_pop below.
+		const uint32_t epoch = wait_epoch_.load();
+		waiter_count_.fetch_add(1);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if (try_pop(out_v)) {
+			waiter_count_.fetch_sub(1);
+			return true;
+		}
+
+		if (wait_allowed_)
+			futex_wait(wait_epoch_, epoch);
+
+		waiter_count_.fetch_sub(1);
+	}
+}
+
+template<typename T>
+void lock_free_queue<T>::notify(size_t count)
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	const uint32_t waiter_count = waiter_count_.load(std::memory_order_relaxed);
+	if (waiter_count == 0) return;
+
+	wait_epoch_.fetch_add(1);
+	if (count >= waiter_count) {
+		futex_wake_all(wait_epoch_);
+		return;
+	}
+
+	for (size_t i = 0; i < count; ++i)
+		futex_wake_one(wait_epoch_);
+}
+
+} // namespace ts
+
+#endif // TS_LOCK_FREE_QUEUE_H_
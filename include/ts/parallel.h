@@ -0,0 +1,363 @@
+#ifndef TS_PARALLEL_H_
+#define TS_PARALLEL_H_
+
+#include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "ts/task_system.h"
+#include "ts/utility.h"
+
+
+namespace ts {
+
+// parallel_for_range processes [first, last) calling func for each index.
+// The range is split lazily (lazy binary splitting): the upper half is spawned only when
+// ts::is_work_demanded says there is an idle worker to take it, otherwise the range is processed
+// grain by grain and the demand is checked again after each grain.
+// See: A. Tzannes et al. 'Lazy Binary-Splitting: A Run-Time Adaptive Work-Stealing Scheduler'.
+template<typename F>
+struct parallel_for_range final {
+	void operator()(size_t first, size_t last) const
+	{
+		while (last - first > grain_size) {
+			if (is_work_demanded()) {
+				const size_t middle = first + (last - first) / 2;
+				const parallel_for_range range = *this;
+				run_joined([range, middle, last] { range(middle, last); }, *p_wait_counter);
+				last = middle;
+				continue;
+			}
+
+			for (const size_t grain_last = first + grain_size; first < grain_last; ++first)
+				(*p_func)(first);
+		}
+
+		for (; first < last; ++first)
+			(*p_func)(first);
+	}
+
+
+	F*					p_func;
+	size_t				grain_size;
+	std::atomic_size_t*	p_wait_counter;
+};
+
+// Calls func(i) for each i in [first, last) in parallel. grain_size is the min number of indices
+// which are processed by one task. Returns when all the indices have been processed.
+// The current fiber processes a part of the range itself.
+template<typename Index, typename F>
+inline typename std::enable_if<std::is_integral<Index>::value>::type
+parallel_for(Index first, Index last, F func, size_t grain_size = 1)
+{
+	assert(grain_size > 0);
+	if (!(first < last)) return;
+
+	auto index_func = [first, &func](size_t i) { func(Index(first + Index(i))); };
+
+	std::atomic_size_t wait_counter(0);
+	const parallel_for_range<decltype(index_func)> range = { &index_func, grain_size, &wait_counter };
+
+	try {
+		range(0, size_t(last - first));
+	}
+	catch (...) {
+		// the spawned tasks refer to func and wait_counter.
+		wait_for(wait_counter);
+		throw;
+	}
+
+	wait_for(wait_counter);
+}
+
+// Calls func(v) for each element v in [b, e) in parallel. See parallel_for above.
+template<typename RandomIt, typename F>
+inline typename std::enable_if<!std::is_integral<RandomIt>::value>::type
+parallel_for(RandomIt b, RandomIt e, F func, size_t grain_size = 1)
+{
+	static_assert(std::is_base_of<std::random_access_iterator_tag,
+		typename std::iterator_traits<RandomIt>::iterator_category>::value,
+		"RandomIt must be a random access iterator.");
+
+	parallel_for(size_t(0), size_t(e - b), [b, &func](size_t i) { func(b[i]); }, grain_size);
+}
+
+// reduce_slot keeps the partial result of one block on its own cache line,
+// the blocks are processed by different workers at the same time.
+template<typename T>
+struct alignas(cache_line_byte_count) reduce_slot final {
+	T* p_value() noexcept
+	{
+		return reinterpret_cast<T*>(&storage);
+	}
+
+
+	typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+	bool constructed = false;
+};
+
+// reduce_slot_array owns slot_count reduce slots and destroys the values which have been constructed.
+template<typename T>
+class reduce_slot_array final {
+public:
+
+	explicit reduce_slot_array(size_t slot_count)
+		: p_slots_(new reduce_slot<T>[slot_count]), slot_count_(slot_count)
+	{}
+
+	reduce_slot_array(reduce_slot_array&&) = delete;
+	reduce_slot_array& operator=(reduce_slot_array&&) = delete;
+
+	~reduce_slot_array() noexcept
+	{
+		for (size_t i = 0; i < slot_count_; ++i) {
+			if (p_slots_[i].constructed)
+				p_slots_[i].p_value()->~T();
+		}
+	}
+
+
+	reduce_slot<T>* data() noexcept
+	{
+		return p_slots_.get();
+	}
+
+private:
+
+	std::unique_ptr<reduce_slot<T>[]>	p_slots_;
+	size_t								slot_count_;
+};
+
+// Returns the size of the blocks parallel reduce/scan algorithms split count items into.
+// Several blocks per thread give lazy splitting room for load balancing.
+inline size_t parallel_block_size(size_t count, size_t grain_size) noexcept
+{
+	constexpr size_t blocks_per_thread = 8;
+	const size_t block_count_limit = std::max<size_t>(thread_count(), 1) * blocks_per_thread;
+	return std::max(grain_size, (count + block_count_limit - 1) / block_count_limit);
+}
+
+// Splits [0, count) into blocks, reduces each block in parallel and combines the partial results
+// in a fixed binary tree order. The blocks depend on count, grain_size and the thread count only,
+// so the result does not depend on scheduling: it is the same from run to run for associative combine
+// functions (floating point addition included). map(i) returns the value of the i-th item.
+template<typename T, typename Map, typename Combine>
+T parallel_reduce_impl(size_t count, Map& map, Combine& combine, size_t grain_size)
+{
+	assert(count > 0);
+	assert(grain_size > 0);
+
+	const size_t block_size = parallel_block_size(count, grain_size);
+	const size_t block_count = (count + block_size - 1) / block_size;
+
+	reduce_slot_array<T> slots(block_count);
+	reduce_slot<T>* p_slots = slots.data();
+	parallel_for(size_t(0), block_count, [p_slots, count, block_size, &map, &combine](size_t b) {
+		const size_t first = b * block_size;
+		const size_t last = std::min(first + block_size, count);
+
+		T acc = map(first);
+		for (size_t i = first + 1; i < last; ++i)
+			acc = combine(std::move(acc), map(i));
+
+		new(&p_slots[b].storage) T(std::move(acc));
+		p_slots[b].constructed = true;
+	});
+
+	// tree combine: ((0 1) (2 3)) ((4 5) (6 7)) ...
+	for (size_t stride = 1; stride < block_count; stride *= 2) {
+		for (size_t i = 0; i + stride < block_count; i += 2 * stride) {
+			T* p_left = p_slots[i].p_value();
+			*p_left = combine(std::move(*p_left), std::move(*p_slots[i + stride].p_value()));
+		}
+	}
+
+	return std::move(*p_slots[0].p_value());
+}
+
+// Returns combine(...combine(map(first), map(first + 1))..., map(last - 1)) computed in parallel,
+// or identity if the range is empty. combine must be associative, the order of the items is preserved.
+// See parallel_reduce_impl for details.
+template<typename Index, typename T, typename Map, typename Combine>
+inline typename std::enable_if<std::is_integral<Index>::value, T>::type
+parallel_reduce(Index first, Index last, T identity, Map map, Combine combine, size_t grain_size = 1)
+{
+	if (!(first < last)) return identity;
+
+	auto index_map = [first, &map](size_t i) { return T(map(Index(first + Index(i)))); };
+	return parallel_reduce_impl<T>(size_t(last - first), index_map, combine, grain_size);
+}
+
+// The same as above, map is called for the elements of [b, e).
+template<typename RandomIt, typename T, typename Map, typename Combine>
+inline typename std::enable_if<!std::is_integral<RandomIt>::value, T>::type
+parallel_reduce(RandomIt b, RandomIt e, T identity, Map map, Combine combine, size_t grain_size = 1)
+{
+	static_assert(std::is_base_of<std::random_access_iterator_tag,
+		typename std::iterator_traits<RandomIt>::iterator_category>::value,
+		"RandomIt must be a random access iterator.");
+
+	if (b == e) return identity;
+
+	auto element_map = [b, &map](size_t i) { return T(map(b[i])); };
+	return parallel_reduce_impl<T>(size_t(e - b), element_map, combine, grain_size);
+}
+
+// Parallel std::transform_reduce: returns reduce(init, reduce(transform(*b), ... transform(*(e - 1)))).
+template<typename RandomIt, typename T, typename Reduce, typename Transform>
+inline T transform_reduce(RandomIt b, RandomIt e, T init, Reduce reduce, Transform transform, size_t grain_size = 1)
+{
+	static_assert(std::is_base_of<std::random_access_iterator_tag,
+		typename std::iterator_traits<RandomIt>::iterator_category>::value,
+		"RandomIt must be a random access iterator.");
+
+	if (b == e) return init;
+
+	auto element_map = [b, &transform](size_t i) { return T(transform(b[i])); };
+	return reduce(std::move(init), parallel_reduce_impl<T>(size_t(e - b), element_map, reduce, grain_size));
+}
+
+// Two-pass (reduce-then-scan) parallel prefix scan of [b, e) into out.
+// Pass 1 reduces every block but the last one, the block sums are turned into the block prefixes serially
+// and pass 2 scans every block starting from its prefix. The prefixes and pass 2 are chained to pass 1
+// with run_when_zero, so the caller waits once for the whole scan. p_init is the initial value
+// of an exclusive scan, nullptr means an inclusive scan. The scan may be done in place (out == b).
+template<typename T, typename RandomIt, typename OutputIt, typename Op>
+void parallel_scan_impl(RandomIt b, RandomIt e, OutputIt out, Op& op, const T* p_init, size_t block_size)
+{
+	const size_t count = size_t(e - b);
+	assert(count > 0);
+
+	if (block_size == 0)
+		block_size = parallel_block_size(count, 1024);
+
+	const size_t block_count = (count + block_size - 1) / block_size;
+	reduce_slot_array<T> slots(block_count);
+	reduce_slot<T>* p_slots = slots.data();
+
+	// pass 1: the sums of all the blocks but the last one.
+	auto reduce_block = [b, block_size, &op, p_slots](size_t block) {
+		RandomIt it = b + block * block_size;
+		const RandomIt block_end = it + block_size;
+
+		T acc = T(*it);
+		for (++it; it != block_end; ++it)
+			acc = op(std::move(acc), *it);
+
+		new(&p_slots[block].storage) T(std::move(acc));
+		p_slots[block].constructed = true;
+	};
+
+	// pass 2: scan the blocks.
+	auto scan_block = [b, out, count, block_size, &op, p_init, p_slots](size_t block) {
+		const size_t first = block * block_size;
+		const size_t last = std::min(first + block_size, count);
+		const T* p_prefix = (block > 0) ? p_slots[block - 1].p_value() : p_init;
+
+		RandomIt it = b + first;
+		const RandomIt block_end = b + last;
+		OutputIt o = out + first;
+
+		if (p_init) {
+			// exclusive: read the item before the output overwrites it.
+			T acc = *p_prefix;
+			for (; it != block_end; ++it, ++o) {
+				T v = T(*it);
+				*o = acc;
+				acc = op(std::move(acc), std::move(v));
+			}
+		}
+		else {
+			T acc = (p_prefix) ? op(*p_prefix, *it) : T(*it);
+			*o = acc;
+			for (++it, ++o; it != block_end; ++it, ++o) {
+				acc = op(std::move(acc), *it);
+				*o = acc;
+			}
+		}
+	};
+
+	// scan_counter holds the chained task until it has spawned pass 2.
+	std::atomic_size_t reduce_counter(0);
+	std::atomic_size_t scan_counter(1);
+	const parallel_for_range<decltype(reduce_block)> reduce_range = { &reduce_block, 1, &reduce_counter };
+	const parallel_for_range<decltype(scan_block)> scan_range = { &scan_block, 1, &scan_counter };
+
+	auto scan_blocks = [&op, p_init, p_slots, block_count, &scan_range, &scan_counter] {
+		try {
+			// slot k becomes the prefix of block k + 1: init op sum(0) op ... op sum(k).
+			if (p_init && block_count > 1)
+				*p_slots[0].p_value() = op(*p_init, std::move(*p_slots[0].p_value()));
+
+			for (size_t block = 1; block + 1 < block_count; ++block)
+				*p_slots[block].p_value() = op(*p_slots[block - 1].p_value(), std::move(*p_slots[block].p_value()));
+
+			scan_range(0, block_count);
+		}
+		catch (...) {
+			decrement_wait_counter(scan_counter);
+			throw;
+		}
+
+		decrement_wait_counter(scan_counter);
+	};
+
+	try {
+		reduce_range(0, block_count - 1);
+	}
+	catch (...) {
+		// the spawned tasks refer to the blocks and reduce_counter.
+		wait_for(reduce_counter);
+		throw;
+	}
+
+	run_when_zero(reduce_counter, [&scan_blocks] { scan_blocks(); });
+	wait_for(scan_counter);
+}
+
+// Parallel std::inclusive_scan: out[i] = in[0] op in[1] op ... op in[i]. op must be associative.
+// block_size is the number of items processed by one task, 0 picks it according to the thread count.
+// Returns the end of the output range.
+template<typename RandomIt, typename OutputIt, typename Op>
+inline OutputIt parallel_inclusive_scan(RandomIt b, RandomIt e, OutputIt out, Op op, size_t block_size = 0)
+{
+	using value_t = typename std::iterator_traits<RandomIt>::value_type;
+
+	if (b == e) return out;
+
+	parallel_scan_impl<value_t>(b, e, out, op, static_cast<const value_t*>(nullptr), block_size);
+	return out + (e - b);
+}
+
+template<typename RandomIt, typename OutputIt>
+inline OutputIt parallel_inclusive_scan(RandomIt b, RandomIt e, OutputIt out)
+{
+	using value_t = typename std::iterator_traits<RandomIt>::value_type;
+	return parallel_inclusive_scan(b, e, out, [](const value_t& l, const value_t& r) { return l + r; });
+}
+
+// Parallel std::exclusive_scan: out[0] = init, out[i] = init op in[0] op ... op in[i - 1]. op must be associative.
+// block_size is the number of items processed by one task, 0 picks it according to the thread count.
+// Returns the end of the output range.
+template<typename RandomIt, typename OutputIt, typename T, typename Op>
+inline OutputIt parallel_exclusive_scan(RandomIt b, RandomIt e, OutputIt out, T init, Op op, size_t block_size = 0)
+{
+	if (b == e) return out;
+
+	parallel_scan_impl<T>(b, e, out, op, &init, block_size);
+	return out + (e - b);
+}
+
+template<typename RandomIt, typename OutputIt, typename T>
+inline OutputIt parallel_exclusive_scan(RandomIt b, RandomIt e, OutputIt out, T init)
+{
+	return parallel_exclusive_scan(b, e, out, std::move(init), [](const T& l, const T& r) { return l + r; });
+}
+
+} // namespace ts
+
+#endif // TS_PARALLEL_H_
@@ -0,0 +1,137 @@
+#ifndef TS_SCRATCH_ALLOCATOR_H_
+#define TS_SCRATCH_ALLOCATOR_H_
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace ts {
+
+// scratch_allocator is a bump allocator for the short-lived data of one task or one frame.
+// An allocation moves a pointer inside the current block, nothing is freed on its own:
+// reset releases everything at once and destructors are not called.
+// Blocks of block_byte_count bytes are recycled through per-thread caches (per-worker under the task system)
+// which exchange blocks with a shared pool. An allocation which does not fit into a block gets a heap block.
+// The allocator keeps no per-thread state, a fiber which owns one may be resumed by any worker.
+// Only one fiber uses an allocator at a time.
+class scratch_allocator final {
+public:
+
+	static constexpr size_t block_byte_count = 64 * 1024;
+
+
+	scratch_allocator() noexcept = default;
+
+	scratch_allocator(scratch_allocator&&) = delete;
+	scratch_allocator& operator=(scratch_allocator&&) = delete;
+
+	~scratch_allocator() noexcept
+	{
+		reset();
+	}
+
+
+	// alignment must be a power of two.
+	void* allocate(size_t byte_count, size_t alignment = alignof(std::max_align_t))
+	{
+		assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+		const uintptr_t p = (uintptr_t(p_cur_) + alignment - 1) & ~uintptr_t(alignment - 1);
+		if (!p_cur_ || p + byte_count > uintptr_t(p_end_))
+			return allocate_slow(byte_count, alignment);
+
+		p_cur_ = reinterpret_cast<char*>(p + byte_count);
+		allocated_byte_count_ += byte_count;
+		return reinterpret_cast<void*>(p);
+	}
+
+	template<typename T>
+	T* allocate_array(size_t count)
+	{
+		return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+	}
+
+	// Releases all the memory allocated since construction or the last reset.
+	void reset() noexcept;
+
+	// The number of bytes allocated since construction or the last reset.
+	size_t allocated_byte_count() const noexcept
+	{
+		return allocated_byte_count_;
+	}
+
+private:
+
+	struct block_header;
+
+
+	void* allocate_slow(size_t byte_count, size_t alignment);
+
+
+	// The current block goes first, heap blocks are linked behind it.
+	block_header*	p_blocks_ = nullptr;
+	char*			p_cur_ = nullptr;
+	char*			p_end_ = nullptr;
+	size_t			allocated_byte_count_ = 0;
+};
+
+// scratch_stl_allocator makes a scratch_allocator usable by the standard containers:
+// std::vector<int, ts::scratch_stl_allocator<int>> v(ts::scratch_stl_allocator<int>(scratch));
+// deallocate does nothing, a growing container leaves its old buffers in the scratch memory until reset.
+// Not final: the standard containers derive from their allocators.
+template<typename T>
+class scratch_stl_allocator {
+public:
+
+	using value_type = T;
+
+
+	explicit scratch_stl_allocator(scratch_allocator& allocator) noexcept
+		: p_allocator_(&allocator)
+	{}
+
+	template<typename U>
+	scratch_stl_allocator(const scratch_stl_allocator<U>& a) noexcept
+		: p_allocator_(&a.allocator())
+	{}
+
+
+	T* allocate(size_t count)
+	{
+		return p_allocator_->allocate_array<T>(count);
+	}
+
+	void deallocate(T*, size_t) noexcept
+	{}
+
+	scratch_allocator& allocator() const noexcept
+	{
+		return *p_allocator_;
+	}
+
+private:
+
+	scratch_allocator* p_allocator_;
+};
+
+template<typename T, typename U>
+inline bool operator==(const scratch_stl_allocator<T>& l, const scratch_stl_allocator<U>& r) noexcept
+{
+	return &l.allocator() == &r.allocator();
+}
+
+template<typename T, typename U>
+inline bool operator!=(const scratch_stl_allocator<T>& l, const scratch_stl_allocator<U>& r) noexcept
+{
+	return !(l == r);
+}
+
+// Returns the scratch allocator of the current task, it is reset when the task completes.
+// Must be called by a task or by the kernel function (reset when the kernel function returns).
+// Unlike a thread local, the allocator follows its task if the fiber is resumed by another worker.
+scratch_allocator& task_scratch_allocator();
+
+} // namespace ts
+
+#endif // TS_SCRATCH_ALLOCATOR_H_
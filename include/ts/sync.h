@@ -0,0 +1,322 @@
+#ifndef TS_SYNC_H_
+#define TS_SYNC_H_
+
+#include <cassert>
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+#include "ts/task_system.h"
+#include "ts/utility.h"
+
+
+// Fiber-aware synchronization primitives. On contention a fiber spins for a while and then
+// is suspended through the task system (ts::wait_for), the worker thread keeps running other tasks.
+// The primitives hand ownership over to the fibers they resume: a resumed fiber never competes
+// for the lock again. They must be used by the fibers of a running task system only.
+
+namespace ts {
+
+// sync_waiter is a fiber waiting in the queue of a synchronization primitive.
+// It lives on the waiting fiber's stack, the fiber is resumed when its wait counter reaches zero.
+struct sync_waiter final {
+	std::atomic_size_t	wait_counter{ 1 };
+	sync_waiter*		p_next = nullptr;
+	bool				shared = false;
+};
+
+// sync_waiter_queue is a FIFO of waiters. It is guarded by the spin lock of its primitive.
+class sync_waiter_queue final {
+public:
+
+	bool empty() const noexcept
+	{
+		return (p_head_ == nullptr);
+	}
+
+	sync_waiter* front() const noexcept
+	{
+		return p_head_;
+	}
+
+	void push_back(sync_waiter* p_waiter) noexcept
+	{
+		assert(p_waiter);
+
+		p_waiter->p_next = nullptr;
+		if (p_tail_) p_tail_->p_next = p_waiter;
+		else p_head_ = p_waiter;
+		p_tail_ = p_waiter;
+	}
+
+	sync_waiter* pop_front() noexcept
+	{
+		sync_waiter* p_waiter = p_head_;
+		if (!p_waiter) return nullptr;
+
+		p_head_ = p_waiter->p_next;
+		if (!p_head_) p_tail_ = nullptr;
+		p_waiter->p_next = nullptr;
+		return p_waiter;
+	}
+
+	// Removes all the waiters and returns them linked by p_next.
+	sync_waiter* pop_all() noexcept
+	{
+		sync_waiter* p_head = p_head_;
+		p_head_ = nullptr;
+		p_tail_ = nullptr;
+		return p_head;
+	}
+
+private:
+
+	sync_waiter* p_head_ = nullptr;
+	sync_waiter* p_tail_ = nullptr;
+};
+
+// The number of attempts to acquire a primitive before the fiber is suspended.
+constexpr size_t sync_spin_count = 64;
+
+// Suspends the current fiber until the waiter is resumed.
+void park_waiter(sync_waiter& waiter);
+
+// Resumes the waiters linked by p_next. Must be called without holding the primitive's spin lock.
+void unpark_waiters(sync_waiter* p_waiter);
+
+// A fiber-aware std::mutex. Waiters get the mutex in FIFO order.
+class mutex final {
+public:
+
+	mutex() noexcept = default;
+
+	mutex(mutex&&) = delete;
+	mutex& operator=(mutex&&) = delete;
+
+	~mutex() noexcept
+	{
+		assert(state_ == 0);
+	}
+
+
+	bool try_lock() noexcept
+	{
+		uint32_t expected = 0;
+		return state_.compare_exchange_strong(expected, locked_bit,
+			std::memory_order_acquire, std::memory_order_relaxed);
+	}
+
+	void lock()
+	{
+		if (!try_lock()) lock_slow();
+	}
+
+	void unlock()
+	{
+		uint32_t expected = locked_bit;
+		if (!state_.compare_exchange_strong(expected, 0, std::memory_order_release, std::memory_order_relaxed))
+			unlock_slow();
+	}
+
+private:
+
+	static constexpr uint32_t locked_bit = 1;
+
+	// Set while there are waiters or a fiber is about to wait. It sends lock/unlock to the slow paths,
+	// so the state changes only under the guard.
+	static constexpr uint32_t waiters_bit = 2;
+
+
+	void lock_slow();
+
+	void unlock_slow();
+
+
+	std::atomic<uint32_t>	state_{ 0 };
+	spin_lock				guard_;
+	sync_waiter_queue		waiters_;
+};
+
+// A fiber-aware std::shared_mutex. Waiters get the mutex in FIFO order, consecutive shared waiters
+// are resumed together. New shared owners queue up behind a waiting exclusive owner.
+class shared_mutex final {
+public:
+
+	shared_mutex() noexcept = default;
+
+	shared_mutex(shared_mutex&&) = delete;
+	shared_mutex& operator=(shared_mutex&&) = delete;
+
+	~shared_mutex() noexcept
+	{
+		assert(state_ == 0);
+	}
+
+
+	bool try_lock() noexcept
+	{
+		size_t expected = 0;
+		return state_.compare_exchange_strong(expected, writer_bit,
+			std::memory_order_acquire, std::memory_order_relaxed);
+	}
+
+	void lock()
+	{
+		if (!try_lock()) lock_slow(false);
+	}
+
+	void unlock()
+	{
+		size_t expected = writer_bit;
+		if (!state_.compare_exchange_strong(expected, 0, std::memory_order_release, std::memory_order_relaxed))
+			unlock_slow(false);
+	}
+
+	bool try_lock_shared() noexcept
+	{
+		size_t s = state_.load(std::memory_order_relaxed);
+		while ((s & (writer_bit | waiters_bit)) == 0) {
+			if (state_.compare_exchange_weak(s, s + reader_unit, std::memory_order_acquire, std::memory_order_relaxed))
+				return true;
+		}
+
+		return false;
+	}
+
+	void lock_shared()
+	{
+		if (!try_lock_shared()) lock_slow(true);
+	}
+
+	void unlock_shared()
+	{
+		size_t s = state_.load(std::memory_order_relaxed);
+		while ((s & waiters_bit) == 0) {
+			assert(s >= reader_unit);
+			if (state_.compare_exchange_weak(s, s - reader_unit, std::memory_order_release, std::memory_order_relaxed))
+				return;
+		}
+
+		unlock_slow(true);
+	}
+
+private:
+
+	static constexpr size_t writer_bit = 1;
+	static constexpr size_t waiters_bit = 2;
+
+	// The number of shared owners is kept in the upper bits.
+	static constexpr size_t reader_unit = 4;
+
+
+	void lock_slow(bool shared);
+
+	void unlock_slow(bool shared);
+
+	// Hands the mutex over to the waiters at the front of the queue. Returns the new state,
+	// the granted waiters are linked to *pp_granted.
+	size_t grant(size_t state, sync_waiter** pp_granted) noexcept;
+
+
+	std::atomic_size_t		state_{ 0 };
+	spin_lock				guard_;
+	sync_waiter_queue		waiters_;
+};
+
+// A fiber-aware counting semaphore.
+class semaphore final {
+public:
+
+	explicit semaphore(size_t count = 0) noexcept
+		: state_(count * count_unit)
+	{}
+
+	semaphore(semaphore&&) = delete;
+	semaphore& operator=(semaphore&&) = delete;
+
+
+	bool try_acquire() noexcept
+	{
+		size_t s = state_.load(std::memory_order_relaxed);
+		while ((s & waiters_bit) == 0 && s >= count_unit) {
+			if (state_.compare_exchange_weak(s, s - count_unit, std::memory_order_acquire, std::memory_order_relaxed))
+				return true;
+		}
+
+		return false;
+	}
+
+	// Decrements the counter, suspends the fiber while the counter is zero.
+	void acquire();
+
+	// Increments the counter by count, the waiting fibers take their units directly.
+	void release(size_t count = 1);
+
+private:
+
+	static constexpr size_t waiters_bit = 1;
+	static constexpr size_t count_unit = 2;
+
+
+	std::atomic_size_t		state_;
+	spin_lock				guard_;
+	sync_waiter_queue		waiters_;
+};
+
+// A fiber-aware std::condition_variable which works with ts::mutex.
+class condition_variable final {
+public:
+
+	condition_variable() noexcept = default;
+
+	condition_variable(condition_variable&&) = delete;
+	condition_variable& operator=(condition_variable&&) = delete;
+
+
+	// Atomically unlocks the mutex and suspends the fiber until it is notified, then locks the mutex again.
+	void wait(std::unique_lock<mutex>& lock);
+
+	template<typename Predicate>
+	void wait(std::unique_lock<mutex>& lock, Predicate pred)
+	{
+		while (!pred())
+			wait(lock);
+	}
+
+	void notify_one();
+
+	void notify_all();
+
+private:
+
+	spin_lock			guard_;
+	sync_waiter_queue	waiters_;
+};
+
+// A fiber-aware reusable barrier for a fixed number of fibers.
+class barrier final {
+public:
+
+	explicit barrier(size_t count) noexcept
+		: count_(count)
+	{
+		assert(count > 0);
+	}
+
+	barrier(barrier&&) = delete;
+	barrier& operator=(barrier&&) = delete;
+
+
+	// Suspends the fiber until count fibers have arrived, then the barrier starts the next phase.
+	void arrive_and_wait();
+
+private:
+
+	spin_lock			guard_;
+	sync_waiter_queue	waiters_;
+	const size_t		count_;
+	size_t				arrived_count_ = 0;
+};
+
+} // namespace ts
+
+#endif // TS_SYNC_H_
@@ -0,0 +1,277 @@
+#ifndef TS_TASK_FUNC_H_
+#define TS_TASK_FUNC_H_
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+
+namespace ts {
+
+class task_func;
+
+// task_func_factory constructs a callable object right inside the storage of a task_func.
+// ts::run uses factories to build closures directly in queue slots without intermediate copies.
+struct task_func_factory final {
+	using construct_func_t = void(*)(task_func& out_func, void* p_arg);
+
+
+	// Returns a factory which forwards func to the task_func being constructed.
+	// The factory refers to func, it must be used before func goes out of scope.
+	template<typename F>
+	static task_func_factory of(F&& func) noexcept;
+
+
+	construct_func_t	p_construct = nullptr;
+	void*				p_arg = nullptr;
+};
+
+// task_func is a move-only void() callable which keeps the callable object in its inline storage.
+// It never allocates: a callable which does not fit into the storage is a compile time error.
+// Such a callable can be explicitly moved to the heap with ts::spill.
+class task_func final {
+public:
+
+	static constexpr size_t storage_byte_count = 48;
+	static constexpr size_t storage_alignment = alignof(std::max_align_t);
+
+	// Checks whether F can be stored in a task_func without spilling.
+	template<typename F>
+	struct fits : std::integral_constant<bool,
+		(sizeof(F) <= storage_byte_count)
+		&& (alignof(F) <= storage_alignment)
+		&& std::is_nothrow_move_constructible<F>::value> {};
+
+
+	task_func() noexcept = default;
+
+	task_func(std::nullptr_t) noexcept {}
+
+	template<typename F, typename = typename std::enable_if<
+		!std::is_same<typename std::decay<F>::type, task_func>::value
+		&& !std::is_same<typename std::decay<F>::type, task_func_factory>::value>::type>
+	task_func(F&& func)
+	{
+		emplace(std::forward<F>(func));
+	}
+
+	task_func(const task_func_factory& factory)
+	{
+		assign(factory);
+	}
+
+	task_func(task_func&& f) noexcept;
+	task_func& operator=(task_func&& f) noexcept;
+
+	task_func(const task_func&) = delete;
+	task_func& operator=(const task_func&) = delete;
+
+	task_func& operator=(std::nullptr_t) noexcept
+	{
+		reset();
+		return *this;
+	}
+
+	~task_func() noexcept
+	{
+		reset();
+	}
+
+
+	explicit operator bool() const noexcept
+	{
+		return (p_ops_ != nullptr);
+	}
+
+	void operator()()
+	{
+		assert(p_ops_);
+		p_ops_->invoke(&storage_);
+	}
+
+	// Destroys the current callable object and constructs a new one from the factory.
+	void assign(const task_func_factory& factory);
+
+	// Destroys the current callable object and constructs a new one from func.
+	template<typename F>
+	void emplace(F&& func);
+
+	void emplace(task_func&& func) noexcept
+	{
+		*this = std::move(func);
+	}
+
+	void reset() noexcept;
+
+private:
+
+	struct ops final {
+		void (*invoke)(void* p_func);
+		void (*relocate)(void* p_dest, void* p_src) noexcept;
+		void (*destroy)(void* p_func) noexcept;
+	};
+
+	template<typename F>
+	struct ops_of final {
+		static void invoke(void* p_func)
+		{
+			(*static_cast<F*>(p_func))();
+		}
+
+		static void relocate(void* p_dest, void* p_src) noexcept
+		{
+			F* p_f = static_cast<F*>(p_src);
+			new(p_dest) F(std::move(*p_f));
+			p_f->~F();
+		}
+
+		static void destroy(void* p_func) noexcept
+		{
+			static_cast<F*>(p_func)->~F();
+		}
+
+		static constexpr ops value = { invoke, relocate, destroy };
+	};
+
+
+	typename std::aligned_storage<storage_byte_count, storage_alignment>::type storage_;
+	const ops* p_ops_ = nullptr;
+};
+
+template<typename F>
+constexpr task_func::ops task_func::ops_of<F>::value;
+
+// spilled_func keeps a callable which is too big for task_func on the heap.
+template<typename F>
+class spilled_func final {
+public:
+
+	template<typename U>
+	explicit spilled_func(U&& func)
+		: p_func_(new F(std::forward<U>(func)))
+	{}
+
+	spilled_func(spilled_func&&) noexcept = default;
+	spilled_func& operator=(spilled_func&&) noexcept = default;
+
+
+	void operator()()
+	{
+		(*p_func_)();
+	}
+
+private:
+
+	std::unique_ptr<F> p_func_;
+};
+
+
+// Explicitly moves func to the heap, the result always fits into a task_func.
+template<typename F>
+inline spilled_func<typename std::decay<F>::type> spill(F&& func)
+{
+	return spilled_func<typename std::decay<F>::type>(std::forward<F>(func));
+}
+
+template<typename F>
+inline task_func make_task_func_impl(F&& func, std::true_type /* fits */)
+{
+	return task_func(std::forward<F>(func));
+}
+
+template<typename F>
+inline task_func make_task_func_impl(F&& func, std::false_type /* fits */)
+{
+	return task_func(spill(std::forward<F>(func)));
+}
+
+// Constructs a task_func from func. If func does not fit into the inline storage it is spilled to the heap.
+template<typename F>
+inline task_func make_task_func(F&& func)
+{
+	using fits_t = task_func::fits<typename std::decay<F>::type>;
+	return make_task_func_impl(std::forward<F>(func), fits_t());
+}
+
+// ----- task_func_factory -----
+
+template<typename F>
+inline task_func_factory task_func_factory::of(F&& func) noexcept
+{
+	using func_ref_t = F&&;
+	using func_t = typename std::remove_reference<F>::type;
+
+	struct impl final {
+		static void construct(task_func& out_func, void* p_arg)
+		{
+			out_func.emplace(static_cast<func_ref_t>(*static_cast<func_t*>(p_arg)));
+		}
+	};
+
+	task_func_factory factory;
+	factory.p_construct = impl::construct;
+	factory.p_arg = const_cast<void*>(static_cast<const void*>(std::addressof(func)));
+	return factory;
+}
+
+// ----- task_func -----
+
+inline task_func::task_func(task_func&& f) noexcept
+	: p_ops_(f.p_ops_)
+{
+	if (!p_ops_) return;
+
+	p_ops_->relocate(&storage_, &f.storage_);
+	f.p_ops_ = nullptr;
+}
+
+inline task_func& task_func::operator=(task_func&& f) noexcept
+{
+	if (this == &f) return *this;
+
+	reset();
+	if (!f.p_ops_) return *this;
+
+	p_ops_ = f.p_ops_;
+	p_ops_->relocate(&storage_, &f.storage_);
+	f.p_ops_ = nullptr;
+
+	return *this;
+}
+
+inline void task_func::assign(const task_func_factory& factory)
+{
+	assert(factory.p_construct);
+	factory.p_construct(*this, factory.p_arg);
+}
+
+template<typename F>
+inline void task_func::emplace(F&& func)
+{
+	using func_t = typename std::decay<F>::type;
+	static_assert(sizeof(func_t) <= storage_byte_count,
+		"The callable object does not fit into task_func. Capture less or wrap it with ts::spill.");
+	static_assert(alignof(func_t) <= storage_alignment,
+		"The callable object is over-aligned for task_func. Wrap it with ts::spill.");
+	static_assert(std::is_nothrow_move_constructible<func_t>::value,
+		"The callable object must be nothrow move constructible. Wrap it with ts::spill.");
+
+	reset();
+	new(&storage_) func_t(std::forward<F>(func));
+	p_ops_ = &ops_of<func_t>::value;
+}
+
+inline void task_func::reset() noexcept
+{
+	if (!p_ops_) return;
+
+	p_ops_->destroy(&storage_);
+	p_ops_ = nullptr;
+}
+
+} // namespace ts
+
+#endif // TS_TASK_FUNC_H_
@@ -0,0 +1,127 @@
+#ifndef TS_TASK_GRAPH_H_
+#define TS_TASK_GRAPH_H_
+
+#include <cassert>
+#include <atomic>
+#include <initializer_list>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "ts/task_func.h"
+#include "ts/task_system.h"
+
+
+namespace ts {
+
+// task_graph is a DAG of tasks. A node is spawned automatically as soon as its last predecessor completes,
+// so no fiber blocks to order the tasks. The graph is built once and may be launched many times,
+// each launch runs every node exactly once.
+// The graph must not be modified or destroyed while it is running.
+class task_graph final {
+public:
+
+	using node_id = size_t;
+
+
+	task_graph() = default;
+
+	task_graph(task_graph&&) = delete;
+	task_graph& operator=(task_graph&&) = delete;
+
+	~task_graph() noexcept
+	{
+		assert(is_done());
+	}
+
+
+	// Adds a node which runs func. The node has no predecessors yet.
+	template<typename F>
+	node_id add(F&& func, task_priority priority = task_priority::normal);
+
+	// Adds a node which runs func after all the predecessors have completed.
+	template<typename F>
+	node_id add(F&& func, std::initializer_list<node_id> predecessors, task_priority priority = task_priority::normal);
+
+	// Makes the after node wait for the before node.
+	void precede(node_id before, node_id after);
+
+	void reserve(size_t node_count);
+
+	// Removes all the nodes.
+	void clear() noexcept;
+
+	size_t node_count() const noexcept
+	{
+		return nodes_.size();
+	}
+
+	// Spawns all the nodes without predecessors and returns. The rest of the nodes are spawned by their
+	// predecessors. The graph must be done (the previous launch has completed).
+	void launch();
+
+	// Suspends the current fiber until all the nodes of the last launch have completed.
+	void wait()
+	{
+		wait_for(wait_counter_);
+	}
+
+	bool is_done() const noexcept
+	{
+		return (wait_counter_ == 0);
+	}
+
+	// The counter reaches zero when all the nodes of the last launch have completed.
+	// It can be passed to ts::wait_any/ts::wait_all along with other counters.
+	const std::atomic_size_t& wait_counter() const noexcept
+	{
+		return wait_counter_;
+	}
+
+private:
+
+	struct node final {
+		task_func				func;
+		task_priority			priority;
+		size_t					predecessor_count;
+		std::vector<node_id>	successors;
+	};
+
+	class spawn_batch;
+
+
+	node_id add_node(task_func&& func, task_priority priority);
+
+	// Runs the node and spawns its successors which become ready. One of them is run by the current task.
+	void exec_node(node_id id);
+
+	bool is_acyclic() const;
+
+
+	std::vector<node>						nodes_;
+	std::unique_ptr<std::atomic_size_t[]>	p_pending_counts_;
+	size_t									pending_count_capacity_ = 0;
+	std::atomic_size_t						wait_counter_{ 0 };
+};
+
+// ----- task_graph -----
+
+template<typename F>
+inline task_graph::node_id task_graph::add(F&& func, task_priority priority)
+{
+	return add_node(make_task_func(std::forward<F>(func)), priority);
+}
+
+template<typename F>
+inline task_graph::node_id task_graph::add(F&& func, std::initializer_list<node_id> predecessors,
+	task_priority priority)
+{
+	const node_id id = add(std::forward<F>(func), priority);
+	for (node_id p : predecessors)
+		precede(p, id);
+
+	return id;
+}
+
+} // namespace ts
+
+#endif // TS_TASK_GRAPH_H_
@@ -8,33 +8,212 @@
 // Each worker thread has a controller fiber. The controller fiber dispathes tasks (inside other fibers)
 // ...
 // The kernel thread has the controller fiber and an addition fiber (kernel fiber) which is used to run the kernel func.
-// The kernel therad never puts the kernel fiber into the fiber pool or fiber wait list.
+// The kernel therad never puts the kernel fiber into the fiber pool. A waiting kernel fiber is always
+// resumed by the kernel thread.
 
 #include <cassert>
+#include <cstdint>
 #include <atomic>
+#include <chrono>
 #include <functional>
+#include <initializer_list>
+#include <string>
 #include <type_traits>
 #include <utility>
+#include <vector>
+#include "ts/task_func.h"
 
 
 namespace ts {
 
 using kernel_func_t = void(*)();
 
+// The clock of the timer functions (run_at, sleep_for, wait_for with a timeout and the like).
+using task_clock = std::chrono::steady_clock;
+
+// The implementation of the shared task queues.
+enum class task_queue_type {
+	// ts::concurrent_queue, a ring buffer guarded by a mutex.
+	concurrent_queue,
+
+	// ts::lock_free_queue, a bounded lock-free queue.
+	lock_free_queue
+};
+
+// Workers always take high priority tasks first, then normal ones and background ones at last.
+// A worker takes one background task after every task_system_desc::background_aging_count
+// normal tasks, so a steady stream of normal tasks can't starve the background.
+enum class task_priority {
+	high,
+	normal,
+	background
+};
+
+// What a worker does when there are no tasks for it.
+enum class task_idle_policy {
+	// Keep polling the queues. The lowest wake up latency, every idle worker burns its CPU.
+	spin,
+
+	// Poll idle_spin_count times, then yield the CPU idle_yield_count times and then sleep
+	// until new tasks are published.
+	park
+};
+
+// How the threads of the task system (the kernel thread included) are pinned to logical CPUs.
+// A pinned worker allocates its task slots on its own NUMA node and steals from the workers which share
+// its last level cache first, then from the workers of its NUMA node and from the rest at last.
+enum class task_thread_affinity {
+	// The threads are not pinned. If task_system_desc::cpu_set is not empty, they may run on any CPU of the set.
+	none,
+
+	// Each thread is pinned to one logical CPU. The threads are spread over the cores first,
+	// SMT siblings are used when every core has a thread already.
+	logical_cpu,
+
+	// Each thread is pinned to all the logical CPUs (SMT siblings) of one core.
+	core
+};
+
+// What happens to a task which does not fit into its queue (task_system_desc::queue_size and the like).
+// Tasks spawned by a worker fiber go to the injection queue when the worker's deque is full,
+// the policy applies when the queue is full too.
+enum class task_overflow_policy {
+	// The spawning fiber executes the task right away. The memory stays bounded, the spawner is delayed.
+	execute_inline,
+
+	// The spawning fiber is suspended until a worker takes a task from a queue.
+	// Threads which are not a part of the task system yield instead.
+	park,
+
+	// The task goes to the unbounded overflow list of the queue. Workers take tasks from the list
+	// when the queue is empty.
+	spill
+};
+
 struct task_system_desc final {
-	size_t thread_count = 0;
-	size_t fiber_count = 0;
-	size_t fiber_stack_byte_count = 0;
-	size_t queue_size = 0;
-	size_t queue_immediate_size = 0;
+	size_t			thread_count = 0;
+	size_t			fiber_count = 0;
+	size_t			fiber_stack_byte_count = 0;
+	size_t			queue_size = 0;
+	size_t			queue_immediate_size = 0;
+	size_t			queue_background_size = 0;
+	size_t			background_aging_count = 64;
+	task_queue_type	queue_type = task_queue_type::concurrent_queue;
+	task_idle_policy	idle_policy = task_idle_policy::park;
+	size_t			idle_spin_count = 1024;
+	size_t			idle_yield_count = 64;
+	task_thread_affinity	thread_affinity = task_thread_affinity::none;
+
+	// The OS indices of the logical CPUs the task system may use. Empty means all the CPUs
+	// available to the process. The kernel thread's affinity is restored when the task system stops.
+	std::vector<uint32_t>	cpu_set;
+
+	// Tracing is on if trace_event_count is not zero: each thread keeps its last trace_event_count events
+	// (tasks, spawns, waits, fiber switches, idle time) and launch_task_system writes them to trace_file_path
+	// in the Chrome trace event format (chrome://tracing, ui.perfetto.dev) before it returns.
+	size_t			trace_event_count = 0;
+	std::string		trace_file_path;
+
+	// Tasks spawned with run_on_large_stack are executed by large_fiber_count fibers with bigger stacks.
+	// The kernel fiber gets a stack of large_fiber_stack_byte_count too.
+	size_t			large_fiber_count = 0;
+	size_t			large_fiber_stack_byte_count = 1024 * 1024;
+	size_t			queue_large_size = 64;
+
+	// Fiber stacks are backed by transparent huge pages (Linux only).
+	bool			fiber_stack_huge_pages = false;
+
+	// Each fiber measures its peak stack usage after every task, see task_system_report.
+	// It costs a syscall per task on posix platforms. Ignored if fiber_stack_huge_pages is set:
+	// the measurement relies on page residency and a huge page is resident as a whole.
+	bool			measure_fiber_stack_usage = false;
+
+	// fiber_count is a soft limit. Fibers are created on demand, fiber_chunk_size at a time. When fiber_count
+	// fibers are in use the pool keeps growing up to fiber_hard_limit (0 stands for 4 * fiber_count),
+	// see task_system_report::fiber_soft_limit_exceeded_count. Reaching the hard limit stops the task system
+	// with an exception. Large stack fibers are created on demand the same way.
+	size_t			fiber_chunk_size = 16;
+	size_t			fiber_hard_limit = 0;
+
+	// When the last worker goes to sleep the free fibers give the unused pages of their stacks back to the OS.
+	bool			trim_idle_fibers = true;
+
+	// See task_overflow_policy. run_on_large_stack spills instead of executing a task inline,
+	// the spawner's stack may be too small for it.
+	task_overflow_policy	overflow_policy = task_overflow_policy::spill;
+
+	// The resolution of the timers. The timers live in a hierarchical timer wheel which the workers service
+	// while they look for tasks, a sleeping worker wakes up for the next timer. A timer never fires early,
+	// it is late by up to a tick plus the time the workers need to notice it.
+	size_t			timer_tick_ns = 100 * 1000;
+};
+
+// The statistics of one thread of the task system. Times are in nanoseconds.
+struct task_worker_report final {
+	// The number of processed tasks of all priorities.
+	uint64_t task_count = 0;
+
+	// The number of tasks spawned by the fibers of the worker.
+	uint64_t spawned_task_count = 0;
+
+	// The number of switches from the worker's controller fiber to task fibers.
+	uint64_t fiber_switch_count = 0;
+
+	// The number of times a fiber has been suspended by wait_for (and the like) and resumed.
+	uint64_t park_count = 0;
+	uint64_t resume_count = 0;
+
+	// The number of times a task did not fit into the worker's deque or into a queue.
+	uint64_t queue_full_count = 0;
+
+	// The number of tasks handled by task_system_desc::overflow_policy: executed inline,
+	// spawned after the spawner had waited for room or spilled.
+	uint64_t overflow_task_count = 0;
+
+	// Busy is the time spent outside of the idle loop: executing tasks and the scheduler itself.
+	// Spin is the time spent spinning and yielding while looking for work, idle - parked.
+	uint64_t busy_ns = 0;
+	uint64_t spin_ns = 0;
+	uint64_t idle_ns = 0;
 };
 
 struct task_system_report final {
 	// The number of processed tasks with high priority.
 	size_t task_immediate_count = 0;
 
-	// The number of processed tasks.
+	// The number of processed tasks with background priority.
+	size_t task_background_count = 0;
+
+	// The number of processed tasks of all priorities.
 	size_t task_count = 0;
+
+	// The sums over the workers (see task_worker_report). Tasks spawned and queue-full events
+	// of the threads which are not a part of the task system are counted here too.
+	size_t spawned_task_count = 0;
+	size_t fiber_switch_count = 0;
+	size_t park_count = 0;
+	size_t resume_count = 0;
+	size_t queue_full_count = 0;
+	size_t overflow_task_count = 0;
+
+	// The max number of fibers taken from the fiber pool at the same time.
+	size_t fiber_high_water_count = 0;
+
+	// The max number of wait records (suspended fibers and run_when_zero continuations) at the same time.
+	size_t wait_list_high_water_count = 0;
+
+	// The number of fibers the pool has created and the number of times a fiber has been taken
+	// while task_system_desc::fiber_count fibers had been in use already.
+	size_t fiber_created_count = 0;
+	size_t fiber_soft_limit_exceeded_count = 0;
+
+	// The peak stack usage over the regular and the large stack fibers (page granularity).
+	// Zero unless task_system_desc::measure_fiber_stack_usage is set.
+	size_t fiber_stack_peak_byte_count = 0;
+	size_t large_fiber_stack_peak_byte_count = 0;
+
+	// Indexed by worker, workers[0] is the kernel thread.
+	std::vector<task_worker_report> workers;
 };
 
 
@@ -43,17 +222,171 @@ inline bool is_valid_task_system_desc(const task_system_desc& desc) noexcept
 	return (desc.thread_count > 0)
 		&& (desc.fiber_count > 0)
 		&& (desc.queue_size > 0)
-		&& (desc.queue_immediate_size > 0);
+		&& (desc.queue_immediate_size > 0)
+		&& (desc.queue_background_size > 0)
+		&& (desc.background_aging_count > 0)
+		&& (desc.large_fiber_count == 0 || desc.queue_large_size > 0)
+		&& (desc.fiber_hard_limit == 0 || desc.fiber_hard_limit >= desc.fiber_count)
+		&& (desc.timer_tick_ns > 0)
+		&& (desc.trace_event_count == 0 || !desc.trace_file_path.empty());
 }
 
 task_system_report launch_task_system(const task_system_desc& desc, kernel_func_t p_kernel_func);
 
+// Collects the statistics of the running task system, must be called by a task or by the kernel function.
+// The workers keep updating the counters
+// while they are read, so the counters do not form a consistent snapshot.
+// A worker's times are updated when it goes idle and when it finds work again.
+task_system_report get_task_system_report();
+
+// Suspends the current fiber until the counter reaches zero.
 void wait_for(const std::atomic_size_t& wait_counter);
 
-void run(std::function<void()>* p_funcs, size_t count, std::atomic_size_t* p_wait_counter = nullptr);
+// Suspends the current fiber until the counter reaches zero or the time comes.
+// Returns true if the counter has reached zero.
+bool wait_until(const std::atomic_size_t& wait_counter, task_clock::time_point time);
+
+inline bool wait_for(const std::atomic_size_t& wait_counter, task_clock::duration timeout)
+{
+	return wait_until(wait_counter, task_clock::now() + timeout);
+}
+
+// Suspends the current fiber until the time comes. The worker executes other tasks meanwhile.
+void sleep_until(task_clock::time_point time);
+
+inline void sleep_for(task_clock::duration duration)
+{
+	sleep_until(task_clock::now() + duration);
+}
+
+// Suspends the current fiber until all the counters reach zero.
+void wait_all(const std::atomic_size_t* const* p_wait_counters, size_t count);
+
+// Suspends the current fiber until any of the counters reaches zero.
+// Returns the index of a counter which has been seen equal to zero.
+size_t wait_any(const std::atomic_size_t* const* p_wait_counters, size_t count);
+
+inline void wait_all(std::initializer_list<const std::atomic_size_t*> wait_counters)
+{
+	wait_all(wait_counters.begin(), wait_counters.size());
+}
+
+inline size_t wait_any(std::initializer_list<const std::atomic_size_t*> wait_counters)
+{
+	return wait_any(wait_counters.begin(), wait_counters.size());
+}
+
+// Spawns count tasks. The functions are moved out of p_funcs.
+void run(task_func* p_funcs, size_t count, task_priority priority, std::atomic_size_t* p_wait_counter = nullptr);
+
+// Spawns count tasks. The functions are moved out of p_funcs. A std::function which does not fit
+// into task_func's inline storage is spilled to the heap, use the other overloads on hot paths.
+void run(std::function<void()>* p_funcs, size_t count, task_priority priority,
+	std::atomic_size_t* p_wait_counter = nullptr);
+
+// Spawns one task. Its function is constructed by the factory right inside the queue slot.
+void run(const task_func_factory& factory, task_priority priority, std::atomic_size_t* p_wait_counter = nullptr);
+
+// Spawns one task which is joined to wait_counter. Unlike run, the counter is incremented rather than assigned,
+// so a running task can add more work to the counter somebody already waits for.
+void run_joined(const task_func_factory& factory, task_priority priority, std::atomic_size_t& wait_counter);
+
+// Spawns count tasks which are joined to wait_counter. The functions are moved out of p_funcs.
+void run_joined(task_func* p_funcs, size_t count, task_priority priority, std::atomic_size_t& wait_counter);
+
+template<typename F>
+inline void run_joined(F&& func, std::atomic_size_t& wait_counter)
+{
+	run_joined(task_func_factory::of(std::forward<F>(func)), task_priority::normal, wait_counter);
+}
+
+// Spawns one task which is executed by a fiber with a large stack (task_system_desc::large_fiber_count),
+// for the rare task which needs more stack than the regular fibers have. The counter is assigned 1.
+void run_on_large_stack(const task_func_factory& factory, std::atomic_size_t* p_wait_counter);
+
+template<typename F>
+inline void run_on_large_stack(F&& func, std::atomic_size_t& wait_counter)
+{
+	run_on_large_stack(task_func_factory::of(std::forward<F>(func)), &wait_counter);
+}
+
+template<typename F>
+inline void run_on_large_stack(F&& func)
+{
+	run_on_large_stack(task_func_factory::of(std::forward<F>(func)), nullptr);
+}
+
+// Decrements the counter and resumes the fibers which wait for it if the counter reaches zero.
+// The counter is signaled the same way a task spawned with it signals the counter on completion.
+// Any thread may call it, including threads which are not a part of the task system.
+void decrement_wait_counter(std::atomic_size_t& wait_counter);
+
+// Spawns func once the counter reaches zero, right away if it is zero already. Unlike wait_for
+// no fiber is suspended, the wait costs a small pooled block. Used to resume coroutines (ts::co_task).
+void run_when_zero(const std::atomic_size_t& wait_counter, task_func&& func,
+	task_priority priority = task_priority::normal);
+
+// Spawns func when the time comes. Timers which are still pending when the task system stops are dropped.
+void run_at(task_clock::time_point time, task_func&& func, task_priority priority = task_priority::normal);
+
+inline void run_after(task_clock::duration delay, task_func&& func, task_priority priority = task_priority::normal)
+{
+	run_at(task_clock::now() + delay, std::move(func), priority);
+}
+
+// Spawns func every period (the first time after one period) until it returns false or the task system stops.
+// The next run is scheduled when the current one completes, so the runs never overlap.
+// The runs keep to the initial schedule, the periods which have been missed entirely are skipped.
+void run_every(task_clock::duration period, std::function<bool()> func,
+	task_priority priority = task_priority::normal);
+
+// Returns the number of threads of the running task system (task_system_desc::thread_count).
+size_t thread_count() noexcept;
+
+// Returns true if spawning a task from the current fiber is likely to feed an idle worker:
+// the tasks spawned by the current worker have all been taken by other workers.
+// Lazy splitting algorithms (ts::parallel_for) split their work only when it returns true.
+bool is_work_demanded() noexcept;
+
+inline void run(task_func* p_funcs, size_t count, std::atomic_size_t* p_wait_counter = nullptr)
+{
+	run(p_funcs, count, task_priority::normal, p_wait_counter);
+}
+
+inline void run(std::function<void()>* p_funcs, size_t count, std::atomic_size_t* p_wait_counter = nullptr)
+{
+	run(p_funcs, count, task_priority::normal, p_wait_counter);
+}
+
+// F is either task_func or std::function<void()>.
+template<typename F, size_t count>
+inline void run(F(&funcs)[count], task_priority priority, std::atomic_size_t& wait_counter)
+{
+	run(funcs, count, priority, &wait_counter);
+}
+
+template<typename F>
+inline void run(F&& func, task_priority priority, std::atomic_size_t& wait_counter)
+{
+	run(task_func_factory::of(std::forward<F>(func)), priority, &wait_counter);
+}
+
+// F is either task_func or std::function<void()>.
+template<typename F, size_t count>
+inline void run(F(&funcs)[count], task_priority priority)
+{
+	run(funcs, count, priority);
+}
+
+template<typename F>
+inline void run(F&& func, task_priority priority)
+{
+	run(task_func_factory::of(std::forward<F>(func)), priority, nullptr);
+}
 
-template<size_t count>
-inline void run(std::function<void()>(&funcs)[count], std::atomic_size_t& wait_counter)
+// F is either task_func or std::function<void()>.
+template<typename F, size_t count>
+inline void run(F(&funcs)[count], std::atomic_size_t& wait_counter)
 {
 	run(funcs, count, &wait_counter);
 }
@@ -61,8 +394,7 @@ inline void run(std::function<void()>(&funcs)[count], std::atomic_size_t& wait_c
 template<typename F>
 inline void run(F&& func, std::atomic_size_t& wait_counter)
 {
-	std::function<void()> f(std::forward<F>(func));
-	run(&f, 1, &wait_counter);
+	run(task_func_factory::of(std::forward<F>(func)), task_priority::normal, &wait_counter);
 }
 
 inline void run(std::function<void()>& func, std::atomic_size_t& wait_counter)
@@ -72,12 +404,12 @@ inline void run(std::function<void()>& func, std::atomic_size_t& wait_counter)
 
 inline void run(void(*func)(), std::atomic_size_t& wait_counter)
 {
-	std::function<void()> f(func);
-	run(&f, 1, &wait_counter);
+	run(task_func_factory::of(func), task_priority::normal, &wait_counter);
 }
 
-template<size_t count>
-inline void run(std::function<void()>(&funcs)[count])
+// F is either task_func or std::function<void()>.
+template<typename F, size_t count>
+inline void run(F(&funcs)[count])
 {
 	run(funcs, count);
 }
@@ -85,8 +417,7 @@ inline void run(std::function<void()>(&funcs)[count])
 template<typename F>
 inline void run(F&& func)
 {
-	std::function<void()> f(std::forward<F>(func));
-	run(&f, 1);
+	run(task_func_factory::of(std::forward<F>(func)), task_priority::normal, nullptr);
 }
 
 inline void run(std::function<void()>& func)
@@ -96,8 +427,7 @@ inline void run(std::function<void()>& func)
 
 inline void run(void(*func)())
 {
-	std::function<void()> f(func);
-	run(&f, 1);
+	run(task_func_factory::of(func), task_priority::normal, nullptr);
 }
 
 } // namespace ts
@@ -0,0 +1,53 @@
+#ifndef TS_TOPOLOGY_H_
+#define TS_TOPOLOGY_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+namespace ts {
+
+// cpu_info describes a logical CPU (a hardware thread) available to the process.
+struct cpu_info final {
+	// The OS index of the logical CPU.
+	uint32_t index = 0;
+
+	// Logical CPUs with the same core id are SMT siblings. Core ids are dense: [0, core_count).
+	uint32_t core_id = 0;
+
+	// Physical package (socket). Package ids are dense: [0, package_count).
+	uint32_t package_id = 0;
+
+	// Logical CPUs with the same cache id share the last level cache. Cache ids are dense: [0, cache_count).
+	uint32_t cache_id = 0;
+
+	// The OS index of the NUMA node the CPU belongs to.
+	uint32_t numa_node = 0;
+};
+
+struct cpu_topology final {
+	// The logical CPUs the process may run on, sorted by index.
+	std::vector<cpu_info> cpus;
+
+	size_t core_count = 0;
+	size_t package_count = 0;
+	size_t cache_count = 0;
+	size_t numa_node_count = 0;
+};
+
+// Discovers the logical CPUs the process may run on: sched_getaffinity and sysfs on Linux,
+// GetProcessAffinityMask and GetLogicalProcessorInformationEx on Windows (processor group 0 only).
+// If some information is not available every CPU is assumed to be a core of its own on one package
+// and one NUMA node.
+cpu_topology get_cpu_topology();
+
+// Returns the logical CPUs the calling thread may run on.
+std::vector<uint32_t> get_current_thread_affinity();
+
+// Restricts the calling thread to the logical CPUs. Returns false if the OS refuses.
+bool set_current_thread_affinity(const std::vector<uint32_t>& cpus);
+
+} // namespace ts
+
+#endif // TS_TOPOLOGY_H_
@@ -0,0 +1,129 @@
+#include "bench/bench.h"
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <numeric>
+#include <ostream>
+#include <stdexcept>
+#include <thread>
+
+
+namespace {
+
+double percentile(const std::vector<double>& sorted_samples, double p)
+{
+	assert(!sorted_samples.empty());
+
+	const size_t rank = size_t(std::ceil(p / 100.0 * double(sorted_samples.size())));
+	const size_t index = (rank > 0) ? rank - 1 : 0;
+	return sorted_samples[std::min(index, sorted_samples.size() - 1)];
+}
+
+} // namespace
+
+
+namespace bench {
+
+// ----- runner -----
+
+runner::runner(const options& opts)
+	: opts_(opts)
+{
+	if (opts_.thread_count == 0)
+		opts_.thread_count = std::max(1u, std::thread::hardware_concurrency());
+}
+
+bool runner::enabled(const std::string& name) const
+{
+	return opts_.filter.empty() || (name.find(opts_.filter) != std::string::npos);
+}
+
+void runner::add(std::ostream& out, const std::string& name, const char* unit, std::vector<double> samples)
+{
+	const bench::summary s = summarize(std::move(samples));
+	results_.push_back(result{ name, unit, s });
+
+	out << std::left << std::setw(48) << name << std::right << std::fixed << std::setprecision(1)
+		<< " p50 " << std::setw(10) << s.p50
+		<< " p90 " << std::setw(10) << s.p90
+		<< " p99 " << std::setw(10) << s.p99
+		<< " max " << std::setw(10) << s.max
+		<< ' ' << unit << " (" << s.sample_count << " samples)" << std::endl;
+}
+
+void runner::write_json(std::ostream& out) const
+{
+	out << std::setprecision(3) << std::fixed;
+	out << "{\n\t\"thread_count\": " << opts_.thread_count << ",\n\t\"benchmarks\": [";
+
+	for (size_t i = 0; i < results_.size(); ++i) {
+		const result& r = results_[i];
+		out << ((i > 0) ? ",\n" : "\n")
+			<< "\t\t{\"name\": \"" << r.name << "\", \"unit\": \"" << r.unit << "\""
+			<< ", \"samples\": " << r.summary.sample_count
+			<< ", \"min\": " << r.summary.min
+			<< ", \"p50\": " << r.summary.p50
+			<< ", \"p90\": " << r.summary.p90
+			<< ", \"p99\": " << r.summary.p99
+			<< ", \"p999\": " << r.summary.p999
+			<< ", \"max\": " << r.summary.max
+			<< ", \"mean\": " << r.summary.mean << "}";
+	}
+
+	out << "\n\t]\n}\n";
+}
+
+// ----- funcs -----
+
+uint64_t now_ns() noexcept
+{
+	return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+summary summarize(std::vector<double> samples)
+{
+	summary s;
+	if (samples.empty()) return s;
+
+	std::sort(samples.begin(), samples.end());
+	s.sample_count = samples.size();
+	s.min = samples.front();
+	s.p50 = percentile(samples, 50.0);
+	s.p90 = percentile(samples, 90.0);
+	s.p99 = percentile(samples, 99.0);
+	s.p999 = percentile(samples, 99.9);
+	s.max = samples.back();
+	s.mean = std::accumulate(samples.cbegin(), samples.cend(), 0.0) / double(samples.size());
+	return s;
+}
+
+options parse_options(int argc, char* argv[])
+{
+	options opts;
+
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		if (i + 1 >= argc)
+			throw std::invalid_argument("A value is missing: " + arg);
+
+		const std::string value = argv[++i];
+		if (arg == "--filter")
+			opts.filter = value;
+		else if (arg == "--json")
+			opts.json_file_path = value;
+		else if (arg == "--samples")
+			opts.sample_count = std::max<size_t>(1, std::stoul(value));
+		else if (arg == "--threads")
+			opts.thread_count = std::stoul(value);
+		else
+			throw std::invalid_argument("Unknown argument: " + arg);
+	}
+
+	return opts;
+}
+
+} // namespace bench
@@ -0,0 +1,88 @@
+#ifndef BENCH_BENCH_H_
+#define BENCH_BENCH_H_
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+
+namespace bench {
+
+// Steady clock nanoseconds.
+uint64_t now_ns() noexcept;
+
+struct summary final {
+	size_t	sample_count = 0;
+	double	min = 0.0;
+	double	p50 = 0.0;
+	double	p90 = 0.0;
+	double	p99 = 0.0;
+	double	p999 = 0.0;
+	double	max = 0.0;
+	double	mean = 0.0;
+};
+
+// Computes the percentiles (nearest rank) of the samples.
+summary summarize(std::vector<double> samples);
+
+struct options final {
+	// Only the benchmarks whose names contain filter are run.
+	std::string		filter;
+
+	// The results are written to json_file_path if it is not empty.
+	std::string		json_file_path;
+
+	// The number of samples a latency benchmark takes.
+	size_t			sample_count = 1000;
+
+	// The max number of threads. 0 stands for std::thread::hardware_concurrency.
+	size_t			thread_count = 0;
+};
+
+// Parses the command line, throws std::invalid_argument on unknown arguments.
+options parse_options(int argc, char* argv[]);
+
+// runner collects the results of the benchmarks, prints them as a table
+// and writes them as JSON so regressions can be found by a script.
+class runner final {
+public:
+
+	explicit runner(const options& opts);
+
+
+	const options& opts() const noexcept
+	{
+		return opts_;
+	}
+
+	// Returns true if the benchmark has to be run.
+	bool enabled(const std::string& name) const;
+
+	// Stores the samples of the benchmark and prints its summary to out.
+	void add(std::ostream& out, const std::string& name, const char* unit, std::vector<double> samples);
+
+	void write_json(std::ostream& out) const;
+
+private:
+
+	struct result final {
+		std::string		name;
+		std::string		unit;
+		bench::summary	summary;
+	};
+
+
+	options				opts_;
+	std::vector<result>	results_;
+};
+
+// Queues, ring_buffer, fiber switches, fiber_pool and fiber_wait_table.
+void run_primitive_benchmarks(runner& r);
+
+// Spawn-to-execute latency, empty task throughput and wait_for park/resume latency.
+void run_task_system_benchmarks(runner& r);
+
+} // namespace bench
+
+#endif // BENCH_BENCH_H_
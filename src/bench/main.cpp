@@ -0,0 +1,31 @@
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include "bench/bench.h"
+
+
+// Usage: bench [--filter <name part>] [--json <file>] [--samples <count>] [--threads <count>]
+int main(int argc, char* argv[])
+{
+	try {
+		bench::runner runner(bench::parse_options(argc, argv));
+
+		bench::run_primitive_benchmarks(runner);
+		bench::run_task_system_benchmarks(runner);
+
+		if (!runner.opts().json_file_path.empty()) {
+			std::ofstream file(runner.opts().json_file_path);
+			runner.write_json(file);
+			if (!file) {
+				std::cerr << "Failed to write " << runner.opts().json_file_path << std::endl;
+				return 1;
+			}
+		}
+
+		return 0;
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+}
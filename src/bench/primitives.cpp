@@ -0,0 +1,295 @@
+#include "bench/bench.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ts/concurrent_queue.h"
+#include "ts/fiber.h"
+#include "ts/lock_free_queue.h"
+#include "ts/utility.h"
+
+
+namespace {
+
+using bench::now_ns;
+
+constexpr size_t queue_size = 1024;
+constexpr size_t queue_op_count = 1 << 16;
+constexpr size_t queue_run_count = 20;
+constexpr size_t batch_size = 1000;
+
+bool try_push(ts::concurrent_queue<size_t>& queue, size_t v)
+{
+	return queue.try_emplace_bulk(1, [v](size_t) { return v; });
+}
+
+bool try_push(ts::lock_free_queue<size_t>& queue, size_t v)
+{
+	return queue.try_push(v);
+}
+
+// Runs producer_count producers and consumer_count consumers which pass queue_op_count values
+// through the queue. Returns nanoseconds per value.
+template<typename Queue>
+double run_queue(size_t producer_count, size_t consumer_count)
+{
+	Queue queue(queue_size);
+	std::atomic_bool start_flag(false);
+	std::atomic_size_t popped_count(0);
+
+	std::vector<std::thread> threads;
+	for (size_t p = 0; p < producer_count; ++p) {
+		threads.emplace_back([&, p] {
+			while (!start_flag) std::this_thread::yield();
+
+			for (size_t i = p; i < queue_op_count; i += producer_count) {
+				while (!try_push(queue, i))
+					std::this_thread::yield();
+			}
+		});
+	}
+
+	for (size_t c = 0; c < consumer_count; ++c) {
+		threads.emplace_back([&] {
+			while (!start_flag) std::this_thread::yield();
+
+			size_t v;
+			while (popped_count.load(std::memory_order_relaxed) < queue_op_count) {
+				if (queue.try_pop(v))
+					popped_count.fetch_add(1, std::memory_order_relaxed);
+				else
+					std::this_thread::yield();
+			}
+		});
+	}
+
+	const uint64_t t0 = now_ns();
+	start_flag = true;
+	for (auto& th : threads)
+		th.join();
+
+	return double(now_ns() - t0) / double(queue_op_count);
+}
+
+template<typename Queue>
+void queue_benchmarks(bench::runner& r, const char* queue_name)
+{
+	for (size_t producer_count = 1; producer_count <= r.opts().thread_count; producer_count *= 2) {
+		for (size_t consumer_count = 1; consumer_count <= r.opts().thread_count; consumer_count *= 2) {
+			const std::string name = std::string("queue.") + queue_name
+				+ ".p" + std::to_string(producer_count) + "c" + std::to_string(consumer_count);
+			if (!r.enabled(name)) continue;
+
+			std::vector<double> samples;
+			for (size_t i = 0; i < queue_run_count; ++i)
+				samples.push_back(run_queue<Queue>(producer_count, consumer_count));
+
+			r.add(std::cout, name, "ns/value", std::move(samples));
+		}
+	}
+}
+
+void ring_buffer_benchmarks(bench::runner& r)
+{
+	const std::string name = "ring_buffer.push_pop";
+	if (!r.enabled(name)) return;
+
+	ts::ring_buffer<size_t> buffer(queue_size);
+	std::vector<double> samples;
+	volatile size_t sink = 0;
+
+	for (size_t s = 0; s < r.opts().sample_count; ++s) {
+		const uint64_t t0 = now_ns();
+		for (size_t i = 0; i < batch_size / 2; ++i)
+			buffer.try_push(i);
+
+		size_t v;
+		while (buffer.try_pop(v))
+			sink = v;
+
+		samples.push_back(double(now_ns() - t0) / double(batch_size));
+	}
+
+	static_cast<void>(sink);
+	r.add(std::cout, name, "ns/op", std::move(samples));
+}
+
+// The fiber switches back to the thread's fiber right away.
+void echo_fiber_func(void* p_data)
+{
+	void* p_thread_fiber = *static_cast<void**>(p_data);
+	for (;;)
+		ts::switch_to_fiber(p_thread_fiber);
+}
+
+void noop_fiber_func(void*)
+{}
+
+// Fibers need a thread_fiber_nature, the benchmarks run in a thread of their own.
+void fiber_benchmarks(bench::runner& r)
+{
+	std::thread th([&r] {
+		ts::thread_fiber_nature tfn;
+
+		if (r.enabled("fiber.switch_round_trip")) {
+			ts::fiber echo_fiber(echo_fiber_func, 64 * 1024, &tfn.p_handle);
+			std::vector<double> samples;
+
+			for (size_t s = 0; s < r.opts().sample_count; ++s) {
+				const uint64_t t0 = now_ns();
+				for (size_t i = 0; i < batch_size; ++i)
+					ts::switch_to_fiber(echo_fiber.p_handle);
+
+				samples.push_back(double(now_ns() - t0) / double(batch_size));
+			}
+
+			r.add(std::cout, "fiber.switch_round_trip", "ns/round trip", std::move(samples));
+		}
+
+		// pop(cache_index) takes a fiber from the thread's cache, pop() from the shared stack.
+		for (bool cached : { true, false }) {
+			const std::string name = cached ? "fiber_pool.pop_push_cached" : "fiber_pool.pop_push_shared";
+			if (!r.enabled(name)) continue;
+
+			ts::fiber_pool pool(16, noop_fiber_func, 64 * 1024, nullptr, 1);
+			std::vector<double> samples;
+
+			for (size_t s = 0; s < r.opts().sample_count; ++s) {
+				const uint64_t t0 = now_ns();
+				for (size_t i = 0; i < batch_size; ++i) {
+					if (cached) {
+						void* p_fiber = pool.pop(0);
+						pool.push_back(p_fiber, 0);
+					}
+					else {
+						void* p_fiber = pool.pop();
+						pool.push_back(p_fiber);
+					}
+				}
+
+				samples.push_back(double(now_ns() - t0) / double(batch_size));
+			}
+
+			r.add(std::cout, name, "ns/pop+push", std::move(samples));
+		}
+	});
+
+	th.join();
+}
+
+// Parks one record and notifies its counter while waiting_count other records wait for their own counters.
+// The table has fewer buckets than counters, so the bucket lists grow with waiting_count.
+void wait_table_notify_one(bench::runner& r, size_t waiting_count)
+{
+	const std::string name = "wait_table.notify_one_of_" + std::to_string(waiting_count);
+	if (!r.enabled(name)) return;
+
+	ts::fiber_wait_table table(256);
+
+	std::unique_ptr<std::atomic_size_t[]> counters(new std::atomic_size_t[waiting_count + 1]);
+	std::unique_ptr<ts::fiber_wait_node[]> nodes(new ts::fiber_wait_node[waiting_count]);
+	std::unique_ptr<ts::fiber_wait_record[]> records(new ts::fiber_wait_record[waiting_count]);
+	for (size_t i = 0; i < waiting_count; ++i) {
+		counters[i] = 1;
+		nodes[i].p_wait_counter = &counters[i];
+		records[i].p_fiber = &records[i]; // the benchmark does not use real fibers
+		records[i].p_nodes = &nodes[i];
+		records[i].node_count = 1;
+		table.park(records[i]);
+	}
+
+	std::atomic_size_t& counter = counters[waiting_count];
+	std::vector<double> samples;
+
+	for (size_t s = 0; s < r.opts().sample_count; ++s) {
+		uint64_t dur = 0;
+		for (size_t i = 0; i < batch_size / 10; ++i) {
+			ts::fiber_wait_node node;
+			node.p_wait_counter = &counter;
+			ts::fiber_wait_record record;
+			record.p_fiber = &record;
+			record.p_nodes = &node;
+			record.node_count = 1;
+			counter = 1;
+
+			const uint64_t t0 = now_ns();
+			table.park(record);
+			counter = 0;
+			table.notify(&counter);
+			dur += now_ns() - t0;
+		}
+
+		samples.push_back(double(dur) / double(batch_size / 10));
+	}
+
+	r.add(std::cout, name, "ns/park+notify", std::move(samples));
+
+	for (size_t i = 0; i < waiting_count; ++i) {
+		counters[i] = 0;
+		table.notify(&counters[i]);
+	}
+}
+
+// Parks waiting_count records on the same counter and notifies all of them at once.
+void wait_table_notify_all(bench::runner& r, size_t waiting_count)
+{
+	const std::string name = "wait_table.notify_all_" + std::to_string(waiting_count);
+	if (!r.enabled(name)) return;
+
+	ts::fiber_wait_table table(256);
+	std::atomic_size_t counter(0);
+	std::vector<double> samples;
+	const size_t run_count = std::max<size_t>(1, r.opts().sample_count / 10);
+
+	for (size_t s = 0; s < run_count; ++s) {
+		std::unique_ptr<ts::fiber_wait_node[]> nodes(new ts::fiber_wait_node[waiting_count]);
+		std::unique_ptr<ts::fiber_wait_record[]> records(new ts::fiber_wait_record[waiting_count]);
+		counter = 1;
+
+		const uint64_t t0 = now_ns();
+		for (size_t i = 0; i < waiting_count; ++i) {
+			nodes[i].p_wait_counter = &counter;
+			records[i].p_fiber = &records[i];
+			records[i].p_nodes = &nodes[i];
+			records[i].node_count = 1;
+			table.park(records[i]);
+		}
+
+		counter = 0;
+		size_t ready_count = 0;
+		for (ts::fiber_wait_record* p = table.notify(&counter); p; p = p->p_next)
+			++ready_count;
+
+		samples.push_back(double(now_ns() - t0) / double(waiting_count));
+		if (ready_count != waiting_count)
+			throw std::logic_error(name + ": not all the records have been notified.");
+	}
+
+	r.add(std::cout, name, "ns/record", std::move(samples));
+}
+
+} // namespace
+
+
+namespace bench {
+
+void run_primitive_benchmarks(runner& r)
+{
+	queue_benchmarks<ts::concurrent_queue<size_t>>(r, "concurrent_queue");
+	queue_benchmarks<ts::lock_free_queue<size_t>>(r, "lock_free_queue");
+	ring_buffer_benchmarks(r);
+	fiber_benchmarks(r);
+
+	for (size_t waiting_count : { size_t(0), size_t(64), size_t(1024), size_t(16384) })
+		wait_table_notify_one(r, waiting_count);
+
+	for (size_t waiting_count : { size_t(1), size_t(64), size_t(1024) })
+		wait_table_notify_all(r, waiting_count);
+}
+
+} // namespace bench
@@ -0,0 +1,185 @@
+#include "bench/bench.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "ts/task_system.h"
+
+
+namespace {
+
+using bench::now_ns;
+
+constexpr size_t task_batch_size = 4096;
+
+constexpr std::chrono::microseconds timer_delay(500);
+
+ts::task_system_desc make_desc(size_t thread_count)
+{
+	ts::task_system_desc desc;
+	desc.thread_count = thread_count;
+	desc.fiber_count = 64;
+	desc.fiber_stack_byte_count = 64 * 1024;
+	// a whole batch of empty tasks fits into the queues.
+	desc.queue_size = task_batch_size * 2;
+	desc.queue_immediate_size = 64;
+	desc.queue_background_size = 64;
+	return desc;
+}
+
+// The kernel function can't capture anything, the benchmarks pass data through these variables.
+size_t				sample_count;
+std::vector<double>	samples;
+
+// Runs func in a task, so it is executed by a worker fiber like most of the code which spawns tasks.
+template<typename F>
+void run_in_task(F func)
+{
+	std::atomic_size_t wait_counter;
+	ts::run(func, wait_counter);
+	ts::wait_for(wait_counter);
+}
+
+// From ts::run until the task starts.
+void spawn_to_execute_kernel()
+{
+	run_in_task([] {
+		for (size_t s = 0; s < sample_count; ++s) {
+			uint64_t t1 = 0;
+			std::atomic_size_t wait_counter;
+
+			const uint64_t t0 = now_ns();
+			ts::run([&t1] { t1 = now_ns(); }, wait_counter);
+			ts::wait_for(wait_counter);
+
+			samples.push_back(double(t1 - t0));
+		}
+	});
+}
+
+// Spawns batches of empty tasks and waits for them.
+void empty_task_kernel()
+{
+	run_in_task([] {
+		std::vector<ts::task_func> funcs(task_batch_size);
+
+		for (size_t s = 0; s < sample_count; ++s) {
+			for (auto& f : funcs)
+				f = [] {};
+
+			std::atomic_size_t wait_counter;
+			const uint64_t t0 = now_ns();
+			ts::run(funcs.data(), funcs.size(), ts::task_priority::normal, &wait_counter);
+			ts::wait_for(wait_counter);
+
+			samples.push_back(double(now_ns() - t0) / double(task_batch_size));
+		}
+	});
+}
+
+// From the decrement which releases a waiting fiber until the fiber runs again.
+// With several threads the task may release the counter before the fiber has been parked,
+// such samples measure the wait_for fast path.
+void wait_for_resume_kernel()
+{
+	run_in_task([] {
+		for (size_t s = 0; s < sample_count; ++s) {
+			uint64_t t0 = 0;
+			std::atomic_size_t wait_counter(1);
+
+			ts::run([&t0, &wait_counter] {
+				t0 = now_ns();
+				ts::decrement_wait_counter(wait_counter);
+			});
+			ts::wait_for(wait_counter);
+
+			samples.push_back(double(now_ns() - t0));
+		}
+	});
+}
+
+double lateness_ns(ts::task_clock::time_point time, ts::task_clock::time_point actual_time)
+{
+	return double(std::chrono::duration_cast<std::chrono::nanoseconds>(actual_time - time).count());
+}
+
+// From the time of a run_at timer until its task starts. The timer tick and the time
+// a sleeping worker needs to wake up are included.
+void run_at_jitter_kernel()
+{
+	run_in_task([] {
+		for (size_t s = 0; s < sample_count; ++s) {
+			ts::task_clock::time_point actual_time;
+			std::atomic_size_t wait_counter(1);
+
+			const ts::task_clock::time_point time = ts::task_clock::now() + timer_delay;
+			ts::run_at(time, [&actual_time, &wait_counter] {
+				actual_time = ts::task_clock::now();
+				ts::decrement_wait_counter(wait_counter);
+			});
+			ts::wait_for(wait_counter);
+
+			samples.push_back(lateness_ns(time, actual_time));
+		}
+	});
+}
+
+// From the time a sleeping fiber has to wake up until it runs again.
+void sleep_until_jitter_kernel()
+{
+	run_in_task([] {
+		for (size_t s = 0; s < sample_count; ++s) {
+			const ts::task_clock::time_point time = ts::task_clock::now() + timer_delay;
+			ts::sleep_until(time);
+			samples.push_back(lateness_ns(time, ts::task_clock::now()));
+		}
+	});
+}
+
+void run_kernel(bench::runner& r, const std::string& name, const char* unit, size_t thread_count,
+	size_t kernel_sample_count, ts::kernel_func_t p_kernel_func)
+{
+	const std::string full_name = name + ".t" + std::to_string(thread_count);
+	if (!r.enabled(full_name)) return;
+
+	sample_count = kernel_sample_count;
+	samples.clear();
+	samples.reserve(sample_count);
+
+	ts::launch_task_system(make_desc(thread_count), p_kernel_func);
+	r.add(std::cout, full_name, unit, std::move(samples));
+}
+
+} // namespace
+
+
+namespace bench {
+
+void run_task_system_benchmarks(runner& r)
+{
+	std::vector<size_t> thread_counts = { 1 };
+	if (r.opts().thread_count > 1)
+		thread_counts.push_back(r.opts().thread_count);
+
+	for (size_t thread_count : thread_counts) {
+		run_kernel(r, "task_system.spawn_to_execute", "ns", thread_count,
+			r.opts().sample_count, spawn_to_execute_kernel);
+
+		run_kernel(r, "task_system.empty_task", "ns/task", thread_count,
+			std::max<size_t>(1, r.opts().sample_count / 10), empty_task_kernel);
+
+		run_kernel(r, "task_system.wait_for_resume", "ns", thread_count,
+			r.opts().sample_count, wait_for_resume_kernel);
+
+		run_kernel(r, "task_system.run_at_jitter", "ns late", thread_count,
+			std::max<size_t>(1, r.opts().sample_count / 4), run_at_jitter_kernel);
+
+		run_kernel(r, "task_system.sleep_until_jitter", "ns late", thread_count,
+			std::max<size_t>(1, r.opts().sample_count / 4), sleep_until_jitter_kernel);
+	}
+}
+
+} // namespace bench
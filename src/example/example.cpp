@@ -2,10 +2,11 @@
 
 #include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <iostream>
 #include <numeric>
 #include <vector>
-#include "ts/task_system.h"
+#include "ts/parallel.h"
 
 namespace {
 
@@ -37,29 +38,39 @@ namespace example {
 void simple_map_example()
 {
 	constexpr size_t item_count = 10'000'000;
-	constexpr size_t task_count = 3;
-	constexpr size_t task_size = item_count / task_count;
+	constexpr size_t grain_size = 16 * 1024;
 
 	const auto time_start = std::chrono::high_resolution_clock::now();
 	std::cout << "[simple_map_example]" << std::endl;
 	to_stream(std::cout, "\titem_count", item_count);
-	to_stream(std::cout, "\ttask_count", task_count);
-	to_stream(std::cout, "\titems per task", task_size);
+	to_stream(std::cout, "\tgrain_size", grain_size);
 
-	std::function<void()> tasks[task_count];
 	std::vector<float> sequence(item_count);
-	
-	for (size_t i = 0; i < task_count; ++i) {
-		const size_t offset = i * task_size;
-		auto b = sequence.begin() + offset;
-		auto e = (i < task_count - 1) ? (b + task_size) : (sequence.end());
-
-		tasks[i] = [b, e, offset] { std::iota(b, e, float(offset)); };
-	}
-
-	std::atomic_size_t wait_counter;
-	ts::run(tasks, wait_counter);
-	ts::wait_for(wait_counter);
+	ts::parallel_for(size_t(0), item_count, [&sequence](size_t i) { sequence[i] = float(i); }, grain_size);
+
+	const auto dur = std::chrono::high_resolution_clock::now() - time_start;
+	to_stream(std::cout, "\t----time", dur);
+}
+
+void map_reduce_example()
+{
+	constexpr size_t item_count = 10'000'000;
+	constexpr size_t grain_size = 16 * 1024;
+
+	std::vector<float> sequence(item_count);
+	std::iota(sequence.begin(), sequence.end(), 0.0f);
+
+	const auto time_start = std::chrono::high_resolution_clock::now();
+	std::cout << "[map_reduce_example]" << std::endl;
+	to_stream(std::cout, "\titem_count", item_count);
+	to_stream(std::cout, "\tgrain_size", grain_size);
+
+	// the mean of sin(x)^2
+	const double sum = ts::transform_reduce(sequence.cbegin(), sequence.cend(), 0.0,
+		[](double l, double r) { return l + r; },
+		[](float v) { const double s = std::sin(v); return s * s; },
+		grain_size);
+	to_stream(std::cout, "\tmean", sum / item_count);
 
 	const auto dur = std::chrono::high_resolution_clock::now() - time_start;
 	to_stream(std::cout, "\t----time", dur);
@@ -8,6 +8,8 @@ namespace example {
 
 void simple_map_example();
 
+void map_reduce_example();
+
 } // namespace example
 
 #endif // EXAMPLE_EXAMPLE_H_
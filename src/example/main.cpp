@@ -7,7 +7,6 @@
 #include <mutex>
 #include <thread>
 #include <vector>
-#include <windows.h>
 
 
 void run_examples()
@@ -15,22 +14,29 @@ void run_examples()
 	std::atomic_size_t wait_counter;
 	ts::run(example::simple_map_example, wait_counter);
 	ts::wait_for(wait_counter);
+
+	ts::run(example::map_reduce_example, wait_counter);
+	ts::wait_for(wait_counter);
 }
 
-void main(int argc, char* argv[])
+int main(int argc, char* argv[])
 {
-	ts::task_system_desc ts_desc = {
-		/* thread_count */				1,
-		/* fiber_count */				8,
-		/* fiber_stack_byte_count */	128,
-		/* queue_size */				64,
-		/* queue_immediate_size */		16
-	};
+	ts::task_system_desc ts_desc;
+	ts_desc.thread_count = 1;
+	ts_desc.fiber_count = 8;
+	ts_desc.fiber_stack_byte_count = 64 * 1024;
+	ts_desc.queue_size = 64;
+	ts_desc.queue_immediate_size = 16;
+	ts_desc.queue_background_size = 16;
 	
 	auto report = ts::launch_task_system(ts_desc, run_examples);
 
 	std::cout << std::endl << "[task system report]" << std::endl
 		<< "\thigh_task_count: " << report.task_immediate_count << ";" << std::endl
-		<< "\ttask_count: " << report.task_count << ";" << std::endl;
+		<< "\tbackground_task_count: " << report.task_background_count << ";" << std::endl
+		<< "\ttask_count: " << report.task_count << ";" << std::endl
+		<< "\tspawned_task_count: " << report.spawned_task_count << ";" << std::endl
+		<< "\tpark_count: " << report.park_count << ";" << std::endl
+		<< "\tfiber_high_water_count: " << report.fiber_high_water_count << ";" << std::endl;
 	std::cin.get();
 }
\ No newline at end of file
@@ -0,0 +1,141 @@
+#ifndef TS_BLOCK_CACHE_H_
+#define TS_BLOCK_CACHE_H_
+
+#include <cassert>
+#include <cstddef>
+#include <mutex>
+#include <new>
+
+
+namespace ts {
+
+// block_cache recycles free memory blocks through per-thread caches which exchange blocks with a shared pool.
+// Each of list_count lists holds blocks of one size, the user chooses the list and allocates the blocks
+// which the cache does not have. A thread keeps at most thread_cache_limit blocks per list and moves
+// transfer_batch_size blocks to or from the shared pool at once. Tag tells apart the caches of different users.
+template<typename Tag, size_t list_count, size_t thread_cache_limit, size_t transfer_batch_size>
+class block_cache final {
+public:
+
+	static_assert(transfer_batch_size > 0 && transfer_batch_size <= thread_cache_limit,
+		"transfer_batch_size must be in (0, thread_cache_limit].");
+
+
+	block_cache() = delete;
+
+
+	// Returns a free block of the list or nullptr if there are none.
+	static void* pop(size_t list_index) noexcept
+	{
+		assert(list_index < list_count);
+
+		free_list& list = tl_cache.lists[list_index];
+		if (!list.p_head) {
+			shared_pool& pool = get_shared_pool();
+			std::lock_guard<std::mutex> lock(pool.mutex);
+			pool.lists[list_index].move_to(list, transfer_batch_size);
+		}
+
+		return list.pop();
+	}
+
+	// The block goes to the cache of the current thread whichever thread has allocated it.
+	static void push(size_t list_index, void* p) noexcept
+	{
+		assert(list_index < list_count);
+		assert(p);
+
+		free_list& list = tl_cache.lists[list_index];
+		list.push(static_cast<free_block*>(p));
+
+		if (list.count > thread_cache_limit) {
+			shared_pool& pool = get_shared_pool();
+			std::lock_guard<std::mutex> lock(pool.mutex);
+			list.move_to(pool.lists[list_index], transfer_batch_size);
+		}
+	}
+
+private:
+
+	struct free_block final {
+		free_block* p_next;
+	};
+
+	struct free_list final {
+		void push(free_block* p_block) noexcept
+		{
+			p_block->p_next = p_head;
+			p_head = p_block;
+			++count;
+		}
+
+		free_block* pop() noexcept
+		{
+			free_block* p_block = p_head;
+			if (!p_block) return nullptr;
+
+			p_head = p_block->p_next;
+			--count;
+			return p_block;
+		}
+
+		// Moves at most block_count blocks to the other list.
+		void move_to(free_list& list, size_t block_count) noexcept
+		{
+			for (; block_count > 0 && p_head; --block_count)
+				list.push(pop());
+		}
+
+
+		free_block*	p_head = nullptr;
+		size_t		count = 0;
+	};
+
+	// The blocks which thread caches have given away. They are freed when the program exits.
+	struct shared_pool final {
+		~shared_pool() noexcept
+		{
+			for (free_list& list : lists) {
+				while (free_block* p_block = list.pop())
+					::operator delete(p_block);
+			}
+		}
+
+
+		std::mutex	mutex;
+		free_list	lists[list_count];
+	};
+
+	// A thread gives its blocks to the shared pool when it exits.
+	struct thread_cache final {
+		~thread_cache() noexcept
+		{
+			shared_pool& pool = get_shared_pool();
+			std::lock_guard<std::mutex> lock(pool.mutex);
+
+			for (size_t i = 0; i < list_count; ++i)
+				lists[i].move_to(pool.lists[i], lists[i].count);
+		}
+
+
+		free_list lists[list_count];
+	};
+
+
+	static shared_pool& get_shared_pool()
+	{
+		static shared_pool pool;
+		return pool;
+	}
+
+
+	static thread_local thread_cache tl_cache;
+};
+
+template<typename Tag, size_t list_count, size_t thread_cache_limit, size_t transfer_batch_size>
+thread_local typename block_cache<Tag, list_count, thread_cache_limit, transfer_batch_size>::thread_cache
+	block_cache<Tag, list_count, thread_cache_limit, transfer_batch_size>::tl_cache;
+
+} // namespace ts
+
+#endif // TS_BLOCK_CACHE_H_
@@ -0,0 +1,58 @@
+#include "ts/block_pool.h"
+
+#include <cassert>
+#include "ts/block_cache.h"
+
+
+namespace {
+
+// Blocks are allocated from size classes of 64, 128, ..., 2048 bytes.
+// Bigger blocks go straight to the heap.
+constexpr size_t size_class_count = 6;
+constexpr size_t min_block_byte_count = 64;
+
+// A thread keeps at most 64 free blocks of one size class and moves 32 blocks to or from the shared pool at once.
+struct pooled_block_tag;
+using pooled_block_cache = ts::block_cache<pooled_block_tag, size_class_count, 64, 32>;
+
+// Returns the index of the smallest size class which fits byte_count, size_class_count if none does.
+size_t size_class_of(size_t byte_count) noexcept
+{
+	size_t index = 0;
+	for (size_t n = min_block_byte_count; index < size_class_count && n < byte_count; n *= 2)
+		++index;
+
+	return index;
+}
+
+} // namespace
+
+
+namespace ts {
+
+void* allocate_pooled_block(size_t byte_count)
+{
+	const size_t index = size_class_of(byte_count);
+	if (index == size_class_count)
+		return ::operator new(byte_count);
+
+	if (void* p = pooled_block_cache::pop(index))
+		return p;
+
+	return ::operator new(min_block_byte_count << index);
+}
+
+void free_pooled_block(void* p, size_t byte_count) noexcept
+{
+	assert(p);
+
+	const size_t index = size_class_of(byte_count);
+	if (index == size_class_count) {
+		::operator delete(p);
+		return;
+	}
+
+	pooled_block_cache::push(index, p);
+}
+
+} // namespace ts
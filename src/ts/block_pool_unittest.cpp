@@ -0,0 +1,44 @@
+#include "ts/block_pool.h"
+
+#include <cstring>
+#include <vector>
+#include "CppUnitTest.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+
+namespace unittest {
+
+TEST_CLASS(block_pool_funcs) {
+public:
+
+	TEST_METHOD(allocate_free)
+	{
+		// a freed block is reused by the next allocation of the same size class
+		void* p0 = ts::allocate_pooled_block(100);
+		ts::free_pooled_block(p0, 100);
+		void* p1 = ts::allocate_pooled_block(120);
+		Assert::IsTrue(p0 == p1);
+		ts::free_pooled_block(p1, 120);
+
+		// big blocks are not pooled
+		void* p2 = ts::allocate_pooled_block(64 * 1024);
+		Assert::IsNotNull(p2);
+		std::memset(p2, 0xff, 64 * 1024);
+		ts::free_pooled_block(p2, 64 * 1024);
+
+		// more blocks than a thread cache keeps
+		for (size_t byte_count : { size_t(1), size_t(64), size_t(700), size_t(2048) }) {
+			std::vector<void*> blocks;
+			for (size_t i = 0; i < 1000; ++i) {
+				blocks.push_back(ts::allocate_pooled_block(byte_count));
+				std::memset(blocks.back(), int(i), byte_count);
+			}
+
+			for (void* p : blocks)
+				ts::free_pooled_block(p, byte_count);
+		}
+	}
+};
+
+} // namespace unittest
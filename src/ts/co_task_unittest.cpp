@@ -0,0 +1,124 @@
+#include "ts/co_task.h"
+
+#ifdef TS_HAS_COROUTINES
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "ts/unittest_utility.h"
+#include "CppUnitTest.h"
+
+using ts::co_task;
+using ts::future;
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+
+namespace {
+
+// many more suspended coroutines than fibers, each of them is resumed by a task.
+constexpr size_t queue_size = 16 * 1024;
+
+co_task<int> add(int l, int r)
+{
+	co_return l + r;
+}
+
+co_task<std::string> add_to_string(int l, int r)
+{
+	const int v = co_await add(l, r);
+	co_return std::to_string(v);
+}
+
+co_task<int> fail()
+{
+	throw std::runtime_error("error");
+	co_return 0;
+}
+
+co_task<void> rethrow()
+{
+	co_await fail();
+}
+
+co_task<int> square_async(int v)
+{
+	future<int> f = ts::async([v] { return v * v; });
+	co_return co_await f;
+}
+
+std::atomic_size_t	gate;
+std::atomic_size_t	passed_count;
+
+co_task<void> wait_gate()
+{
+	co_await ts::co_wait_for(gate);
+	++passed_count;
+}
+
+void co_task_kernel()
+{
+	Assert::AreEqual(std::string("5"), ts::spawn(add_to_string(2, 3)).get());
+	Assert::AreEqual(49, ts::spawn(square_async(7)).get());
+
+	// the exception goes through co_await to the future
+	future<void> f = ts::spawn(rethrow());
+	bool thrown = false;
+	try {
+		f.get();
+	}
+	catch (const std::runtime_error&) {
+		thrown = true;
+	}
+	Assert::IsTrue(thrown);
+
+	// a co_task which is never started
+	co_task<int> never = add(1, 1);
+	Assert::IsTrue(never.valid());
+}
+
+void co_task_wait_kernel()
+{
+	// way more waiters than fibers
+	constexpr size_t waiter_count = 10000;
+	gate = 1;
+	passed_count = 0;
+
+	std::vector<future<void>> futures;
+	futures.reserve(waiter_count);
+	for (size_t i = 0; i < waiter_count; ++i)
+		futures.push_back(ts::spawn(wait_gate()));
+
+	Assert::AreEqual(size_t(0), passed_count.load());
+	ts::decrement_wait_counter(gate);
+
+	ts::when_all(std::move(futures)).wait();
+	Assert::AreEqual(waiter_count, passed_count.load());
+
+	// a zero counter does not suspend
+	ts::spawn(wait_gate()).get();
+	Assert::AreEqual(waiter_count + 1, passed_count.load());
+}
+
+} // namespace
+
+
+namespace unittest {
+
+TEST_CLASS(co_task_co_task) {
+public:
+
+	TEST_METHOD(await_spawn)
+	{
+		run_kernel_for_thread_counts(co_task_kernel, default_fiber_count, queue_size);
+	}
+
+	TEST_METHOD(wait_counter)
+	{
+		run_kernel_for_thread_counts(co_task_wait_kernel, default_fiber_count, queue_size);
+	}
+};
+
+} // namespace unittest
+
+#endif // TS_HAS_COROUTINES
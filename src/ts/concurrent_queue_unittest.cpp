@@ -87,6 +87,86 @@ public:
 		Assert::IsTrue(queue.empty());
 	}
 
+	TEST_METHOD(try_emplace_bulk_try_pop_bulk)
+	{
+		concurrent_queue<int> queue(4);
+
+		// not enough room, nothing is pushed
+		Assert::IsFalse(queue.try_emplace_bulk(5, [](size_t i) { return int(i); }));
+		Assert::IsTrue(queue.empty());
+
+		Assert::IsTrue(queue.try_emplace_bulk(3, [](size_t i) { return int(i) + 1; }));
+		Assert::AreEqual<size_t>(3, queue.size());
+		Assert::IsFalse(queue.try_emplace_bulk(2, [](size_t i) { return int(i); }));
+
+		int values[4] = {};
+		Assert::AreEqual<size_t>(2, queue.try_pop_bulk(values, 2));
+		Assert::AreEqual(1, values[0]);
+		Assert::AreEqual(2, values[1]);
+
+		// goes around the buffer
+		Assert::IsTrue(queue.try_emplace_bulk(3, [](size_t i) { return int(i) + 10; }));
+		Assert::AreEqual<size_t>(4, queue.try_pop_bulk(values, 8));
+		Assert::AreEqual(3, values[0]);
+		Assert::AreEqual(10, values[1]);
+		Assert::AreEqual(11, values[2]);
+		Assert::AreEqual(12, values[3]);
+
+		// empty
+		Assert::AreEqual<size_t>(0, queue.try_pop_bulk(values, 8));
+	}
+
+	TEST_METHOD(push_pop_bulk_several_threads)
+	{
+		const size_t thread_count = 4;
+		const int value_count = 40000;
+		const size_t batch_size = 8;
+
+		concurrent_queue<int> queue(64);
+		std::vector<std::vector<int>> popped_values(thread_count);
+		std::atomic_size_t popped_count = 0;
+
+		auto consumer_func = [&](std::vector<int>& out_values) {
+			int values[batch_size];
+			while (popped_count < size_t(value_count)) {
+				const size_t count = queue.try_pop_bulk(values, batch_size);
+				out_values.insert(out_values.end(), values, values + count);
+				popped_count += count;
+			}
+		};
+
+		std::vector<std::thread> consumers;
+		for (size_t i = 0; i < thread_count; ++i)
+			consumers.emplace_back(consumer_func, std::ref(popped_values[i]));
+
+		std::vector<std::thread> producers;
+		for (size_t t = 0; t < thread_count; ++t) {
+			producers.emplace_back([&, t] {
+				const int first = int(t) * value_count / int(thread_count);
+				const int last = int(t + 1) * value_count / int(thread_count);
+
+				for (int v = first; v < last; v += int(batch_size)) {
+					const size_t count = std::min(batch_size, size_t(last - v));
+					while (!queue.try_emplace_bulk(count, [v](size_t i) { return v + int(i); }))
+						std::this_thread::yield();
+				}
+			});
+		}
+
+		for (auto& t : producers) t.join();
+		for (auto& t : consumers) t.join();
+
+		std::vector<int> actual_values;
+		for (const auto& values : popped_values)
+			actual_values.insert(actual_values.end(), values.cbegin(), values.cend());
+
+		std::vector<int> origin_values(value_count);
+		std::iota(origin_values.begin(), origin_values.end(), 0);
+		std::sort(actual_values.begin(), actual_values.end());
+		Assert::AreEqual(origin_values.size(), actual_values.size());
+		Assert::IsTrue(std::equal(origin_values.cbegin(), origin_values.cend(), actual_values.cbegin()));
+	}
+
 	TEST_METHOD(push_pop_several_threads)
 	{
 		const size_t thread_count = 29; // this_thread is not taken into account here
@@ -1,21 +1,270 @@
 #include "ts/fiber.h"
 
 #include <cassert>
+#include <cstdint>
 #include <algorithm>
-#include <windows.h>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <cstdint>
+	#include <cstdlib>
+	#include <new>
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif
+
+
+#ifndef _WIN32
+
+// ----- posix context switch -----
+//
+// ts_switch_context(pp_from_sp, p_to_sp) pushes the callee-saved registers of the current
+// context onto its stack, stores the resulting stack pointer in *pp_from_sp, loads p_to_sp
+// and pops the callee-saved registers of the target context. Caller-saved registers are
+// already spilled by the compiler at the call site, so nothing else has to be preserved and
+// no syscall (signal mask) is involved, unlike swapcontext.
+//
+// A fresh fiber stack is prepared by make_initial_stack so that the first switch 'returns'
+// into ts_fiber_trampoline which forwards the fiber_context pointer to ts_fiber_entry.
+
+extern "C" void ts_switch_context(void** pp_from_sp, void* p_to_sp) noexcept;
+extern "C" void ts_fiber_trampoline() noexcept;
+
+#if defined(__x86_64__)
+
+// Stack frame (from the lowest address): mxcsr(4) + x87 cw(4), r15, r14, r13, r12, rbx, rbp, ret addr.
+asm(R"(
+	.text
+	.globl	ts_switch_context
+	.type	ts_switch_context, @function
+	.align	16
+ts_switch_context:
+	pushq	%rbp
+	pushq	%rbx
+	pushq	%r12
+	pushq	%r13
+	pushq	%r14
+	pushq	%r15
+	subq	$8, %rsp
+	stmxcsr	(%rsp)
+	fnstcw	4(%rsp)
+	movq	%rsp, (%rdi)
+	movq	%rsi, %rsp
+	ldmxcsr	(%rsp)
+	fldcw	4(%rsp)
+	addq	$8, %rsp
+	popq	%r15
+	popq	%r14
+	popq	%r13
+	popq	%r12
+	popq	%rbx
+	popq	%rbp
+	ret
+	.size	ts_switch_context, .-ts_switch_context
+
+	.globl	ts_fiber_trampoline
+	.type	ts_fiber_trampoline, @function
+	.align	16
+ts_fiber_trampoline:
+	movq	%rbx, %rdi
+	call	ts_fiber_entry
+	ud2
+	.size	ts_fiber_trampoline, .-ts_fiber_trampoline
+)");
+
+#elif defined(__aarch64__)
+
+// Stack frame (from the lowest address): x19-x28, x29(fp), x30(lr), d8-d15.
+asm(R"(
+	.text
+	.globl	ts_switch_context
+	.type	ts_switch_context, %function
+	.align	4
+ts_switch_context:
+	sub	sp, sp, #160
+	stp	x19, x20, [sp, #0]
+	stp	x21, x22, [sp, #16]
+	stp	x23, x24, [sp, #32]
+	stp	x25, x26, [sp, #48]
+	stp	x27, x28, [sp, #64]
+	stp	x29, x30, [sp, #80]
+	stp	d8, d9, [sp, #96]
+	stp	d10, d11, [sp, #112]
+	stp	d12, d13, [sp, #128]
+	stp	d14, d15, [sp, #144]
+	mov	x9, sp
+	str	x9, [x0]
+	mov	sp, x1
+	ldp	x19, x20, [sp, #0]
+	ldp	x21, x22, [sp, #16]
+	ldp	x23, x24, [sp, #32]
+	ldp	x25, x26, [sp, #48]
+	ldp	x27, x28, [sp, #64]
+	ldp	x29, x30, [sp, #80]
+	ldp	d8, d9, [sp, #96]
+	ldp	d10, d11, [sp, #112]
+	ldp	d12, d13, [sp, #128]
+	ldp	d14, d15, [sp, #144]
+	add	sp, sp, #160
+	ret
+	.size	ts_switch_context, .-ts_switch_context
+
+	.globl	ts_fiber_trampoline
+	.type	ts_fiber_trampoline, %function
+	.align	4
+ts_fiber_trampoline:
+	mov	x0, x19
+	bl	ts_fiber_entry
+	brk	#0
+	.size	ts_fiber_trampoline, .-ts_fiber_trampoline
+)");
+
+#else
+	#error ts::fiber has no context switch implementation for the target architecture.
+#endif
+
+namespace {
+
+// fiber_context is the object p_handle points to on posix platforms.
+// Contexts of fibers live at the top of their own stack mapping, the contexts created by
+// thread_fiber_nature are allocated on the heap and have no stack.
+// The mapping starts with the guard page, p_stack and stack_byte_count describe the whole mapping.
+struct fiber_context final {
+	void*			p_stack_pointer = nullptr;
+	ts::fiber_func_t	func = nullptr;
+	void*			p_data = nullptr;
+	void*			p_stack = nullptr;
+	size_t			stack_byte_count = 0;
+};
+
+thread_local fiber_context* p_current_fiber_context = nullptr;
+
+
+size_t page_byte_count() noexcept
+{
+	static const size_t byte_count = size_t(sysconf(_SC_PAGESIZE));
+	return byte_count;
+}
+
+// Writes the frame ts_switch_context expects to find on the stack of a suspended context.
+// Returns the stack pointer value to be used for the first switch.
+void* make_initial_stack(void* p_stack_top, fiber_context* p_ctx) noexcept
+{
+	assert((uintptr_t(p_stack_top) & 15) == 0);
+
+#if defined(__x86_64__)
+	// 8 slots of the frame + 2 spare slots keep the stack 16 byte aligned at the trampoline's call.
+	uint64_t* p = static_cast<uint64_t*>(p_stack_top) - 10;
+	std::fill(p, p + 10, 0);
+	p[0] = uint64_t(0x037F) << 32 | 0x1F80;		// x87 control word | mxcsr (default values)
+	p[5] = uint64_t(uintptr_t(p_ctx));			// rbx
+	p[7] = uint64_t(uintptr_t(&ts_fiber_trampoline));	// return address
+#elif defined(__aarch64__)
+	uint64_t* p = static_cast<uint64_t*>(p_stack_top) - 20;
+	std::fill(p, p + 20, 0);
+	p[0] = uint64_t(uintptr_t(p_ctx));			// x19
+	p[11] = uint64_t(uintptr_t(&ts_fiber_trampoline));	// x30
+#endif
+
+	return p;
+}
+
+} // namespace
+
+extern "C" void ts_fiber_entry(fiber_context* p_ctx) noexcept
+{
+	p_ctx->func(p_ctx->p_data);
+
+	// Fiber functions must not return, there is no context to return to.
+	// Win32 terminates the thread in this case.
+	std::abort();
+}
+
+#else
+
+namespace {
+
+size_t page_byte_count() noexcept
+{
+	static const size_t byte_count = [] {
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return size_t(info.dwPageSize);
+	}();
+
+	return byte_count;
+}
+
+} // namespace
+
+#endif // _WIN32
 
 
 namespace ts {
 
 // ----- fiber -----
 
-fiber::fiber(fiber_func_t func, size_t stack_byte_count, void* p_data)
+#ifdef _WIN32
+
+fiber::fiber(fiber_func_t func, size_t stack_byte_count, void* p_data, bool huge_pages)
 {
 	assert(func);
 	assert(stack_byte_count > 0);
-	p_handle = CreateFiber(stack_byte_count, func, p_data);
+
+	// Win32 reserves the stack and commits it page by page below its own guard page, an overflow
+	// raises EXCEPTION_STACK_OVERFLOW. Large pages need a privilege and can't back a stack.
+	(void)huge_pages;
+	p_handle = CreateFiberEx(0, fiber_stack_byte_count(stack_byte_count), 0, func, p_data);
+	if (!p_handle)
+		throw std::bad_alloc();
+}
+
+#else
+
+fiber::fiber(fiber_func_t func, size_t stack_byte_count, void* p_data, bool huge_pages)
+{
+	assert(func);
+	assert(stack_byte_count > 0);
+
+	// MAP_NORESERVE: pages are committed on first touch.
+	const size_t page_size = page_byte_count();
+	const size_t mapping_byte_count = fiber_stack_byte_count(stack_byte_count) + page_size;
+	void* p_mapping = mmap(nullptr, mapping_byte_count, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+	if (p_mapping == MAP_FAILED)
+		throw std::bad_alloc();
+
+	// the guard page
+	if (mprotect(p_mapping, page_size, PROT_NONE) != 0) {
+		munmap(p_mapping, mapping_byte_count);
+		throw std::bad_alloc();
+	}
+
+#ifdef MADV_HUGEPAGE
+	// just a hint, the stack works either way.
+	if (huge_pages)
+		madvise(static_cast<char*>(p_mapping) + page_size, mapping_byte_count - page_size, MADV_HUGEPAGE);
+#else
+	(void)huge_pages;
+#endif
+
+	// the context occupies the top of the stack mapping.
+	constexpr size_t ctx_byte_count = (sizeof(fiber_context) + 15) & ~size_t(15);
+	void* p_ctx_memory = static_cast<char*>(p_mapping) + mapping_byte_count - ctx_byte_count;
+
+	fiber_context* p_ctx = new(p_ctx_memory) fiber_context();
+	p_ctx->func = func;
+	p_ctx->p_data = p_data;
+	p_ctx->p_stack = p_mapping;
+	p_ctx->stack_byte_count = mapping_byte_count;
+	p_ctx->p_stack_pointer = make_initial_stack(p_ctx_memory, p_ctx);
+
+	p_handle = p_ctx;
 }
 
+#endif // _WIN32
+
 fiber::fiber(fiber&& fbr) noexcept
 	: p_handle(fbr.p_handle)
 {
@@ -41,102 +290,354 @@ fiber::~fiber() noexcept
 void fiber::dispose() noexcept
 {
 	if (!p_handle) return;
+
+#ifdef _WIN32
 	DeleteFiber(p_handle);
+#else
+	fiber_context* p_ctx = static_cast<fiber_context*>(p_handle);
+	assert(p_ctx != p_current_fiber_context);
+	munmap(p_ctx->p_stack, p_ctx->stack_byte_count);
+#endif
+
 	p_handle = nullptr;
 }
 
 // ----- fiber_pool -----
 
-fiber_pool::fiber_pool(size_t fiber_count, void(*func)(void*), size_t stack_byte_count, void* p_data)
+fiber_pool::fiber_pool(size_t fiber_count, void(*func)(void*), size_t stack_byte_count, void* p_data,
+	size_t cache_count, bool huge_pages, size_t chunk_size)
+	: fibers_(new list_entry[fiber_count]),
+	fiber_count_(fiber_count),
+	chunk_size_((chunk_size > 0) ? std::min(chunk_size, fiber_count) : fiber_count),
+	created_count_(0),
+	handle_table_(new std::atomic<uint32_t>[next_power_of_two(fiber_count * 2)]),
+	handle_table_mask_(next_power_of_two(fiber_count * 2) - 1),
+	caches_(new cache[cache_count]),
+	cache_count_(cache_count),
+	func_(func),
+	stack_byte_count_(stack_byte_count),
+	p_data_(p_data),
+	huge_pages_(huge_pages),
+	head_(no_index)
 {
 	assert(fiber_count > 0);
+	assert(fiber_count < no_index);
 	assert(func);
 	assert(stack_byte_count);
 
-	fibers_.resize(fiber_count);
-	for (auto& e : fibers_)
-		e.fiber = fiber(func, stack_byte_count, p_data);
+	for (size_t i = 0; i <= handle_table_mask_; ++i)
+		handle_table_[i].store(no_index, std::memory_order_relaxed);
+
+	for (size_t i = 0; i < cache_count_; ++i) {
+		for (auto& index : caches_[i].indices)
+			index.store(no_index, std::memory_order_relaxed);
+	}
 
-	std::sort(fibers_.begin(), fibers_.end(), 
-		[](const list_entry& l, const list_entry& r) { return l.fiber.p_handle < r.fiber.p_handle; });
+	push_back(grow());
 }
 
 void fiber_pool::push_back(void* p_fbr)
 {
-	using it_t = decltype(fibers_)::iterator;
+	push_entry(index_of(p_fbr));
+}
 
-	assert(p_fbr);
-	std::lock_guard<std::mutex> lock(mutex_);
+void fiber_pool::push_back(void* p_fbr, size_t cache_index)
+{
+	assert(cache_index < cache_count_);
+
+	const uint32_t index = index_of(p_fbr);
+	for (auto& slot : caches_[cache_index].indices) {
+		if (slot.load(std::memory_order_relaxed) != no_index) continue;
 
-	it_t it = std::lower_bound(fibers_.begin(), fibers_.end(), p_fbr,
-		[](const list_entry& e, const void* p_fbr)  { return (e.fiber.p_handle < p_fbr); });
-	assert(it != fibers_.end());
-	
-	it->in_use = false;
+		const uint8_t prev_state = fibers_[index].state.exchange(entry_free, std::memory_order_release);
+		assert(prev_state == entry_in_use);
+		(void)prev_state;
+
+		slot.store(index, std::memory_order_release);
+		return;
+	}
+
+	push_entry(index);
 }
 
 void* fiber_pool::pop()
 {
-	using it_t = decltype(fibers_)::iterator;
+	const uint32_t index = pop_entry();
+	return (index == no_index) ? grow() : acquire_entry(index);
+}
+
+void* fiber_pool::pop(size_t cache_index)
+{
+	assert(cache_index < cache_count_);
+
+	for (auto& slot : caches_[cache_index].indices) {
+		if (slot.load(std::memory_order_relaxed) == no_index) continue;
 
-	std::lock_guard<std::mutex> lock(mutex_);
-	it_t it = std::find_if(fibers_.begin(), fibers_.end(), [](const list_entry& e) { return !e.in_use; });
-	
-	if (it == fibers_.end()) {
-		return nullptr;
+		const uint32_t index = slot.exchange(no_index, std::memory_order_acquire);
+		if (index != no_index) return acquire_entry(index);
 	}
-	else {
-		it->in_use = true;
-		return it->fiber.p_handle;
+
+	const uint32_t index = pop_entry();
+	if (index != no_index) return acquire_entry(index);
+
+	// the shared stack is empty, the rest of the free fibers are in other caches.
+	for (size_t i = 1; i < cache_count_; ++i) {
+		for (auto& slot : caches_[(cache_index + i) % cache_count_].indices) {
+			if (slot.load(std::memory_order_relaxed) == no_index) continue;
+
+			const uint32_t index = slot.exchange(no_index, std::memory_order_acquire);
+			if (index != no_index) return acquire_entry(index);
+		}
 	}
+
+	return grow();
 }
 
-// ----- fiber_wait_list -----
+void fiber_pool::trim()
+{
+	const size_t created_count = created_count_.load(std::memory_order_acquire);
+
+	for (size_t i = 0; i < created_count; ++i) {
+		list_entry& e = fibers_[i];
+		if (e.trimmed.load(std::memory_order_relaxed) || e.state.load(std::memory_order_relaxed) != entry_free) continue;
+
+		uint8_t state = entry_free;
+		if (!e.state.compare_exchange_strong(state, entry_trimming, std::memory_order_acquire)) continue;
+
+		if (!e.trimmed.load(std::memory_order_relaxed)) {
+			release_fiber_stack(e.fiber.p_handle);
+			e.trimmed.store(true, std::memory_order_relaxed);
+		}
 
-fiber_wait_list::fiber_wait_list(size_t fiber_count)
+		e.state.store(entry_free, std::memory_order_release);
+	}
+}
+
+uint32_t fiber_pool::index_of(void* p_fbr) const noexcept
 {
-	wait_list_.resize(fiber_count);
+	assert(p_fbr);
+
+	size_t h = (reinterpret_cast<uintptr_t>(p_fbr) * 11400714819323198485ull) >> 32;
+	while (true) {
+		const uint32_t index = handle_table_[h & handle_table_mask_].load(std::memory_order_acquire);
+		assert(index != no_index); // p_fbr is not a fiber from the pool
+		if (fibers_[index].fiber.p_handle == p_fbr) return index;
+		++h;
+	}
 }
 
-void fiber_wait_list::push(void* p_fiber, const std::atomic_size_t* p_wait_counter)
+void fiber_pool::push_entry(uint32_t index) noexcept
 {
-	assert(p_fiber);
-	assert(p_wait_counter);
-	assert(*p_wait_counter > 0);
+	assert(index < fiber_count_);
+
+	list_entry& e = fibers_[index];
+	const uint8_t prev_state = e.state.exchange(entry_free, std::memory_order_release);
+	assert(prev_state == entry_in_use);
+	(void)prev_state;
+
+	uint64_t head = head_.load(std::memory_order_relaxed);
+	uint64_t new_head;
+	do {
+		e.next_index.store(uint32_t(head), std::memory_order_relaxed);
+		new_head = ((head >> 32) + 1) << 32 | index;
+	} while (!head_.compare_exchange_weak(head, new_head,
+		std::memory_order_release, std::memory_order_relaxed));
+}
+
+uint32_t fiber_pool::pop_entry() noexcept
+{
+	uint64_t head = head_.load(std::memory_order_acquire);
+	uint64_t new_head;
+	uint32_t index;
+	do {
+		index = uint32_t(head);
+		if (index == no_index) return no_index;
+
+		// next_index may be stale if the entry has been popped meanwhile, the tag makes the CAS fail then.
+		const uint32_t next_index = fibers_[index].next_index.load(std::memory_order_relaxed);
+		new_head = ((head >> 32) + 1) << 32 | next_index;
+	} while (!head_.compare_exchange_weak(head, new_head,
+		std::memory_order_acquire, std::memory_order_acquire));
+
+	return index;
+}
+
+void* fiber_pool::acquire_entry(uint32_t index) noexcept
+{
+	// trim may hold the entry for the duration of one madvise call.
+	list_entry& e = fibers_[index];
+	uint8_t state = entry_free;
+	while (!e.state.compare_exchange_weak(state, entry_in_use, std::memory_order_acquire)) {
+		assert(state == entry_trimming);
+		state = entry_free;
+		cpu_pause();
+	}
+
+	e.trimmed.store(false, std::memory_order_relaxed);
+	return e.fiber.p_handle;
+}
+
+void* fiber_pool::grow()
+{
+	std::lock_guard<std::mutex> lock(grow_mutex_);
+
+	// another thread may have grown the pool meanwhile.
+	const uint32_t free_index = pop_entry();
+	if (free_index != no_index) return acquire_entry(free_index);
+
+	const size_t begin = created_count_.load(std::memory_order_relaxed);
+	if (begin == fiber_count_) return nullptr;
+
+	const size_t end = std::min(begin + chunk_size_, fiber_count_);
+	for (size_t i = begin; i < end; ++i) {
+		list_entry& e = fibers_[i];
+		e.fiber = fiber(func_, stack_byte_count_, p_data_, huge_pages_);
+		e.state.store(entry_in_use, std::memory_order_relaxed);
+
+		size_t h = (reinterpret_cast<uintptr_t>(e.fiber.p_handle) * 11400714819323198485ull) >> 32;
+		while (handle_table_[h & handle_table_mask_].load(std::memory_order_relaxed) != no_index) ++h;
+		handle_table_[h & handle_table_mask_].store(uint32_t(i), std::memory_order_release);
+	}
+
+	created_count_.store(end, std::memory_order_release);
 
-	std::lock_guard<std::mutex> lock(mutex_);
-	assert(push_index_ < wait_list_.size());
+	// push in reverse order, so fibers are popped in the order of creation.
+	for (size_t i = end - 1; i > begin; --i)
+		push_entry(uint32_t(i));
 
-	wait_list_[push_index_] = list_entry{ p_fiber, p_wait_counter };
-	++push_index_;
+	return fibers_[begin].fiber.p_handle;
 }
 
-bool fiber_wait_list::try_pop(void*& p_out_fiber)
+// ----- fiber_wait_table -----
+
+fiber_wait_table::fiber_wait_table(size_t bucket_count)
+	: buckets_(new bucket[next_power_of_two(bucket_count)]),
+	mask_(next_power_of_two(bucket_count) - 1)
+{
+	assert(bucket_count > 0);
+}
+
+bool fiber_wait_table::park(fiber_wait_record& record)
+{
+	assert(record.p_nodes);
+	assert(record.node_count > 0);
+
+	// +1 keeps the record from becoming ready while its nodes are being registered.
+	const size_t wait_count = (record.wait_all) ? record.node_count : 1;
+	record.ready_index.store(fiber_wait_record::no_index, std::memory_order_relaxed);
+	record.remaining_count.store(int64_t(wait_count) + 1, std::memory_order_relaxed);
+
+	for (size_t i = 0; i < record.node_count; ++i) {
+		fiber_wait_node& node = record.p_nodes[i];
+		assert(node.p_wait_counter);
+		assert(!node.linked);
+		node.p_record = &record;
+
+		bucket& b = bucket_of(node.p_wait_counter);
+		std::unique_lock<std::mutex> lock(b.mutex);
+
+		// node_count is incremented before the counter is checked. notify decrements the counter
+		// before it checks node_count, so one of them always sees the other.
+		b.node_count.fetch_add(1);
+		if (node.p_wait_counter->load() > 0) {
+			node.p_prev = nullptr;
+			node.p_next = b.p_head;
+			if (b.p_head) b.p_head->p_prev = &node;
+			b.p_head = &node;
+			node.linked = true;
+			continue;
+		}
+
+		b.node_count.fetch_sub(1);
+		lock.unlock();
+		satisfy(node);
+
+		// there is no point in registering the rest of the nodes.
+		if (!record.wait_all) break;
+	}
+
+	return (record.remaining_count.fetch_sub(1, std::memory_order_acq_rel) == 1);
+}
+
+fiber_wait_record* fiber_wait_table::notify(const std::atomic_size_t* p_wait_counter)
 {
-	std::lock_guard<std::mutex> lock(mutex_);
-	if (push_index_ == 0) return false;
+	assert(p_wait_counter);
 
-	for (size_t i = push_index_; i > 0; --i) {
-		list_entry& e = wait_list_[i - 1];
-		if (*e.p_wait_counter > 0) continue;
+	bucket& b = bucket_of(p_wait_counter);
+	if (b.node_count.load() == 0) return nullptr;
 
-		// remove i - 1 fiber from the list
-		p_out_fiber = e.p_fiber;
-		e.p_fiber = nullptr;
-		e.p_wait_counter = nullptr;
+	fiber_wait_record* p_ready_list = nullptr;
+	std::lock_guard<std::mutex> lock(b.mutex);
 
-		if (i != push_index_)
-			std::swap(e, wait_list_[push_index_ - 1]);
+	// A notifier may be delayed between the decrement and the notify. Meanwhile the counter can be re-armed
+	// (a spawn with the same counter or a new counter at the same address) and waited for again:
+	// the nodes belong to the new wait then and stay linked. park checks the counter under the same lock.
+	if (p_wait_counter->load() != 0) return nullptr;
 
-		--push_index_;
-		return true;
+	fiber_wait_node* p_node = b.p_head;
+	while (p_node) {
+		fiber_wait_node* p_next = p_node->p_next;
+
+		if (p_node->p_wait_counter == p_wait_counter) {
+			if (p_node->p_prev) p_node->p_prev->p_next = p_next;
+			else b.p_head = p_next;
+			if (p_next) p_next->p_prev = p_node->p_prev;
+			p_node->linked = false;
+			b.node_count.fetch_sub(1, std::memory_order_relaxed);
+
+			if (satisfy(*p_node)) {
+				fiber_wait_record* p_record = p_node->p_record;
+				p_record->p_next = p_ready_list;
+				p_ready_list = p_record;
+			}
+		}
+
+		p_node = p_next;
 	}
 
-	return false;
+	return p_ready_list;
+}
+
+void fiber_wait_table::unpark(fiber_wait_record& record)
+{
+	for (size_t i = 0; i < record.node_count; ++i) {
+		fiber_wait_node& node = record.p_nodes[i];
+
+		bucket& b = bucket_of(node.p_wait_counter);
+		std::lock_guard<std::mutex> lock(b.mutex);
+		if (!node.linked) continue;
+
+		if (node.p_prev) node.p_prev->p_next = node.p_next;
+		else b.p_head = node.p_next;
+		if (node.p_next) node.p_next->p_prev = node.p_prev;
+		node.linked = false;
+		b.node_count.fetch_sub(1, std::memory_order_relaxed);
+	}
+}
+
+bool fiber_wait_table::satisfy(fiber_wait_node& node) noexcept
+{
+	fiber_wait_record& record = *node.p_record;
+
+	size_t no_index = fiber_wait_record::no_index;
+	record.ready_index.compare_exchange_strong(no_index, size_t(&node - record.p_nodes),
+		std::memory_order_relaxed);
+
+	// wait any: the counter goes below zero if several nodes are satisfied, only 1 -> 0 matters.
+	return (record.remaining_count.fetch_sub(1, std::memory_order_acq_rel) == 1);
+}
+
+fiber_wait_table::bucket& fiber_wait_table::bucket_of(const std::atomic_size_t* p_wait_counter) noexcept
+{
+	// Fibonacci hashing of the address.
+	const uint64_t h = uint64_t(reinterpret_cast<uintptr_t>(p_wait_counter)) * 11400714819323198485ull;
+	return buckets_[size_t(h >> 32) & mask_];
 }
 
 // ----- thread_fiber_nature -----
 
+#ifdef _WIN32
+
 thread_fiber_nature::thread_fiber_nature()
 	: p_handle(ConvertThreadToFiber(GetCurrentThread()))
 {
@@ -149,6 +650,24 @@ thread_fiber_nature::~thread_fiber_nature()
 	ConvertFiberToThread();
 }
 
+#else
+
+thread_fiber_nature::thread_fiber_nature()
+	: p_handle(new fiber_context())
+{
+	assert(!p_current_fiber_context);
+	p_current_fiber_context = static_cast<fiber_context*>(p_handle);
+}
+
+thread_fiber_nature::~thread_fiber_nature()
+{
+	assert(p_current_fiber_context == p_handle);
+	p_current_fiber_context = nullptr;
+	delete static_cast<fiber_context*>(p_handle);
+}
+
+#endif // _WIN32
+
 // ----- funcs -----
 
 std::ostream& operator<<(std::ostream& o, const fiber& f)
@@ -163,6 +682,43 @@ std::wostream& operator<<(std::wostream& o, const fiber& f)
 	return o;
 }
 
+#ifdef _WIN32
+
+void release_fiber_stack(void* p_fbr) noexcept
+{
+	assert(p_fbr);
+	(void)p_fbr;
+}
+
+#else
+
+void release_fiber_stack(void* p_fbr) noexcept
+{
+	assert(p_fbr);
+
+	fiber_context* p_ctx = static_cast<fiber_context*>(p_fbr);
+	assert(p_ctx != p_current_fiber_context);
+	if (!p_ctx->p_stack) return;
+
+	// the guard page is not a part of the stack.
+	const size_t page_size = page_byte_count();
+	char* p_first_page = static_cast<char*>(p_ctx->p_stack) + page_size;
+	char* p_sp_page = reinterpret_cast<char*>(uintptr_t(p_ctx->p_stack_pointer) & ~uintptr_t(page_size - 1));
+	if (p_sp_page > p_first_page)
+		madvise(p_first_page, size_t(p_sp_page - p_first_page), MADV_DONTNEED);
+}
+
+#endif // _WIN32
+
+size_t fiber_stack_byte_count(size_t stack_byte_count) noexcept
+{
+	const size_t page_size = page_byte_count();
+	stack_byte_count = std::max(stack_byte_count, fiber_min_stack_byte_count);
+	return (stack_byte_count + page_size - 1) / page_size * page_size;
+}
+
+#ifdef _WIN32
+
 void* current_fiber()
 {
 	return GetCurrentFiber();
@@ -179,4 +735,70 @@ void switch_to_fiber(void* p_fbr) noexcept
 	SwitchToFiber(p_fbr);
 }
 
+size_t current_fiber_stack_usage()
+{
+	// The TIB is switched along with the fiber. The stack grows by moving its guard page down,
+	// StackLimit is the lowest committed address.
+	const NT_TIB* p_tib = reinterpret_cast<const NT_TIB*>(NtCurrentTeb());
+	return size_t(static_cast<const char*>(p_tib->StackBase) - static_cast<const char*>(p_tib->StackLimit));
+}
+
+#else
+
+void* current_fiber()
+{
+	return p_current_fiber_context;
+}
+
+void* fiber_data()
+{
+	assert(p_current_fiber_context);
+	return p_current_fiber_context->p_data;
+}
+
+void switch_to_fiber(void* p_fbr) noexcept
+{
+	assert(p_fbr);
+	assert(p_current_fiber_context);
+
+	fiber_context* p_from = p_current_fiber_context;
+	fiber_context* p_to = static_cast<fiber_context*>(p_fbr);
+	if (p_from == p_to) return;
+
+	p_current_fiber_context = p_to;
+	ts_switch_context(&p_from->p_stack_pointer, p_to->p_stack_pointer);
+}
+
+size_t current_fiber_stack_usage()
+{
+	const fiber_context* p_ctx = p_current_fiber_context;
+	if (!p_ctx || !p_ctx->p_stack) return 0;
+
+	// Stack pages are committed on first touch, so the lowest resident page is the watermark.
+	// The pages above the guard page are scanned upwards a chunk at a time, it is called after every task.
+	constexpr size_t chunk_page_count = 256;
+#ifdef __APPLE__
+	char residency[chunk_page_count];
+#else
+	unsigned char residency[chunk_page_count];
+#endif
+
+	const size_t page_size = page_byte_count();
+	const size_t page_count = p_ctx->stack_byte_count / page_size - 1;
+	char* p_first_page = static_cast<char*>(p_ctx->p_stack) + page_size;
+
+	for (size_t offset = 0; offset < page_count; offset += chunk_page_count) {
+		const size_t count = std::min(chunk_page_count, page_count - offset);
+		if (mincore(p_first_page + offset * page_size, count * page_size, residency) != 0) return 0;
+
+		for (size_t i = 0; i < count; ++i) {
+			if (residency[i] & 1) return (page_count - offset - i) * page_size;
+		}
+	}
+
+	return 0;
+}
+
+#endif // _WIN32
+
 } // namespace ts
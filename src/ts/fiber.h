@@ -1,20 +1,30 @@
 #ifndef TS_FIBER_H_
 #define TS_FIBER_H_
 
+#include <cstdint>
 #include <atomic>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <vector>
+#include "ts/utility.h"
 
 
 namespace ts {
 
 using fiber_func_t = void(*)(void*);
 
+// The smallest stack a fiber gets whatever size is requested.
+constexpr size_t fiber_min_stack_byte_count = 64 * 1024;
+
+// A fiber's stack is reserved at once and committed page by page on first touch.
+// A guard page below the stack turns an overflow into an access violation instead of memory corruption.
 struct fiber final {
 	fiber() noexcept = default;
 
-	fiber(fiber_func_t func, size_t stack_byte_count, void* p_data = nullptr);
+	// huge_pages asks the OS to back the stack with transparent huge pages (Linux only),
+	// it pays off for stacks of several megabytes.
+	fiber(fiber_func_t func, size_t stack_byte_count, void* p_data = nullptr, bool huge_pages = false);
 
 	fiber(fiber&& fbr) noexcept;
 	fiber& operator=(fiber&& fbr) noexcept;
@@ -29,10 +39,22 @@ struct fiber final {
 };
 
 // The only source of fiber objects.
+// Free fibers are kept in a lock-free stack (Treiber stack) whose head is tagged to avoid ABA.
+// A pool may also have several small caches, each of them is meant to be used by one thread
+// (see cache_index parameters). A cache is accessed without contention unless the shared stack is empty
+// and other threads take fibers from it. push_back and pop take constant time unless the pool grows.
+//
+// Fibers are created on demand, chunk_size of them at a time, fiber_count at most. The first chunk is
+// created by the constructor, chunk_size == 0 creates all the fibers right away.
 class fiber_pool final {
 public:
 
-	fiber_pool(size_t fiber_count, void (*func)(void*), size_t stack_byte_count, void* p_data = nullptr);
+	// The number of fibers a cache holds.
+	static constexpr size_t cache_size = 4;
+
+
+	fiber_pool(size_t fiber_count, void (*func)(void*), size_t stack_byte_count, void* p_data = nullptr,
+		size_t cache_count = 0, bool huge_pages = false, size_t chunk_size = 0);
 
 	fiber_pool(fiber_pool&&) = delete;
 	fiber_pool& operator=(fiber_pool&&) = delete;
@@ -42,50 +64,178 @@ public:
 	// asserts if the specified pointer is not a fiber from the pool.
 	void push_back(void* p_fbr);
 
+	// Puts back the specified fiber object into the cache if there is room for it.
+	// Only one thread may use the cache.
+	void push_back(void* p_fbr, size_t cache_index);
+
 	// Returns a pointer to a fiber object or nullptr if there are no fibers left.
 	void* pop();
 
+	// Takes a fiber from the cache first, then from the shared stack and from other caches at last.
+	// Only one thread may use the cache.
+	void* pop(size_t cache_index);
+
+	// Gives the unused stack pages of the free fibers back to the OS, see release_fiber_stack.
+	// Any thread may call it at any time, a fiber which is being trimmed is popped once it is done.
+	void trim();
+
+	// The number of fibers created so far.
+	size_t created_count() const noexcept
+	{
+		return created_count_.load(std::memory_order_relaxed);
+	}
 
 private:
 
+	static constexpr uint32_t no_index = uint32_t(-1);
+
+	enum entry_state : uint8_t {
+		entry_free,
+		entry_in_use,
+		entry_trimming
+	};
+
 	struct list_entry final {
-		fiber fiber;
-		bool in_use = false;
+		ts::fiber				fiber;
+		std::atomic<uint32_t>	next_index;
+		std::atomic<uint8_t>	state;
+
+		// The fiber's stack has been trimmed since it was used last time.
+		// Written by the thread which has moved the entry out of entry_free.
+		// trim also reads it without holding the entry, to skip trimmed entries cheaply.
+		std::atomic_bool		trimmed { false };
+	};
+
+	struct alignas(cache_line_byte_count) cache final {
+		// A slot is either no_index or an index of a free fiber.
+		// The owner stores indices into empty slots only, anybody may exchange a slot with no_index.
+		std::atomic<uint32_t>	indices[cache_size];
 	};
 
 
-	std::vector<list_entry> fibers_;
-	std::mutex mutex_;
+	// Returns the index of the fiber entry, uses the handle table built by the constructor.
+	uint32_t index_of(void* p_fbr) const noexcept;
+
+	// Pushes the entry to the shared stack.
+	void push_entry(uint32_t index) noexcept;
+
+	// Pops an entry from the shared stack. Returns no_index if the stack is empty.
+	uint32_t pop_entry() noexcept;
+
+	// Marks the entry as used and returns its fiber.
+	void* acquire_entry(uint32_t index) noexcept;
+
+	// Creates the next chunk of fibers and returns one of them, the rest go to the shared stack.
+	// Returns nullptr if all the fibers have been created.
+	void* grow();
+
+
+	std::unique_ptr<list_entry[]>	fibers_;
+	size_t							fiber_count_;
+	size_t							chunk_size_;
+	std::atomic_size_t				created_count_;
+
+	// Open addressing hash table: fiber handle -> entry index. Slots are only added,
+	// a slot is written before its fiber is published.
+	std::unique_ptr<std::atomic<uint32_t>[]>	handle_table_;
+	size_t							handle_table_mask_;
+
+	std::unique_ptr<cache[]>		caches_;
+	size_t							cache_count_;
+
+	// Creation parameters of the fibers.
+	fiber_func_t					func_;
+	size_t							stack_byte_count_;
+	void*							p_data_;
+	bool							huge_pages_;
+	std::mutex						grow_mutex_;
+
+	// The lower 32 bits are the index of the top entry, the upper 32 bits are a tag which
+	// is incremented by every successful push and pop.
+	alignas(cache_line_byte_count) std::atomic<uint64_t> head_;
+};
+
+struct fiber_wait_record;
+
+// fiber_wait_node registers a waiting fiber on one wait counter.
+struct fiber_wait_node final {
+	const std::atomic_size_t*	p_wait_counter = nullptr;
+	fiber_wait_record*			p_record = nullptr;
+	fiber_wait_node*			p_prev = nullptr;
+	fiber_wait_node*			p_next = nullptr;
+	bool						linked = false;
+};
+
+// fiber_wait_record describes a fiber which waits for one or several wait counters.
+// Records and nodes usually live on the waiting fiber's stack. A record without a fiber belongs to
+// a task which is spawned when the record is ready, see ts::run_when_zero.
+struct fiber_wait_record final {
+	static constexpr size_t no_index = size_t(-1);
+
+
+	void*					p_fiber = nullptr;
+	void*					p_data = nullptr;
+	fiber_wait_node*		p_nodes = nullptr;
+	size_t					node_count = 0;
+
+	// true - the fiber is ready when all the counters are zero, false - when any of them is zero.
+	bool					wait_all = true;
+
+	// The index of the first node whose counter has been seen equal to zero.
+	std::atomic_size_t		ready_index = no_index;
+
+	// The number of counters the fiber still waits for, plus one while the record is being parked.
+	std::atomic<int64_t>	remaining_count = 0;
+
+	// Links ready records, see fiber_wait_table::notify.
+	fiber_wait_record*		p_next = nullptr;
 };
 
-class fiber_wait_list final {
+// fiber_wait_table is a hash table of waiting fibers keyed by wait counter addresses.
+// A fiber registers itself on the counters it waits for and becomes ready when the last of them
+// (or any of them) is notified. Only the bucket of the notified counter is locked and scanned,
+// so wakeup does not depend on the total number of waiting fibers.
+class fiber_wait_table final {
 public:
 
-	explicit fiber_wait_list(size_t fiber_count);
+	// bucket_count is rounded up to the next power of two.
+	explicit fiber_wait_table(size_t bucket_count);
+
+	fiber_wait_table(fiber_wait_table&&) = delete;
+	fiber_wait_table& operator=(fiber_wait_table&&) = delete;
 
-	fiber_wait_list(fiber_wait_list&&) = delete;
-	fiber_wait_list& operator=(fiber_wait_list&&) = delete;
 
+	// Registers the record's nodes on their counters. Returns true if the record is ready right away,
+	// in this case the caller keeps executing the fiber. Otherwise the record becomes ready in notify.
+	// The fiber must not be executed anywhere until the record is ready.
+	bool park(fiber_wait_record& record);
 
-	// Puts the given pair of a fiber and its wait counter to the underlying list.
-	// Does not check whether the specified fiber is already in the list.
-	void push(void* p_fiber, const std::atomic_size_t* p_wait_counter);
+	// Must be called after a wait counter has been decremented to zero.
+	// Returns the list (linked by p_next) of records which have become ready.
+	// Nothing is notified if the counter is not zero anymore.
+	fiber_wait_record* notify(const std::atomic_size_t* p_wait_counter);
 
-	// Iterates over the wait list searching for a fiber whose wait counter equals to zero.
-	// Returns true if such a fiber has been found, p_out_fiber will store the value.
-	bool try_pop(void*& p_out_fiber);
+	// Removes the nodes of a ready record which are still registered (wait any).
+	// Must be called before the record is destroyed.
+	void unpark(fiber_wait_record& record);
 
 private:
 
-	struct list_entry final {
-		void*						p_fiber = nullptr;
-		const std::atomic_size_t*	p_wait_counter = nullptr;
+	struct alignas(cache_line_byte_count) bucket final {
+		std::mutex				mutex;
+		fiber_wait_node*		p_head = nullptr;
+		std::atomic_size_t		node_count = 0;
 	};
 
 
-	std::vector<list_entry>	wait_list_;
-	std::mutex				mutex_;
-	size_t					push_index_ = 0;
+	// Marks the node's counter as zero. Returns true if the node's record has become ready.
+	static bool satisfy(fiber_wait_node& node) noexcept;
+
+	bucket& bucket_of(const std::atomic_size_t* p_wait_counter) noexcept;
+
+
+	std::unique_ptr<bucket[]>	buckets_;
+	size_t						mask_;
 };
 
 // thread_fiber_nature object makes it possible to execute fibers inside the current thread.
@@ -116,6 +266,21 @@ inline T* fiber_data()
 
 void switch_to_fiber(void* p_fbr) noexcept;
 
+// Returns the size of the stack a fiber created with the specified stack_byte_count gets:
+// at least fiber_min_stack_byte_count, rounded up to whole pages.
+size_t fiber_stack_byte_count(size_t stack_byte_count) noexcept;
+
+// Gives the stack pages of a suspended fiber which lie below its stack pointer back to the OS
+// (madvise MADV_DONTNEED). The fiber must not be running. Does nothing on Win32, the stack of
+// a suspended fiber is not exposed there.
+void release_fiber_stack(void* p_fbr) noexcept;
+
+// Returns the peak stack usage of the current fiber: the distance from the top of the stack to the lowest
+// page which has ever been touched. Returns 0 on posix platforms if the current fiber is a thread_fiber_nature.
+// On posix platforms residency tells the touched pages: the result is meaningless for a stack
+// backed by transparent huge pages, a huge page is resident as a whole.
+size_t current_fiber_stack_usage();
+
 } // namespace ts
 
 #endif // TS_FIBER_H_
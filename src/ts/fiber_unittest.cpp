@@ -1,17 +1,72 @@
 #include "ts/fiber.h"
 
+#include <algorithm>
+#include <thread>
+#include <vector>
 #include "CppUnitTest.h"
 
 using ts::fiber;
 using ts::fiber_pool;
-using ts::fiber_wait_list;
+using ts::fiber_wait_node;
+using ts::fiber_wait_record;
+using ts::fiber_wait_table;
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 
 
 namespace {
 
+struct switch_payload final {
+	void*	p_origin_fiber = nullptr;
+	void*	p_current_fiber = nullptr;
+	void*	p_fiber_data = nullptr;
+	size_t	switch_count = 0;
+};
+
+struct stack_usage_payload final {
+	void*	p_origin_fiber = nullptr;
+	size_t	touched_byte_count = 0;
+	size_t	stack_usage = 0;
+};
+
 void fiber_func(void*) { /* noop */ }
 
+// Touches at least byte_count bytes of the stack, 4Kb per frame.
+void touch_stack(size_t byte_count)
+{
+	volatile char buffer[4096];
+	buffer[0] = 0;
+	if (byte_count > sizeof(buffer))
+		touch_stack(byte_count - sizeof(buffer));
+
+	// keeps the recursive call from becoming a jump.
+	buffer[1] = 0;
+}
+
+void stack_usage_fiber_func(void* p_data)
+{
+	stack_usage_payload* p_payload = static_cast<stack_usage_payload*>(p_data);
+
+	while (true) {
+		touch_stack(p_payload->touched_byte_count);
+		p_payload->stack_usage = ts::current_fiber_stack_usage();
+
+		ts::switch_to_fiber(p_payload->p_origin_fiber);
+	}
+}
+
+void switch_fiber_func(void* p_data)
+{
+	switch_payload* p_payload = static_cast<switch_payload*>(p_data);
+
+	while (true) {
+		p_payload->p_current_fiber = ts::current_fiber();
+		p_payload->p_fiber_data = ts::fiber_data();
+		++p_payload->switch_count;
+
+		ts::switch_to_fiber(p_payload->p_origin_fiber);
+	}
+}
+
 } // namespace
 
 
@@ -47,6 +102,67 @@ public:
 		f.dispose();
 		Assert::IsNull(f.p_handle);
 	}
+
+	TEST_METHOD(stack_byte_count)
+	{
+		Assert::AreEqual(ts::fiber_min_stack_byte_count, ts::fiber_stack_byte_count(128));
+
+		const size_t byte_count = ts::fiber_stack_byte_count(ts::fiber_min_stack_byte_count + 1);
+		Assert::IsTrue(byte_count > ts::fiber_min_stack_byte_count);
+		Assert::AreEqual(size_t(0), byte_count % 4096);
+	}
+
+	TEST_METHOD(stack_usage)
+	{
+		ts::thread_fiber_nature tfn;
+
+		stack_usage_payload small_payload;
+		small_payload.p_origin_fiber = tfn.p_handle;
+		small_payload.touched_byte_count = 4 * 1024;
+
+		stack_usage_payload large_payload;
+		large_payload.p_origin_fiber = tfn.p_handle;
+		large_payload.touched_byte_count = 256 * 1024;
+
+		const size_t stack_byte_count = 1024 * 1024;
+		fiber small_fiber(stack_usage_fiber_func, stack_byte_count, &small_payload);
+		fiber large_fiber(stack_usage_fiber_func, stack_byte_count, &large_payload);
+		ts::switch_to_fiber(small_fiber.p_handle);
+		ts::switch_to_fiber(large_fiber.p_handle);
+
+		Assert::IsTrue(small_payload.stack_usage > 0);
+		Assert::IsTrue(small_payload.stack_usage < 64 * 1024);
+		Assert::IsTrue(large_payload.stack_usage >= 256 * 1024);
+		Assert::IsTrue(large_payload.stack_usage <= ts::fiber_stack_byte_count(stack_byte_count));
+
+		// the watermark does not go down
+		large_payload.touched_byte_count = 0;
+		ts::switch_to_fiber(large_fiber.p_handle);
+		Assert::IsTrue(large_payload.stack_usage >= 256 * 1024);
+	}
+};
+
+TEST_CLASS(fiber_funcs) {
+public:
+
+	TEST_METHOD(switch_to_fiber)
+	{
+		ts::thread_fiber_nature tfn;
+		Assert::AreEqual(tfn.p_handle, ts::current_fiber());
+
+		switch_payload payload;
+		payload.p_origin_fiber = tfn.p_handle;
+		fiber f(switch_fiber_func, 1024, &payload);
+
+		// each switch resumes the fiber right after its previous switch back to the thread.
+		for (size_t i = 1; i <= 3; ++i) {
+			ts::switch_to_fiber(f.p_handle);
+			Assert::AreEqual(tfn.p_handle, ts::current_fiber());
+			Assert::AreEqual(f.p_handle, payload.p_current_fiber);
+			Assert::AreEqual<void*>(&payload, payload.p_fiber_data);
+			Assert::AreEqual(i, payload.switch_count);
+		}
+	}
 };
 
 TEST_CLASS(fiber_fiber_pool) {
@@ -79,64 +195,241 @@ public:
 		void* f5 = fiber_pool.pop();
 		Assert::IsNull(f5);
 	}
+
+	TEST_METHOD(grow)
+	{
+		// 10 fibers at most, 4 at a time
+		fiber_pool fiber_pool(10, fiber_func, 64 * 1024, nullptr, 1, false, 4);
+		Assert::AreEqual(size_t(4), fiber_pool.created_count());
+
+		std::vector<void*> fibers;
+		for (size_t i = 0; i < 4; ++i)
+			fibers.push_back(fiber_pool.pop(0));
+		Assert::AreEqual(size_t(4), fiber_pool.created_count());
+
+		fibers.push_back(fiber_pool.pop(0));
+		Assert::AreEqual(size_t(8), fiber_pool.created_count());
+
+		while (void* p_fiber = fiber_pool.pop())
+			fibers.push_back(p_fiber);
+		Assert::AreEqual(size_t(10), fiber_pool.created_count());
+		Assert::AreEqual(size_t(10), fibers.size());
+		Assert::IsNull(fiber_pool.pop(0));
+
+		std::sort(fibers.begin(), fibers.end());
+		Assert::IsTrue(std::unique(fibers.begin(), fibers.end()) == fibers.end());
+
+		// the pool does not grow while there are free fibers
+		for (void* p_fiber : fibers)
+			fiber_pool.push_back(p_fiber, 0);
+		for (size_t i = 0; i < fibers.size(); ++i)
+			Assert::IsNotNull(fiber_pool.pop(0));
+		Assert::AreEqual(size_t(10), fiber_pool.created_count());
+	}
+
+	TEST_METHOD(trim)
+	{
+		ts::thread_fiber_nature tfn;
+
+		stack_usage_payload payload;
+		payload.p_origin_fiber = tfn.p_handle;
+		payload.touched_byte_count = 256 * 1024;
+
+		fiber_pool fiber_pool(2, stack_usage_fiber_func, 1024 * 1024, &payload);
+		void* p_fiber = fiber_pool.pop();
+		ts::switch_to_fiber(p_fiber);
+		Assert::IsTrue(payload.stack_usage >= 256 * 1024);
+
+		fiber_pool.push_back(p_fiber);
+		fiber_pool.trim();
+		fiber_pool.trim();
+
+		// the trimmed fiber goes on where it has stopped
+		payload.touched_byte_count = 0;
+		payload.stack_usage = 0;
+		Assert::AreEqual(p_fiber, fiber_pool.pop());
+		ts::switch_to_fiber(p_fiber);
+		Assert::IsTrue(payload.stack_usage > 0);
+#ifndef _WIN32
+		Assert::IsTrue(payload.stack_usage < 256 * 1024);
+#endif
+		fiber_pool.push_back(p_fiber);
+	}
+
+	TEST_METHOD(push_back_pop_caches)
+	{
+		fiber_pool fiber_pool(fiber_pool::cache_size + 2, fiber_func, 128, nullptr, 2);
+
+		std::vector<void*> fibers;
+		for (size_t i = 0; i < fiber_pool::cache_size + 2; ++i) {
+			void* f = fiber_pool.pop(0);
+			Assert::IsNotNull(f);
+			fibers.push_back(f);
+		}
+		Assert::IsNull(fiber_pool.pop(0));
+
+		// the cache takes cache_size fibers, the rest go to the shared stack.
+		for (void* f : fibers)
+			fiber_pool.push_back(f, 0);
+
+		// the most recently pushed fiber is in the shared stack
+		Assert::AreEqual(fibers.back(), fiber_pool.pop());
+
+		// a fiber in the cache goes first.
+		void* f0 = fiber_pool.pop(0);
+		Assert::AreEqual(fibers[0], f0);
+
+		// cache #1 is empty, the rest of the fibers are taken from the shared stack and from cache #0.
+		for (size_t i = 0; i < fiber_pool::cache_size; ++i)
+			Assert::IsNotNull(fiber_pool.pop(1));
+
+		Assert::IsNull(fiber_pool.pop(1));
+		Assert::IsNull(fiber_pool.pop());
+	}
+
+	TEST_METHOD(push_back_pop_several_threads)
+	{
+		const size_t thread_count = 4;
+		const size_t fiber_count = 16;
+		fiber_pool fiber_pool(fiber_count, fiber_func, 128, nullptr, thread_count);
+
+		auto thread_func = [&fiber_pool](size_t cache_index) {
+			void* fibers[fiber_count / thread_count];
+			for (size_t rep = 0; rep < 10000; ++rep) {
+				size_t count = 0;
+				for (void*& f : fibers) {
+					f = (rep % 2) ? fiber_pool.pop(cache_index) : fiber_pool.pop();
+					if (f) ++count;
+				}
+
+				for (size_t i = 0; i < count; ++i) {
+					if (rep % 3) fiber_pool.push_back(fibers[i], cache_index);
+					else fiber_pool.push_back(fibers[i]);
+				}
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < thread_count; ++i)
+			threads.emplace_back(thread_func, i);
+		for (auto& t : threads)
+			t.join();
+
+		// all the fibers are back
+		std::vector<void*> fibers;
+		while (void* f = fiber_pool.pop(0))
+			fibers.push_back(f);
+
+		std::sort(fibers.begin(), fibers.end());
+		Assert::AreEqual(fiber_count, fibers.size());
+		Assert::IsTrue(std::unique(fibers.begin(), fibers.end()) == fibers.end());
+	}
 };
 
-TEST_CLASS(task_system_fiber_wait_list) {
+TEST_CLASS(task_system_fiber_wait_table) {
 public:
 
-	TEST_METHOD(push_try_pop)
+	TEST_METHOD(park_notify_wait_all)
 	{
 		std::atomic_size_t wc1 = 1;
 		std::atomic_size_t wc2 = 2;
-		std::atomic_size_t wc3 = 3;
-		fiber_wait_list wait_list(3);
+		std::atomic_size_t wc3 = 0;
+		fiber_wait_table wait_table(4);
 
-		// Try pop from empty wait list
-		void* p_fiber = nullptr;
-		Assert::IsFalse(wait_list.try_pop(p_fiber));
-		Assert::IsNull(p_fiber);
+		// The test does not use real fibers.
+		fiber_wait_node nodes[3];
+		nodes[0].p_wait_counter = &wc1;
+		nodes[1].p_wait_counter = &wc2;
+		nodes[2].p_wait_counter = &wc3;
 
-		// Populate the wait list. The test does not use real fibers.
-		wait_list.push(&wc1, &wc1);
-		wait_list.push(&wc2, &wc2);
-		wait_list.push(&wc3, &wc3);
+		fiber_wait_record record;
+		record.p_fiber = &record;
+		record.p_nodes = nodes;
+		record.node_count = 3;
+		record.wait_all = true;
 
-		// All the wait counters are greater than zero.
-		p_fiber = nullptr;
-		Assert::IsFalse(wait_list.try_pop(p_fiber));
-		Assert::IsNull(p_fiber);
+		// wc3 is already zero, the others are not.
+		Assert::IsFalse(wait_table.park(record));
+		Assert::IsTrue(nodes[0].linked);
+		Assert::IsTrue(nodes[1].linked);
+		Assert::IsFalse(nodes[2].linked);
+		Assert::AreEqual<size_t>(2, record.ready_index);
+
+		// notification of a counter nobody waits for
+		std::atomic_size_t wc_other = 0;
+		Assert::IsNull(wait_table.notify(&wc_other));
 
-		// get back wc1
 		--wc1;
-		Assert::AreEqual<size_t>(0, wc1);
-		Assert::IsTrue(wait_list.try_pop(p_fiber));
-		Assert::AreEqual<void*>(p_fiber, &wc1);
+		Assert::IsNull(wait_table.notify(&wc1));
+		Assert::IsFalse(nodes[0].linked);
+
+		wc2 = 0;
+		fiber_wait_record* p_ready = wait_table.notify(&wc2);
+		Assert::IsTrue(p_ready == &record);
+		Assert::IsNull(p_ready->p_next);
+		Assert::IsFalse(nodes[1].linked);
+
+		// the record is not registered anymore
+		Assert::IsNull(wait_table.notify(&wc2));
+	}
+
+	TEST_METHOD(park_notify_wait_any)
+	{
+		std::atomic_size_t wc1 = 1;
+		std::atomic_size_t wc2 = 1;
+		fiber_wait_table wait_table(4);
+
+		fiber_wait_node nodes[2];
+		nodes[0].p_wait_counter = &wc1;
+		nodes[1].p_wait_counter = &wc2;
+
+		fiber_wait_record record;
+		record.p_fiber = &record;
+		record.p_nodes = nodes;
+		record.node_count = 2;
+		record.wait_all = false;
+
+		Assert::IsFalse(wait_table.park(record));
 
-		// get back wc2
-		p_fiber = nullptr;
-		--wc2;
-		Assert::AreEqual<size_t>(1, wc2);
-		Assert::IsFalse(wait_list.try_pop(p_fiber));
-		Assert::IsNull(p_fiber);
 		--wc2;
-		Assert::AreEqual<size_t>(0, wc2);
-		Assert::IsTrue(wait_list.try_pop(p_fiber));
-		Assert::AreEqual<void*>(p_fiber, &wc2);
-
-		// get back wc3;
-		p_fiber = nullptr;
-		--wc3;
-		Assert::AreEqual<size_t>(2, wc3);
-		Assert::IsFalse(wait_list.try_pop(p_fiber));
-		Assert::IsNull(p_fiber);
-		wc3 = 0;
-		Assert::IsTrue(wait_list.try_pop(p_fiber));
-		Assert::AreEqual<void*>(p_fiber, &wc3);
-
-		// The list is empty again
-		p_fiber = nullptr;
-		Assert::IsFalse(wait_list.try_pop(p_fiber));
-		Assert::IsNull(p_fiber);
+		Assert::IsTrue(wait_table.notify(&wc2) == &record);
+		Assert::AreEqual<size_t>(1, record.ready_index);
+
+		// unpark removes the node which is still registered
+		Assert::IsTrue(nodes[0].linked);
+		wait_table.unpark(record);
+		Assert::IsFalse(nodes[0].linked);
+
+		--wc1;
+		Assert::IsNull(wait_table.notify(&wc1));
+
+		// ready right away
+		Assert::IsTrue(wait_table.park(record));
+		Assert::AreEqual<size_t>(0, record.ready_index);
+		wait_table.unpark(record);
+	}
+
+	TEST_METHOD(notify_several_records)
+	{
+		std::atomic_size_t wc = 1;
+		fiber_wait_table wait_table(1);
+
+		fiber_wait_node nodes[3];
+		fiber_wait_record records[3];
+		for (size_t i = 0; i < 3; ++i) {
+			nodes[i].p_wait_counter = &wc;
+			records[i].p_fiber = &records[i];
+			records[i].p_nodes = &nodes[i];
+			records[i].node_count = 1;
+			Assert::IsFalse(wait_table.park(records[i]));
+		}
+
+		--wc;
+		size_t ready_count = 0;
+		for (fiber_wait_record* p = wait_table.notify(&wc); p; p = p->p_next)
+			++ready_count;
+
+		Assert::AreEqual<size_t>(3, ready_count);
 	}
 };
 
@@ -0,0 +1,82 @@
+#include "ts/futex.h"
+
+#include <climits>
+
+#ifdef _WIN32
+	#include <windows.h>
+	#pragma comment(lib, "Synchronization.lib")
+#else
+	#include <linux/futex.h>
+	#include <time.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+#endif
+
+
+namespace {
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+	"std::atomic<uint32_t> must have the same representation as uint32_t.");
+
+inline void* address_of(const std::atomic<uint32_t>& value) noexcept
+{
+	return const_cast<std::atomic<uint32_t>*>(&value);
+}
+
+} // namespace
+
+
+namespace ts {
+
+#ifdef _WIN32
+
+void futex_wait(const std::atomic<uint32_t>& value, uint32_t expected_value) noexcept
+{
+	WaitOnAddress(address_of(value), &expected_value, sizeof(uint32_t), INFINITE);
+}
+
+void futex_wait_for(const std::atomic<uint32_t>& value, uint32_t expected_value, uint64_t timeout_ns) noexcept
+{
+	const uint64_t timeout_ms = (timeout_ns + 999999) / 1000000;
+	const DWORD ms = (timeout_ms < INFINITE) ? DWORD(timeout_ms) : INFINITE - 1;
+	WaitOnAddress(address_of(value), &expected_value, sizeof(uint32_t), ms);
+}
+
+void futex_wake_one(const std::atomic<uint32_t>& value) noexcept
+{
+	WakeByAddressSingle(address_of(value));
+}
+
+void futex_wake_all(const std::atomic<uint32_t>& value) noexcept
+{
+	WakeByAddressAll(address_of(value));
+}
+
+#else
+
+void futex_wait(const std::atomic<uint32_t>& value, uint32_t expected_value) noexcept
+{
+	syscall(SYS_futex, address_of(value), FUTEX_WAIT_PRIVATE, expected_value, nullptr, nullptr, 0);
+}
+
+void futex_wait_for(const std::atomic<uint32_t>& value, uint32_t expected_value, uint64_t timeout_ns) noexcept
+{
+	timespec timeout;
+	timeout.tv_sec = time_t(timeout_ns / 1000000000);
+	timeout.tv_nsec = long(timeout_ns % 1000000000);
+	syscall(SYS_futex, address_of(value), FUTEX_WAIT_PRIVATE, expected_value, &timeout, nullptr, 0);
+}
+
+void futex_wake_one(const std::atomic<uint32_t>& value) noexcept
+{
+	syscall(SYS_futex, address_of(value), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+
+void futex_wake_all(const std::atomic<uint32_t>& value) noexcept
+{
+	syscall(SYS_futex, address_of(value), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
+
+#endif // _WIN32
+
+} // namespace ts
@@ -0,0 +1,30 @@
+#ifndef TS_FUTEX_H_
+#define TS_FUTEX_H_
+
+#include <cstdint>
+#include <atomic>
+
+
+namespace ts {
+
+// futex_wait/futex_wake_* are thin wrappers over the OS address based wait primitives
+// (futex on Linux, WaitOnAddress on Windows). They are slow paths of blocking operations,
+// fast paths must never call them.
+
+// Blocks the calling thread if value == expected_value until a wake call for the same address.
+// Spurious wake ups are possible, the caller has to recheck its condition.
+void futex_wait(const std::atomic<uint32_t>& value, uint32_t expected_value) noexcept;
+
+// Same as futex_wait but returns after timeout_ns nanoseconds at the latest. The timeout is rounded up
+// to the resolution of the OS timer.
+void futex_wait_for(const std::atomic<uint32_t>& value, uint32_t expected_value, uint64_t timeout_ns) noexcept;
+
+// Wakes at most one thread blocked in futex_wait on the given address.
+void futex_wake_one(const std::atomic<uint32_t>& value) noexcept;
+
+// Wakes all the threads blocked in futex_wait on the given address.
+void futex_wake_all(const std::atomic<uint32_t>& value) noexcept;
+
+} // namespace ts
+
+#endif // TS_FUTEX_H_
@@ -0,0 +1,189 @@
+#include "ts/future.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "ts/unittest_utility.h"
+#include "CppUnitTest.h"
+
+using ts::future;
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+
+namespace {
+
+void async_get_kernel()
+{
+	future<int> f0 = ts::async([] { return 42; });
+	Assert::IsTrue(f0.valid());
+	Assert::AreEqual(42, f0.get());
+	Assert::IsFalse(f0.valid());
+
+	// move-only result
+	future<std::unique_ptr<std::string>> f1 = ts::async([] { return std::make_unique<std::string>("abc"); },
+		ts::task_priority::high);
+	Assert::AreEqual(std::string("abc"), *f1.get());
+
+	// void result
+	int v = 0;
+	future<void> f2 = ts::async([&v] { v = 24; });
+	f2.get();
+	Assert::AreEqual(24, v);
+
+	// the exception goes to get()
+	future<int> f3 = ts::async([]() -> int { throw std::runtime_error("error"); });
+	bool thrown = false;
+	try {
+		f3.get();
+	}
+	catch (const std::runtime_error&) {
+		thrown = true;
+	}
+	Assert::IsTrue(thrown);
+
+	// a future can be dropped before its task completes
+	std::atomic_int done_count(0);
+	ts::async([&done_count] { ++done_count; });
+
+	// wait_any along with other counters
+	future<int> f4 = ts::async([] { return 1; });
+	Assert::AreEqual(size_t(0), ts::wait_any({ &f4.wait_counter() }));
+	Assert::IsTrue(f4.is_ready());
+
+	// many futures in flight
+	std::vector<future<size_t>> futures;
+	for (size_t i = 0; i < 200; ++i)
+		futures.push_back(ts::async([i] { return i * i; }));
+
+	for (size_t i = 0; i < futures.size(); ++i)
+		Assert::AreEqual(i * i, futures[i].get());
+
+	while (done_count == 0)
+		ts::async([] {}).get();
+}
+
+// Future states are pooled: the state of the next future usually takes the address of the previous one.
+// A late notify meant for the previous state must not resume get() on the next one.
+void pooled_async_get_kernel()
+{
+	constexpr size_t driver_count = 8;
+
+	ts::task_func drivers[driver_count];
+	for (size_t i = 0; i < driver_count; ++i) {
+		drivers[i] = [i] {
+			for (size_t k = 0; k < 1000; ++k) {
+				future<std::string> f = ts::async([i, k] { return std::to_string(i * 1000 + k); });
+
+				// every 16th get takes its fast path while the notify may still be on its way.
+				if (k % 16 == 0)
+					ts::sleep_for(std::chrono::microseconds(100));
+
+				Assert::AreEqual(std::to_string(i * 1000 + k), f.get());
+			}
+		};
+	}
+
+	std::atomic_size_t wait_counter;
+	ts::run(drivers, wait_counter);
+	ts::wait_for(wait_counter);
+}
+
+void then_kernel()
+{
+	future<std::string> f0 = ts::async([] { return 2; })
+		.then([](int v) { return v * 10; })
+		.then([](int v) { return std::to_string(v); });
+	Assert::AreEqual(std::string("20"), f0.get());
+
+	// a continuation of a ready future
+	future<int> f1 = ts::async([] { return 5; });
+	f1.wait();
+	Assert::AreEqual(6, f1.then([](int v) { return v + 1; }).get());
+
+	// void to value and value to void
+	int v = 0;
+	future<void> f2 = ts::async([] {})
+		.then([] { return 7; })
+		.then([&v](int r) { v = r; });
+	f2.get();
+	Assert::AreEqual(7, v);
+
+	// the exception skips the continuations
+	bool called = false;
+	future<int> f3 = ts::async([]() -> int { throw std::runtime_error("error"); })
+		.then([&called](int r) { called = true; return r; });
+
+	bool thrown = false;
+	try {
+		f3.get();
+	}
+	catch (const std::runtime_error&) {
+		thrown = true;
+	}
+	Assert::IsTrue(thrown);
+	Assert::IsFalse(called);
+}
+
+void when_all_kernel()
+{
+	std::vector<future<int>> futures;
+	for (int i = 0; i < 100; ++i)
+		futures.push_back(ts::async([i] { return i; }));
+
+	future<std::vector<future<int>>> all = ts::when_all(futures.begin(), futures.end());
+	std::vector<future<int>> results = all.get();
+
+	Assert::AreEqual(size_t(100), results.size());
+	for (int i = 0; i < 100; ++i) {
+		Assert::IsTrue(results[i].is_ready());
+		Assert::AreEqual(i, results[i].get());
+	}
+
+	// no futures
+	Assert::IsTrue(ts::when_all(std::vector<future<void>>()).get().empty());
+
+	// a continuation of when_all
+	std::vector<future<void>> voids;
+	std::atomic_int count(0);
+	for (int i = 0; i < 10; ++i)
+		voids.push_back(ts::async([&count] { ++count; }));
+
+	const int total = ts::when_all(std::move(voids))
+		.then([&count](std::vector<future<void>>) { return count.load(); })
+		.get();
+	Assert::AreEqual(10, total);
+}
+
+} // namespace
+
+
+namespace unittest {
+
+TEST_CLASS(future_future) {
+public:
+
+	TEST_METHOD(async_get)
+	{
+		run_kernel_for_thread_counts(async_get_kernel);
+	}
+
+	TEST_METHOD(pooled_async_get)
+	{
+		run_kernel_for_thread_counts(pooled_async_get_kernel);
+	}
+
+	TEST_METHOD(then)
+	{
+		run_kernel_for_thread_counts(then_kernel);
+	}
+
+	TEST_METHOD(when_all)
+	{
+		run_kernel_for_thread_counts(when_all_kernel);
+	}
+};
+
+} // namespace unittest
@@ -0,0 +1,292 @@
+#include "ts/lock_free_queue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <numeric>
+#include <thread>
+#include <vector>
+#include "CppUnitTest.h"
+
+using ts::lock_free_queue;
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+
+namespace unittest {
+
+TEST_CLASS(lock_free_queue_lock_free_queue) {
+public:
+
+	TEST_METHOD(ctors)
+	{
+		lock_free_queue<int> queue(4);
+		Assert::IsTrue(queue.empty());
+		Assert::AreEqual<size_t>(0, queue.size());
+		Assert::AreEqual<size_t>(4, queue.size_limit());
+		Assert::IsTrue(queue.wait_allowed());
+
+		// size_limit is rounded up to a power of two
+		lock_free_queue<int> queue_5(5);
+		Assert::AreEqual<size_t>(8, queue_5.size_limit());
+	}
+
+	TEST_METHOD(dtor)
+	{
+		std::shared_ptr<int> p = std::make_shared<int>(42);
+
+		{
+			lock_free_queue<std::shared_ptr<int>> queue(4);
+			queue.push(p);
+			queue.push(p);
+			Assert::AreEqual<long>(3, p.use_count());
+		}
+
+		// the queue destroys the values it still holds
+		Assert::AreEqual<long>(1, p.use_count());
+	}
+
+	TEST_METHOD(try_push_try_pop_circling)
+	{
+		lock_free_queue<int> queue(2);
+
+		// go around the buffer several times
+		for (int i = 0; i < 10; i += 2) {
+			Assert::IsTrue(queue.try_push(i));
+			Assert::IsTrue(queue.try_emplace(i + 1));
+			Assert::IsFalse(queue.try_push(42)); // the queue is full
+			Assert::AreEqual<size_t>(2, queue.size());
+
+			int v;
+			Assert::IsTrue(queue.try_pop(v));
+			Assert::AreEqual(i, v);
+			Assert::IsTrue(queue.try_pop(v));
+			Assert::AreEqual(i + 1, v);
+			Assert::IsFalse(queue.try_pop(v));
+			Assert::IsTrue(queue.empty());
+		}
+	}
+
+	TEST_METHOD(push_emplace_pop_one_thread)
+	{
+		std::unique_ptr<int> p0 = std::make_unique<int>(24);
+		std::unique_ptr<int> p1 = std::make_unique<int>(100);
+		int* p2 = new int(1024);
+
+		// push
+		lock_free_queue<std::unique_ptr<int>> queue(6);
+		queue.push(std::move(p0));
+		queue.push(std::move(p1));
+		queue.emplace(p2);
+
+		Assert::IsFalse(bool(p0));
+		Assert::IsFalse(bool(p1));
+		Assert::AreEqual<size_t>(3, queue.size());
+
+		// push(iterator, iterator)
+		std::vector<std::unique_ptr<int>> pointers;
+		pointers.emplace_back(new int(1));
+		pointers.emplace_back(new int(2));
+		pointers.emplace_back(new int(3));
+		queue.push(std::make_move_iterator(pointers.begin()), std::make_move_iterator(pointers.end()));
+		
+		Assert::IsTrue(std::all_of(pointers.cbegin(), pointers.cend(), [](const std::unique_ptr<int>& p) { return !p; }));
+		Assert::AreEqual<size_t>(6, queue.size());
+
+		// pop
+		std::unique_ptr<int> out;
+
+		// pop 24 back
+		Assert::IsTrue(queue.try_pop(out));
+		Assert::AreEqual(24, *out);
+		Assert::AreEqual<size_t>(5, queue.size());
+
+		// pop 100 back
+		Assert::IsTrue(queue.try_pop(out));
+		Assert::AreEqual(100, *out);
+		Assert::AreEqual<size_t>(4, queue.size());
+
+		// pop 1024 back
+		Assert::IsTrue(queue.wait_pop(out));
+		Assert::AreEqual(1024, *out);
+		Assert::AreEqual<size_t>(3, queue.size());
+
+		// pop 1 back
+		Assert::IsTrue(queue.try_pop(out));
+		Assert::AreEqual(1, *out);
+		Assert::AreEqual<size_t>(2, queue.size());
+
+		// pop 2 back
+		Assert::IsTrue(queue.try_pop(out));
+		Assert::AreEqual(2, *out);
+		Assert::AreEqual<size_t>(1, queue.size());
+
+		// pop 3 back
+		Assert::IsTrue(queue.try_pop(out));
+		Assert::AreEqual(3, *out);
+		Assert::AreEqual<size_t>(0, queue.size());
+
+		Assert::IsTrue(queue.empty());
+	}
+
+	TEST_METHOD(try_emplace_bulk_try_pop_bulk)
+	{
+		lock_free_queue<int> queue(4);
+
+		// not enough room, nothing is pushed
+		Assert::IsFalse(queue.try_emplace_bulk(5, [](size_t i) { return int(i); }));
+		Assert::IsTrue(queue.empty());
+
+		Assert::IsTrue(queue.try_emplace_bulk(3, [](size_t i) { return int(i) + 1; }));
+		Assert::AreEqual<size_t>(3, queue.size());
+		Assert::IsFalse(queue.try_emplace_bulk(2, [](size_t i) { return int(i); }));
+
+		int values[4] = {};
+		Assert::AreEqual<size_t>(2, queue.try_pop_bulk(values, 2));
+		Assert::AreEqual(1, values[0]);
+		Assert::AreEqual(2, values[1]);
+
+		// goes around the buffer
+		Assert::IsTrue(queue.try_emplace_bulk(3, [](size_t i) { return int(i) + 10; }));
+		Assert::AreEqual<size_t>(4, queue.try_pop_bulk(values, 8));
+		Assert::AreEqual(3, values[0]);
+		Assert::AreEqual(10, values[1]);
+		Assert::AreEqual(11, values[2]);
+		Assert::AreEqual(12, values[3]);
+
+		// empty
+		Assert::AreEqual<size_t>(0, queue.try_pop_bulk(values, 8));
+	}
+
+	TEST_METHOD(push_pop_bulk_several_threads)
+	{
+		const size_t thread_count = 4;
+		const int value_count = 40000;
+		const size_t batch_size = 8;
+
+		lock_free_queue<int> queue(64);
+		std::vector<std::vector<int>> popped_values(thread_count);
+		std::atomic_size_t popped_count = 0;
+
+		auto consumer_func = [&](std::vector<int>& out_values) {
+			int values[batch_size];
+			while (popped_count < size_t(value_count)) {
+				const size_t count = queue.try_pop_bulk(values, batch_size);
+				out_values.insert(out_values.end(), values, values + count);
+				popped_count += count;
+			}
+		};
+
+		std::vector<std::thread> consumers;
+		for (size_t i = 0; i < thread_count; ++i)
+			consumers.emplace_back(consumer_func, std::ref(popped_values[i]));
+
+		std::vector<std::thread> producers;
+		for (size_t t = 0; t < thread_count; ++t) {
+			producers.emplace_back([&, t] {
+				const int first = int(t) * value_count / int(thread_count);
+				const int last = int(t + 1) * value_count / int(thread_count);
+
+				for (int v = first; v < last; v += int(batch_size)) {
+					const size_t count = std::min(batch_size, size_t(last - v));
+					while (!queue.try_emplace_bulk(count, [v](size_t i) { return v + int(i); }))
+						std::this_thread::yield();
+				}
+			});
+		}
+
+		for (auto& t : producers) t.join();
+		for (auto& t : consumers) t.join();
+
+		std::vector<int> actual_values;
+		for (const auto& values : popped_values)
+			actual_values.insert(actual_values.end(), values.cbegin(), values.cend());
+
+		std::vector<int> origin_values(value_count);
+		std::iota(origin_values.begin(), origin_values.end(), 0);
+		std::sort(actual_values.begin(), actual_values.end());
+		Assert::AreEqual(origin_values.size(), actual_values.size());
+		Assert::IsTrue(std::equal(origin_values.cbegin(), origin_values.cend(), actual_values.cbegin()));
+	}
+
+	TEST_METHOD(push_pop_several_threads)
+	{
+		const size_t thread_count = 29; // this_thread is not taken into account here
+		const size_t elements_per_thread = 3000;
+		using it_t = std::vector<int>::iterator;
+
+		std::vector<int> origin_vector((thread_count + 1) * elements_per_thread); // thread_count + 1 - 1 means this_thread
+		std::iota(origin_vector.begin(), origin_vector.end(), 0);
+	
+
+		lock_free_queue<int> queue(origin_vector.size());
+		std::vector<int> actual_vector = origin_vector;
+
+		// worker_func acts as a producer and a consumer interchangeable.
+		// puts all the values from [begin, end) to the queue_.
+		auto worker_func = [&queue, &actual_vector](it_t begin, it_t end) 
+		{
+			// put values into the queue_
+			for (auto i = begin; i != end; ++i)
+				queue.push(*i);
+
+			// try_pop
+			// get values from the queue_ and put them back into [begin, end)
+			for (auto i = begin; i != end; ++i) {
+				int v;
+				while (!queue.try_pop(v)) { ; }
+				
+				*i = v;
+			}
+
+			// wait_pop
+			// put values into the queue_ again
+			for (auto i = begin; i != end; ++i)
+				queue.push(*i);
+
+			// get values from the queue_ and put them back into [begin, end)
+			for (auto i = begin; i != end; ++i) {
+				int v;
+				queue.wait_pop(v);
+
+				*i = v;
+			}
+		};
+
+		
+		// spawn worker threads
+		std::vector<std::thread> threads;
+		threads.reserve(thread_count);
+
+		for (size_t i = 0; i < thread_count; ++i) {
+			it_t begin = actual_vector.begin() + i * elements_per_thread;
+			it_t end = begin + elements_per_thread;
+			threads.emplace_back(worker_func, begin, end);
+		}
+
+		it_t begin = actual_vector.end() - elements_per_thread;
+		it_t end = actual_vector.end();
+		worker_func(begin, end);
+
+		for (auto& t : threads)
+			t.join();
+
+		std::sort(actual_vector.begin(), actual_vector.end());
+		Assert::IsTrue(std::equal(origin_vector.cbegin(), origin_vector.cend(), actual_vector.cbegin()));
+	}
+
+	TEST_METHOD(push_wait_allowed)
+	{
+		lock_free_queue<int> queue(1);
+
+		std::thread waiter([&queue] {
+			int v;
+			queue.wait_pop(v);
+		});
+
+		queue.set_wait_allowed(false);
+		waiter.join(); // if wait_flag does not work, we are going to wait forever }:]
+	}
+};
+
+} // namespace
@@ -0,0 +1,198 @@
+#include "ts/parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <vector>
+#include "ts/unittest_utility.h"
+#include "CppUnitTest.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+
+namespace {
+
+std::unique_ptr<std::atomic_int[]>	p_visit_counts;
+std::vector<int>					values;
+
+void parallel_for_index_kernel()
+{
+	// irregular per item cost
+	ts::parallel_for(10, 10010, [](int i) {
+		volatile int sink = 0;
+		for (int k = 0; k < (i % 97) * 10; ++k) sink = sink + k;
+		++p_visit_counts[size_t(i - 10)];
+	});
+
+	// empty range
+	ts::parallel_for(5, 5, [](int) { Assert::Fail(); });
+}
+
+void parallel_for_iterator_kernel()
+{
+	ts::parallel_for(values.begin(), values.end(), [](int& v) { v *= 2; }, 64);
+}
+
+std::vector<float>	float_values;
+float				float_sums[2];
+std::string			concatenation;
+long long			index_sum;
+double				square_sum;
+
+void parallel_reduce_kernel()
+{
+	index_sum = ts::parallel_reduce(1, 100001, 0ll, [](int i) { return (long long)i; },
+		[](long long l, long long r) { return l + r; });
+
+	// the same blocks and the same combine order each time
+	for (float& s : float_sums) {
+		s = ts::parallel_reduce(float_values.cbegin(), float_values.cend(), 0.0f, [](float v) { return v; },
+			[](float l, float r) { return l + r; }, 16);
+	}
+
+	// associative but not commutative
+	concatenation = ts::parallel_reduce(0, 26, std::string(), [](int i) { return std::string(1, char('a' + i)); },
+		[](const std::string& l, const std::string& r) { return l + r; });
+
+	square_sum = ts::transform_reduce(values.cbegin(), values.cend(), 0.5,
+		[](double l, double r) { return l + r; }, [](int v) { return double(v) * v; });
+
+	// empty range
+	Assert::AreEqual(42, ts::parallel_reduce(3, 3, 42, [](int i) { return i; }, [](int l, int r) { return l + r; }));
+}
+
+std::vector<long long>		inclusive_sums;
+std::vector<long long>		exclusive_sums;
+std::vector<std::string>	letters;
+std::vector<std::string>	prefixes;
+size_t						scan_block_size;
+
+void parallel_scan_kernel()
+{
+	auto plus = [](long long l, long long r) { return l + r; };
+
+	auto it = ts::parallel_inclusive_scan(values.cbegin(), values.cend(), inclusive_sums.begin(), plus, scan_block_size);
+	Assert::IsTrue(it == inclusive_sums.end());
+
+	it = ts::parallel_exclusive_scan(values.cbegin(), values.cend(), exclusive_sums.begin(), 10ll, plus, scan_block_size);
+	Assert::IsTrue(it == exclusive_sums.end());
+
+	// in place
+	ts::parallel_inclusive_scan(values.begin(), values.end(), values.begin());
+
+	// associative but not commutative
+	ts::parallel_exclusive_scan(letters.cbegin(), letters.cend(), prefixes.begin(), std::string(">"),
+		[](const std::string& l, const std::string& r) { return l + r; }, 3);
+
+	// empty range
+	Assert::IsTrue(ts::parallel_inclusive_scan(values.cend(), values.cend(), inclusive_sums.begin()) == inclusive_sums.begin());
+}
+
+} // namespace
+
+
+namespace unittest {
+
+TEST_CLASS(parallel_funcs) {
+public:
+
+	TEST_METHOD(parallel_for_index)
+	{
+		for (size_t thread_count : thread_counts) {
+			p_visit_counts.reset(new std::atomic_int[10000]);
+			for (size_t i = 0; i < 10000; ++i)
+				p_visit_counts[i] = 0;
+
+			ts::launch_task_system(make_desc(thread_count), parallel_for_index_kernel);
+
+			// each index is visited exactly once
+			for (size_t i = 0; i < 10000; ++i)
+				Assert::AreEqual(1, p_visit_counts[i].load());
+		}
+
+		p_visit_counts.reset();
+	}
+
+	TEST_METHOD(parallel_for_iterator)
+	{
+		for (size_t thread_count : thread_counts) {
+			values.resize(100000);
+			for (size_t i = 0; i < values.size(); ++i)
+				values[i] = int(i);
+
+			ts::launch_task_system(make_desc(thread_count), parallel_for_iterator_kernel);
+
+			for (size_t i = 0; i < values.size(); ++i)
+				Assert::AreEqual(int(i) * 2, values[i]);
+		}
+
+		values.clear();
+	}
+
+	TEST_METHOD(parallel_reduce_transform_reduce)
+	{
+		for (size_t thread_count : thread_counts) {
+			float_values.resize(100000);
+			for (size_t i = 0; i < float_values.size(); ++i)
+				float_values[i] = 1.0f / float(i + 1);
+
+			values = { 1, 2, 3, 4 };
+
+			ts::launch_task_system(make_desc(thread_count), parallel_reduce_kernel);
+
+			Assert::AreEqual(100000ll * 100001 / 2, index_sum);
+			Assert::AreEqual(float_sums[0], float_sums[1]);
+			Assert::AreEqual(std::string("abcdefghijklmnopqrstuvwxyz"), concatenation);
+			Assert::AreEqual(30.5, square_sum);
+		}
+
+		float_values.clear();
+		values.clear();
+	}
+
+	TEST_METHOD(parallel_scan)
+	{
+		for (size_t thread_count : thread_counts) {
+			for (size_t block_size : { size_t(0), size_t(1), size_t(7), size_t(1 << 20) }) {
+				values.resize(10007);
+				for (size_t i = 0; i < values.size(); ++i)
+					values[i] = int(i % 13) - 6;
+
+				inclusive_sums.assign(values.size(), 0);
+				exclusive_sums.assign(values.size(), 0);
+				letters.resize(26);
+				for (size_t i = 0; i < letters.size(); ++i)
+					letters[i] = std::string(1, char('a' + i));
+				prefixes.assign(letters.size(), std::string());
+				scan_block_size = block_size;
+
+				std::vector<int> origin = values;
+				ts::launch_task_system(make_desc(thread_count), parallel_scan_kernel);
+
+				long long sum = 0;
+				for (size_t i = 0; i < origin.size(); ++i) {
+					Assert::AreEqual(sum + 10, exclusive_sums[i]);
+					sum += origin[i];
+					Assert::AreEqual(sum, inclusive_sums[i]);
+					Assert::AreEqual(int(sum), values[i]);
+				}
+
+				std::string prefix = ">";
+				for (size_t i = 0; i < letters.size(); ++i) {
+					Assert::AreEqual(prefix, prefixes[i]);
+					prefix += letters[i];
+				}
+			}
+		}
+
+		values.clear();
+		inclusive_sums.clear();
+		exclusive_sums.clear();
+		letters.clear();
+		prefixes.clear();
+	}
+};
+
+} // namespace unittest
@@ -0,0 +1,89 @@
+#include "ts/scratch_allocator.h"
+
+#include <algorithm>
+#include <new>
+#include "ts/block_cache.h"
+
+
+namespace {
+
+// A thread keeps at most 8 free blocks and moves 4 blocks to or from the shared pool at once.
+struct scratch_block_tag;
+using scratch_block_cache = ts::block_cache<scratch_block_tag, 1, 8, 4>;
+
+void* allocate_scratch_block()
+{
+	if (void* p = scratch_block_cache::pop(0))
+		return p;
+
+	return ::operator new(ts::scratch_allocator::block_byte_count);
+}
+
+} // namespace
+
+
+namespace ts {
+
+// ----- scratch_allocator -----
+
+// block_header occupies the beginning of every block. Blocks of block_byte_count bytes are pooled,
+// bigger ones come from the heap.
+struct scratch_allocator::block_header final {
+	block_header*	p_next;
+	size_t			byte_count;
+};
+
+void scratch_allocator::reset() noexcept
+{
+	while (p_blocks_) {
+		block_header* p_block = p_blocks_;
+		p_blocks_ = p_block->p_next;
+
+		if (p_block->byte_count == block_byte_count)
+			scratch_block_cache::push(0, p_block);
+		else
+			::operator delete(p_block);
+	}
+
+	p_cur_ = nullptr;
+	p_end_ = nullptr;
+	allocated_byte_count_ = 0;
+}
+
+void* scratch_allocator::allocate_slow(size_t byte_count, size_t alignment)
+{
+	constexpr size_t header_byte_count = (sizeof(block_header) + alignof(std::max_align_t) - 1)
+		& ~(alignof(std::max_align_t) - 1);
+	const size_t padded_byte_count = byte_count + std::max(alignment, alignof(std::max_align_t)) - 1;
+
+	// Does not fit into a block: a heap block of its own which does not become the current one.
+	if (padded_byte_count > block_byte_count - header_byte_count) {
+		const size_t heap_byte_count = header_byte_count + padded_byte_count;
+		block_header* p_block = static_cast<block_header*>(::operator new(heap_byte_count));
+		p_block->byte_count = heap_byte_count;
+
+		if (p_blocks_) {
+			p_block->p_next = p_blocks_->p_next;
+			p_blocks_->p_next = p_block;
+		}
+		else {
+			p_block->p_next = nullptr;
+			p_blocks_ = p_block;
+		}
+
+		const uintptr_t p = (uintptr_t(p_block) + header_byte_count + alignment - 1) & ~uintptr_t(alignment - 1);
+		allocated_byte_count_ += byte_count;
+		return reinterpret_cast<void*>(p);
+	}
+
+	block_header* p_block = static_cast<block_header*>(allocate_scratch_block());
+	p_block->p_next = p_blocks_;
+	p_block->byte_count = block_byte_count;
+	p_blocks_ = p_block;
+	p_cur_ = reinterpret_cast<char*>(p_block) + header_byte_count;
+	p_end_ = reinterpret_cast<char*>(p_block) + block_byte_count;
+
+	return allocate(byte_count, alignment);
+}
+
+} // namespace ts
@@ -0,0 +1,141 @@
+#include "ts/scratch_allocator.h"
+
+#include <cstring>
+#include <atomic>
+#include <vector>
+#include "ts/task_system.h"
+#include "ts/unittest_utility.h"
+#include "CppUnitTest.h"
+
+using ts::scratch_allocator;
+using ts::scratch_stl_allocator;
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+
+namespace {
+
+constexpr size_t task_count = 64;
+
+bool is_aligned(const void* p, size_t alignment)
+{
+	return (reinterpret_cast<uintptr_t>(p) % alignment) == 0;
+}
+
+std::atomic_size_t	task_error_count;
+
+// Each task fills its scratch memory, waits (the fiber may be resumed by another worker) and checks the memory.
+void task_scratch_kernel()
+{
+	scratch_allocator& kernel_scratch = ts::task_scratch_allocator();
+	int* p_kernel_value = kernel_scratch.allocate_array<int>(1);
+	*p_kernel_value = 42;
+
+	std::atomic_size_t wait_counter;
+	ts::task_func funcs[task_count];
+	for (size_t i = 0; i < task_count; ++i) {
+		funcs[i] = [i] {
+			scratch_allocator& scratch = ts::task_scratch_allocator();
+			if (scratch.allocated_byte_count() != 0) ++task_error_count;
+
+			std::vector<size_t, scratch_stl_allocator<size_t>> values{ scratch_stl_allocator<size_t>(scratch) };
+			for (size_t k = 0; k < 1000; ++k)
+				values.push_back(i + k);
+
+			std::atomic_size_t c;
+			ts::run([] { ts::task_scratch_allocator().allocate(100); }, c);
+			ts::wait_for(c);
+
+			if (&ts::task_scratch_allocator() != &scratch) ++task_error_count;
+			for (size_t k = 0; k < values.size(); ++k) {
+				if (values[k] != i + k) ++task_error_count;
+			}
+		};
+	}
+
+	ts::run(funcs, wait_counter);
+	ts::wait_for(wait_counter);
+
+	if (&ts::task_scratch_allocator() != &kernel_scratch || *p_kernel_value != 42) ++task_error_count;
+}
+
+} // namespace
+
+
+namespace unittest {
+
+TEST_CLASS(scratch_allocator_scratch_allocator) {
+public:
+
+	TEST_METHOD(allocate_reset)
+	{
+		scratch_allocator scratch;
+		Assert::AreEqual(size_t(0), scratch.allocated_byte_count());
+
+		// consecutive allocations are adjacent
+		char* p0 = static_cast<char*>(scratch.allocate(10, 1));
+		char* p1 = static_cast<char*>(scratch.allocate(10, 1));
+		Assert::IsTrue(p0 + 10 == p1);
+		Assert::AreEqual(size_t(20), scratch.allocated_byte_count());
+
+		for (size_t alignment : { size_t(2), size_t(16), size_t(64), size_t(4096) }) {
+			void* p = scratch.allocate(3, alignment);
+			Assert::IsTrue(is_aligned(p, alignment));
+		}
+
+		// more than a block in total
+		for (size_t i = 0; i < 100; ++i) {
+			void* p = scratch.allocate(1000);
+			Assert::IsTrue(is_aligned(p, alignof(std::max_align_t)));
+			std::memset(p, int(i), 1000);
+		}
+
+		// bigger than a block
+		char* p_big = scratch.allocate_array<char>(scratch_allocator::block_byte_count * 2);
+		std::memset(p_big, 1, scratch_allocator::block_byte_count * 2);
+		void* p_after_big = scratch.allocate(8);
+		Assert::IsNotNull(p_after_big);
+
+		scratch.reset();
+		Assert::AreEqual(size_t(0), scratch.allocated_byte_count());
+
+		// the allocator is usable after reset
+		int* p_ints = scratch.allocate_array<int>(16);
+		for (int i = 0; i < 16; ++i)
+			p_ints[i] = i;
+		Assert::AreEqual(15, p_ints[15]);
+	}
+
+	TEST_METHOD(stl_allocator)
+	{
+		scratch_allocator scratch;
+		scratch_stl_allocator<int> a(scratch);
+		scratch_stl_allocator<double> b(a);
+		Assert::IsTrue(a == scratch_stl_allocator<int>(b));
+
+		scratch_allocator other_scratch;
+		Assert::IsTrue(a != scratch_stl_allocator<int>(other_scratch));
+
+		std::vector<int, scratch_stl_allocator<int>> v(a);
+		for (int i = 0; i < 10000; ++i)
+			v.push_back(i);
+
+		Assert::AreEqual(size_t(10000), v.size());
+		Assert::AreEqual(9999, v.back());
+		Assert::IsTrue(scratch.allocated_byte_count() >= 10000 * sizeof(int));
+	}
+};
+
+TEST_CLASS(scratch_allocator_funcs) {
+public:
+
+	TEST_METHOD(task_scratch_allocator)
+	{
+		for (size_t thread_count : thread_counts) {
+			task_error_count = 0;
+			ts::launch_task_system(make_desc(thread_count), task_scratch_kernel);
+			Assert::AreEqual(size_t(0), task_error_count.load());
+		}
+	}
+};
+
+} // namespace unittest
@@ -0,0 +1,278 @@
+#include "ts/sync.h"
+
+
+namespace ts {
+
+// ----- funcs -----
+
+// Waiters live on the stack, the next waiter at the same address may get a late notify
+// meant for this one. The wait table ignores it: the new waiter's counter is not zero.
+void park_waiter(sync_waiter& waiter)
+{
+	wait_for(waiter.wait_counter);
+}
+
+void unpark_waiters(sync_waiter* p_waiter)
+{
+	while (p_waiter) {
+		// the waiter's fiber may be resumed and destroy the waiter right after its counter is decremented.
+		sync_waiter* p_next = p_waiter->p_next;
+		decrement_wait_counter(p_waiter->wait_counter);
+		p_waiter = p_next;
+	}
+}
+
+// ----- mutex -----
+
+void mutex::lock_slow()
+{
+	for (size_t i = 0; i < sync_spin_count; ++i) {
+		cpu_pause();
+		if (state_.load(std::memory_order_relaxed) == 0 && try_lock()) return;
+	}
+
+	sync_waiter waiter;
+	{
+		std::lock_guard<spin_lock> lock(guard_);
+
+		// Once the waiters bit is set the fast paths fail, the state changes only under the guard.
+		// unlock hands the mutex over to a waiter, so the mutex is free only if nobody waits for it.
+		const uint32_t s = state_.fetch_or(waiters_bit, std::memory_order_acquire);
+		if ((s & locked_bit) == 0) {
+			assert(waiters_.empty());
+			state_.store(locked_bit, std::memory_order_relaxed);
+			return;
+		}
+
+		waiters_.push_back(&waiter);
+	}
+
+	// the mutex is ours when the fiber is resumed.
+	park_waiter(waiter);
+}
+
+void mutex::unlock_slow()
+{
+	sync_waiter* p_waiter = nullptr;
+	{
+		std::lock_guard<spin_lock> lock(guard_);
+
+		p_waiter = waiters_.pop_front();
+		if (!p_waiter) {
+			state_.store(0, std::memory_order_release);
+			return;
+		}
+
+		// the mutex stays locked, it belongs to the waiter now.
+		state_.store((waiters_.empty()) ? locked_bit : (locked_bit | waiters_bit), std::memory_order_release);
+	}
+
+	unpark_waiters(p_waiter);
+}
+
+// ----- shared_mutex -----
+
+void shared_mutex::lock_slow(bool shared)
+{
+	for (size_t i = 0; i < sync_spin_count; ++i) {
+		cpu_pause();
+		if ((shared) ? try_lock_shared() : (state_.load(std::memory_order_relaxed) == 0 && try_lock())) return;
+	}
+
+	sync_waiter waiter;
+	waiter.shared = shared;
+	{
+		std::lock_guard<spin_lock> lock(guard_);
+
+		// see mutex::lock_slow
+		const size_t s = state_.fetch_or(waiters_bit, std::memory_order_acquire) & ~waiters_bit;
+		if (waiters_.empty()) {
+			if (shared && (s & writer_bit) == 0) {
+				state_.store(s + reader_unit, std::memory_order_relaxed);
+				return;
+			}
+
+			if (!shared && s == 0) {
+				state_.store(writer_bit, std::memory_order_relaxed);
+				return;
+			}
+		}
+
+		waiters_.push_back(&waiter);
+	}
+
+	park_waiter(waiter);
+}
+
+void shared_mutex::unlock_slow(bool shared)
+{
+	sync_waiter* p_granted = nullptr;
+	{
+		std::lock_guard<spin_lock> lock(guard_);
+
+		size_t s = state_.fetch_or(waiters_bit, std::memory_order_acq_rel);
+		if (shared) {
+			assert(s >= reader_unit);
+			s -= reader_unit;
+		}
+		else {
+			assert(s & writer_bit);
+			s &= ~writer_bit;
+		}
+
+		s = grant(s, &p_granted);
+		s = (waiters_.empty()) ? (s & ~waiters_bit) : (s | waiters_bit);
+		state_.store(s, std::memory_order_release);
+	}
+
+	unpark_waiters(p_granted);
+}
+
+size_t shared_mutex::grant(size_t state, sync_waiter** pp_granted) noexcept
+{
+	sync_waiter** pp_tail = pp_granted;
+
+	while (sync_waiter* p_waiter = waiters_.front()) {
+		if (p_waiter->shared) {
+			if (state & writer_bit) break;
+			state += reader_unit;
+		}
+		else {
+			if ((state & ~waiters_bit) != 0) break;
+			state |= writer_bit;
+		}
+
+		waiters_.pop_front();
+		*pp_tail = p_waiter;
+		pp_tail = &p_waiter->p_next;
+
+		if (!p_waiter->shared) break;
+	}
+
+	return state;
+}
+
+// ----- semaphore -----
+
+void semaphore::acquire()
+{
+	if (try_acquire()) return;
+
+	for (size_t i = 0; i < sync_spin_count; ++i) {
+		cpu_pause();
+		if (try_acquire()) return;
+	}
+
+	sync_waiter waiter;
+	{
+		std::lock_guard<spin_lock> lock(guard_);
+
+		// see mutex::lock_slow
+		const size_t s = state_.fetch_or(waiters_bit, std::memory_order_acquire) & ~waiters_bit;
+		if (waiters_.empty() && s >= count_unit) {
+			state_.store(s - count_unit, std::memory_order_relaxed);
+			return;
+		}
+
+		waiters_.push_back(&waiter);
+	}
+
+	// release has given a unit to the waiter.
+	park_waiter(waiter);
+}
+
+void semaphore::release(size_t count)
+{
+	if (count == 0) return;
+
+	size_t s = state_.load(std::memory_order_relaxed);
+	while ((s & waiters_bit) == 0) {
+		if (state_.compare_exchange_weak(s, s + count * count_unit, std::memory_order_release, std::memory_order_relaxed))
+			return;
+	}
+
+	sync_waiter* p_granted = nullptr;
+	{
+		std::lock_guard<spin_lock> lock(guard_);
+
+		s = (state_.fetch_or(waiters_bit, std::memory_order_acq_rel) & ~waiters_bit) + count * count_unit;
+
+		sync_waiter** pp_tail = &p_granted;
+		while (s >= count_unit && !waiters_.empty()) {
+			s -= count_unit;
+			*pp_tail = waiters_.pop_front();
+			pp_tail = &(*pp_tail)->p_next;
+		}
+
+		state_.store((waiters_.empty()) ? s : (s | waiters_bit), std::memory_order_release);
+	}
+
+	unpark_waiters(p_granted);
+}
+
+// ----- condition_variable -----
+
+void condition_variable::wait(std::unique_lock<mutex>& lock)
+{
+	assert(lock.owns_lock());
+
+	sync_waiter waiter;
+	{
+		std::lock_guard<spin_lock> guard_lock(guard_);
+		waiters_.push_back(&waiter);
+	}
+
+	// a notification which comes between unlock and park_waiter is not lost, it decrements the counter.
+	lock.unlock();
+	park_waiter(waiter);
+	lock.lock();
+}
+
+void condition_variable::notify_one()
+{
+	sync_waiter* p_waiter = nullptr;
+	{
+		std::lock_guard<spin_lock> lock(guard_);
+		p_waiter = waiters_.pop_front();
+	}
+
+	unpark_waiters(p_waiter);
+}
+
+void condition_variable::notify_all()
+{
+	sync_waiter* p_waiters = nullptr;
+	{
+		std::lock_guard<spin_lock> lock(guard_);
+		p_waiters = waiters_.pop_all();
+	}
+
+	unpark_waiters(p_waiters);
+}
+
+// ----- barrier -----
+
+void barrier::arrive_and_wait()
+{
+	sync_waiter waiter;
+	sync_waiter* p_waiters = nullptr;
+	bool last = false;
+	{
+		std::lock_guard<spin_lock> lock(guard_);
+
+		last = (++arrived_count_ == count_);
+		if (last) {
+			// the last fiber starts the next phase and resumes the others.
+			arrived_count_ = 0;
+			p_waiters = waiters_.pop_all();
+		}
+		else {
+			waiters_.push_back(&waiter);
+		}
+	}
+
+	if (last) unpark_waiters(p_waiters);
+	else park_waiter(waiter);
+}
+
+} // namespace ts
@@ -0,0 +1,242 @@
+#include "ts/sync.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "ts/unittest_utility.h"
+#include "CppUnitTest.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+
+namespace {
+
+constexpr size_t task_count = 32;
+
+// every task may be suspended at the same time.
+constexpr size_t fiber_count = task_count * 2;
+
+// Suspends the current fiber for a while, so other fibers contend for the primitive it holds.
+void switch_fiber()
+{
+	std::atomic_size_t wait_counter;
+	ts::run([] {}, wait_counter);
+	ts::wait_for(wait_counter);
+}
+
+// Runs func(i) in task_count tasks and waits for them.
+template<typename F>
+void run_tasks(F func)
+{
+	ts::task_func funcs[task_count];
+	for (size_t i = 0; i < task_count; ++i)
+		funcs[i] = [&func, i] { func(i); };
+
+	std::atomic_size_t wait_counter;
+	ts::run(funcs, wait_counter);
+	ts::wait_for(wait_counter);
+}
+
+void mutex_kernel()
+{
+	ts::mutex m;
+	size_t value = 0;
+
+	run_tasks([&](size_t) {
+		for (size_t k = 0; k < 50; ++k) {
+			std::lock_guard<ts::mutex> lock(m);
+			const size_t v = value;
+			if (k % 5 == 0) switch_fiber();
+			value = v + 1;
+		}
+	});
+
+	Assert::AreEqual(task_count * 50, value);
+	Assert::IsTrue(m.try_lock());
+	m.unlock();
+}
+
+// Tight lock/unlock loops: the waiters of consecutive iterations live at the same stack addresses,
+// a late wakeup meant for an earlier waiter must not hand out the mutex or a unit twice.
+void contention_kernel()
+{
+	ts::mutex m;
+	ts::semaphore s(2);
+	std::atomic_bool owned(false);
+	std::atomic_int unit_count(0);
+
+	run_tasks([&](size_t) {
+		for (size_t k = 0; k < 2000; ++k) {
+			m.lock();
+			Assert::IsFalse(owned.exchange(true));
+			owned = false;
+			m.unlock();
+
+			s.acquire();
+			Assert::IsTrue(++unit_count <= 2);
+			--unit_count;
+			s.release();
+		}
+	});
+}
+
+void shared_mutex_kernel()
+{
+	ts::shared_mutex m;
+	std::atomic_int reader_count(0);
+	std::atomic_int writer_count(0);
+	size_t value = 0;
+
+	run_tasks([&](size_t i) {
+		for (size_t k = 0; k < 20; ++k) {
+			if ((i + k) % 4 == 0) {
+				std::lock_guard<ts::shared_mutex> lock(m);
+				Assert::AreEqual(1, ++writer_count);
+				Assert::AreEqual(0, reader_count.load());
+				++value;
+				if (k % 3 == 0) switch_fiber();
+				--writer_count;
+			}
+			else {
+				m.lock_shared();
+				++reader_count;
+				Assert::AreEqual(0, writer_count.load());
+				if (k % 3 == 0) switch_fiber();
+				--reader_count;
+				m.unlock_shared();
+			}
+		}
+	});
+
+	Assert::AreEqual(size_t(task_count * 20 / 4), value);
+	Assert::IsTrue(m.try_lock_shared());
+	Assert::IsFalse(m.try_lock());
+	m.unlock_shared();
+}
+
+void semaphore_kernel()
+{
+	ts::semaphore s(3);
+	std::atomic_int inside_count(0);
+	std::atomic_int max_inside_count(0);
+
+	run_tasks([&](size_t) {
+		for (size_t k = 0; k < 10; ++k) {
+			s.acquire();
+			const int n = ++inside_count;
+			int max_n = max_inside_count.load();
+			while (n > max_n && !max_inside_count.compare_exchange_weak(max_n, n)) {}
+
+			switch_fiber();
+			--inside_count;
+			s.release();
+		}
+	});
+
+	Assert::IsTrue(max_inside_count.load() <= 3);
+	Assert::IsTrue(s.try_acquire());
+	Assert::IsTrue(s.try_acquire());
+	Assert::IsTrue(s.try_acquire());
+	Assert::IsFalse(s.try_acquire());
+	s.release(3);
+}
+
+void condition_variable_kernel()
+{
+	ts::mutex m;
+	ts::condition_variable cv;
+	std::vector<size_t> items;
+	bool done = false;
+	std::atomic_size_t sum(0);
+
+	// task 0 produces, the others consume.
+	run_tasks([&](size_t i) {
+		if (i == 0) {
+			for (size_t k = 1; k <= 1000; ++k) {
+				{
+					std::lock_guard<ts::mutex> lock(m);
+					items.push_back(k);
+				}
+				cv.notify_one();
+				if (k % 100 == 0) switch_fiber();
+			}
+
+			{
+				std::lock_guard<ts::mutex> lock(m);
+				done = true;
+			}
+			cv.notify_all();
+			return;
+		}
+
+		std::unique_lock<ts::mutex> lock(m);
+		while (true) {
+			cv.wait(lock, [&] { return done || !items.empty(); });
+			if (items.empty()) return;
+
+			sum += items.back();
+			items.pop_back();
+		}
+	});
+
+	Assert::AreEqual(size_t(1000 * 1001 / 2), sum.load());
+}
+
+void barrier_kernel()
+{
+	constexpr size_t phase_count = 20;
+	ts::barrier b(task_count);
+	std::atomic_size_t arrived_counts[phase_count] = {};
+
+	run_tasks([&](size_t i) {
+		for (size_t phase = 0; phase < phase_count; ++phase) {
+			++arrived_counts[phase];
+			if ((i + phase) % 7 == 0) switch_fiber();
+
+			b.arrive_and_wait();
+			Assert::AreEqual(task_count, arrived_counts[phase].load());
+		}
+	});
+}
+
+} // namespace
+
+
+namespace unittest {
+
+TEST_CLASS(sync_primitives) {
+public:
+
+	TEST_METHOD(mutex)
+	{
+		run_kernel_for_thread_counts(mutex_kernel, fiber_count);
+	}
+
+	TEST_METHOD(contention)
+	{
+		run_kernel_for_thread_counts(contention_kernel, fiber_count);
+	}
+
+	TEST_METHOD(shared_mutex)
+	{
+		run_kernel_for_thread_counts(shared_mutex_kernel, fiber_count);
+	}
+
+	TEST_METHOD(semaphore)
+	{
+		run_kernel_for_thread_counts(semaphore_kernel, fiber_count);
+	}
+
+	TEST_METHOD(condition_variable)
+	{
+		run_kernel_for_thread_counts(condition_variable_kernel, fiber_count);
+	}
+
+	TEST_METHOD(barrier)
+	{
+		run_kernel_for_thread_counts(barrier_kernel, fiber_count);
+	}
+};
+
+} // namespace unittest
@@ -0,0 +1,154 @@
+#include "ts/task_func.h"
+
+#include <array>
+#include <memory>
+#include <utility>
+#include "CppUnitTest.h"
+
+using ts::task_func;
+using ts::task_func_factory;
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+
+namespace {
+
+// Counts invocations and destructions of its instances.
+struct counting_func final {
+	counting_func(int* p_invoke_count, int* p_dtor_count) noexcept
+		: p_invoke_count(p_invoke_count), p_dtor_count(p_dtor_count)
+	{}
+
+	counting_func(counting_func&& f) noexcept
+		: p_invoke_count(f.p_invoke_count), p_dtor_count(f.p_dtor_count)
+	{
+		f.p_dtor_count = nullptr;
+	}
+
+	~counting_func() noexcept
+	{
+		if (p_dtor_count) ++(*p_dtor_count);
+	}
+
+	void operator()()
+	{
+		++(*p_invoke_count);
+	}
+
+	int* p_invoke_count;
+	int* p_dtor_count;
+};
+
+} // namespace
+
+
+namespace unittest {
+
+TEST_CLASS(task_func_task_func) {
+public:
+
+	TEST_METHOD(ctors)
+	{
+		static_assert(sizeof(task_func) == 64, "task_func must take one cache line.");
+
+		task_func f0;
+		Assert::IsFalse(bool(f0));
+
+		task_func f1 = nullptr;
+		Assert::IsFalse(bool(f1));
+
+		int v = 0;
+		task_func f2 = [&v] { v = 42; };
+		Assert::IsTrue(bool(f2));
+		f2();
+		Assert::AreEqual(42, v);
+
+		// move-only captures
+		std::unique_ptr<int> p = std::make_unique<int>(24);
+		task_func f3 = [&v, p = std::move(p)] { v = *p; };
+		f3();
+		Assert::AreEqual(24, v);
+	}
+
+	TEST_METHOD(move_reset)
+	{
+		int invoke_count = 0;
+		int dtor_count = 0;
+
+		{
+			task_func f0 = counting_func(&invoke_count, &dtor_count);
+			Assert::AreEqual(0, dtor_count);
+
+			task_func f1 = std::move(f0);
+			Assert::IsFalse(bool(f0));
+			Assert::IsTrue(bool(f1));
+			f1();
+			Assert::AreEqual(1, invoke_count);
+
+			task_func f2;
+			f2 = std::move(f1);
+			f2();
+			Assert::AreEqual(2, invoke_count);
+			Assert::AreEqual(0, dtor_count);
+
+			f2.reset();
+			Assert::IsFalse(bool(f2));
+			Assert::AreEqual(1, dtor_count);
+
+			f2 = counting_func(&invoke_count, &dtor_count);
+			f2 = nullptr;
+			Assert::AreEqual(2, dtor_count);
+
+			f2.emplace(counting_func(&invoke_count, &dtor_count));
+		}
+
+		// the destructor destroys the callable
+		Assert::AreEqual(3, dtor_count);
+	}
+
+	TEST_METHOD(factory)
+	{
+		int invoke_count = 0;
+		int dtor_count = 0;
+
+		{
+			// the callable is constructed right inside the task_func
+			counting_func origin(&invoke_count, &dtor_count);
+			task_func f = task_func_factory::of(std::move(origin));
+			Assert::IsTrue(origin.p_dtor_count == nullptr); // moved out
+			f();
+			Assert::AreEqual(1, invoke_count);
+
+			// assign destroys the previous callable
+			f.assign(task_func_factory::of(counting_func(&invoke_count, &dtor_count)));
+			Assert::AreEqual(1, dtor_count);
+		}
+
+		Assert::AreEqual(2, dtor_count);
+	}
+
+	TEST_METHOD(spill)
+	{
+		std::array<int, 32> values = {};
+		values[31] = 42;
+
+		auto big_func = [values, p_out = (int*)nullptr]() mutable { if (p_out) *p_out = values[31]; };
+		static_assert(!task_func::fits<decltype(big_func)>::value, "big_func must not fit into task_func.");
+
+		int v = 0;
+		task_func f0 = ts::spill([values, &v] { v = values[31]; });
+		f0();
+		Assert::AreEqual(42, v);
+
+		// make_task_func spills only if the callable does not fit
+		v = 0;
+		task_func f1 = ts::make_task_func([values, &v] { v = values[31] + 1; });
+		f1();
+		Assert::AreEqual(43, v);
+
+		task_func f2 = ts::make_task_func([&v] { v = 24; });
+		f2();
+		Assert::AreEqual(24, v);
+	}
+};
+
+} // namespace unittest
@@ -0,0 +1,162 @@
+#include "ts/task_graph.h"
+
+#include <limits>
+
+
+namespace ts {
+
+// spawn_batch collects ready nodes and spawns them with one ts::run_joined call per priority run.
+class task_graph::spawn_batch final {
+public:
+
+	explicit spawn_batch(task_graph& graph) noexcept
+		: graph_(graph)
+	{}
+
+	spawn_batch(spawn_batch&&) = delete;
+	spawn_batch& operator=(spawn_batch&&) = delete;
+
+
+	void push(node_id id)
+	{
+		const task_priority priority = graph_.nodes_[id].priority;
+		if (count_ == capacity || (count_ > 0 && priority != priority_))
+			flush();
+
+		task_graph* p_graph = &graph_;
+		funcs_[count_] = [p_graph, id] { p_graph->exec_node(id); };
+		priority_ = priority;
+		++count_;
+	}
+
+	void flush()
+	{
+		if (count_ == 0) return;
+
+		run_joined(funcs_, count_, priority_, graph_.wait_counter_);
+		count_ = 0;
+	}
+
+private:
+
+	static constexpr size_t capacity = 16;
+
+	task_graph&		graph_;
+	task_func		funcs_[capacity];
+	size_t			count_ = 0;
+	task_priority	priority_ = task_priority::normal;
+};
+
+task_graph::node_id task_graph::add_node(task_func&& func, task_priority priority)
+{
+	assert(is_done());
+	assert(func);
+
+	nodes_.push_back(node{ std::move(func), priority, 0, {} });
+	return nodes_.size() - 1;
+}
+
+void task_graph::precede(node_id before, node_id after)
+{
+	assert(is_done());
+	assert(before < nodes_.size());
+	assert(after < nodes_.size());
+	assert(before != after);
+
+	nodes_[before].successors.push_back(after);
+	++nodes_[after].predecessor_count;
+}
+
+void task_graph::reserve(size_t node_count)
+{
+	nodes_.reserve(node_count);
+}
+
+void task_graph::clear() noexcept
+{
+	assert(is_done());
+	nodes_.clear();
+}
+
+void task_graph::launch()
+{
+	assert(is_done());
+	assert(is_acyclic());
+
+	if (nodes_.empty()) return;
+
+	if (pending_count_capacity_ < nodes_.size()) {
+		p_pending_counts_.reset(new std::atomic_size_t[nodes_.size()]);
+		pending_count_capacity_ = nodes_.size();
+	}
+
+	for (size_t i = 0; i < nodes_.size(); ++i)
+		p_pending_counts_[i].store(nodes_[i].predecessor_count, std::memory_order_relaxed);
+
+	// pushing the tasks publishes the pending counts.
+	spawn_batch batch(*this);
+	for (node_id id = 0; id < nodes_.size(); ++id) {
+		if (nodes_[id].predecessor_count == 0)
+			batch.push(id);
+	}
+
+	batch.flush();
+}
+
+void task_graph::exec_node(node_id id)
+{
+	constexpr node_id no_node = std::numeric_limits<node_id>::max();
+
+	while (true) {
+		node& n = nodes_[id];
+		n.func();
+
+		// The ready successors are spawned before the current task completes,
+		// so the wait counter can't reach zero while there are nodes to run.
+		// The first ready successor with normal priority is run by the current task,
+		// a chain of nodes does not go through the queues at all.
+		spawn_batch batch(*this);
+		node_id next_id = no_node;
+		for (node_id s : n.successors) {
+			if (p_pending_counts_[s].fetch_sub(1) != 1) continue;
+
+			if (next_id == no_node && nodes_[s].priority == task_priority::normal)
+				next_id = s;
+			else
+				batch.push(s);
+		}
+
+		batch.flush();
+		if (next_id == no_node) return;
+
+		id = next_id;
+	}
+}
+
+bool task_graph::is_acyclic() const
+{
+	// Kahn's algorithm: all the nodes can be visited in topological order.
+	std::vector<size_t> predecessor_counts(nodes_.size());
+	std::vector<node_id> ready_ids;
+	for (node_id id = 0; id < nodes_.size(); ++id) {
+		predecessor_counts[id] = nodes_[id].predecessor_count;
+		if (predecessor_counts[id] == 0)
+			ready_ids.push_back(id);
+	}
+
+	size_t visit_count = 0;
+	while (!ready_ids.empty()) {
+		const node_id id = ready_ids.back();
+		ready_ids.pop_back();
+		++visit_count;
+
+		for (node_id s : nodes_[id].successors) {
+			if (--predecessor_counts[s] == 0)
+				ready_ids.push_back(s);
+		}
+	}
+
+	return (visit_count == nodes_.size());
+}
+
+} // namespace ts
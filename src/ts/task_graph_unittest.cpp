@@ -0,0 +1,136 @@
+#include "ts/task_graph.h"
+
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "ts/unittest_utility.h"
+#include "CppUnitTest.h"
+
+using ts::task_graph;
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+
+namespace {
+
+// a launch may spawn every node of the graph at once.
+constexpr size_t								queue_size = 4096;
+constexpr size_t								node_count = 2000;
+std::vector<std::pair<size_t, size_t>>			edges;
+std::unique_ptr<std::atomic_size_t[]>			p_run_counts;
+std::unique_ptr<size_t[]>						p_stamps;
+std::atomic_size_t								stamp_counter;
+
+void task_graph_dag_kernel()
+{
+	task_graph graph;
+	graph.reserve(node_count);
+
+	for (size_t i = 0; i < node_count; ++i) {
+		const ts::task_priority priority = (i % 7 == 0) ? ts::task_priority::high
+			: (i % 11 == 0) ? ts::task_priority::background
+			: ts::task_priority::normal;
+
+		graph.add([i] {
+			p_stamps[i] = stamp_counter++;
+			++p_run_counts[i];
+		}, priority);
+	}
+
+	for (const auto& e : edges)
+		graph.precede(e.first, e.second);
+
+	Assert::AreEqual(node_count, graph.node_count());
+
+	// the graph can be launched again once it is done.
+	for (int launch = 0; launch < 2; ++launch) {
+		graph.launch();
+		graph.wait();
+		Assert::IsTrue(graph.is_done());
+	}
+}
+
+void task_graph_chain_kernel()
+{
+	task_graph graph;
+	std::vector<size_t> order;
+
+	// no synchronization is needed, the nodes of a chain run one by one.
+	task_graph::node_id prev = graph.add([&order] { order.push_back(0); });
+	for (size_t i = 1; i < 1000; ++i)
+		prev = graph.add([&order, i] { order.push_back(i); }, { prev });
+
+	// a second independent graph waited along with the first one.
+	task_graph fan;
+	std::atomic_size_t fan_count(0);
+	const task_graph::node_id fan_root = fan.add([] {});
+	for (size_t i = 0; i < 100; ++i)
+		fan.add([&fan_count] { ++fan_count; }, { fan_root });
+
+	graph.launch();
+	fan.launch();
+	ts::wait_all({ &graph.wait_counter(), &fan.wait_counter() });
+
+	Assert::AreEqual(size_t(1000), order.size());
+	for (size_t i = 0; i < order.size(); ++i)
+		Assert::AreEqual(i, order[i]);
+
+	Assert::AreEqual(size_t(100), fan_count.load());
+
+	// an empty graph is done right away.
+	task_graph empty;
+	empty.launch();
+	Assert::IsTrue(empty.is_done());
+}
+
+} // namespace
+
+
+namespace unittest {
+
+TEST_CLASS(task_graph_task_graph) {
+public:
+
+	TEST_METHOD(dag)
+	{
+		// every node depends on up to 3 earlier nodes.
+		edges.clear();
+		size_t seed = 12345;
+		for (size_t i = 1; i < node_count; ++i) {
+			for (int k = 0; k < 3; ++k) {
+				seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+				if ((seed >> 40) % 2 == 0) continue;
+				edges.emplace_back(size_t((seed >> 20) % i), i);
+			}
+		}
+
+		for (size_t thread_count : thread_counts) {
+			p_run_counts.reset(new std::atomic_size_t[node_count]);
+			p_stamps.reset(new size_t[node_count]);
+			for (size_t i = 0; i < node_count; ++i)
+				p_run_counts[i] = 0;
+
+			stamp_counter = 0;
+
+			ts::launch_task_system(make_desc(thread_count, default_fiber_count, queue_size), task_graph_dag_kernel);
+
+			// each launch runs each node once, a node runs after all its predecessors.
+			for (size_t i = 0; i < node_count; ++i)
+				Assert::AreEqual(size_t(2), p_run_counts[i].load());
+
+			for (const auto& e : edges)
+				Assert::IsTrue(p_stamps[e.first] < p_stamps[e.second]);
+		}
+
+		edges.clear();
+		p_run_counts.reset();
+		p_stamps.reset();
+	}
+
+	TEST_METHOD(chain_and_wait)
+	{
+		run_kernel_for_thread_counts(task_graph_chain_kernel, default_fiber_count, queue_size);
+	}
+};
+
+} // namespace unittest
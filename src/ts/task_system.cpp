@@ -1,8 +1,24 @@
 #include "ts/task_system.h"
 
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <fstream>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "ts/block_pool.h"
 #include "ts/fiber.h"
+#include "ts/futex.h"
 #include "ts/concurrent_queue.h"
+#include "ts/lock_free_queue.h"
+#include "ts/scratch_allocator.h"
+#include "ts/timer_wheel.h"
+#include "ts/topology.h"
+#include "ts/trace.h"
+#include "ts/work_stealing_deque.h"
 
 
 namespace {
@@ -10,186 +26,1799 @@ namespace {
 using namespace ts;
 
 struct task final {
-	std::function<void()>	func;
+	task_func				func;
 	std::atomic_size_t*		p_wait_counter = nullptr;
 };
 
+// counter_continuation is a wait record which spawns a task instead of resuming a fiber (ts::run_when_zero).
+// The record is the first member, notify_waiters casts one to the other.
+struct counter_continuation final {
+	fiber_wait_record	record;
+	fiber_wait_node		node;
+	task_func			func;
+	task_priority		priority = task_priority::normal;
+};
+
+enum class timer_kind {
+	// run_at: spawns its task and is freed.
+	task,
+
+	// run_every: spawns a task which runs the function and schedules the timer again.
+	periodic,
+
+	// wait_until, sleep_until: resumes a fiber through its counter. Lives on the fiber's stack.
+	wake
+};
+
+// timer is a pending timer of the task system, node.p_data points back to it.
+struct timer final {
+	timer_node				node;
+	timer_kind				kind = timer_kind::task;
+	task_priority			priority = task_priority::normal;
+
+	// The time the timer fires at and the period of a periodic timer, steady clock nanoseconds.
+	uint64_t				time_ns = 0;
+	uint64_t				period_ns = 0;
+
+	task_func				func;
+	std::function<bool()>	periodic_func;
+	std::atomic_size_t*		p_wait_counter = nullptr;
+};
+
+// task_queue forwards to the queue implementation chosen by task_system_desc::queue_type.
+// Tasks which do not fit into the queue may be spilled into its overflow list (task_overflow_policy::spill),
+// the list is used only after the queue has been drained.
+class task_queue final {
+public:
+
+	task_queue(task_queue_type type, size_t size_limit);
+
+	task_queue(task_queue&&) = delete;
+	task_queue& operator=(task_queue&&) = delete;
+
+	~task_queue() noexcept;
+
+
+	// Does not take a lock. The value is approximate if the queue is accessed concurrently.
+	bool empty() const noexcept;
+
+	void set_wait_allowed(bool flag);
+
+	// Pushes count tasks at once, the i-th task is make_task(i). Returns false if there is not enough room.
+	template<typename MakeTask>
+	bool try_emplace_bulk(size_t count, MakeTask make_task);
+
+	// Pushes count tasks into the overflow list which has no size limit, the i-th task is make_task(i).
+	template<typename MakeTask>
+	void spill_bulk(size_t count, MakeTask make_task);
+
+	bool try_pop(task& out_task);
+
+	size_t try_pop_bulk(task* p_out, size_t out_count_limit);
+
+private:
+
+	// The overflow list consists of fixed size segments. Tasks are pushed to the tail and popped from the head.
+	struct overflow_segment final {
+		static constexpr size_t task_count = 64;
+
+		task				tasks[task_count];
+		size_t				begin = 0;
+		size_t				end = 0;
+		overflow_segment*	p_next = nullptr;
+	};
+
+
+	size_t try_pop_overflow(task* p_out, size_t out_count_limit);
+
+
+	std::unique_ptr<concurrent_queue<task>>	p_concurrent_queue_;
+	std::unique_ptr<lock_free_queue<task>>	p_lock_free_queue_;
+
+	// concurrent_queue::empty takes the lock, the task count is tracked here instead.
+	std::atomic_size_t						concurrent_queue_size_;
+
+	// The overflow list is guarded by overflow_mutex_, overflow_size_ lets the consumers skip the lock.
+	// A drained segment is kept as a spare one, so a queue which overflows now and then does not allocate.
+	std::mutex								overflow_mutex_;
+	overflow_segment*						p_overflow_head_ = nullptr;
+	overflow_segment*						p_overflow_tail_ = nullptr;
+	std::unique_ptr<overflow_segment>		p_spare_segment_;
+	std::atomic_size_t						overflow_size_;
+};
+
+// stat_counter is a statistics counter. Only its worker writes it, any thread may read it
+// (see get_task_system_report), so there is no need for a read-modify-write.
+class stat_counter final {
+public:
+
+	void add(uint64_t n = 1) noexcept
+	{
+		value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	void raise_to(uint64_t v) noexcept
+	{
+		if (v > value_.load(std::memory_order_relaxed))
+			value_.store(v, std::memory_order_relaxed);
+	}
+
+	uint64_t get() const noexcept
+	{
+		return value_.load(std::memory_order_relaxed);
+	}
+
+private:
+
+	std::atomic<uint64_t> value_{ 0 };
+};
+
+// The statistics of a worker, see task_worker_report.
+struct worker_stats final {
+	// Indexed by task_priority.
+	stat_counter	task_counts[3];
+	stat_counter	spawned_task_count;
+	stat_counter	fiber_switch_count;
+	stat_counter	park_count;
+	stat_counter	resume_count;
+	stat_counter	queue_full_count;
+	stat_counter	overflow_task_count;
+	stat_counter	fiber_high_water_count;
+	stat_counter	fiber_soft_limit_exceeded_count;
+	stat_counter	wait_list_high_water_count;
+	stat_counter	fiber_stack_peak_byte_count;
+	stat_counter	large_fiber_stack_peak_byte_count;
+	stat_counter	busy_ns;
+	stat_counter	spin_ns;
+	stat_counter	idle_ns;
+
+	// The time the worker has become busy or has started to spin. Owner only.
+	uint64_t		state_begin_ns = 0;
+};
+
+struct worker;
+
+// task_slot is a task which lives in the slot storage of a worker.
+// Deques hold pointers to slots. A slot always goes back to the worker it belongs to.
+struct task_slot final {
+	task		value;
+	worker*		p_owner = nullptr;
+	task_slot*	p_next = nullptr;
+};
+
+// worker is the scheduling state of a thread which executes tasks (the kernel thread or a worker thread).
+struct alignas(cache_line_byte_count) worker final {
+	// The max number of task slots a thief takes from a victim at once.
+	static constexpr size_t steal_count_limit = 32;
+
+	// The max number of tasks a worker takes from the injection queue at once.
+	static constexpr size_t injection_batch_size = 8;
+
+	// A busy worker polls the timers after every timer_poll_interval tasks.
+	static constexpr size_t timer_poll_interval = 64;
+
+
+	worker(size_t index, size_t slot_count);
+
+	worker(worker&&) = delete;
+	worker& operator=(worker&&) = delete;
+
+
+	// Returns a free slot or nullptr if all the slots are in use. Owner only.
+	task_slot* acquire_slot() noexcept;
+
+	// Returns the slot to its owner. Any thread.
+	void release_slot(task_slot* p_slot) noexcept;
+
+	// Puts a record whose fiber is ready to be resumed into the ready list. Any thread.
+	void push_ready(fiber_wait_record* p_record) noexcept;
+
+	// Returns a fiber to resume or nullptr if the ready list is empty. Owner only.
+	void* pop_ready_fiber() noexcept;
+
+	// xorshift32, good enough to pick a victim.
+	uint32_t next_random() noexcept
+	{
+		random_state ^= random_state << 13;
+		random_state ^= random_state >> 17;
+		random_state ^= random_state << 5;
+		return random_state;
+	}
+
+
+	work_stealing_deque<task_slot*>		deque;
+	std::unique_ptr<task_slot[]>		slots;
+	task_slot*							p_free_list = nullptr;
+	uint32_t							random_state;
+	size_t								index;
+
+	// The number of normal priority tasks taken since the last background one.
+	size_t								normal_task_streak = 0;
+
+	// Set by the worker fiber: whether its last attempt to take a task succeeded.
+	bool								found_task = false;
+
+	// Set by a large stack fiber which has executed its task and has to go back to its pool.
+	bool								large_fiber_done = false;
+
+	// The number of idle iterations in a row, see idle.
+	size_t								idle_count = 0;
+
+	// The number of tasks since the last time the busy worker has polled the timers, see poll_timers.
+	size_t								timer_poll_count = 0;
+
+	// Written by the owner only, on its own cache lines.
+	alignas(cache_line_byte_count) worker_stats stats;
+
+	// Not null if tracing is on, see record_trace.
+	std::unique_ptr<trace_buffer>		p_trace;
+
+	// Ready records taken from p_ready_list, owner only.
+	fiber_wait_record*					p_ready_local = nullptr;
+
+	// The indices of the other workers, closer ones first. victim_tier_ends[i] is the end of the i-th tier:
+	// the workers which share the last level cache, the workers of the same NUMA node, the rest of them.
+	std::vector<uint32_t>				victims;
+	size_t								victim_tier_ends[3] = {};
+
+	// Slots released by other threads. The owner takes the whole list at once,
+	// so the list is never popped element by element and does not suffer from ABA.
+	alignas(cache_line_byte_count) std::atomic<task_slot*> p_released_list;
+
+	// Records of waiting fibers which have become ready. Pushed by any thread, taken the same way as p_released_list.
+	alignas(cache_line_byte_count) std::atomic<fiber_wait_record*> p_ready_list;
+
+	// A sleeping worker waits for wake_epoch to change. A waker claims the worker by resetting sleeping,
+	// so each sleeper is woken by exactly one waker. See park_worker and wake_worker.
+	alignas(cache_line_byte_count) std::atomic<uint32_t> wake_epoch;
+	std::atomic_bool					sleeping;
+};
+
 // Task system state.
 struct tss final {
 	// Task system global 'fields'.
-	// 
-	static concurrent_queue<task>*	p_queue;
-	static concurrent_queue<task>*	p_queue_immediate;
-	static exception_slot			exception_slot;
+	//
+	// p_queue is the injection queue: tasks from the kernel function and from threads
+	// which are not a part of the task system. Tasks spawned by worker fibers go to the worker's deque.
+	static task_queue*				p_queue;
+	static task_queue*				p_queue_immediate;
+	static task_queue*				p_queue_background;
+	static task_queue*				p_queue_large;
+	static fiber_pool*				p_fiber_pool;
+	static fiber_pool*				p_large_fiber_pool;
+	static size_t					fiber_soft_limit;
+	static bool						trim_idle_fibers;
+	static task_overflow_policy		overflow_policy;
+	static size_t					background_aging_count;
+	static task_idle_policy			idle_policy;
+	static size_t					idle_spin_count;
+	static size_t					idle_yield_count;
+	static std::atomic_size_t		sleeper_count;
+	static std::vector<std::unique_ptr<worker>>	workers;
+	static std::atomic_size_t		started_worker_count;
+	static std::atomic_size_t		fiber_in_use_count;
+	static std::atomic_size_t		wait_record_count;
+	static std::atomic_size_t		external_spawned_task_count;
+	static std::atomic_size_t		external_queue_full_count;
+	static std::atomic_size_t		external_overflow_task_count;
+
+	// Picks the workers (round-robin) which resume the fibers signaled by threads outside the task system.
+	static std::atomic_size_t		external_ready_index;
+	static fiber_wait_table*		p_wait_table;
+	static void*					p_kernel_fiber;
+
+	// Fibers which wait for room in a queue (task_overflow_policy::park) wait for queue_space_counter.
+	// A spawner sets it to 1, a worker which takes a task from a queue resets it and resumes the spawners.
+	static std::atomic_size_t		queue_space_counter;
+
+	// The timers. The wheel is guarded by timer_mutex. next_timer_ns is the time of the next timer
+	// (no_timer_ns if there are none), so the workers do not take the lock until a timer expires.
+	// The wheel's ticks are counted from timer_start_ns.
+	static timer_wheel*				p_timer_wheel;
+	static std::mutex				timer_mutex;
+	static std::atomic<uint64_t>	next_timer_ns;
+	static uint64_t					timer_start_ns;
+	static uint64_t					timer_tick_ns;
+
+	// The sleeping worker which wakes up when the next timer expires, see park_worker.
+	static std::atomic<worker*>		p_timer_keeper;
+	static ts::exception_slot		exception_slot;
 	static task_system_report		report;
 	static std::atomic_bool			exec_flag;
+	static bool						trace_enabled;
+	static bool						measure_stack_usage;
+
+	// The following fields represents thread local communication channel between
+	// the thread controller fiber and a worker fiber which is executed in the current thread.
+	//
+	static thread_local void* 						p_controller_fiber;
+	static thread_local fiber_wait_record*			p_wait_record;
+	static thread_local worker*						p_worker;
+
+	// The scratch allocator of the task the current fiber executes. A fiber restores it
+	// when it is resumed, see wait_for_counters.
+	static thread_local scratch_allocator*			p_scratch_allocator;
+};
+
+task_queue*								tss::p_queue = nullptr;
+task_queue*								tss::p_queue_immediate = nullptr;
+task_queue*								tss::p_queue_background = nullptr;
+task_queue*								tss::p_queue_large = nullptr;
+fiber_pool*								tss::p_fiber_pool = nullptr;
+fiber_pool*								tss::p_large_fiber_pool = nullptr;
+size_t									tss::fiber_soft_limit = 0;
+bool									tss::trim_idle_fibers = false;
+task_overflow_policy					tss::overflow_policy = task_overflow_policy::spill;
+size_t									tss::background_aging_count = 0;
+task_idle_policy						tss::idle_policy = task_idle_policy::park;
+size_t									tss::idle_spin_count = 0;
+size_t									tss::idle_yield_count = 0;
+std::atomic_size_t						tss::sleeper_count = 0;
+std::vector<std::unique_ptr<worker>>	tss::workers;
+std::atomic_size_t						tss::started_worker_count = 0;
+std::atomic_size_t						tss::fiber_in_use_count = 0;
+std::atomic_size_t						tss::wait_record_count = 0;
+std::atomic_size_t						tss::external_spawned_task_count = 0;
+std::atomic_size_t						tss::external_queue_full_count = 0;
+std::atomic_size_t						tss::external_overflow_task_count = 0;
+std::atomic_size_t						tss::external_ready_index = 0;
+fiber_wait_table*						tss::p_wait_table = nullptr;
+void*									tss::p_kernel_fiber = nullptr;
+std::atomic_size_t						tss::queue_space_counter = 0;
+timer_wheel*							tss::p_timer_wheel = nullptr;
+std::mutex								tss::timer_mutex;
+std::atomic<uint64_t>					tss::next_timer_ns = 0;
+uint64_t								tss::timer_start_ns = 0;
+uint64_t								tss::timer_tick_ns = 0;
+std::atomic<worker*>					tss::p_timer_keeper = nullptr;
+exception_slot							tss::exception_slot;
+task_system_report						tss::report;
+std::atomic_bool						tss::exec_flag = false;
+bool									tss::trace_enabled = false;
+bool									tss::measure_stack_usage = false;
+thread_local void*						tss::p_controller_fiber = nullptr;
+thread_local fiber_wait_record*			tss::p_wait_record = nullptr;
+thread_local worker*					tss::p_worker = nullptr;
+thread_local scratch_allocator*			tss::p_scratch_allocator = nullptr;
+
+// ----- task_queue -----
+
+task_queue::task_queue(task_queue_type type, size_t size_limit)
+	: concurrent_queue_size_(0),
+	overflow_size_(0)
+{
+	if (type == task_queue_type::lock_free_queue)
+		p_lock_free_queue_ = std::make_unique<lock_free_queue<task>>(size_limit);
+	else
+		p_concurrent_queue_ = std::make_unique<concurrent_queue<task>>(size_limit);
+}
+
+task_queue::~task_queue() noexcept
+{
+	while (p_overflow_head_) {
+		overflow_segment* p_segment = p_overflow_head_;
+		p_overflow_head_ = p_segment->p_next;
+		delete p_segment;
+	}
+}
+
+bool task_queue::empty() const noexcept
+{
+	if (overflow_size_.load(std::memory_order_relaxed) > 0) return false;
+
+	return (p_lock_free_queue_)
+		? p_lock_free_queue_->empty()
+		: (concurrent_queue_size_.load(std::memory_order_relaxed) == 0);
+}
+
+void task_queue::set_wait_allowed(bool flag)
+{
+	if (p_lock_free_queue_)
+		p_lock_free_queue_->set_wait_allowed(flag);
+	else
+		p_concurrent_queue_->set_wait_allowed(flag);
+}
+
+template<typename MakeTask>
+bool task_queue::try_emplace_bulk(size_t count, MakeTask make_task)
+{
+	if (p_lock_free_queue_)
+		return p_lock_free_queue_->try_emplace_bulk(count, make_task);
+
+	if (!p_concurrent_queue_->try_emplace_bulk(count, make_task)) return false;
+
+	concurrent_queue_size_.fetch_add(count, std::memory_order_relaxed);
+	return true;
+}
+
+template<typename MakeTask>
+void task_queue::spill_bulk(size_t count, MakeTask make_task)
+{
+	std::lock_guard<std::mutex> lock(overflow_mutex_);
+
+	for (size_t i = 0; i < count; ++i) {
+		if (!p_overflow_tail_ || p_overflow_tail_->end == overflow_segment::task_count) {
+			std::unique_ptr<overflow_segment> p_segment = std::move(p_spare_segment_);
+			if (!p_segment)
+				p_segment = std::make_unique<overflow_segment>();
+
+			if (p_overflow_tail_)
+				p_overflow_tail_->p_next = p_segment.get();
+			else
+				p_overflow_head_ = p_segment.get();
+
+			p_overflow_tail_ = p_segment.release();
+		}
+
+		p_overflow_tail_->tasks[p_overflow_tail_->end++] = make_task(i);
+		overflow_size_.fetch_add(1, std::memory_order_release);
+	}
+}
+
+bool task_queue::try_pop(task& out_task)
+{
+	if (p_lock_free_queue_) {
+		if (p_lock_free_queue_->try_pop(out_task)) return true;
+	}
+	else if (p_concurrent_queue_->try_pop(out_task)) {
+		concurrent_queue_size_.fetch_sub(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	return try_pop_overflow(&out_task, 1) > 0;
+}
+
+size_t task_queue::try_pop_bulk(task* p_out, size_t out_count_limit)
+{
+	size_t count;
+	if (p_lock_free_queue_) {
+		count = p_lock_free_queue_->try_pop_bulk(p_out, out_count_limit);
+	}
+	else {
+		count = p_concurrent_queue_->try_pop_bulk(p_out, out_count_limit);
+		concurrent_queue_size_.fetch_sub(count, std::memory_order_relaxed);
+	}
+
+	if (count > 0) return count;
+	return try_pop_overflow(p_out, out_count_limit);
+}
+
+size_t task_queue::try_pop_overflow(task* p_out, size_t out_count_limit)
+{
+	if (overflow_size_.load(std::memory_order_acquire) == 0) return 0;
+
+	std::lock_guard<std::mutex> lock(overflow_mutex_);
+
+	size_t count = 0;
+	while (count < out_count_limit && p_overflow_head_) {
+		overflow_segment* p_segment = p_overflow_head_;
+		p_out[count++] = std::move(p_segment->tasks[p_segment->begin++]);
+
+		// a drained segment becomes the spare one.
+		if (p_segment->begin == p_segment->end) {
+			p_overflow_head_ = p_segment->p_next;
+			if (!p_overflow_head_) p_overflow_tail_ = nullptr;
+
+			p_segment->begin = 0;
+			p_segment->end = 0;
+			p_segment->p_next = nullptr;
+			p_spare_segment_.reset(p_segment);
+		}
+	}
+
+	overflow_size_.fetch_sub(count, std::memory_order_relaxed);
+	return count;
+}
+
+// ----- worker -----
+
+worker::worker(size_t index, size_t slot_count)
+	: deque(slot_count + steal_count_limit),
+	slots(new task_slot[slot_count]),
+	random_state(uint32_t(index * 2654435761u + 1)),
+	index(index),
+	p_released_list(nullptr),
+	p_ready_list(nullptr),
+	wake_epoch(0),
+	sleeping(false)
+{
+	assert(slot_count > 0);
+
+	for (size_t i = 0; i < slot_count; ++i) {
+		slots[i].p_owner = this;
+		slots[i].p_next = (i + 1 < slot_count) ? &slots[i + 1] : nullptr;
+	}
+
+	p_free_list = &slots[0];
+}
+
+task_slot* worker::acquire_slot() noexcept
+{
+	if (!p_free_list)
+		p_free_list = p_released_list.exchange(nullptr, std::memory_order_acquire);
+
+	task_slot* p_slot = p_free_list;
+	if (p_slot)
+		p_free_list = p_slot->p_next;
+
+	return p_slot;
+}
+
+void worker::release_slot(task_slot* p_slot) noexcept
+{
+	assert(p_slot);
+	assert(p_slot->p_owner == this);
+
+	if (tss::p_worker == this) {
+		p_slot->p_next = p_free_list;
+		p_free_list = p_slot;
+		return;
+	}
+
+	task_slot* p_head = p_released_list.load(std::memory_order_relaxed);
+	do {
+		p_slot->p_next = p_head;
+	} while (!p_released_list.compare_exchange_weak(p_head, p_slot,
+		std::memory_order_release, std::memory_order_relaxed));
+}
+
+void worker::push_ready(fiber_wait_record* p_record) noexcept
+{
+	assert(p_record);
+
+	fiber_wait_record* p_head = p_ready_list.load(std::memory_order_relaxed);
+	do {
+		p_record->p_next = p_head;
+	} while (!p_ready_list.compare_exchange_weak(p_head, p_record,
+		std::memory_order_release, std::memory_order_relaxed));
+}
+
+void* worker::pop_ready_fiber() noexcept
+{
+	if (!p_ready_local && p_ready_list.load(std::memory_order_relaxed))
+		p_ready_local = p_ready_list.exchange(nullptr, std::memory_order_acquire);
+
+	fiber_wait_record* p_record = p_ready_local;
+	if (!p_record) return nullptr;
+
+	// The record lives on the fiber's stack, it must not be touched after the fiber is resumed.
+	p_ready_local = p_record->p_next;
+	return p_record->p_fiber;
+}
+
+// ----- funcs ------
+
+uint64_t now_ns() noexcept
+{
+	return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+uint64_t to_ns(task_clock::time_point time) noexcept
+{
+	return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count());
+}
+
+constexpr uint64_t no_timer_ns = UINT64_MAX;
+
+// Returns true if the next timer has expired.
+inline bool timer_expired() noexcept
+{
+	const uint64_t next_timer_ns = tss::next_timer_ns.load(std::memory_order_relaxed);
+	return (next_timer_ns != no_timer_ns) && (next_timer_ns <= now_ns());
+}
+
+// Records a trace event of the worker. When tracing is off the cost is one predictable branch.
+inline void record_trace(worker& w, trace_event_type type, const void* p_fiber = nullptr, uint32_t value = 0) noexcept
+{
+	if (tss::trace_enabled)
+		w.p_trace->record(type, p_fiber, value);
+}
+
+// Records a trace event of the current fiber. Does nothing in threads which are not a part of the task system.
+inline void record_fiber_trace(trace_event_type type, uint32_t value = 0) noexcept
+{
+	if (tss::trace_enabled && tss::p_worker)
+		tss::p_worker->p_trace->record(type, current_fiber(), value);
+}
+
+// Counts a task which has not fit into the current worker's deque or into a queue.
+void count_queue_full() noexcept
+{
+	if (tss::p_worker)
+		tss::p_worker->stats.queue_full_count.add();
+	else
+		tss::external_queue_full_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Counts the tasks which have been handled by the overflow policy.
+void count_overflow_tasks(size_t count) noexcept
+{
+	if (tss::p_worker)
+		tss::p_worker->stats.overflow_task_count.add(count);
+	else
+		tss::external_overflow_task_count.fetch_add(count, std::memory_order_relaxed);
+}
+
+// Returns true if there may be something to do for the worker.
+bool has_work(const worker& w) noexcept
+{
+	if (!tss::exec_flag) return true;
+	if (w.p_ready_local || w.p_ready_list.load(std::memory_order_relaxed)) return true;
+	if (timer_expired()) return true;
+
+	if (!tss::p_queue_immediate->empty()
+		|| !tss::p_queue->empty()
+		|| !tss::p_queue_background->empty()
+		|| (tss::p_large_fiber_pool && !tss::p_queue_large->empty())) return true;
+
+	for (const auto& p_w : tss::workers) {
+		if (!p_w->deque.empty()) return true;
+	}
+
+	return false;
+}
+
+// Wakes the worker if it sleeps. Returns false if the worker has not been asleep.
+bool wake_worker(worker& w) noexcept
+{
+	if (!w.sleeping.load(std::memory_order_relaxed)) return false;
+	if (!w.sleeping.exchange(false)) return false;
+
+	tss::sleeper_count.fetch_sub(1);
+	w.wake_epoch.fetch_add(1);
+	futex_wake_one(w.wake_epoch);
+	return true;
+}
+
+// Wakes at most count sleeping workers. Must be called after new work has been published.
+void wake_workers(size_t count) noexcept
+{
+	// pairs with the fence in park_worker: either the sleeper sees the new work or we see the sleeper.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (tss::sleeper_count.load(std::memory_order_relaxed) == 0) return;
+
+	for (const auto& p_w : tss::workers) {
+		if (count == 0) return;
+		if (wake_worker(*p_w)) --count;
+	}
+}
+
+void wake_all_workers() noexcept
+{
+	wake_workers(tss::workers.size());
+}
+
+// Puts the current thread to sleep until a waker claims the worker or there is some work.
+void park_worker(worker& w) noexcept
+{
+	const uint32_t epoch = w.wake_epoch.load();
+	w.sleeping.store(true);
+	tss::sleeper_count.fetch_add(1);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	if (has_work(w)) {
+		// a waker which has already claimed the worker decrements sleeper_count itself.
+		if (w.sleeping.exchange(false))
+			tss::sleeper_count.fetch_sub(1);
+
+		return;
+	}
+
+	// One of the sleeping workers is the timer keeper, it sleeps until the next timer expires.
+	// next_timer_ns is read after the claim, pairs with wake_timer_keeper.
+	worker* p_keeper = nullptr;
+	const bool timer_keeper = tss::p_timer_keeper.compare_exchange_strong(p_keeper, &w);
+
+	while (w.wake_epoch.load() == epoch) {
+		const uint64_t next_timer_ns = tss::next_timer_ns.load();
+		if (!timer_keeper || next_timer_ns == no_timer_ns) {
+			futex_wait(w.wake_epoch, epoch);
+			continue;
+		}
+
+		const uint64_t t = now_ns();
+		if (t >= next_timer_ns) break;
+
+		futex_wait_for(w.wake_epoch, epoch, next_timer_ns - t);
+	}
+
+	if (!timer_keeper) return;
+
+	tss::p_timer_keeper.store(nullptr);
+
+	// The keeper has woken up on its own, it services the timers.
+	if (w.sleeping.exchange(false)) {
+		tss::sleeper_count.fetch_sub(1);
+		return;
+	}
+
+	// The keeper has been woken up for other work, another sleeping worker takes its place.
+	if (tss::next_timer_ns.load() != no_timer_ns)
+		wake_workers(1);
+}
+
+// Wakes the timer keeper, so it sees a timer which expires earlier than the one it sleeps for.
+// If there is no keeper a sleeping worker is woken up to become one.
+void wake_timer_keeper() noexcept
+{
+	// pairs with the keeper claim in park_worker.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	worker* p_keeper = tss::p_timer_keeper.load();
+	if (p_keeper)
+		wake_worker(*p_keeper);
+	else
+		wake_workers(1);
+}
+
+// Called by the controller fiber each time the worker fiber has found nothing to do.
+// Spins, then yields and parks the thread at last according to the idle policy.
+void idle(worker& w) noexcept
+{
+	if (w.idle_count++ == 0) {
+		// the worker has been busy until now.
+		const uint64_t t = now_ns();
+		w.stats.busy_ns.add(t - w.stats.state_begin_ns);
+		w.stats.state_begin_ns = t;
+		record_trace(w, trace_event_type::idle_begin);
+	}
+
+	if (tss::idle_policy == task_idle_policy::spin || w.idle_count <= tss::idle_spin_count) {
+		cpu_pause();
+	}
+	else if (w.idle_count <= tss::idle_spin_count + tss::idle_yield_count) {
+		std::this_thread::yield();
+	}
+	else {
+		// the whole task system is about to sleep.
+		if (tss::trim_idle_fibers && tss::sleeper_count.load(std::memory_order_relaxed) + 1 == tss::workers.size()) {
+			tss::p_fiber_pool->trim();
+			if (tss::p_large_fiber_pool) tss::p_large_fiber_pool->trim();
+		}
+
+		const uint64_t t = now_ns();
+		w.stats.spin_ns.add(t - w.stats.state_begin_ns);
+		record_trace(w, trace_event_type::sleep_begin);
+		park_worker(w);
+		record_trace(w, trace_event_type::sleep_end);
+		record_trace(w, trace_event_type::idle_end);
+		w.stats.state_begin_ns = now_ns();
+		w.stats.idle_ns.add(w.stats.state_begin_ns - t);
+		w.idle_count = 0;
+	}
+}
+
+// Called by the controller fiber each time the worker has found something to do.
+void end_idle(worker& w) noexcept
+{
+	if (w.idle_count == 0) return;
+
+	const uint64_t t = now_ns();
+	w.stats.spin_ns.add(t - w.stats.state_begin_ns);
+	w.stats.state_begin_ns = t;
+	w.idle_count = 0;
+	record_trace(w, trace_event_type::idle_end);
+}
+
+// Accounts the time since the last idle state change when the worker stops.
+void finish_worker_stats(worker& w) noexcept
+{
+	const uint64_t t = now_ns();
+	if (w.idle_count > 0) {
+		w.stats.spin_ns.add(t - w.stats.state_begin_ns);
+		record_trace(w, trace_event_type::idle_end);
+	}
+	else {
+		w.stats.busy_ns.add(t - w.stats.state_begin_ns);
+	}
+
+	w.stats.state_begin_ns = t;
+}
+
+// Merges the statistics of the workers.
+task_system_report collect_report()
+{
+	task_system_report report;
+	report.spawned_task_count = tss::external_spawned_task_count.load(std::memory_order_relaxed);
+	report.queue_full_count = tss::external_queue_full_count.load(std::memory_order_relaxed);
+	report.overflow_task_count = tss::external_overflow_task_count.load(std::memory_order_relaxed);
+	report.fiber_created_count = tss::p_fiber_pool->created_count();
+	report.workers.resize(tss::workers.size());
+
+	for (size_t i = 0; i < tss::workers.size(); ++i) {
+		const worker_stats& s = tss::workers[i]->stats;
+		task_worker_report& r = report.workers[i];
+
+		for (const stat_counter& c : s.task_counts)
+			r.task_count += c.get();
+
+		r.spawned_task_count = s.spawned_task_count.get();
+		r.fiber_switch_count = s.fiber_switch_count.get();
+		r.park_count = s.park_count.get();
+		r.resume_count = s.resume_count.get();
+		r.queue_full_count = s.queue_full_count.get();
+		r.overflow_task_count = s.overflow_task_count.get();
+		r.busy_ns = s.busy_ns.get();
+		r.spin_ns = s.spin_ns.get();
+		r.idle_ns = s.idle_ns.get();
+
+		report.task_immediate_count += size_t(s.task_counts[size_t(task_priority::high)].get());
+		report.task_background_count += size_t(s.task_counts[size_t(task_priority::background)].get());
+		report.task_count += size_t(r.task_count);
+		report.spawned_task_count += size_t(r.spawned_task_count);
+		report.fiber_switch_count += size_t(r.fiber_switch_count);
+		report.park_count += size_t(r.park_count);
+		report.resume_count += size_t(r.resume_count);
+		report.queue_full_count += size_t(r.queue_full_count);
+		report.overflow_task_count += size_t(r.overflow_task_count);
+		report.fiber_high_water_count = std::max(report.fiber_high_water_count,
+			size_t(s.fiber_high_water_count.get()));
+		report.fiber_soft_limit_exceeded_count += size_t(s.fiber_soft_limit_exceeded_count.get());
+		report.wait_list_high_water_count = std::max(report.wait_list_high_water_count,
+			size_t(s.wait_list_high_water_count.get()));
+		report.fiber_stack_peak_byte_count = std::max(report.fiber_stack_peak_byte_count,
+			size_t(s.fiber_stack_peak_byte_count.get()));
+		report.large_fiber_stack_peak_byte_count = std::max(report.large_fiber_stack_peak_byte_count,
+			size_t(s.large_fiber_stack_peak_byte_count.get()));
+	}
+
+	return report;
+}
+
+// Writes the trace events of the workers to the file.
+void write_trace(const std::string& file_path, const std::vector<std::unique_ptr<trace_buffer>>& traces,
+	const trace_clock& clock, const void* p_kernel_fiber)
+{
+	std::vector<const trace_buffer*> buffers;
+	for (const auto& p_trace : traces)
+		buffers.push_back(p_trace.get());
+
+	std::ofstream file(file_path, std::ios::out | std::ios::trunc);
+	if (!file) throw std::runtime_error("Failed to open the trace file: " + file_path);
+
+	write_chrome_trace(file, buffers, clock, p_kernel_fiber);
+	if (!file) throw std::runtime_error("Failed to write the trace file: " + file_path);
+}
+
+// Stops the task system and wakes the workers, so they can see it.
+void stop_execution() noexcept
+{
+	tss::exec_flag = false;
+	wake_all_workers();
+}
+
+// Spawns the task of a ready counter continuation and frees the continuation.
+void spawn_counter_continuation(fiber_wait_record* p_record)
+{
+	static_assert(std::is_standard_layout<counter_continuation>::value,
+		"counter_continuation must be standard layout, its record is cast to it.");
+
+	counter_continuation* p_cont = reinterpret_cast<counter_continuation*>(p_record);
+	run(&p_cont->func, 1, p_cont->priority);
+
+	p_cont->~counter_continuation();
+	free_pooled_block(p_cont, sizeof(counter_continuation));
+}
+
+// Resumes the fibers which wait for the counter. A fiber is resumed by its home worker if it has one
+// (the kernel fiber), otherwise by the current worker. A thread outside the task system
+// hands the fibers to the workers round-robin.
+void notify_waiters(const std::atomic_size_t* p_wait_counter)
+{
+	fiber_wait_record* p_record = tss::p_wait_table->notify(p_wait_counter);
+
+	while (p_record) {
+		fiber_wait_record* p_next = p_record->p_next;
+		tss::wait_record_count.fetch_sub(1, std::memory_order_relaxed);
+
+		if (!p_record->p_fiber) {
+			spawn_counter_continuation(p_record);
+			p_record = p_next;
+			continue;
+		}
+
+		worker* p_target = static_cast<worker*>(p_record->p_data);
+		if (!p_target) p_target = tss::p_worker;
+		if (!p_target) {
+			const size_t index = tss::external_ready_index.fetch_add(1, std::memory_order_relaxed);
+			p_target = tss::workers[index % tss::workers.size()].get();
+		}
+
+		p_target->push_ready(p_record);
+
+		if (p_target != tss::p_worker) {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			wake_worker(*p_target);
+		}
+
+		p_record = p_next;
+	}
+}
+
+inline void exec_task(task& t)
+{
+	t.func();
+
+	if (t.p_wait_counter) {
+		assert(*t.p_wait_counter > 0);
+		if (t.p_wait_counter->fetch_sub(1) == 1)
+			notify_waiters(t.p_wait_counter);
+	}
+}
+
+// Resumes the spawners which wait for room in a queue (task_overflow_policy::park).
+// Called after a task has been taken from a shared queue.
+inline void notify_queue_space()
+{
+	if (tss::overflow_policy != task_overflow_policy::park) return;
+
+	// pairs with the fence in push_to_queue: either the spawner sees the room or we see the spawner.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (tss::queue_space_counter.load(std::memory_order_relaxed) == 0) return;
+
+	if (tss::queue_space_counter.exchange(0) != 0)
+		notify_waiters(&tss::queue_space_counter);
+}
+
+// Executes a task which has not fit into its queue right in the spawning fiber (task_overflow_policy::execute_inline).
+// The task gets a scratch allocator of its own, an exception goes to the spawner.
+void execute_inline(task& t, task_priority priority)
+{
+	if (tss::p_worker)
+		tss::p_worker->stats.task_counts[size_t(priority)].add();
+
+	scratch_allocator scratch;
+	scratch_allocator* p_scratch_allocator = tss::p_scratch_allocator;
+	tss::p_scratch_allocator = &scratch;
+
+	try {
+		exec_task(t);
+	}
+	catch (...) {
+		tss::p_scratch_allocator = p_scratch_allocator;
+		throw;
+	}
+
+	tss::p_scratch_allocator = p_scratch_allocator;
+}
+
+// ----- timers -----
+
+struct timer_deleter final {
+	void operator()(timer* p_timer) const noexcept
+	{
+		p_timer->~timer();
+		free_pooled_block(p_timer, sizeof(timer));
+	}
+};
+
+using timer_ptr = std::unique_ptr<timer, timer_deleter>;
+
+timer_ptr make_timer(timer_kind kind, uint64_t time_ns, task_priority priority)
+{
+	timer_ptr p_timer(new(allocate_pooled_block(sizeof(timer))) timer());
+	p_timer->kind = kind;
+	p_timer->time_ns = time_ns;
+	p_timer->priority = priority;
+	return p_timer;
+}
+
+// Must be called under timer_mutex.
+void update_next_timer_ns() noexcept
+{
+	const uint64_t tick = tss::p_timer_wheel->next_tick();
+	tss::next_timer_ns.store((tick == timer_wheel::no_tick)
+		? no_timer_ns
+		: tss::timer_start_ns + tick * tss::timer_tick_ns);
+}
+
+// Puts the timer into the wheel. The tick is rounded up, a timer never fires early.
+void schedule_timer(timer& t)
+{
+	assert(tss::p_timer_wheel);
+
+	const uint64_t tick = (t.time_ns > tss::timer_start_ns)
+		? (t.time_ns - tss::timer_start_ns + tss::timer_tick_ns - 1) / tss::timer_tick_ns
+		: 0;
+
+	t.node.p_data = &t;
+	bool earliest;
+	{
+		std::lock_guard<std::mutex> lock(tss::timer_mutex);
+		const uint64_t prev_next_timer_ns = tss::next_timer_ns.load(std::memory_order_relaxed);
+		tss::p_timer_wheel->insert(t.node, tick);
+		update_next_timer_ns();
+		earliest = (tss::next_timer_ns.load(std::memory_order_relaxed) < prev_next_timer_ns);
+	}
+
+	if (earliest)
+		wake_timer_keeper();
+}
+
+// Removes the timer from the wheel unless it has fired already. Once the function returns
+// the timer is not touched by anybody, see poll_timers.
+void cancel_timer(timer& t)
+{
+	std::lock_guard<std::mutex> lock(tss::timer_mutex);
+	if (!t.node.linked) return;
+
+	tss::p_timer_wheel->remove(t.node);
+	update_next_timer_ns();
+}
+
+// Spawns a task which runs the function of the periodic timer and schedules the timer again.
+void spawn_periodic_run(timer_ptr p_timer)
+{
+	const task_priority priority = p_timer->priority;
+
+	run([p_timer = std::move(p_timer)]() mutable {
+		if (!p_timer->periodic_func()) return;
+
+		// keep to the initial schedule, skip the periods which have been missed.
+		const uint64_t t = now_ns();
+		p_timer->time_ns += p_timer->period_ns;
+		if (p_timer->time_ns <= t)
+			p_timer->time_ns += ((t - p_timer->time_ns) / p_timer->period_ns + 1) * p_timer->period_ns;
+
+		schedule_timer(*p_timer.release());
+	}, priority);
+}
+
+// Fires the expired timers. An idle worker polls the timers each time it looks for a task,
+// a busy one after every worker::timer_poll_interval tasks. Returns true if some timers have fired.
+bool poll_timers(worker& w)
+{
+	const uint64_t next_timer_ns = tss::next_timer_ns.load(std::memory_order_relaxed);
+	if (next_timer_ns == no_timer_ns) return false;
+	if (w.found_task && ++w.timer_poll_count < worker::timer_poll_interval) return false;
+
+	w.timer_poll_count = 0;
+	const uint64_t t = now_ns();
+	if (t < next_timer_ns) return false;
+
+	// another worker is firing the timers.
+	std::unique_lock<std::mutex> lock(tss::timer_mutex, std::try_to_lock);
+	if (!lock) return false;
+
+	timer_node* p_node = tss::p_timer_wheel->advance((t - tss::timer_start_ns) / tss::timer_tick_ns);
+	update_next_timer_ns();
+
+	// Fibers are resumed under the lock: a fiber resumed by its other counter waits in cancel_timer
+	// until its timer is not touched anymore. The tasks are spawned after the lock has been released.
+	timer_node* p_spawn_list = nullptr;
+	while (p_node) {
+		timer_node* p_next = p_node->p_next;
+		timer& tm = *static_cast<timer*>(p_node->p_data);
+
+		if (tm.kind == timer_kind::wake) {
+			if (tm.p_wait_counter->fetch_sub(1) == 1)
+				notify_waiters(tm.p_wait_counter);
+		}
+		else {
+			p_node->p_next = p_spawn_list;
+			p_spawn_list = p_node;
+		}
+
+		p_node = p_next;
+	}
+
+	lock.unlock();
+
+	while (p_spawn_list) {
+		timer_ptr p_timer(static_cast<timer*>(p_spawn_list->p_data));
+		p_spawn_list = p_spawn_list->p_next;
+
+		if (p_timer->kind == timer_kind::periodic)
+			spawn_periodic_run(std::move(p_timer));
+		else
+			run(&p_timer->func, 1, p_timer->priority);
+	}
+
+	return true;
+}
+
+// Frees the timers which are still pending when the task system stops.
+void drop_timers(timer_wheel& wheel) noexcept
+{
+	timer_node* p_node = wheel.clear();
+	while (p_node) {
+		timer_node* p_next = p_node->p_next;
+		timer* p_timer = static_cast<timer*>(p_node->p_data);
+
+		// the fiber of a wake timer has been abandoned, the timer lives on its stack.
+		if (p_timer->kind != timer_kind::wake)
+			timer_deleter()(p_timer);
+
+		p_node = p_next;
+	}
+}
+
+// Executes the task in the current fiber (a worker fiber or a large stack fiber).
+// The scratch memory of the task is released when the task completes.
+void execute_task(task& t, bool large_stack)
+{
+	scratch_allocator scratch;
+	tss::p_scratch_allocator = &scratch;
+
+	record_fiber_trace(trace_event_type::task_begin);
+	try {
+		exec_task(t);
+	}
+	catch (...) {
+		tss::exception_slot.set_exception(std::current_exception());
+	}
+
+	// the fiber may have been resumed by another worker.
+	record_fiber_trace(trace_event_type::task_end);
+	tss::p_scratch_allocator = nullptr;
+
+	if (tss::measure_stack_usage) {
+		worker_stats& s = tss::p_worker->stats;
+		stat_counter& peak = large_stack ? s.large_fiber_stack_peak_byte_count : s.fiber_stack_peak_byte_count;
+		peak.raise_to(current_fiber_stack_usage());
+	}
+}
+
+// Returns the index of a zero counter (wait any) or 0 if all the counters are zero (wait all).
+// Returns fiber_wait_record::no_index if the fiber has to wait. first_index is checked first.
+size_t find_zero_counter(const std::atomic_size_t* const* p_wait_counters, size_t count, bool wait_all,
+	size_t first_index = 0) noexcept
+{
+	for (size_t k = 0; k < count; ++k) {
+		const size_t i = (first_index + k) % count;
+		if (p_wait_counters[i]->load() > 0) {
+			if (wait_all) return fiber_wait_record::no_index;
+			continue;
+		}
+
+		if (!wait_all) return i;
+	}
+
+	return (wait_all) ? 0 : fiber_wait_record::no_index;
+}
+
+// Suspends the current fiber until all/any of the counters reach zero.
+// Returns the index of a counter which has been seen equal to zero.
+size_t wait_for_counters(const std::atomic_size_t* const* p_wait_counters, size_t count, bool wait_all)
+{
+	assert(current_fiber() != tss::p_controller_fiber);
+	assert(p_wait_counters);
+	assert(count > 0);
+
+	// fast path: no need to suspend the fiber.
+	size_t index = find_zero_counter(p_wait_counters, count, wait_all);
+	if (index != fiber_wait_record::no_index) return index;
+
+	constexpr size_t local_node_count = 8;
+	fiber_wait_node local_nodes[local_node_count];
+	std::unique_ptr<fiber_wait_node[]> p_heap_nodes;
+	fiber_wait_node* p_nodes = local_nodes;
+	if (count > local_node_count) {
+		p_heap_nodes.reset(new fiber_wait_node[count]);
+		p_nodes = p_heap_nodes.get();
+	}
+
+	for (size_t i = 0; i < count; ++i)
+		p_nodes[i].p_wait_counter = p_wait_counters[i];
+
+	fiber_wait_record record;
+	record.p_fiber = current_fiber();
+	record.p_data = (record.p_fiber == tss::p_kernel_fiber) ? tss::workers[0].get() : nullptr;
+	record.p_nodes = p_nodes;
+	record.node_count = count;
+	record.wait_all = wait_all;
+
+	// A counter may be re-armed between the notify and the resumption, the fiber waits again then.
+	do {
+		// The controller fiber parks the record once the current fiber is suspended.
+		// The thread which resumes the fiber runs other tasks meanwhile, their scratch allocators replace ours.
+		scratch_allocator* p_scratch_allocator = tss::p_scratch_allocator;
+		tss::p_wait_record = &record;
+		switch_to_fiber(tss::p_controller_fiber);
+		tss::p_scratch_allocator = p_scratch_allocator;
+
+		// wait all: every node has been removed by notify.
+		if (!wait_all)
+			tss::p_wait_table->unpark(record);
+
+		const size_t ready_index = record.ready_index.load(std::memory_order_relaxed);
+		assert(ready_index != fiber_wait_record::no_index);
+		index = find_zero_counter(p_wait_counters, count, wait_all, ready_index);
+	} while (index == fiber_wait_record::no_index);
+
+	return index;
+}
+
+// Tries to steal tasks from other workers, closer victims first (see worker::victims). Within a tier
+// the victims are tried starting from a random one. On success the first stolen slot is returned,
+// the rest of them are pushed into the thief's deque.
+task_slot* steal_task_slots(worker& thief)
+{
+	task_slot* stolen_slots[worker::steal_count_limit];
+
+	size_t tier_begin = 0;
+	for (const size_t tier_end : thief.victim_tier_ends) {
+		const size_t tier_size = tier_end - tier_begin;
+		const size_t offset = (tier_size > 1) ? thief.next_random() % tier_size : 0;
+
+		for (size_t i = 0; i < tier_size; ++i) {
+			worker& victim = *tss::workers[thief.victims[tier_begin + (offset + i) % tier_size]];
+			const size_t count = victim.deque.try_steal_half(stolen_slots, worker::steal_count_limit);
+			if (count == 0) continue;
+
+			// Stealing happens only if the thief's deque is empty, there is always enough room.
+			for (size_t k = 1; k < count; ++k) {
+				const bool r = thief.deque.try_push(stolen_slots[k]);
+				assert(r);
+			}
+
+			return stolen_slots[0];
+		}
 
-	// The following fields represents thread local communication channel between 
-	// the thread controller fiber and a worker fiber which is executed in the current thread.
-	// 
-	static thread_local void* 						p_controller_fiber;
-	static thread_local const std::atomic_size_t*	p_wait_list_counter;
+		tier_begin = tier_end;
+	}
+
+	return nullptr;
+}
+
+// Takes several tasks from the injection queue at once. The first one goes to out_task,
+// the rest of them are moved to the worker's deque. Returns false if the injection queue is empty.
+bool pop_injected_tasks(worker& w, task& out_task)
+{
+	// there have to be enough free slots for the tasks which go to the deque.
+	task_slot* slots[worker::injection_batch_size - 1];
+	size_t slot_count = 0;
+	for (; slot_count < worker::injection_batch_size - 1; ++slot_count) {
+		slots[slot_count] = w.acquire_slot();
+		if (!slots[slot_count]) break;
+	}
+
+	task tasks[worker::injection_batch_size];
+	const size_t count = tss::p_queue->try_pop_bulk(tasks, slot_count + 1);
+
+	if (count > 0) {
+		notify_queue_space();
+		out_task = std::move(tasks[0]);
+
+		for (size_t i = 1; i < count; ++i) {
+			slots[i - 1]->value = std::move(tasks[i]);
+			const bool r = w.deque.try_push(slots[i - 1]);
+			assert(r);
+		}
+	}
+
+	// give back the slots which have not been used.
+	for (size_t i = (count > 0) ? count - 1 : 0; i < slot_count; ++i)
+		w.release_slot(slots[i]);
+
+	return (count > 0);
+}
+
+// Pops a normal priority task from the worker's deque, the injection queue or steals one from another worker.
+bool pop_normal_task(worker& w, task& out_task)
+{
+	task_slot* p_slot = nullptr;
+	if (!w.deque.try_pop(p_slot)) {
+		if (!tss::p_queue->empty() && pop_injected_tasks(w, out_task)) return true;
+
+		p_slot = steal_task_slots(w);
+		if (!p_slot) return false;
+	}
+
+	out_task = std::move(p_slot->value);
+	p_slot->p_owner->release_slot(p_slot);
+	return true;
+}
+
+// Pops the next task the current thread has to execute according to the task priorities.
+bool pop_task(task& out_task)
+{
+	worker* p_worker = tss::p_worker;
+	assert(p_worker);
+
+	// high priority tasks go first
+	if (!tss::p_queue_immediate->empty() && tss::p_queue_immediate->try_pop(out_task)) {
+		notify_queue_space();
+		p_worker->stats.task_counts[size_t(task_priority::high)].add();
+		return true;
+	}
+
+	// aging: give a background task its turn after a long streak of normal ones.
+	if (p_worker->normal_task_streak >= tss::background_aging_count) {
+		p_worker->normal_task_streak = 0;
+
+		if (!tss::p_queue_background->empty() && tss::p_queue_background->try_pop(out_task)) {
+			notify_queue_space();
+			p_worker->stats.task_counts[size_t(task_priority::background)].add();
+			return true;
+		}
+	}
+
+	if (pop_normal_task(*p_worker, out_task)) {
+		++p_worker->normal_task_streak;
+		p_worker->stats.task_counts[size_t(task_priority::normal)].add();
+		return true;
+	}
+
+	p_worker->normal_task_streak = 0;
+	if (!tss::p_queue_background->empty() && tss::p_queue_background->try_pop(out_task)) {
+		notify_queue_space();
+		p_worker->stats.task_counts[size_t(task_priority::background)].add();
+		return true;
+	}
+
+	return false;
+}
+
+// Pushes count tasks into the queue, the i-th task is make_task(i).
+// The tasks which do not fit are handled according to the policy, see task_overflow_policy.
+template<typename MakeTask>
+void push_to_queue(task_queue& queue, size_t count, task_priority priority, task_overflow_policy policy,
+	MakeTask make_task)
+{
+	if (queue.try_emplace_bulk(count, make_task)) return;
+
+	count_queue_full();
+	if (policy == task_overflow_policy::spill) {
+		count_overflow_tasks(count);
+		queue.spill_bulk(count, make_task);
+		return;
+	}
+
+	// The queue is full, the workers have enough to do. Some of the tasks may still fit one by one.
+	wake_workers(count);
+	for (size_t i = 0; i < count; ++i) {
+		auto make_ith_task = [&make_task, i](size_t) { return make_task(i); };
+		if (queue.try_emplace_bulk(1, make_ith_task)) continue;
+
+		count_overflow_tasks(1);
+		if (policy == task_overflow_policy::execute_inline) {
+			task t = make_task(i);
+			execute_inline(t, priority);
+			continue;
+		}
+
+		// A thread which is not a part of the task system can't be suspended, it yields.
+		do {
+			if (tss::p_worker) {
+				tss::queue_space_counter.store(1);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (queue.try_emplace_bulk(1, make_ith_task)) break;
+
+				wait_for(tss::queue_space_counter);
+			}
+			else {
+				std::this_thread::yield();
+			}
+		} while (!queue.try_emplace_bulk(1, make_ith_task));
+	}
+}
+
+// Pushes count tasks into the queue which corresponds to the priority.
+// The function of the i-th task is constructed right inside its slot by the factory make_factory(i) returns.
+// The wait counter is either assigned count or incremented by count (join_wait_counter == true).
+template<typename MakeFactory>
+void push_tasks(size_t count, task_priority priority, std::atomic_size_t* p_wait_counter,
+	bool join_wait_counter, MakeFactory make_factory)
+{
+	assert(tss::p_queue);
+	assert(count > 0);
+
+	if (tss::p_worker)
+		tss::p_worker->stats.spawned_task_count.add(count);
+	else
+		tss::external_spawned_task_count.fetch_add(count, std::memory_order_relaxed);
+
+	record_fiber_trace(trace_event_type::spawn, uint32_t(count));
+
+	if (p_wait_counter) {
+		if (join_wait_counter)
+			p_wait_counter->fetch_add(count);
+		else
+			*p_wait_counter = count;
+	}
+
+	if (priority != task_priority::normal) {
+		task_queue* p_queue = (priority == task_priority::high)
+			? tss::p_queue_immediate
+			: tss::p_queue_background;
+
+		push_to_queue(*p_queue, count, priority, tss::overflow_policy, [&make_factory, p_wait_counter](size_t i) {
+			return task{ task_func(make_factory(i)), p_wait_counter };
+		});
+
+		wake_workers(count);
+		return;
+	}
+
+	// Tasks spawned by worker fibers go to the current thread's deque,
+	// tasks from the kernel fiber and from foreign threads go to the injection queue.
+	worker* p_worker = tss::p_worker;
+	if (p_worker && current_fiber() == tss::p_kernel_fiber)
+		p_worker = nullptr;
+
+	size_t slot_count = 0;
+	for (; p_worker && slot_count < count; ++slot_count) {
+		task_slot* p_slot = p_worker->acquire_slot();
+		if (!p_slot) break;
+
+		p_slot->value.func.assign(make_factory(slot_count));
+		p_slot->value.p_wait_counter = p_wait_counter;
+		const bool r = p_worker->deque.try_push(p_slot);
+		assert(r);
+	}
+
+	// the rest of the tasks go to the injection queue in one batch.
+	if (slot_count < count) {
+		if (p_worker) count_queue_full();
+
+		push_to_queue(*tss::p_queue, count - slot_count, priority, tss::overflow_policy,
+			[&make_factory, slot_count, p_wait_counter](size_t i) {
+				return task{ task_func(make_factory(slot_count + i)), p_wait_counter };
+			});
+	}
+
+	wake_workers(count);
+}
+
+// The logical CPUs a thread of the task system is pinned to. Empty cpus means the thread is not pinned.
+struct worker_placement final {
+	std::vector<uint32_t>	cpus;
+	uint32_t				cache_id = 0;
+	uint32_t				numa_node = 0;
 };
 
-concurrent_queue<task>*					tss::p_queue = nullptr;
-concurrent_queue<task>*					tss::p_queue_immediate = nullptr;
-exception_slot							tss::exception_slot;
-task_system_report						tss::report;
-std::atomic_bool						tss::exec_flag = false;
-thread_local void*						tss::p_controller_fiber = nullptr;
-thread_local const std::atomic_size_t*	tss::p_wait_list_counter = nullptr;
+// Distributes the threads of the task system over the logical CPUs according to desc.thread_affinity.
+std::vector<worker_placement> place_workers(const task_system_desc& desc)
+{
+	std::vector<worker_placement> placements(desc.thread_count);
+	if (desc.thread_affinity == task_thread_affinity::none && desc.cpu_set.empty())
+		return placements;
 
-// ----- funcs ------
+	std::vector<cpu_info> cpus = get_cpu_topology().cpus;
+	if (!desc.cpu_set.empty()) {
+		cpus.erase(std::remove_if(cpus.begin(), cpus.end(), [&desc](const cpu_info& c) {
+			return std::find(desc.cpu_set.cbegin(), desc.cpu_set.cend(), c.index) == desc.cpu_set.cend();
+		}), cpus.end());
+	}
 
-inline void exec_task(task& t)
+	if (cpus.empty())
+		throw std::invalid_argument("None of the CPUs of task_system_desc::cpu_set is available to the process.");
+
+	// Neighbouring threads get close CPUs.
+	std::sort(cpus.begin(), cpus.end(), [](const cpu_info& l, const cpu_info& r) {
+		if (l.numa_node != r.numa_node) return l.numa_node < r.numa_node;
+		if (l.package_id != r.package_id) return l.package_id < r.package_id;
+		if (l.cache_id != r.cache_id) return l.cache_id < r.cache_id;
+		if (l.core_id != r.core_id) return l.core_id < r.core_id;
+		return l.index < r.index;
+	});
+
+	if (desc.thread_affinity == task_thread_affinity::none) {
+		std::vector<uint32_t> all_cpus;
+		for (const cpu_info& c : cpus)
+			all_cpus.push_back(c.index);
+
+		// The threads are not pinned to particular CPUs, so they are considered equally close to each other.
+		for (worker_placement& p : placements)
+			p.cpus = all_cpus;
+
+		return placements;
+	}
+
+	// The first CPU of each core goes first, then the second ones and so on.
+	// cores[k] is the range of the k-th core's CPUs in cpus.
+	std::vector<std::pair<size_t, size_t>> cores;
+	for (size_t i = 0; i < cpus.size(); ++i) {
+		if (cores.empty() || cpus[cores.back().first].core_id != cpus[i].core_id)
+			cores.emplace_back(i, i);
+		++cores.back().second;
+	}
+
+	std::vector<const cpu_info*> order;
+	for (size_t sibling = 0; order.size() < cpus.size(); ++sibling) {
+		for (const auto& core : cores) {
+			if (core.first + sibling < core.second)
+				order.push_back(&cpus[core.first + sibling]);
+		}
+	}
+
+	for (size_t i = 0; i < placements.size(); ++i) {
+		worker_placement& p = placements[i];
+
+		if (desc.thread_affinity == task_thread_affinity::logical_cpu) {
+			const cpu_info& c = *order[i % order.size()];
+			p.cpus.push_back(c.index);
+			p.cache_id = c.cache_id;
+			p.numa_node = c.numa_node;
+		}
+		else {
+			const auto& core = cores[i % cores.size()];
+			for (size_t k = core.first; k < core.second; ++k)
+				p.cpus.push_back(cpus[k].index);
+			p.cache_id = cpus[core.first].cache_id;
+			p.numa_node = cpus[core.first].numa_node;
+		}
+	}
+
+	return placements;
+}
+
+// Pins the calling thread, constructs its worker and waits until all the workers are constructed.
+// The worker is constructed by its own thread, so its deque and task slots are first touched
+// (and placed by the OS) on the worker's NUMA node.
+void start_worker(size_t worker_index, const task_system_desc& desc, const std::vector<worker_placement>& placements)
 {
-	t.func();
+	const worker_placement& placement = placements[worker_index];
+	if (!placement.cpus.empty())
+		set_current_thread_affinity(placement.cpus);
 
-	if (t.p_wait_counter) {
-		assert(*t.p_wait_counter > 0);
-		--(*t.p_wait_counter);
+	std::unique_ptr<worker> p_worker = std::make_unique<worker>(worker_index, desc.queue_size);
+	if (desc.trace_event_count > 0)
+		p_worker->p_trace = std::make_unique<trace_buffer>(desc.trace_event_count);
+
+	// Victim tiers: the same last level cache, the same NUMA node, the rest.
+	// Unpinned workers know nothing about their neighbours, all the victims are in the last tier.
+	for (size_t tier = 0; tier < 3; ++tier) {
+		for (size_t i = 0; i < placements.size(); ++i) {
+			if (i == worker_index) continue;
+
+			const worker_placement& other = placements[i];
+			const bool pinned = !placement.cpus.empty() && !other.cpus.empty();
+			const bool same_numa = pinned && (other.numa_node == placement.numa_node);
+			const bool same_cache = same_numa && (other.cache_id == placement.cache_id);
+			const size_t victim_tier = same_cache ? 0 : (same_numa ? 1 : 2);
+			if (victim_tier == tier)
+				p_worker->victims.push_back(uint32_t(i));
+		}
+
+		p_worker->victim_tier_ends[tier] = p_worker->victims.size();
 	}
+
+	tss::workers[worker_index] = std::move(p_worker);
+	tss::started_worker_count.fetch_add(1, std::memory_order_release);
+
+	while (tss::started_worker_count.load(std::memory_order_acquire) < placements.size())
+		std::this_thread::yield();
+
+	tss::workers[worker_index]->stats.state_begin_ns = now_ns();
 }
 
-void kernel_fiber_func(void* data)
+// Parks the record of the fiber which has just been suspended. Returns true if the fiber may go on right away.
+bool park_fiber(worker& w, fiber_wait_record& record)
+{
+	const size_t wait_record_count = tss::wait_record_count.fetch_add(1, std::memory_order_relaxed) + 1;
+	if (tss::p_wait_table->park(record)) {
+		tss::wait_record_count.fetch_sub(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	w.stats.park_count.add();
+	w.stats.wait_list_high_water_count.raise_to(wait_record_count);
+	record_trace(w, trace_event_type::park, record.p_fiber);
+	return false;
+}
+
+// Takes a regular fiber from the pool. If the pool has reached task_system_desc::fiber_hard_limit,
+// the task system is stopped with an exception and nullptr is returned.
+void* pop_pool_fiber(worker& w, fiber_pool& fiber_pool)
 {
-	kernel_func_t p_kernel_func = static_cast<kernel_func_t>(data);
+	void* p_fiber = fiber_pool.pop(w.index);
+	if (!p_fiber) {
+		tss::exception_slot.set_exception(std::make_exception_ptr(std::runtime_error(
+			"All the fibers are in use, see task_system_desc::fiber_hard_limit.")));
+		stop_execution();
+		return nullptr;
+	}
 
-	try {
-		p_kernel_func();
+	const size_t in_use_count = tss::fiber_in_use_count.fetch_add(1, std::memory_order_relaxed) + 1;
+	w.stats.fiber_high_water_count.raise_to(in_use_count);
+	if (in_use_count > tss::fiber_soft_limit)
+		w.stats.fiber_soft_limit_exceeded_count.add();
+
+	return p_fiber;
+}
+
+void push_pool_fiber(worker& w, fiber_pool& fiber_pool, void* p_fiber)
+{
+	fiber_pool.push_back(p_fiber, w.index);
+	tss::fiber_in_use_count.fetch_sub(1, std::memory_order_relaxed);
+}
+
+// Called by the controller fiber when p_fiber has finished its current tasks. Returns the fiber to execute next:
+// a waiting fiber which has become ready, a large stack fiber if there are tasks for it or p_fiber itself.
+void* select_next_fiber(worker& w, fiber_pool& fiber_pool, void* p_fiber)
+{
+	// Regular tasks are not executed by large stack fibers. p_fiber == nullptr means that
+	// the worker needs a regular fiber unless it switches to another one.
+	if (w.large_fiber_done) {
+		w.large_fiber_done = false;
+		tss::p_large_fiber_pool->push_back(p_fiber, w.index);
+		p_fiber = nullptr;
 	}
-	catch (...) {
-		tss::exception_slot.set_exception(std::current_exception());
+
+	// If a waiting fiber is ready we return the current fiber back to the pool.
+	void* p_fbr = w.pop_ready_fiber();
+	if (p_fbr) {
+		if (p_fiber) push_pool_fiber(w, fiber_pool, p_fiber);
+		w.stats.resume_count.add();
+		record_trace(w, trace_event_type::resume, p_fbr);
+		end_idle(w);
+		return p_fbr;
+	}
+
+	if (tss::p_large_fiber_pool && !tss::p_queue_large->empty()) {
+		p_fbr = tss::p_large_fiber_pool->pop(w.index);
+		if (p_fbr) {
+			if (p_fiber) push_pool_fiber(w, fiber_pool, p_fiber);
+			end_idle(w);
+			return p_fbr;
+		}
+	}
+
+	if (!p_fiber)
+		p_fiber = pop_pool_fiber(w, fiber_pool);
+
+	if (w.found_task)
+		end_idle(w);
+	else
+		idle(w);
+
+	return p_fiber;
+}
+
+void kernel_fiber_func(void* data)
+{
+	kernel_func_t p_kernel_func = reinterpret_cast<kernel_func_t>(data);
+
+	{
+		scratch_allocator scratch;
+		tss::p_scratch_allocator = &scratch;
+
+		try {
+			p_kernel_func();
+		}
+		catch (...) {
+			tss::exception_slot.set_exception(std::current_exception());
+		}
+
+		tss::p_scratch_allocator = nullptr;
 	}
 
 	switch_to_fiber(tss::p_controller_fiber);
 }
 
-void kernel_thread_func(kernel_func_t p_kernel_func, fiber_pool& fiber_pool,
-	fiber_wait_list& fiber_wait_list)
+void kernel_thread_func(kernel_func_t p_kernel_func, fiber_pool& fiber_pool, const task_system_desc& desc,
+	const std::vector<worker_placement>& placements)
 {
+	start_worker(0, desc, placements);
+
 	thread_fiber_nature			tfn;
-	fiber						kernel_fiber(kernel_fiber_func, 1024, p_kernel_func);
-	const std::atomic_size_t*	p_kernel_wait_counter = nullptr;
+	fiber						kernel_fiber(kernel_fiber_func, desc.large_fiber_stack_byte_count,
+									reinterpret_cast<void*>(p_kernel_func), desc.fiber_stack_huge_pages);
 	void* 						p_fiber_to_exec = kernel_fiber.p_handle;
 
 
 	// init fiber execution context
 	tss::p_controller_fiber = tfn.p_handle;
-	tss::p_wait_list_counter = nullptr;
+	tss::p_wait_record = nullptr;
+	tss::p_worker = tss::workers[0].get();
+	tss::p_kernel_fiber = kernel_fiber.p_handle;
 
 	// main loop
+	worker& w = *tss::p_worker;
 	while (tss::exec_flag) {
+		w.stats.fiber_switch_count.add();
+		record_trace(w, trace_event_type::fiber_switch_to, p_fiber_to_exec);
 		switch_to_fiber(p_fiber_to_exec);
+		record_trace(w, trace_event_type::fiber_switch_back);
 		if (tss::exception_slot.has_exception()) {
-			tss::exec_flag = false;
-			return;
+			stop_execution();
+			break;
 		}
 
-		if (tss::p_wait_list_counter) {
-			// Fiber's code has called ts::wait_for.
-			// The current fiber must be put into the wait list.
-			if (p_kernel_wait_counter) {
-				fiber_wait_list.push(p_fiber_to_exec, tss::p_wait_list_counter);
-			}
-			else {
-				p_kernel_wait_counter = tss::p_wait_list_counter;
-				assert(p_fiber_to_exec == kernel_fiber.p_handle);
-			}
+		if (tss::p_wait_record) {
+			// Fiber's code has called ts::wait_for. The fiber is suspended now and can be parked.
+			// The kernel fiber's record points to workers[0], so it always comes back to this thread.
+			fiber_wait_record* p_record = tss::p_wait_record;
+			tss::p_wait_record = nullptr;
+			if (park_fiber(w, *p_record)) continue;
 
-			p_fiber_to_exec = fiber_pool.pop();
-			tss::p_wait_list_counter = nullptr;
+			p_fiber_to_exec = pop_pool_fiber(w, fiber_pool);
 		}
 		else {
 			// Fiber's code has finished its current tasks. No wait request occured.
 			// Check if the kernel fiber is completed. If so, then stop the task system.
-			if (p_kernel_wait_counter == nullptr) {
-				tss::exec_flag = false;
-				return;
-			}
-			
-			// Check if any of the waiting fibers are ready.
-			void* p_fbr = nullptr;
-
-			// If the kernel fiber is NOT ready we are going to exec any fiber from the wait list.
-			if (*p_kernel_wait_counter > 0) {
-				const bool r = fiber_wait_list.try_pop(p_fbr);
-			}
-			else {
-				// The kernel fiber is ready.
-				p_fbr = kernel_fiber.p_handle;
-				p_kernel_wait_counter = nullptr;
+			if (p_fiber_to_exec == kernel_fiber.p_handle) {
+				stop_execution();
+				break;
 			}
 
-			// If a waiting fiber has been found we return the current fiber back to the pool.
-			if (p_fbr) {
-				fiber_pool.push_back(p_fiber_to_exec);
-				p_fiber_to_exec = p_fbr;
-			}
+			p_fiber_to_exec = select_next_fiber(w, fiber_pool, p_fiber_to_exec);
 		}
 	} // while
+
+	finish_worker_stats(w);
 }
 
 void worker_fiber_func(void*)
 {
 	while (tss::exec_flag) {
-		// drain queue_immediate
+		const bool fired = poll_timers(*tss::p_worker);
 
-		// process regular tasks
+		// pop_task drains the immediate queue before any other task is taken.
 		task t;
-		const bool r = tss::p_queue->try_pop(t);
-		if (r) {
-			try {
-				exec_task(t);
-			}
-			catch (...) {
-				tss::exception_slot.set_exception(std::current_exception());
-			}
+		const bool r = pop_task(t);
+		tss::p_worker->found_task = r || fired;
+		if (r)
+			execute_task(t, false);
+
+		switch_to_fiber(tss::p_controller_fiber);
+	}
+
+	switch_to_fiber(tss::p_controller_fiber);
+}
+
+// A large stack fiber executes one task of the large stack queue and goes back to its pool.
+void large_fiber_func(void*)
+{
+	while (tss::exec_flag) {
+		task t;
+		if (tss::p_queue_large->try_pop(t)) {
+			notify_queue_space();
+			tss::p_worker->stats.task_counts[size_t(task_priority::normal)].add();
+			tss::p_worker->found_task = true;
+			execute_task(t, true);
 		}
 
+		tss::p_worker->large_fiber_done = true;
 		switch_to_fiber(tss::p_controller_fiber);
 	}
 
 	switch_to_fiber(tss::p_controller_fiber);
 }
 
-void worker_thread_func(fiber_pool& fiber_pool, fiber_wait_list& fiber_wait_list)
+void worker_thread_func(size_t worker_index, fiber_pool& fiber_pool, const task_system_desc& desc,
+	const std::vector<worker_placement>& placements)
 {
+	start_worker(worker_index, desc, placements);
+
 	thread_fiber_nature	tmf;
-	void* 				p_fiber_to_exec = fiber_pool.pop();
+	worker&				w = *tss::workers[worker_index];
+	void* 				p_fiber_to_exec = pop_pool_fiber(w, fiber_pool);
 
 	// init fiber execution context (thread_local part of the tss)
 	tss::p_controller_fiber = tmf.p_handle;
-	tss::p_wait_list_counter = nullptr;
+	tss::p_wait_record = nullptr;
+	tss::p_worker = &w;
 
 	// main loop
 	while (tss::exec_flag) {
+		w.stats.fiber_switch_count.add();
+		record_trace(w, trace_event_type::fiber_switch_to, p_fiber_to_exec);
 		switch_to_fiber(p_fiber_to_exec);
+		record_trace(w, trace_event_type::fiber_switch_back);
 		if (tss::exception_slot.has_exception()) {
-			tss::exec_flag = false;
-			return;
+			stop_execution();
+			break;
 		}
 
-		if (tss::p_wait_list_counter) {
-			// Fiber's code has called ts::wait_for.
-			// The current fiber must be put into the wait list.
-			fiber_wait_list.push(p_fiber_to_exec, tss::p_wait_list_counter);
-			tss::p_wait_list_counter = nullptr;
+		if (tss::p_wait_record) {
+			// Fiber's code has called ts::wait_for. The fiber is suspended now and can be parked.
+			// If all the counters are already zero the fiber goes on right away.
+			fiber_wait_record* p_record = tss::p_wait_record;
+			tss::p_wait_record = nullptr;
+			if (park_fiber(w, *p_record)) continue;
 
-			p_fiber_to_exec = fiber_pool.pop();
-			assert(p_fiber_to_exec);
+			p_fiber_to_exec = pop_pool_fiber(w, fiber_pool);
 		}
 		else {
 			// Fiber's code has finished its current tasks. No wait request occured.
-			// Check if any of the waiting fibers are ready.
-			void* p_fpr;
-			const bool r = fiber_wait_list.try_pop(p_fpr);
-			if (r) {
-				fiber_pool.push_back(p_fiber_to_exec);
-				p_fiber_to_exec = p_fpr;
-			}
+			p_fiber_to_exec = select_next_fiber(w, fiber_pool, p_fiber_to_exec);
 		}
 	} // while
+
+	finish_worker_stats(w);
 }
 
 } // namespace
@@ -207,39 +1836,123 @@ task_system_report launch_task_system(const task_system_desc& desc, kernel_func_
 
 	try {
 		// init the task system
-		concurrent_queue<task>	queue(desc.queue_size);
-		concurrent_queue<task>	queue_immediate(desc.queue_immediate_size);
-		fiber_pool				fiber_pool(desc.fiber_count, worker_fiber_func, desc.fiber_stack_byte_count);
-		fiber_wait_list			fiber_wait_list(desc.fiber_count);
-		
+		task_queue				queue(desc.queue_type, desc.queue_size);
+		task_queue				queue_immediate(desc.queue_type, desc.queue_immediate_size);
+		task_queue				queue_background(desc.queue_type, desc.queue_background_size);
+		const size_t			fiber_hard_limit = (desc.fiber_hard_limit > 0)
+									? desc.fiber_hard_limit : 4 * desc.fiber_count;
+		fiber_pool				fiber_pool(fiber_hard_limit, worker_fiber_func, desc.fiber_stack_byte_count,
+									nullptr, desc.thread_count, desc.fiber_stack_huge_pages, desc.fiber_chunk_size);
+		fiber_wait_table		wait_table(desc.fiber_count + desc.large_fiber_count);
+		timer_wheel				timer_wheel;
+
+		// Large stack fibers are created only if somebody needs them.
+		std::unique_ptr<task_queue>	p_queue_large;
+		std::unique_ptr<ts::fiber_pool>	p_large_fiber_pool;
+		if (desc.large_fiber_count > 0) {
+			p_queue_large = std::make_unique<task_queue>(desc.queue_type, desc.queue_large_size);
+			p_large_fiber_pool = std::make_unique<ts::fiber_pool>(desc.large_fiber_count, large_fiber_func,
+				desc.large_fiber_stack_byte_count, nullptr, desc.thread_count, desc.fiber_stack_huge_pages,
+				desc.fiber_chunk_size);
+		}
+
+		// workers[0] belongs to the kernel thread. Each thread constructs its worker, see start_worker.
+		const std::vector<worker_placement> placements = place_workers(desc);
+		const std::vector<uint32_t> kernel_thread_affinity = get_current_thread_affinity();
+		tss::workers.resize(desc.thread_count);
+		tss::started_worker_count = 0;
+
 		tss::p_queue = &queue;
 		tss::p_queue_immediate = &queue_immediate;
+		tss::p_queue_background = &queue_background;
+		tss::p_queue_large = p_queue_large.get();
+		tss::p_fiber_pool = &fiber_pool;
+		tss::p_large_fiber_pool = p_large_fiber_pool.get();
+		tss::fiber_soft_limit = desc.fiber_count;
+		tss::trim_idle_fibers = desc.trim_idle_fibers;
+		tss::overflow_policy = desc.overflow_policy;
+		tss::p_wait_table = &wait_table;
+		tss::background_aging_count = desc.background_aging_count;
+		tss::idle_policy = desc.idle_policy;
+		tss::idle_spin_count = desc.idle_spin_count;
+		tss::idle_yield_count = desc.idle_yield_count;
+		tss::sleeper_count = 0;
+		tss::fiber_in_use_count = 0;
+		tss::wait_record_count = 0;
+		tss::external_spawned_task_count = 0;
+		tss::external_queue_full_count = 0;
+		tss::external_overflow_task_count = 0;
+		tss::external_ready_index = 0;
+		tss::queue_space_counter = 0;
+		tss::p_timer_wheel = &timer_wheel;
+		tss::next_timer_ns = no_timer_ns;
+		tss::timer_start_ns = now_ns();
+		tss::timer_tick_ns = desc.timer_tick_ns;
+		tss::p_timer_keeper = nullptr;
+		tss::report = task_system_report();
+		tss::exception_slot.set_exception(nullptr);
+		tss::trace_enabled = (desc.trace_event_count > 0);
+		tss::measure_stack_usage = desc.measure_fiber_stack_usage && !desc.fiber_stack_huge_pages;
+		const uint64_t trace_start_timestamp = read_trace_timestamp();
+		const uint64_t trace_start_ns = now_ns();
 		tss::exec_flag = true;
-		
+
 		// spawn new worker threads if needed
 		// desc.thread_count - 1 because 1 stands for the kernel thread
 		std::vector<std::thread> worker_threads;
 		worker_threads.reserve(desc.thread_count - 1);
 		for (size_t i = 0; i < desc.thread_count - 1; ++i) {
 			worker_threads.emplace_back(worker_thread_func,
+				i + 1,
 				std::ref(fiber_pool),
-				std::ref(fiber_wait_list));
+				std::cref(desc),
+				std::cref(placements));
 		}
 
 		// run the kernel thread's func. the kernel func is executed here.
-		kernel_thread_func(p_kernel_func, fiber_pool, fiber_wait_list);
+		kernel_thread_func(p_kernel_func, fiber_pool, desc, placements);
 		assert(!tss::exec_flag);
 
+		if (!placements[0].cpus.empty())
+			set_current_thread_affinity(kernel_thread_affinity);
+
 		// finilize the task system
 		queue.set_wait_allowed(false);
 		queue_immediate.set_wait_allowed(false);
+		queue_background.set_wait_allowed(false);
+		if (p_queue_large) p_queue_large->set_wait_allowed(false);
 		for (auto& th : worker_threads)
 			th.join();
 
+		tss::report = collect_report();
+
+		const trace_clock clock = calibrate_trace_clock(trace_start_timestamp, trace_start_ns);
+		const void* p_kernel_fiber = tss::p_kernel_fiber;
+		std::vector<std::unique_ptr<trace_buffer>> traces;
+		for (const auto& p_w : tss::workers)
+			traces.push_back(std::move(p_w->p_trace));
+
+		tss::p_queue = nullptr;
+		tss::p_queue_immediate = nullptr;
+		tss::p_queue_background = nullptr;
+		tss::p_queue_large = nullptr;
+		tss::p_fiber_pool = nullptr;
+		tss::p_large_fiber_pool = nullptr;
+		tss::workers.clear();
+		tss::p_wait_table = nullptr;
+		tss::p_kernel_fiber = nullptr;
+		tss::p_timer_wheel = nullptr;
+		drop_timers(timer_wheel);
+
+		if (tss::trace_enabled) {
+			tss::trace_enabled = false;
+			write_trace(desc.trace_file_path, traces, clock, p_kernel_fiber);
+		}
+
 		// only after all the threads have been joined we may rethrow.
 		if (tss::exception_slot.has_exception())
 			std::rethrow_exception(tss::exception_slot.exception());
-		
+
 		return tss::report;
 	}
 	catch (...) {
@@ -247,29 +1960,202 @@ task_system_report launch_task_system(const task_system_desc& desc, kernel_func_
 	}
 }
 
-void run(std::function<void()>* p_funcs, size_t count, std::atomic_size_t* p_wait_counter)
+task_system_report get_task_system_report()
 {
 	assert(tss::p_queue);
+	return collect_report();
+}
+
+void run(task_func* p_funcs, size_t count, task_priority priority, std::atomic_size_t* p_wait_counter)
+{
 	assert(p_funcs);
-	assert(count > 0);
+
+	push_tasks(count, priority, p_wait_counter, false, [p_funcs](size_t i) {
+		return task_func_factory::of(std::move(p_funcs[i]));
+	});
+}
+
+void run(std::function<void()>* p_funcs, size_t count, task_priority priority,
+	std::atomic_size_t* p_wait_counter)
+{
+	assert(p_funcs);
+
+	struct impl final {
+		static void construct(task_func& out_func, void* p_arg)
+		{
+			out_func = make_task_func(std::move(*static_cast<std::function<void()>*>(p_arg)));
+		}
+	};
+
+	push_tasks(count, priority, p_wait_counter, false, [p_funcs](size_t i) {
+		task_func_factory factory;
+		factory.p_construct = impl::construct;
+		factory.p_arg = &p_funcs[i];
+		return factory;
+	});
+}
+
+void run(const task_func_factory& factory, task_priority priority, std::atomic_size_t* p_wait_counter)
+{
+	push_tasks(1, priority, p_wait_counter, false, [&factory](size_t) { return factory; });
+}
+
+void run_joined(const task_func_factory& factory, task_priority priority, std::atomic_size_t& wait_counter)
+{
+	push_tasks(1, priority, &wait_counter, true, [&factory](size_t) { return factory; });
+}
+
+void run_joined(task_func* p_funcs, size_t count, task_priority priority, std::atomic_size_t& wait_counter)
+{
+	assert(p_funcs);
+
+	push_tasks(count, priority, &wait_counter, true, [p_funcs](size_t i) {
+		return task_func_factory::of(std::move(p_funcs[i]));
+	});
+}
+
+void run_on_large_stack(const task_func_factory& factory, std::atomic_size_t* p_wait_counter)
+{
+	assert(tss::p_large_fiber_pool && "task_system_desc::large_fiber_count is zero.");
+
+	if (tss::p_worker)
+		tss::p_worker->stats.spawned_task_count.add();
+	else
+		tss::external_spawned_task_count.fetch_add(1, std::memory_order_relaxed);
+
+	record_fiber_trace(trace_event_type::spawn, 1);
 
 	if (p_wait_counter)
-		*p_wait_counter = count;
+		*p_wait_counter = 1;
 
-	for (size_t i = 0; i < count; ++i)
-		tss::p_queue->emplace(std::move(p_funcs[i]), p_wait_counter);
+	// the spawner's stack may be too small for the task.
+	const task_overflow_policy policy = (tss::overflow_policy == task_overflow_policy::execute_inline)
+		? task_overflow_policy::spill
+		: tss::overflow_policy;
+
+	push_to_queue(*tss::p_queue_large, 1, task_priority::normal, policy, [&factory, p_wait_counter](size_t) {
+		return task{ task_func(factory), p_wait_counter };
+	});
+
+	wake_workers(1);
+}
+
+void decrement_wait_counter(std::atomic_size_t& wait_counter)
+{
+	assert(wait_counter > 0);
+	if (wait_counter.fetch_sub(1) == 1)
+		notify_waiters(&wait_counter);
+}
+
+void run_when_zero(const std::atomic_size_t& wait_counter, task_func&& func, task_priority priority)
+{
+	assert(func);
+
+	void* p = allocate_pooled_block(sizeof(counter_continuation));
+	counter_continuation* p_cont = new(p) counter_continuation();
+	p_cont->node.p_wait_counter = &wait_counter;
+	p_cont->record.p_nodes = &p_cont->node;
+	p_cont->record.node_count = 1;
+	p_cont->func = std::move(func);
+	p_cont->priority = priority;
+
+	const size_t wait_record_count = tss::wait_record_count.fetch_add(1, std::memory_order_relaxed) + 1;
+	if (tss::p_wait_table->park(p_cont->record)) {
+		tss::wait_record_count.fetch_sub(1, std::memory_order_relaxed);
+		spawn_counter_continuation(&p_cont->record);
+	}
+	else if (tss::p_worker) {
+		tss::p_worker->stats.wait_list_high_water_count.raise_to(wait_record_count);
+	}
+}
+
+void run_at(task_clock::time_point time, task_func&& func, task_priority priority)
+{
+	assert(func);
+
+	timer_ptr p_timer = make_timer(timer_kind::task, to_ns(time), priority);
+	p_timer->func = std::move(func);
+	schedule_timer(*p_timer.release());
+}
+
+void run_every(task_clock::duration period, std::function<bool()> func, task_priority priority)
+{
+	assert(func);
+	assert(period.count() > 0);
+
+	const uint64_t period_ns = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(period).count());
+	timer_ptr p_timer = make_timer(timer_kind::periodic, now_ns() + period_ns, priority);
+	p_timer->period_ns = period_ns;
+	p_timer->periodic_func = std::move(func);
+	schedule_timer(*p_timer.release());
+}
+
+bool wait_until(const std::atomic_size_t& wait_counter, task_clock::time_point time)
+{
+	if (wait_counter.load() == 0) return true;
+
+	const uint64_t time_ns = to_ns(time);
+	if (time_ns <= now_ns()) return false;
+
+	// The timer resumes the fiber through a counter of its own.
+	std::atomic_size_t timeout_counter(1);
+	timer t;
+	t.kind = timer_kind::wake;
+	t.time_ns = time_ns;
+	t.p_wait_counter = &timeout_counter;
+	schedule_timer(t);
+
+	const std::atomic_size_t* p_wait_counters[] = { &wait_counter, &timeout_counter };
+	wait_for_counters(p_wait_counters, 2, false);
+	cancel_timer(t);
+
+	return (wait_counter.load() == 0);
+}
+
+void sleep_until(task_clock::time_point time)
+{
+	// nobody decrements the counter, only the timer resumes the fiber.
+	std::atomic_size_t wait_counter(1);
+	wait_until(wait_counter, time);
+}
+
+scratch_allocator& task_scratch_allocator()
+{
+	assert(tss::p_scratch_allocator && "task_scratch_allocator must be called by a task or by the kernel function.");
+	return *tss::p_scratch_allocator;
+}
+
+size_t thread_count() noexcept
+{
+	return tss::workers.size();
+}
+
+bool is_work_demanded() noexcept
+{
+	worker* p_worker = tss::p_worker;
+	if (!p_worker || tss::workers.size() < 2) return false;
+
+	// the kernel fiber spawns into the injection queue.
+	if (current_fiber() == tss::p_kernel_fiber)
+		return tss::p_queue->empty();
 
-	tss::report.task_count += count;
+	return p_worker->deque.empty();
 }
 
 void wait_for(const std::atomic_size_t& wait_counter)
 {
-	assert(current_fiber() != tss::p_controller_fiber);
+	const std::atomic_size_t* p_wait_counter = &wait_counter;
+	wait_for_counters(&p_wait_counter, 1, true);
+}
 
-	if (wait_counter == 0) return;
+void wait_all(const std::atomic_size_t* const* p_wait_counters, size_t count)
+{
+	wait_for_counters(p_wait_counters, count, true);
+}
 
-	tss::p_wait_list_counter = &wait_counter;
-	switch_to_fiber(tss::p_controller_fiber);
+size_t wait_any(const std::atomic_size_t* const* p_wait_counters, size_t count)
+{
+	return wait_for_counters(p_wait_counters, count, false);
 }
 
 } // namespace ts
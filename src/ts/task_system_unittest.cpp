@@ -0,0 +1,513 @@
+#include "ts/task_system.h"
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ts/unittest_utility.h"
+#include "CppUnitTest.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+
+namespace {
+
+constexpr size_t task_count = 100;
+
+ts::task_system_report running_report;
+
+void report_kernel()
+{
+	std::atomic_size_t wait_counter;
+
+	ts::run([] {}, ts::task_priority::high, wait_counter);
+	ts::wait_for(wait_counter);
+
+	ts::run([] {}, ts::task_priority::background, wait_counter);
+	ts::wait_for(wait_counter);
+
+	// each task suspends its fiber once
+	ts::task_func funcs[task_count];
+	for (auto& f : funcs) {
+		f = [] {
+			std::atomic_size_t c;
+			ts::run([] {}, c);
+			ts::wait_for(c);
+		};
+	}
+
+	ts::run(funcs, wait_counter);
+	ts::wait_for(wait_counter);
+
+	running_report = ts::get_task_system_report();
+}
+
+// The order the tasks of priority_kernel have run in, one thread only.
+std::vector<char> run_order;
+
+void priority_kernel()
+{
+	std::atomic_size_t wait_counter;
+
+	// from the kernel: the normal tasks are queued first, the high one runs first anyway.
+	ts::task_func funcs[8];
+	for (auto& f : funcs)
+		f = [] { run_order.push_back('n'); };
+
+	ts::run(funcs, wait_counter);
+	ts::run_joined(ts::task_func_factory::of([] { run_order.push_back('h'); }), ts::task_priority::high, wait_counter);
+	ts::run_joined(ts::task_func_factory::of([] { run_order.push_back('b'); }), ts::task_priority::background,
+		wait_counter);
+	ts::wait_for(wait_counter);
+
+	// from a task: the high task goes before the normal tasks which are in the worker's deque.
+	ts::run([] {
+		std::atomic_size_t c;
+		ts::task_func fs[8];
+		for (auto& f : fs)
+			f = [] { run_order.push_back('N'); };
+
+		ts::run(fs, c);
+		ts::run_joined(ts::task_func_factory::of([] { run_order.push_back('H'); }), ts::task_priority::high, c);
+		ts::wait_for(c);
+	}, wait_counter);
+	ts::wait_for(wait_counter);
+}
+
+constexpr size_t aging_count = 8;
+constexpr size_t aging_feeder_count = 4;
+constexpr size_t aging_normal_task_limit = 10000;
+std::atomic_size_t aging_normal_run_count;
+std::atomic_size_t aging_background_position;
+
+// Each normal task spawns the next one until the background task has run, normal work never runs out.
+void spawn_aging_normal_task(std::atomic_size_t& wait_counter)
+{
+	ts::run_joined([&wait_counter] {
+		const size_t n = ++aging_normal_run_count;
+		if (aging_background_position == 0 && n < aging_normal_task_limit)
+			spawn_aging_normal_task(wait_counter);
+	}, wait_counter);
+}
+
+void aging_kernel()
+{
+	std::atomic_size_t wait_counter;
+	ts::run([] { aging_background_position = aging_normal_run_count + 1; }, ts::task_priority::background, wait_counter);
+
+	for (size_t i = 0; i < aging_feeder_count; ++i)
+		spawn_aging_normal_task(wait_counter);
+
+	ts::wait_for(wait_counter);
+}
+
+constexpr size_t nesting_depth = 6;
+
+// Each task spawns the next one and waits for it, so nesting_depth fibers are suspended at the same time.
+void nested_task(size_t depth)
+{
+	if (depth == 0) return;
+
+	std::atomic_size_t c;
+	ts::run([depth] { nested_task(depth - 1); }, c);
+	ts::wait_for(c);
+}
+
+void nested_kernel()
+{
+	std::atomic_size_t wait_counter;
+	ts::run([] { nested_task(nesting_depth); }, wait_counter);
+	ts::wait_for(wait_counter);
+}
+
+constexpr size_t large_stack_task_count = 8;
+constexpr size_t large_stack_buffer_byte_count = 256 * 1024;
+
+void large_stack_kernel()
+{
+	// a task which needs a large stack, it may wait like any other task.
+	auto large_task = [] {
+		volatile char buffer[large_stack_buffer_byte_count];
+		buffer[0] = 1;
+
+		std::atomic_size_t c;
+		ts::run([] {}, c);
+		ts::wait_for(c);
+		buffer[1] = buffer[0];
+	};
+
+	std::atomic_size_t wait_counter;
+	ts::run_on_large_stack(large_task, wait_counter);
+	ts::wait_for(wait_counter);
+
+	// large stack tasks spawned by a regular task
+	ts::run([large_task] {
+		std::atomic_size_t counters[large_stack_task_count];
+		for (auto& c : counters)
+			ts::run_on_large_stack(large_task, c);
+
+		for (auto& c : counters)
+			ts::wait_for(c);
+	}, wait_counter);
+	ts::wait_for(wait_counter);
+}
+
+constexpr size_t overflow_task_count = 1000;
+std::atomic_size_t overflow_executed_count;
+
+// Spawns many more tasks than the queues can hold.
+void overflow_kernel()
+{
+	auto count_task = [] { overflow_executed_count.fetch_add(1, std::memory_order_relaxed); };
+	std::vector<ts::task_func> funcs(overflow_task_count);
+
+	for (ts::task_priority priority : { ts::task_priority::high, ts::task_priority::normal, ts::task_priority::background }) {
+		for (auto& f : funcs)
+			f = count_task;
+
+		std::atomic_size_t wait_counter;
+		ts::run(funcs.data(), funcs.size(), priority, &wait_counter);
+		ts::wait_for(wait_counter);
+	}
+
+	// one by one from a task: the worker's deque overflows into the injection queue.
+	std::atomic_size_t wait_counter;
+	ts::run([count_task] {
+		std::atomic_size_t c(0);
+		for (size_t i = 0; i < overflow_task_count; ++i)
+			ts::run_joined(count_task, c);
+
+		ts::wait_for(c);
+	}, wait_counter);
+	ts::wait_for(wait_counter);
+}
+
+constexpr size_t rearm_driver_count = 8;
+constexpr size_t rearm_round_count = 1000;
+std::atomic_size_t rearm_error_count;
+
+// Each driver re-arms the same counter round after round, a late notify from the previous round
+// must not resume it before the tasks of the current round are done.
+void rearm_kernel()
+{
+	ts::task_func drivers[rearm_driver_count];
+	for (auto& d : drivers) {
+		d = [] {
+			std::atomic_size_t wait_counter;
+			for (size_t r = 0; r < rearm_round_count; ++r) {
+				std::atomic_size_t done_count(0);
+				ts::task_func funcs[2];
+				for (auto& f : funcs)
+					f = [&done_count] { done_count.fetch_add(1, std::memory_order_relaxed); };
+
+				ts::run(funcs, wait_counter);
+
+				// every other round wait_for takes its fast path while the notify may still be on its way.
+				if (r % 2)
+					ts::sleep_for(std::chrono::microseconds(200));
+
+				ts::wait_for(wait_counter);
+				if (done_count.load(std::memory_order_relaxed) != 2) ++rearm_error_count;
+			}
+		};
+	}
+
+	std::atomic_size_t wait_counter;
+	ts::run(drivers, wait_counter);
+	ts::wait_for(wait_counter);
+}
+
+constexpr size_t foreign_round_count = 20;
+std::atomic_size_t foreign_resumed_count;
+
+// Task fibers wait for a counter which is signaled by a thread outside the task system.
+void foreign_signal_kernel()
+{
+	for (size_t r = 0; r < foreign_round_count; ++r) {
+		std::atomic_size_t signal_counter(1);
+		std::atomic_size_t wait_counter;
+
+		ts::task_func funcs[4];
+		for (auto& f : funcs) {
+			f = [&signal_counter] {
+				ts::wait_for(signal_counter);
+				++foreign_resumed_count;
+			};
+		}
+		ts::run(funcs, wait_counter);
+
+		std::thread thread([&signal_counter, r] {
+			if (r % 2) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			ts::decrement_wait_counter(signal_counter);
+		});
+
+		ts::wait_for(wait_counter);
+		thread.join();
+	}
+
+	// the kernel fiber is resumed by its home worker
+	std::atomic_size_t signal_counter(1);
+	std::thread thread([&signal_counter] {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		ts::decrement_wait_counter(signal_counter);
+	});
+	ts::wait_for(signal_counter);
+	thread.join();
+	++foreign_resumed_count;
+}
+
+using std::chrono::milliseconds;
+using std::chrono::microseconds;
+using std::chrono::seconds;
+
+// Each sleeping task holds a fiber, make_desc allows up to 64 of them.
+constexpr size_t sleeper_count = 32;
+
+std::atomic_size_t timer_error_count;
+
+// A timer must never fire early.
+void check_elapsed(ts::task_clock::time_point since, ts::task_clock::duration min_duration)
+{
+	if (ts::task_clock::now() - since < min_duration)
+		++timer_error_count;
+}
+
+void timer_kernel()
+{
+	// only the kernel fiber sleeps
+	const auto t0 = ts::task_clock::now();
+	ts::sleep_for(milliseconds(5));
+	check_elapsed(t0, milliseconds(5));
+
+	std::atomic_size_t wait_counter(2);
+	const auto t1 = ts::task_clock::now();
+	ts::run_after(milliseconds(3), [&wait_counter, t1] {
+		check_elapsed(t1, milliseconds(3));
+		ts::decrement_wait_counter(wait_counter);
+	});
+	ts::run_at(t1 + milliseconds(2), [&wait_counter, t1] {
+		check_elapsed(t1, milliseconds(2));
+		ts::decrement_wait_counter(wait_counter);
+	}, ts::task_priority::high);
+	ts::wait_for(wait_counter);
+
+	// wait_for with a timeout: the counter nobody decrements times out, the other one does not
+	std::atomic_size_t never_counter(1);
+	const auto t2 = ts::task_clock::now();
+	if (ts::wait_for(never_counter, milliseconds(2))) ++timer_error_count;
+	check_elapsed(t2, milliseconds(2));
+
+	ts::run([] { ts::sleep_for(milliseconds(1)); }, wait_counter);
+	if (!ts::wait_for(wait_counter, seconds(30))) ++timer_error_count;
+
+	// the periodic function is called until it returns false
+	std::atomic_size_t periodic_counter(1);
+	std::atomic_size_t run_count(0);
+	const auto t3 = ts::task_clock::now();
+	ts::run_every(milliseconds(1), [&periodic_counter, &run_count] {
+		if (++run_count < 5) return true;
+
+		ts::decrement_wait_counter(periodic_counter);
+		return false;
+	});
+	ts::wait_for(periodic_counter);
+	check_elapsed(t3, milliseconds(5));
+
+	// many fibers sleep at the same time
+	ts::task_func funcs[sleeper_count];
+	for (size_t i = 0; i < sleeper_count; ++i) {
+		funcs[i] = [i] {
+			const auto t = ts::task_clock::now();
+			const auto duration = microseconds(100 * (i % 30));
+			ts::sleep_for(duration);
+			check_elapsed(t, duration);
+		};
+	}
+	ts::run(funcs, wait_counter);
+	ts::wait_for(wait_counter);
+
+	// pending timers are dropped when the task system stops
+	ts::run_after(seconds(1000), [] { ++timer_error_count; });
+}
+
+} // namespace
+
+
+namespace unittest {
+
+TEST_CLASS(task_system_funcs) {
+public:
+
+	TEST_METHOD(report)
+	{
+		for (size_t thread_count : thread_counts) {
+			const ts::task_system_report report = ts::launch_task_system(make_desc(thread_count), report_kernel);
+
+			// 2 + task_count tasks spawned by the kernel, one more by each of the task_count tasks.
+			const size_t total_task_count = 2 + 2 * task_count;
+			Assert::AreEqual(total_task_count, report.task_count);
+			Assert::AreEqual(total_task_count, report.spawned_task_count);
+			Assert::AreEqual(size_t(1), report.task_immediate_count);
+			Assert::AreEqual(size_t(1), report.task_background_count);
+			Assert::AreEqual(size_t(0), report.queue_full_count);
+
+			// every parked fiber has been resumed, the kernel fiber is not a part of the pool
+			Assert::AreEqual(report.park_count, report.resume_count);
+			Assert::IsTrue(report.fiber_switch_count >= report.task_count);
+			Assert::IsTrue(report.fiber_high_water_count <= 16);
+			Assert::IsTrue(report.wait_list_high_water_count <= report.park_count);
+
+			Assert::AreEqual(thread_count, report.workers.size());
+			uint64_t worker_task_count = 0;
+			for (const ts::task_worker_report& w : report.workers) {
+				worker_task_count += w.task_count;
+				Assert::IsTrue(w.busy_ns > 0);
+			}
+			Assert::AreEqual(uint64_t(report.task_count), worker_task_count);
+
+			// the kernel took its snapshot after all the tasks had been spawned and processed
+			Assert::AreEqual(thread_count, running_report.workers.size());
+			Assert::AreEqual(report.task_count, running_report.task_count);
+			Assert::AreEqual(report.spawned_task_count, running_report.spawned_task_count);
+		}
+	}
+
+	TEST_METHOD(priority_order)
+	{
+		run_order.clear();
+		ts::launch_task_system(make_desc(1), priority_kernel);
+
+		// h, the normal tasks, then b (nothing else is queued), H, N...
+		const std::string order(run_order.cbegin(), run_order.cend());
+		Assert::AreEqual(std::string("hnnnnnnnnbHNNNNNNNN"), order);
+		run_order.clear();
+	}
+
+	TEST_METHOD(background_aging)
+	{
+		for (size_t thread_count : thread_counts) {
+			ts::task_system_desc desc = make_desc(thread_count);
+			desc.background_aging_count = aging_count;
+			aging_normal_run_count = 0;
+			aging_background_position = 0;
+
+			ts::launch_task_system(desc, aging_kernel);
+
+			// the background task has not waited for the normal work to run out.
+			Assert::IsTrue(aging_background_position > 0);
+			Assert::IsTrue(aging_background_position <= aging_feeder_count * aging_count);
+			Assert::IsTrue(aging_normal_run_count < aging_normal_task_limit);
+		}
+	}
+
+	TEST_METHOD(fiber_limits)
+	{
+		ts::task_system_desc desc = make_desc(1);
+		desc.fiber_count = 2;
+		desc.fiber_chunk_size = 1;
+
+		// the pool grows beyond the soft limit
+		ts::task_system_report report = ts::launch_task_system(desc, nested_kernel);
+		Assert::AreEqual(nesting_depth + 1, report.task_count);
+		Assert::IsTrue(report.fiber_created_count > desc.fiber_count);
+		Assert::IsTrue(report.fiber_created_count <= 4 * desc.fiber_count);
+		Assert::IsTrue(report.fiber_soft_limit_exceeded_count > 0);
+
+		// and it does not create more fibers than it needs
+		desc.fiber_count = 16;
+		report = ts::launch_task_system(desc, nested_kernel);
+		Assert::IsTrue(report.fiber_created_count < desc.fiber_count);
+		Assert::AreEqual(size_t(0), report.fiber_soft_limit_exceeded_count);
+
+		// the hard limit stops the task system
+		desc.fiber_count = 2;
+		desc.fiber_hard_limit = 3;
+		bool thrown = false;
+		try {
+			ts::launch_task_system(desc, nested_kernel);
+		}
+		catch (const std::runtime_error&) {
+			thrown = true;
+		}
+		Assert::IsTrue(thrown);
+	}
+
+	TEST_METHOD(queue_overflow)
+	{
+		const ts::task_overflow_policy policies[] = {
+			ts::task_overflow_policy::execute_inline,
+			ts::task_overflow_policy::park,
+			ts::task_overflow_policy::spill
+		};
+
+		for (ts::task_overflow_policy policy : policies) {
+			for (size_t thread_count : thread_counts) {
+				ts::task_system_desc desc = make_desc(thread_count, default_fiber_count, 4);
+				desc.overflow_policy = policy;
+				overflow_executed_count = 0;
+
+				const ts::task_system_report report = ts::launch_task_system(desc, overflow_kernel);
+
+				// no task is lost whichever way it has been executed.
+				Assert::AreEqual(4 * overflow_task_count, overflow_executed_count.load());
+				Assert::AreEqual(4 * overflow_task_count + 1, report.task_count);
+				Assert::AreEqual(report.spawned_task_count, report.task_count);
+				Assert::IsTrue(report.queue_full_count > 0);
+				Assert::IsTrue(report.overflow_task_count > 0);
+			}
+		}
+	}
+
+	TEST_METHOD(rearm_wait_counter)
+	{
+		rearm_error_count = 0;
+		run_kernel_for_thread_counts(rearm_kernel);
+		Assert::AreEqual(size_t(0), rearm_error_count.load());
+	}
+
+	TEST_METHOD(foreign_thread_signal)
+	{
+		for (size_t thread_count : thread_counts) {
+			foreign_resumed_count = 0;
+			ts::launch_task_system(make_desc(thread_count), foreign_signal_kernel);
+			Assert::AreEqual(4 * foreign_round_count + 1, foreign_resumed_count.load());
+		}
+	}
+
+	TEST_METHOD(timers)
+	{
+		for (size_t thread_count : thread_counts) {
+			for (ts::task_idle_policy idle_policy : { ts::task_idle_policy::park, ts::task_idle_policy::spin }) {
+				ts::task_system_desc desc = make_desc(thread_count);
+				desc.idle_policy = idle_policy;
+				timer_error_count = 0;
+
+				ts::launch_task_system(desc, timer_kernel);
+				Assert::AreEqual(size_t(0), timer_error_count.load());
+			}
+		}
+	}
+
+	TEST_METHOD(run_on_large_stack)
+	{
+		for (size_t thread_count : thread_counts) {
+			ts::task_system_desc desc = make_desc(thread_count);
+			desc.large_fiber_count = 4;
+			desc.large_fiber_stack_byte_count = 1024 * 1024;
+			desc.measure_fiber_stack_usage = true;
+
+			const ts::task_system_report report = ts::launch_task_system(desc, large_stack_kernel);
+
+			// each large stack task spawns a regular one
+			Assert::AreEqual(1 + 2 * (large_stack_task_count + 1), report.task_count);
+			Assert::IsTrue(report.large_fiber_stack_peak_byte_count >= large_stack_buffer_byte_count);
+			Assert::IsTrue(report.large_fiber_stack_peak_byte_count <= desc.large_fiber_stack_byte_count);
+			Assert::IsTrue(report.fiber_stack_peak_byte_count > 0);
+			Assert::IsTrue(report.fiber_stack_peak_byte_count <= desc.fiber_stack_byte_count);
+		}
+	}
+};
+
+} // namespace unittest
@@ -0,0 +1,185 @@
+#include "ts/timer_wheel.h"
+
+#include <cassert>
+#include <algorithm>
+
+
+namespace {
+
+constexpr uint64_t slot_mask = ts::timer_wheel::slot_count - 1;
+
+// The max distance from the current tick to a slot of the top level.
+constexpr uint64_t max_delta = (uint64_t(1) << (ts::timer_wheel::slot_bit_count * ts::timer_wheel::level_count)) - 1;
+
+} // namespace
+
+
+namespace ts {
+
+// ----- timer_wheel -----
+
+timer_wheel::timer_wheel(uint64_t tick) noexcept
+	: cur_tick_(tick)
+{}
+
+void timer_wheel::insert(timer_node& node, uint64_t tick) noexcept
+{
+	assert(!node.linked);
+
+	node.tick = std::max(tick, cur_tick_ + 1);
+	place(node, node.tick);
+	++count_;
+}
+
+void timer_wheel::remove(timer_node& node) noexcept
+{
+	assert(node.linked);
+
+	if (node.p_prev)
+		node.p_prev->p_next = node.p_next;
+	else
+		slots_[node.level][node.index].p_head = node.p_next;
+
+	if (node.p_next)
+		node.p_next->p_prev = node.p_prev;
+
+	if (!slots_[node.level][node.index].p_head)
+		occupied_[node.level] &= ~(uint64_t(1) << node.index);
+
+	node.p_prev = nullptr;
+	node.p_next = nullptr;
+	node.linked = false;
+	--count_;
+}
+
+timer_node* timer_wheel::advance(uint64_t tick) noexcept
+{
+	timer_node* p_expired = nullptr;
+
+	// The ticks whose slots are empty are skipped at once.
+	while (cur_tick_ < tick) {
+		const uint64_t next = next_tick();
+		if (next > tick) {
+			cur_tick_ = tick;
+			break;
+		}
+
+		cur_tick_ = next;
+		process_current_tick(p_expired);
+	}
+
+	return p_expired;
+}
+
+uint64_t timer_wheel::next_tick() const noexcept
+{
+	uint64_t result = no_tick;
+
+	for (size_t level = 0; level < level_count; ++level) {
+		if (!occupied_[level]) continue;
+
+		// The slots of the level are visited every 2^shift ticks.
+		const size_t shift = slot_bit_count * level;
+		const uint64_t pos = cur_tick_ >> shift;
+		for (uint64_t i = 1; i <= slot_count; ++i) {
+			if ((occupied_[level] >> ((pos + i) & slot_mask)) & 1) {
+				result = std::min(result, (pos + i) << shift);
+				break;
+			}
+		}
+	}
+
+	return result;
+}
+
+timer_node* timer_wheel::clear() noexcept
+{
+	timer_node* p_list = nullptr;
+
+	for (size_t level = 0; level < level_count; ++level) {
+		for (size_t index = 0; index < slot_count; ++index) {
+			timer_node* p_node = detach(level, index);
+			while (p_node) {
+				timer_node* p_next = p_node->p_next;
+				p_node->p_prev = nullptr;
+				p_node->linked = false;
+				p_node->p_next = p_list;
+				p_list = p_node;
+				p_node = p_next;
+			}
+		}
+	}
+
+	count_ = 0;
+	return p_list;
+}
+
+void timer_wheel::place(timer_node& node, uint64_t tick) noexcept
+{
+	assert(tick >= cur_tick_);
+
+	// the timers which do not fit into the wheel wait at the end of its range.
+	const uint64_t delta = std::min(tick - cur_tick_, max_delta);
+
+	size_t level = 0;
+	while (level + 1 < level_count && delta >= (uint64_t(1) << (slot_bit_count * (level + 1))))
+		++level;
+
+	const uint64_t t = cur_tick_ + delta;
+	link(level, size_t((t >> (slot_bit_count * level)) & slot_mask), node);
+}
+
+void timer_wheel::link(size_t level, size_t index, timer_node& node) noexcept
+{
+	slot& s = slots_[level][index];
+
+	node.p_prev = nullptr;
+	node.p_next = s.p_head;
+	if (s.p_head)
+		s.p_head->p_prev = &node;
+
+	s.p_head = &node;
+	node.level = uint8_t(level);
+	node.index = uint8_t(index);
+	node.linked = true;
+	occupied_[level] |= uint64_t(1) << index;
+}
+
+timer_node* timer_wheel::detach(size_t level, size_t index) noexcept
+{
+	timer_node* p_head = slots_[level][index].p_head;
+	slots_[level][index].p_head = nullptr;
+	occupied_[level] &= ~(uint64_t(1) << index);
+	return p_head;
+}
+
+void timer_wheel::process_current_tick(timer_node*& p_expired) noexcept
+{
+	// Higher levels first: their nodes may land in the current slot of level 0.
+	for (size_t level = level_count - 1; level > 0; --level) {
+		const size_t shift = slot_bit_count * level;
+		if ((cur_tick_ & ((uint64_t(1) << shift) - 1)) != 0) continue;
+
+		timer_node* p_node = detach(level, size_t((cur_tick_ >> shift) & slot_mask));
+		while (p_node) {
+			timer_node* p_next = p_node->p_next;
+			place(*p_node, p_node->tick);
+			p_node = p_next;
+		}
+	}
+
+	timer_node* p_node = detach(0, size_t(cur_tick_ & slot_mask));
+	while (p_node) {
+		timer_node* p_next = p_node->p_next;
+		assert(p_node->tick == cur_tick_);
+
+		p_node->p_prev = nullptr;
+		p_node->linked = false;
+		p_node->p_next = p_expired;
+		p_expired = p_node;
+		--count_;
+		p_node = p_next;
+	}
+}
+
+} // namespace ts
@@ -0,0 +1,108 @@
+#ifndef TS_TIMER_WHEEL_H_
+#define TS_TIMER_WHEEL_H_
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace ts {
+
+// timer_node is a timer registered in a timer_wheel. Nodes are intrusive, the wheel does not own them.
+struct timer_node final {
+	// The tick the timer expires at.
+	uint64_t	tick = 0;
+	timer_node*	p_prev = nullptr;
+	timer_node*	p_next = nullptr;
+	bool		linked = false;
+
+	// Not used by the wheel.
+	void*		p_data = nullptr;
+
+	// The slot the node is linked into.
+	uint8_t		level = 0;
+	uint8_t		index = 0;
+};
+
+// timer_wheel is a hierarchical timer wheel: level_count levels of slot_count slots each.
+// A slot of level l spans slot_count^l ticks. A timer goes to the lowest level whose range covers it
+// and moves to the lower levels (cascades) as its tick comes closer. Insert and remove are O(1),
+// advance is O(1) per expired or cascaded timer. Timers beyond the range of the wheel wait
+// in the last slots of the top level and are cascaded until they fit.
+// The wheel is not thread safe.
+class timer_wheel final {
+public:
+
+	static constexpr size_t slot_bit_count = 6;
+	static constexpr size_t slot_count = size_t(1) << slot_bit_count;
+	static constexpr size_t level_count = 4;
+	static constexpr uint64_t no_tick = UINT64_MAX;
+
+
+	explicit timer_wheel(uint64_t tick = 0) noexcept;
+
+	timer_wheel(timer_wheel&&) = delete;
+	timer_wheel& operator=(timer_wheel&&) = delete;
+
+
+	// The tick the wheel has been advanced to.
+	uint64_t current_tick() const noexcept
+	{
+		return cur_tick_;
+	}
+
+	bool empty() const noexcept
+	{
+		return (count_ == 0);
+	}
+
+	size_t size() const noexcept
+	{
+		return count_;
+	}
+
+	// Registers the node. A tick which is not after the current one expires on the next advance.
+	void insert(timer_node& node, uint64_t tick) noexcept;
+
+	// Unregisters a linked node.
+	void remove(timer_node& node) noexcept;
+
+	// Advances the wheel to the tick. Returns the list (linked by p_next) of the expired nodes,
+	// the nodes are not linked anymore.
+	timer_node* advance(uint64_t tick) noexcept;
+
+	// Returns a tick no later than the earliest expiration (a cascade may come first) or no_tick if the wheel is empty.
+	uint64_t next_tick() const noexcept;
+
+	// Unregisters all the nodes and returns them as a list linked by p_next.
+	timer_node* clear() noexcept;
+
+private:
+
+	struct slot final {
+		timer_node* p_head = nullptr;
+	};
+
+
+	// Puts the node into the slot which is visited at the tick or before it.
+	void place(timer_node& node, uint64_t tick) noexcept;
+
+	void link(size_t level, size_t index, timer_node& node) noexcept;
+
+	// Empties the slot and returns its nodes.
+	timer_node* detach(size_t level, size_t index) noexcept;
+
+	// Moves the nodes of the slot of the current tick to the lower levels or to the expired list.
+	void process_current_tick(timer_node*& p_expired) noexcept;
+
+
+	slot		slots_[level_count][slot_count];
+
+	// A bit per slot which is not empty.
+	uint64_t	occupied_[level_count] = {};
+	uint64_t	cur_tick_;
+	size_t		count_ = 0;
+};
+
+} // namespace ts
+
+#endif // TS_TIMER_WHEEL_H_
@@ -0,0 +1,143 @@
+#include "ts/timer_wheel.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "CppUnitTest.h"
+
+using ts::timer_node;
+using ts::timer_wheel;
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+
+namespace {
+
+size_t list_size(const timer_node* p_node)
+{
+	size_t count = 0;
+	for (; p_node; p_node = p_node->p_next)
+		++count;
+
+	return count;
+}
+
+} // namespace
+
+
+namespace unittest {
+
+TEST_CLASS(timer_wheel_timer_wheel) {
+public:
+
+	TEST_METHOD(insert_advance)
+	{
+		timer_wheel wheel(100);
+		Assert::IsTrue(wheel.empty());
+		Assert::AreEqual(timer_wheel::no_tick, wheel.next_tick());
+		Assert::IsNull(wheel.advance(200));
+		Assert::AreEqual(uint64_t(200), wheel.current_tick());
+
+		// the past and the present expire on the next tick
+		timer_node past;
+		timer_node present;
+		wheel.insert(past, 10);
+		wheel.insert(present, 200);
+		Assert::AreEqual(size_t(2), wheel.size());
+		Assert::AreEqual(uint64_t(201), wheel.next_tick());
+		Assert::AreEqual(size_t(2), list_size(wheel.advance(201)));
+		Assert::IsFalse(past.linked);
+		Assert::IsTrue(wheel.empty());
+
+		// one timer per level
+		const uint64_t deltas[] = { 5, 100, 10000, 1000000 };
+		timer_node nodes[4];
+		for (size_t i = 0; i < 4; ++i)
+			wheel.insert(nodes[i], wheel.current_tick() + deltas[i]);
+
+		const uint64_t start = wheel.current_tick();
+		for (size_t i = 0; i < 4; ++i) {
+			Assert::IsTrue(wheel.next_tick() <= start + deltas[i]);
+			Assert::IsNull(wheel.advance(start + deltas[i] - 1));
+
+			timer_node* p_expired = wheel.advance(start + deltas[i]);
+			Assert::IsTrue(p_expired == &nodes[i]);
+			Assert::IsNull(p_expired->p_next);
+		}
+
+		Assert::IsTrue(wheel.empty());
+	}
+
+	TEST_METHOD(remove_clear)
+	{
+		timer_wheel wheel;
+		timer_node nodes[3];
+		wheel.insert(nodes[0], 10);
+		wheel.insert(nodes[1], 10);
+		wheel.insert(nodes[2], 5000);
+
+		wheel.remove(nodes[0]);
+		Assert::IsFalse(nodes[0].linked);
+		Assert::AreEqual(size_t(2), wheel.size());
+
+		timer_node* p_expired = wheel.advance(10);
+		Assert::IsTrue(p_expired == &nodes[1]);
+		Assert::IsNull(p_expired->p_next);
+
+		timer_node late;
+		wheel.insert(late, 1000000);
+		Assert::AreEqual(size_t(2), list_size(wheel.clear()));
+		Assert::IsTrue(wheel.empty());
+		Assert::IsFalse(late.linked);
+		Assert::IsNull(wheel.advance(2000000));
+	}
+
+	TEST_METHOD(beyond_range)
+	{
+		const uint64_t range = uint64_t(1) << (timer_wheel::slot_bit_count * timer_wheel::level_count);
+
+		timer_wheel wheel(7);
+		timer_node node;
+		wheel.insert(node, 7 + 3 * range + 12345);
+
+		Assert::IsNull(wheel.advance(7 + 3 * range + 12344));
+		Assert::IsTrue(wheel.advance(7 + 3 * range + 12345) == &node);
+	}
+
+	TEST_METHOD(random_timers)
+	{
+		constexpr size_t node_count = 2000;
+
+		std::mt19937 gen(7);
+		std::uniform_int_distribution<uint64_t> delta_distr(0, 300000);
+		std::uniform_int_distribution<uint64_t> step_distr(1, 2000);
+
+		timer_wheel wheel;
+		std::vector<timer_node> nodes(node_count);
+		std::vector<uint64_t> ticks(node_count);
+		for (size_t i = 0; i < node_count; ++i) {
+			ticks[i] = delta_distr(gen) + 1;
+			wheel.insert(nodes[i], ticks[i]);
+		}
+
+		// every third timer is removed
+		for (size_t i = 0; i < node_count; i += 3)
+			wheel.remove(nodes[i]);
+
+		size_t expired_count = 0;
+		while (!wheel.empty()) {
+			const uint64_t tick = wheel.current_tick() + step_distr(gen);
+			const uint64_t prev_tick = wheel.current_tick();
+
+			for (timer_node* p = wheel.advance(tick); p; p = p->p_next) {
+				const size_t i = size_t(p - nodes.data());
+				Assert::IsTrue(i % 3 != 0);
+				Assert::IsTrue(ticks[i] > prev_tick && ticks[i] <= tick);
+				++expired_count;
+			}
+		}
+
+		Assert::AreEqual(node_count - (node_count + 2) / 3, expired_count);
+	}
+};
+
+} // namespace unittest
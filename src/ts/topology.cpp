@@ -0,0 +1,371 @@
+#include "ts/topology.h"
+
+#include <cassert>
+#include <algorithm>
+#include <map>
+#include <set>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <cstdio>
+	#include <cstdlib>
+	#include <string>
+	#include <dirent.h>
+	#include <pthread.h>
+	#include <sched.h>
+#endif
+
+
+namespace {
+
+using namespace ts;
+
+// raw_cpu keeps the ids reported by the OS, make_topology renumbers them densely.
+struct raw_cpu final {
+	uint32_t	index = 0;
+	uint64_t	core_key = 0;
+	uint32_t	package_key = 0;
+	uint64_t	cache_key = 0;
+	uint32_t	numa_node = 0;
+};
+
+// Maps keys to dense ids in the order of their first appearance.
+template<typename Key>
+class dense_ids final {
+public:
+
+	uint32_t id_of(Key key)
+	{
+		auto it = ids_.find(key);
+		if (it != ids_.end()) return it->second;
+
+		const uint32_t id = uint32_t(ids_.size());
+		ids_.emplace(key, id);
+		return id;
+	}
+
+	size_t size() const noexcept
+	{
+		return ids_.size();
+	}
+
+private:
+
+	std::map<Key, uint32_t> ids_;
+};
+
+cpu_topology make_topology(std::vector<raw_cpu> raw_cpus)
+{
+	std::sort(raw_cpus.begin(), raw_cpus.end(),
+		[](const raw_cpu& l, const raw_cpu& r) { return l.index < r.index; });
+
+	dense_ids<uint64_t> core_ids;
+	dense_ids<uint32_t> package_ids;
+	dense_ids<uint64_t> cache_ids;
+	std::set<uint32_t> numa_nodes;
+
+	cpu_topology topology;
+	topology.cpus.reserve(raw_cpus.size());
+	for (const raw_cpu& r : raw_cpus) {
+		cpu_info cpu;
+		cpu.index = r.index;
+		cpu.core_id = core_ids.id_of(r.core_key);
+		cpu.package_id = package_ids.id_of(r.package_key);
+		cpu.cache_id = cache_ids.id_of(r.cache_key);
+		cpu.numa_node = r.numa_node;
+		topology.cpus.push_back(cpu);
+		numa_nodes.insert(r.numa_node);
+	}
+
+	topology.core_count = core_ids.size();
+	topology.package_count = package_ids.size();
+	topology.cache_count = cache_ids.size();
+	topology.numa_node_count = numa_nodes.size();
+	return topology;
+}
+
+#ifdef _WIN32
+
+// Calls func(cpu_index) for each bit of the mask.
+template<typename F>
+void for_each_cpu(KAFFINITY mask, F func)
+{
+	for (uint32_t i = 0; i < sizeof(KAFFINITY) * 8; ++i) {
+		if (mask & (KAFFINITY(1) << i)) func(i);
+	}
+}
+
+std::vector<raw_cpu> query_raw_cpus()
+{
+	DWORD_PTR process_mask = 0;
+	DWORD_PTR system_mask = 0;
+	if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+		process_mask = 1;
+
+	raw_cpu cpus[sizeof(KAFFINITY) * 8];
+	uint32_t cache_levels[sizeof(KAFFINITY) * 8] = {};
+	for (uint32_t i = 0; i < sizeof(KAFFINITY) * 8; ++i) {
+		cpus[i].index = i;
+		cpus[i].core_key = i;
+		cpus[i].cache_key = i;
+	}
+
+	DWORD byte_count = 0;
+	GetLogicalProcessorInformationEx(RelationAll, nullptr, &byte_count);
+	std::vector<char> buffer(byte_count);
+	if (byte_count > 0
+		&& GetLogicalProcessorInformationEx(RelationAll,
+			reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data()), &byte_count)) {
+
+		uint32_t core_counter = 0;
+		uint32_t package_counter = 0;
+		uint32_t cache_counter = 0;
+
+		for (DWORD offset = 0; offset < byte_count;) {
+			const auto* p_info = reinterpret_cast<const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data() + offset);
+			offset += p_info->Size;
+
+			switch (p_info->Relationship) {
+				case RelationProcessorCore: {
+					const uint32_t core = core_counter++;
+					if (p_info->Processor.GroupMask[0].Group == 0)
+						for_each_cpu(p_info->Processor.GroupMask[0].Mask, [&](uint32_t i) { cpus[i].core_key = core; });
+					break;
+				}
+
+				case RelationProcessorPackage: {
+					const uint32_t package = package_counter++;
+					for (WORD g = 0; g < p_info->Processor.GroupCount; ++g) {
+						if (p_info->Processor.GroupMask[g].Group != 0) continue;
+						for_each_cpu(p_info->Processor.GroupMask[g].Mask, [&](uint32_t i) { cpus[i].package_key = package; });
+					}
+					break;
+				}
+
+				case RelationCache: {
+					const uint32_t cache = cache_counter++;
+					const uint32_t level = p_info->Cache.Level;
+					if (p_info->Cache.GroupMask.Group != 0) break;
+
+					for_each_cpu(p_info->Cache.GroupMask.Mask, [&](uint32_t i) {
+						if (level < cache_levels[i]) return;
+						cache_levels[i] = level;
+						cpus[i].cache_key = (uint64_t(1) << 32) | cache;
+					});
+					break;
+				}
+
+				case RelationNumaNode: {
+					if (p_info->NumaNode.GroupMask.Group != 0) break;
+					const uint32_t node = p_info->NumaNode.NodeNumber;
+					for_each_cpu(p_info->NumaNode.GroupMask.Mask, [&](uint32_t i) { cpus[i].numa_node = node; });
+					break;
+				}
+
+				default:
+					break;
+			}
+		}
+	}
+
+	std::vector<raw_cpu> result;
+	for_each_cpu(process_mask, [&](uint32_t i) { result.push_back(cpus[i]); });
+	return result;
+}
+
+#else
+
+// Reads the first line of a sysfs file. Returns false if there is no such file.
+bool read_line(const std::string& path, std::string& out_line)
+{
+	FILE* p_file = std::fopen(path.c_str(), "r");
+	if (!p_file) return false;
+
+	char buffer[4096];
+	const bool res = (std::fgets(buffer, sizeof(buffer), p_file) != nullptr);
+	std::fclose(p_file);
+	if (!res) return false;
+
+	out_line = buffer;
+	while (!out_line.empty() && (out_line.back() == '\n' || out_line.back() == '\r'))
+		out_line.pop_back();
+
+	return true;
+}
+
+bool read_uint(const std::string& path, uint32_t& out_value)
+{
+	std::string line;
+	if (!read_line(path, line) || line.empty()) return false;
+
+	out_value = uint32_t(std::strtoul(line.c_str(), nullptr, 10));
+	return true;
+}
+
+// Parses the sysfs cpu list format: "0-3,8,10-11".
+std::vector<uint32_t> parse_cpu_list(const std::string& list)
+{
+	std::vector<uint32_t> cpus;
+
+	const char* p = list.c_str();
+	while (*p) {
+		char* p_end = nullptr;
+		const unsigned long first = std::strtoul(p, &p_end, 10);
+		if (p_end == p) break;
+
+		unsigned long last = first;
+		p = p_end;
+		if (*p == '-') {
+			last = std::strtoul(p + 1, &p_end, 10);
+			p = p_end;
+		}
+
+		for (unsigned long i = first; i <= last; ++i)
+			cpus.push_back(uint32_t(i));
+
+		if (*p == ',') ++p;
+		else break;
+	}
+
+	return cpus;
+}
+
+std::vector<raw_cpu> query_raw_cpus()
+{
+	const std::vector<uint32_t> indices = get_current_thread_affinity();
+
+	// cpu -> numa node
+	std::map<uint32_t, uint32_t> numa_nodes;
+	if (DIR* p_dir = opendir("/sys/devices/system/node")) {
+		while (dirent* p_entry = readdir(p_dir)) {
+			unsigned node = 0;
+			if (std::sscanf(p_entry->d_name, "node%u", &node) != 1) continue;
+
+			std::string list;
+			if (!read_line(std::string("/sys/devices/system/node/") + p_entry->d_name + "/cpulist", list)) continue;
+
+			for (uint32_t cpu : parse_cpu_list(list))
+				numa_nodes[cpu] = node;
+		}
+
+		closedir(p_dir);
+	}
+
+	std::vector<raw_cpu> cpus;
+	cpus.reserve(indices.size());
+	for (uint32_t index : indices) {
+		const std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(index);
+
+		raw_cpu cpu;
+		cpu.index = index;
+
+		uint32_t core_id = index;
+		uint32_t package_id = 0;
+		read_uint(dir + "/topology/core_id", core_id);
+		read_uint(dir + "/topology/physical_package_id", package_id);
+		cpu.core_key = (uint64_t(package_id) << 32) | core_id;
+		cpu.package_key = package_id;
+
+		// the last level cache is identified by the first CPU which shares it.
+		cpu.cache_key = (uint64_t(1) << 32) | package_id;
+		uint32_t cache_level = 0;
+		for (int i = 0; i < 16; ++i) {
+			const std::string cache_dir = dir + "/cache/index" + std::to_string(i);
+
+			uint32_t level = 0;
+			if (!read_uint(cache_dir + "/level", level)) break;
+
+			std::string list;
+			if (level < cache_level || !read_line(cache_dir + "/shared_cpu_list", list)) continue;
+
+			const std::vector<uint32_t> shared_cpus = parse_cpu_list(list);
+			if (shared_cpus.empty()) continue;
+
+			cache_level = level;
+			cpu.cache_key = shared_cpus.front();
+		}
+
+		auto it = numa_nodes.find(index);
+		cpu.numa_node = (it != numa_nodes.end()) ? it->second : 0;
+
+		cpus.push_back(cpu);
+	}
+
+	return cpus;
+}
+
+#endif // _WIN32
+
+} // namespace
+
+
+namespace ts {
+
+cpu_topology get_cpu_topology()
+{
+	return make_topology(query_raw_cpus());
+}
+
+#ifdef _WIN32
+
+std::vector<uint32_t> get_current_thread_affinity()
+{
+	DWORD_PTR process_mask = 0;
+	DWORD_PTR system_mask = 0;
+	GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask);
+
+	// there is no GetThreadAffinityMask, the previous mask is returned by SetThreadAffinityMask.
+	const DWORD_PTR thread_mask = SetThreadAffinityMask(GetCurrentThread(), process_mask);
+	if (thread_mask) SetThreadAffinityMask(GetCurrentThread(), thread_mask);
+
+	std::vector<uint32_t> cpus;
+	for_each_cpu((thread_mask) ? thread_mask : process_mask, [&cpus](uint32_t i) { cpus.push_back(i); });
+	return cpus;
+}
+
+bool set_current_thread_affinity(const std::vector<uint32_t>& cpus)
+{
+	DWORD_PTR mask = 0;
+	for (uint32_t i : cpus) {
+		if (i < sizeof(DWORD_PTR) * 8)
+			mask |= DWORD_PTR(1) << i;
+	}
+
+	return (mask != 0) && (SetThreadAffinityMask(GetCurrentThread(), mask) != 0);
+}
+
+#else
+
+std::vector<uint32_t> get_current_thread_affinity()
+{
+	std::vector<uint32_t> cpus;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+		cpus.push_back(0);
+		return cpus;
+	}
+
+	for (uint32_t i = 0; i < CPU_SETSIZE; ++i) {
+		if (CPU_ISSET(i, &set)) cpus.push_back(i);
+	}
+
+	return cpus;
+}
+
+bool set_current_thread_affinity(const std::vector<uint32_t>& cpus)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (uint32_t i : cpus) {
+		if (i < CPU_SETSIZE) CPU_SET(i, &set);
+	}
+
+	return (CPU_COUNT(&set) > 0) && (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0);
+}
+
+#endif // _WIN32
+
+} // namespace ts
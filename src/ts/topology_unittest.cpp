@@ -0,0 +1,122 @@
+#include "ts/topology.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "ts/task_system.h"
+#include "ts/unittest_utility.h"
+#include "CppUnitTest.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+
+namespace {
+
+constexpr size_t task_count = 64;
+
+std::mutex							affinities_mutex;
+std::vector<std::vector<uint32_t>>	affinities;
+
+void record_affinity()
+{
+	std::vector<uint32_t> cpus = ts::get_current_thread_affinity();
+	std::sort(cpus.begin(), cpus.end());
+
+	std::lock_guard<std::mutex> lock(affinities_mutex);
+	affinities.push_back(std::move(cpus));
+}
+
+void affinity_kernel()
+{
+	record_affinity();
+
+	ts::task_func funcs[task_count];
+	for (size_t i = 0; i < task_count; ++i)
+		funcs[i] = [] { record_affinity(); };
+
+	std::atomic_size_t wait_counter;
+	ts::run(funcs, wait_counter);
+	ts::wait_for(wait_counter);
+}
+
+} // namespace
+
+
+namespace unittest {
+
+TEST_CLASS(topology_funcs) {
+public:
+
+	TEST_METHOD(cpu_topology)
+	{
+		const ts::cpu_topology topology = ts::get_cpu_topology();
+		Assert::IsFalse(topology.cpus.empty());
+		Assert::IsTrue(topology.core_count > 0 && topology.core_count <= topology.cpus.size());
+		Assert::IsTrue(topology.package_count > 0 && topology.package_count <= topology.core_count);
+		Assert::IsTrue(topology.cache_count > 0 && topology.cache_count <= topology.core_count);
+		Assert::IsTrue(topology.numa_node_count > 0 && topology.numa_node_count <= topology.cpus.size());
+
+		for (size_t i = 0; i < topology.cpus.size(); ++i) {
+			const ts::cpu_info& c = topology.cpus[i];
+			if (i > 0) Assert::IsTrue(topology.cpus[i - 1].index < c.index);
+			Assert::IsTrue(c.core_id < topology.core_count);
+			Assert::IsTrue(c.package_id < topology.package_count);
+			Assert::IsTrue(c.cache_id < topology.cache_count);
+		}
+
+		// the calling thread may run on the process CPUs only
+		for (uint32_t cpu : ts::get_current_thread_affinity()) {
+			Assert::IsTrue(std::any_of(topology.cpus.cbegin(), topology.cpus.cend(),
+				[cpu](const ts::cpu_info& c) { return c.index == cpu; }));
+		}
+	}
+
+	TEST_METHOD(thread_affinity)
+	{
+		const ts::cpu_topology topology = ts::get_cpu_topology();
+		std::vector<uint32_t> origin = ts::get_current_thread_affinity();
+		std::sort(origin.begin(), origin.end());
+
+		// logical_cpu: each thread runs on exactly one CPU
+		ts::task_system_desc desc = make_desc(4);
+		desc.thread_affinity = ts::task_thread_affinity::logical_cpu;
+		affinities.clear();
+		ts::launch_task_system(desc, affinity_kernel);
+		Assert::AreEqual(task_count + 1, affinities.size());
+		for (const auto& cpus : affinities)
+			Assert::AreEqual(size_t(1), cpus.size());
+
+		// core: each thread runs on all the SMT siblings of a core
+		desc.thread_affinity = ts::task_thread_affinity::core;
+		affinities.clear();
+		ts::launch_task_system(desc, affinity_kernel);
+		for (const auto& cpus : affinities) {
+			Assert::IsFalse(cpus.empty());
+			for (uint32_t cpu : cpus) {
+				auto it = std::find_if(topology.cpus.cbegin(), topology.cpus.cend(),
+					[cpu](const ts::cpu_info& c) { return c.index == cpu; });
+				Assert::IsTrue(it != topology.cpus.cend());
+				const auto sibling_count = std::count_if(topology.cpus.cbegin(), topology.cpus.cend(),
+					[it](const ts::cpu_info& c) { return c.core_id == it->core_id; });
+				Assert::AreEqual(size_t(sibling_count), cpus.size());
+			}
+		}
+
+		// cpu_set restricts every thread, the kernel thread's affinity is restored afterwards
+		affinities.clear();
+		desc = make_desc(2);
+		desc.cpu_set = { topology.cpus.back().index };
+		ts::launch_task_system(desc, affinity_kernel);
+		for (const auto& cpus : affinities)
+			Assert::IsTrue(cpus == desc.cpu_set);
+
+		std::vector<uint32_t> restored = ts::get_current_thread_affinity();
+		std::sort(restored.begin(), restored.end());
+		Assert::IsTrue(origin == restored);
+
+		affinities.clear();
+	}
+};
+
+} // namespace unittest
@@ -0,0 +1,305 @@
+#include "ts/trace.h"
+
+#include <cassert>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+#include <unordered_map>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	#include <intrin.h>
+	#define TS_TRACE_HAS_RDTSC
+#elif defined(__x86_64__) || defined(__i386__)
+	#include <x86intrin.h>
+	#define TS_TRACE_HAS_RDTSC
+#endif
+
+
+namespace {
+
+using namespace ts;
+
+uint64_t steady_clock_ns() noexcept
+{
+	return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// An event of a fiber together with the worker which has recorded it.
+struct fiber_event final {
+	const trace_event*	p_event;
+	size_t				worker_index;
+};
+
+// Writes Chrome trace events, one per line.
+class chrome_trace_writer final {
+public:
+
+	chrome_trace_writer(std::ostream& out, const trace_clock& clock)
+		: out_(out), clock_(clock)
+	{}
+
+
+	void metadata(const char* name, size_t pid, size_t tid, const char* value_prefix, size_t value_index)
+	{
+		begin_event();
+		out_ << "{\"name\":\"" << name << "\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << tid
+			<< ",\"args\":{\"name\":\"" << value_prefix;
+		if (value_index != no_index) out_ << ' ' << value_index;
+		out_ << "\"}}";
+	}
+
+	// A complete event, it lasts from begin to end.
+	void slice(const char* name, size_t pid, size_t tid, uint64_t begin, uint64_t end,
+		const char* arg_name = nullptr, size_t arg_value = 0)
+	{
+		begin_event();
+		out_ << "{\"name\":\"" << name << "\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << tid
+			<< ",\"ts\":" << to_us(begin) << ",\"dur\":" << (to_us(end) - to_us(begin));
+		write_args(arg_name, arg_value);
+		out_ << '}';
+	}
+
+	void instant(const char* name, size_t pid, size_t tid, uint64_t timestamp,
+		const char* arg_name = nullptr, size_t arg_value = 0)
+	{
+		begin_event();
+		out_ << "{\"name\":\"" << name << "\",\"ph\":\"i\",\"s\":\"t\",\"pid\":" << pid << ",\"tid\":" << tid
+			<< ",\"ts\":" << to_us(timestamp);
+		write_args(arg_name, arg_value);
+		out_ << '}';
+	}
+
+	static constexpr size_t no_index = size_t(-1);
+
+private:
+
+	void begin_event()
+	{
+		if (event_count_++ > 0) out_ << ",\n";
+	}
+
+	void write_args(const char* arg_name, size_t arg_value)
+	{
+		if (arg_name) out_ << ",\"args\":{\"" << arg_name << "\":" << arg_value << '}';
+	}
+
+	double to_us(uint64_t timestamp) const noexcept
+	{
+		if (timestamp < clock_.origin) return 0.0;
+		return double(timestamp - clock_.origin) / clock_.ticks_per_us;
+	}
+
+
+	std::ostream&		out_;
+	const trace_clock&	clock_;
+	size_t				event_count_ = 0;
+};
+
+constexpr size_t worker_pid = 1;
+constexpr size_t fiber_pid = 2;
+
+// The worker's track: the fibers it has run, idle and sleep time, spawns, parks and resumes.
+// An end event whose begin event has been overwritten is skipped.
+void write_worker_track(chrome_trace_writer& writer, size_t worker_index, const trace_buffer& buffer,
+	const std::unordered_map<const void*, size_t>& fiber_ids)
+{
+	writer.metadata("thread_name", worker_pid, worker_index, "worker", worker_index);
+
+	const trace_event* p_switch = nullptr;
+	const trace_event* p_idle = nullptr;
+	const trace_event* p_sleep = nullptr;
+
+	for (size_t i = 0; i < buffer.size(); ++i) {
+		const trace_event& e = buffer[i];
+
+		switch (e.type) {
+			case trace_event_type::fiber_switch_to:
+				p_switch = &e;
+				break;
+
+			case trace_event_type::fiber_switch_back:
+				// an idle worker switches to its fiber only to look for a task, it is a part of the idle slice.
+				if (p_switch && !p_idle) {
+					writer.slice("fiber", worker_pid, worker_index, p_switch->timestamp, e.timestamp,
+						"fiber", fiber_ids.at(p_switch->p_fiber));
+				}
+				p_switch = nullptr;
+				break;
+
+			case trace_event_type::idle_begin:
+				p_idle = &e;
+				break;
+
+			case trace_event_type::idle_end:
+				if (p_idle) writer.slice("idle", worker_pid, worker_index, p_idle->timestamp, e.timestamp);
+				p_idle = nullptr;
+				break;
+
+			case trace_event_type::sleep_begin:
+				p_sleep = &e;
+				break;
+
+			case trace_event_type::sleep_end:
+				if (p_sleep) writer.slice("sleep", worker_pid, worker_index, p_sleep->timestamp, e.timestamp);
+				p_sleep = nullptr;
+				break;
+
+			case trace_event_type::spawn:
+				writer.instant("spawn", worker_pid, worker_index, e.timestamp, "count", e.value);
+				break;
+
+			case trace_event_type::park:
+				writer.instant("park", worker_pid, worker_index, e.timestamp, "fiber", fiber_ids.at(e.p_fiber));
+				break;
+
+			case trace_event_type::resume:
+				writer.instant("resume", worker_pid, worker_index, e.timestamp, "fiber", fiber_ids.at(e.p_fiber));
+				break;
+
+			default:
+				break;
+		}
+	}
+}
+
+// The fiber's track: its tasks and the time it has been parked. A fiber may move from one worker
+// to another, so the events of all the workers are merged.
+void write_fiber_track(chrome_trace_writer& writer, size_t fiber_id, const std::vector<fiber_event>& events)
+{
+	const fiber_event* p_task = nullptr;
+	const fiber_event* p_park = nullptr;
+
+	for (const fiber_event& fe : events) {
+		const trace_event& e = *fe.p_event;
+
+		switch (e.type) {
+			case trace_event_type::task_begin:
+				p_task = &fe;
+				break;
+
+			case trace_event_type::task_end:
+				if (p_task) {
+					writer.slice("task", fiber_pid, fiber_id, p_task->p_event->timestamp, e.timestamp,
+						"worker", p_task->worker_index);
+				}
+				p_task = nullptr;
+				break;
+
+			case trace_event_type::park:
+				p_park = &fe;
+				break;
+
+			case trace_event_type::resume:
+				if (p_park) {
+					writer.slice("wait", fiber_pid, fiber_id, p_park->p_event->timestamp, e.timestamp,
+						"resumed_by_worker", fe.worker_index);
+				}
+				p_park = nullptr;
+				break;
+
+			default:
+				break;
+		}
+	}
+}
+
+} // namespace
+
+
+namespace ts {
+
+// ----- trace_buffer -----
+
+trace_buffer::trace_buffer(size_t capacity)
+	: p_events_(new trace_event[capacity]),
+	capacity_(capacity)
+{
+	assert(capacity > 0);
+}
+
+// ----- funcs -----
+
+uint64_t read_trace_timestamp() noexcept
+{
+#ifdef TS_TRACE_HAS_RDTSC
+	return __rdtsc();
+#else
+	return steady_clock_ns();
+#endif
+}
+
+trace_clock calibrate_trace_clock(uint64_t start_timestamp, uint64_t start_ns) noexcept
+{
+	trace_clock clock;
+	clock.origin = start_timestamp;
+
+	const uint64_t timestamp = read_trace_timestamp();
+	const uint64_t ns = steady_clock_ns();
+	if (ns > start_ns && timestamp > start_timestamp)
+		clock.ticks_per_us = double(timestamp - start_timestamp) * 1000.0 / double(ns - start_ns);
+
+	return clock;
+}
+
+void write_chrome_trace(std::ostream& out, const std::vector<const trace_buffer*>& buffers,
+	const trace_clock& clock, const void* p_kernel_fiber)
+{
+	// Fiber ids are assigned in the order the fibers appear, the kernel fiber is always 0.
+	std::unordered_map<const void*, size_t> fiber_ids;
+	std::vector<std::vector<fiber_event>> fiber_events;
+	auto fiber_id_of = [&fiber_ids, &fiber_events](const void* p_fiber) {
+		auto it = fiber_ids.emplace(p_fiber, fiber_ids.size()).first;
+		if (fiber_events.size() < fiber_ids.size()) fiber_events.resize(fiber_ids.size());
+		return it->second;
+	};
+
+	if (p_kernel_fiber) fiber_id_of(p_kernel_fiber);
+
+	for (size_t w = 0; w < buffers.size(); ++w) {
+		const trace_buffer& buffer = *buffers[w];
+		for (size_t i = 0; i < buffer.size(); ++i) {
+			const trace_event& e = buffer[i];
+			if (!e.p_fiber) continue;
+
+			const size_t id = fiber_id_of(e.p_fiber);
+			if (e.type == trace_event_type::task_begin || e.type == trace_event_type::task_end
+				|| e.type == trace_event_type::park || e.type == trace_event_type::resume) {
+				fiber_events[id].push_back(fiber_event{ &e, w });
+			}
+		}
+	}
+
+	const std::ios_base::fmtflags flags = out.flags();
+	const std::streamsize precision = out.precision();
+	out << std::fixed << std::setprecision(3);
+	out << "{\"traceEvents\":[\n";
+
+	chrome_trace_writer writer(out, clock);
+	writer.metadata("process_name", worker_pid, 0, "workers", chrome_trace_writer::no_index);
+	writer.metadata("process_name", fiber_pid, 0, "fibers", chrome_trace_writer::no_index);
+
+	for (size_t w = 0; w < buffers.size(); ++w)
+		write_worker_track(writer, w, *buffers[w], fiber_ids);
+
+	for (size_t id = 0; id < fiber_events.size(); ++id) {
+		if (id == 0 && p_kernel_fiber)
+			writer.metadata("thread_name", fiber_pid, id, "kernel fiber", chrome_trace_writer::no_index);
+		else
+			writer.metadata("thread_name", fiber_pid, id, "fiber", id);
+
+		std::vector<fiber_event>& events = fiber_events[id];
+		std::stable_sort(events.begin(), events.end(), [](const fiber_event& l, const fiber_event& r) {
+			return l.p_event->timestamp < r.p_event->timestamp;
+		});
+
+		write_fiber_track(writer, id, events);
+	}
+
+	out << "\n]}\n";
+	out.flags(flags);
+	out.precision(precision);
+}
+
+} // namespace ts
@@ -0,0 +1,104 @@
+#ifndef TS_TRACE_H_
+#define TS_TRACE_H_
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <vector>
+
+
+namespace ts {
+
+enum class trace_event_type : uint8_t {
+	task_begin,
+	task_end,
+	spawn,
+	park,
+	resume,
+	fiber_switch_to,
+	fiber_switch_back,
+	idle_begin,
+	idle_end,
+	sleep_begin,
+	sleep_end
+};
+
+struct trace_event final {
+	uint64_t			timestamp = 0;
+
+	// The fiber the event is about: the fiber which executes the task, waits or is switched to.
+	const void*			p_fiber = nullptr;
+
+	// spawn: the number of tasks.
+	uint32_t			value = 0;
+	trace_event_type	type = trace_event_type::task_begin;
+};
+
+// Returns the time stamp counter where it is available (x86), steady clock nanoseconds otherwise.
+uint64_t read_trace_timestamp() noexcept;
+
+// trace_buffer keeps the last capacity events recorded by one thread.
+// Only the owner thread records events. The events are read after the owner has been joined.
+class trace_buffer final {
+public:
+
+	explicit trace_buffer(size_t capacity);
+
+	trace_buffer(trace_buffer&&) = delete;
+	trace_buffer& operator=(trace_buffer&&) = delete;
+
+
+	void record(trace_event_type type, const void* p_fiber = nullptr, uint32_t value = 0) noexcept
+	{
+		trace_event& e = p_events_[size_t(recorded_count_ % capacity_)];
+		e.timestamp = read_trace_timestamp();
+		e.p_fiber = p_fiber;
+		e.value = value;
+		e.type = type;
+		++recorded_count_;
+	}
+
+	// The number of events which are kept, the oldest events are overwritten when the buffer is full.
+	size_t size() const noexcept
+	{
+		return (recorded_count_ < capacity_) ? size_t(recorded_count_) : capacity_;
+	}
+
+	uint64_t recorded_count() const noexcept
+	{
+		return recorded_count_;
+	}
+
+	// The i-th oldest kept event.
+	const trace_event& operator[](size_t i) const noexcept
+	{
+		const uint64_t first = recorded_count_ - size();
+		return p_events_[size_t((first + i) % capacity_)];
+	}
+
+private:
+
+	std::unique_ptr<trace_event[]>	p_events_;
+	size_t							capacity_;
+	uint64_t						recorded_count_ = 0;
+};
+
+// The parameters to convert trace timestamps to microseconds since the trace start.
+struct trace_clock final {
+	uint64_t	origin = 0;
+	double		ticks_per_us = 1000.0;
+};
+
+// Measures the timestamp frequency between the start of the trace and now.
+// start_timestamp and start_ns are read_trace_timestamp() and steady clock nanoseconds at the start.
+trace_clock calibrate_trace_clock(uint64_t start_timestamp, uint64_t start_ns) noexcept;
+
+// Writes the events in the Chrome trace event format (chrome://tracing, ui.perfetto.dev).
+// buffers[i] holds the events of the i-th worker. Each worker gets a track with the fibers it has run
+// and its idle time, each fiber gets a track with its tasks and waits.
+void write_chrome_trace(std::ostream& out, const std::vector<const trace_buffer*>& buffers,
+	const trace_clock& clock, const void* p_kernel_fiber);
+
+} // namespace ts
+
+#endif // TS_TRACE_H_
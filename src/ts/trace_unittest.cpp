@@ -0,0 +1,134 @@
+#include "ts/trace.h"
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include "ts/task_system.h"
+#include "CppUnitTest.h"
+
+using ts::trace_buffer;
+using ts::trace_event_type;
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+
+namespace {
+
+const char* trace_file_path = "ts_trace_unittest.json";
+
+size_t count_of(const std::string& str, const std::string& pattern)
+{
+	size_t count = 0;
+	for (size_t pos = str.find(pattern); pos != std::string::npos; pos = str.find(pattern, pos + 1))
+		++count;
+
+	return count;
+}
+
+void trace_kernel()
+{
+	ts::task_func funcs[8];
+	for (auto& f : funcs) {
+		f = [] {
+			std::atomic_size_t c;
+			ts::run([] {}, c);
+			ts::wait_for(c);
+		};
+	}
+
+	std::atomic_size_t wait_counter;
+	ts::run(funcs, wait_counter);
+	ts::wait_for(wait_counter);
+}
+
+} // namespace
+
+
+namespace unittest {
+
+TEST_CLASS(trace_trace_buffer) {
+public:
+
+	TEST_METHOD(record)
+	{
+		trace_buffer buffer(4);
+		Assert::AreEqual(size_t(0), buffer.size());
+
+		int fibers[6];
+		for (uint32_t i = 0; i < 3; ++i)
+			buffer.record(trace_event_type::spawn, &fibers[i], i);
+
+		Assert::AreEqual(size_t(3), buffer.size());
+		Assert::IsTrue(buffer[0].p_fiber == &fibers[0]);
+		Assert::IsTrue(buffer[0].timestamp <= buffer[2].timestamp);
+
+		// the oldest events are overwritten
+		for (uint32_t i = 3; i < 6; ++i)
+			buffer.record(trace_event_type::park, &fibers[i], i);
+
+		Assert::AreEqual(size_t(4), buffer.size());
+		Assert::AreEqual(uint64_t(6), buffer.recorded_count());
+		for (size_t i = 0; i < 4; ++i) {
+			Assert::IsTrue(buffer[i].p_fiber == &fibers[i + 2]);
+			Assert::AreEqual(uint32_t(i + 2), buffer[i].value);
+		}
+	}
+
+	TEST_METHOD(write_chrome_trace)
+	{
+		int fibers[2];
+		trace_buffer buffer(64);
+		buffer.record(trace_event_type::task_end, &fibers[0]); // its begin has been overwritten
+		buffer.record(trace_event_type::fiber_switch_to, &fibers[0]);
+		buffer.record(trace_event_type::task_begin, &fibers[0]);
+		buffer.record(trace_event_type::spawn, &fibers[0], 3);
+		buffer.record(trace_event_type::task_end, &fibers[0]);
+		buffer.record(trace_event_type::fiber_switch_back);
+		buffer.record(trace_event_type::idle_begin);
+		buffer.record(trace_event_type::idle_end);
+		buffer.record(trace_event_type::park, &fibers[1]);
+		buffer.record(trace_event_type::resume, &fibers[1]);
+
+		std::ostringstream out;
+		ts::write_chrome_trace(out, { &buffer }, ts::trace_clock(), &fibers[1]);
+		const std::string json = out.str();
+
+		Assert::AreEqual(size_t(1), count_of(json, "\"name\":\"task\""));
+		Assert::AreEqual(size_t(1), count_of(json, "\"name\":\"fiber\",\"ph\":\"X\""));
+		Assert::AreEqual(size_t(1), count_of(json, "\"name\":\"idle\""));
+		Assert::AreEqual(size_t(1), count_of(json, "\"name\":\"wait\""));
+		Assert::AreEqual(size_t(1), count_of(json, "\"args\":{\"count\":3}"));
+		Assert::AreEqual(size_t(1), count_of(json, "kernel fiber"));
+		Assert::AreEqual(count_of(json, "{"), count_of(json, "}"));
+	}
+
+	TEST_METHOD(task_system_trace)
+	{
+		ts::task_system_desc desc;
+		desc.thread_count = 2;
+		desc.fiber_count = 16;
+		desc.fiber_stack_byte_count = 64 * 1024;
+		desc.queue_size = 256;
+		desc.queue_immediate_size = 16;
+		desc.queue_background_size = 16;
+		desc.trace_event_count = 1024;
+		desc.trace_file_path = trace_file_path;
+
+		ts::launch_task_system(desc, trace_kernel);
+
+		std::ifstream file(trace_file_path);
+		Assert::IsTrue(bool(file));
+		std::stringstream json;
+		json << file.rdbuf();
+		file.close();
+		std::remove(trace_file_path);
+
+		// 8 tasks spawned by the kernel, one more by each of them
+		Assert::AreEqual(size_t(16), count_of(json.str(), "\"name\":\"task\""));
+		Assert::IsTrue(count_of(json.str(), "\"name\":\"park\"") > 0);
+		Assert::AreEqual(count_of(json.str(), "{"), count_of(json.str(), "}"));
+	}
+};
+
+} // namespace unittest
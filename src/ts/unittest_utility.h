@@ -0,0 +1,41 @@
+#ifndef TS_UNITTEST_UTILITY_H_
+#define TS_UNITTEST_UTILITY_H_
+
+#include "ts/task_system.h"
+
+
+// The helpers of the tests which launch the task system.
+// A kernel function can't capture anything, the tests pass data to and from kernels through file scope variables.
+namespace unittest {
+
+constexpr size_t default_fiber_count = 16;
+constexpr size_t default_queue_size = 256;
+
+// The thread counts each kernel is tested with.
+constexpr size_t thread_counts[] = { 1, 4 };
+
+// A small task system with 64 KiB stacks. Each of the three queues holds queue_size tasks.
+inline ts::task_system_desc make_desc(size_t thread_count,
+	size_t fiber_count = default_fiber_count, size_t queue_size = default_queue_size)
+{
+	ts::task_system_desc desc;
+	desc.thread_count = thread_count;
+	desc.fiber_count = fiber_count;
+	desc.fiber_stack_byte_count = 64 * 1024;
+	desc.queue_size = queue_size;
+	desc.queue_immediate_size = queue_size;
+	desc.queue_background_size = queue_size;
+	return desc;
+}
+
+// Launches the task system with the kernel once for each of thread_counts.
+inline void run_kernel_for_thread_counts(ts::kernel_func_t p_kernel_func,
+	size_t fiber_count = default_fiber_count, size_t queue_size = default_queue_size)
+{
+	for (size_t thread_count : thread_counts)
+		ts::launch_task_system(make_desc(thread_count, fiber_count, queue_size), p_kernel_func);
+}
+
+} // namespace unittest
+
+#endif // TS_UNITTEST_UTILITY_H_
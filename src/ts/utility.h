@@ -2,13 +2,76 @@
 #define TS_UTILITY_H_
 
 #include <cassert>
+#include <atomic>
 #include <mutex>
 #include <type_traits>
 #include <vector>
 
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+	#include <immintrin.h>
+#endif
+
 
 namespace ts {
 
+// The size of a cache line on the supported platforms.
+// Data which is written by different threads is aligned/padded to it to avoid false sharing.
+constexpr size_t cache_line_byte_count = 64;
+
+// Returns the smallest power of two which is greater than or equal to v.
+inline size_t next_power_of_two(size_t v) noexcept
+{
+	size_t p = 1;
+	while (p < v) p <<= 1;
+	return p;
+}
+
+// Hints the CPU that the thread is in a spin-wait loop.
+inline void cpu_pause() noexcept
+{
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+	_mm_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+// spin_lock guards short critical sections which never suspend the current fiber.
+// Unlike std::mutex it never puts the thread to sleep.
+class spin_lock final {
+public:
+
+	spin_lock() noexcept = default;
+
+	spin_lock(spin_lock&&) = delete;
+	spin_lock& operator=(spin_lock&&) = delete;
+
+
+	bool try_lock() noexcept
+	{
+		return !locked_.exchange(true, std::memory_order_acquire);
+	}
+
+	void lock() noexcept
+	{
+		while (!try_lock()) {
+			while (locked_.load(std::memory_order_relaxed))
+				cpu_pause();
+		}
+	}
+
+	void unlock() noexcept
+	{
+		locked_.store(false, std::memory_order_release);
+	}
+
+private:
+
+	std::atomic_bool locked_{ false };
+};
+
 // exception_slot is used to convey an exception from one thread(or fiber) to another thread(or fiber).
 class exception_slot final {
 public:
@@ -135,7 +198,7 @@ template<typename T>
 template<typename U>
 bool ring_buffer<T>::try_push(U&& v)
 {
-	static_assert(std::is_same<T, std::remove_reference<U>::type>::value, "U must be implicitly convertible to T.");
+	static_assert(std::is_same<T, typename std::remove_reference<U>::type>::value, "U must be implicitly convertible to T.");
 
 	if (curr_count_ == buffer_.size()) return false;
 
@@ -0,0 +1,155 @@
+#ifndef TS_WORK_STEALING_DEQUE_H_
+#define TS_WORK_STEALING_DEQUE_H_
+
+#include <cassert>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <type_traits>
+#include "ts/utility.h"
+
+
+namespace ts {
+
+// Bounded Chase-Lev deque.
+// The owner thread pushes and pops at the bottom (LIFO), any other thread steals from the top (FIFO).
+// Values are read speculatively by thieves and discarded if the steal fails,
+// that is why T has to be trivially copyable (usually it is a pointer).
+// See: D. Chase, Y. Lev 'Dynamic Circular Work-Stealing Deque' and
+// N. M. Le et al. 'Correct and Efficient Work-Stealing for Weak Memory Models'.
+template<typename T>
+class work_stealing_deque final {
+public:
+
+	static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable.");
+
+
+	// size_limit is rounded up to the next power of two.
+	explicit work_stealing_deque(size_t size_limit);
+
+	work_stealing_deque(work_stealing_deque&&) = delete;
+	work_stealing_deque& operator=(work_stealing_deque&&) = delete;
+
+
+	// The value is approximate if the deque is accessed concurrently.
+	bool empty() const noexcept
+	{
+		return (size() == 0);
+	}
+
+	// The value is approximate if the deque is accessed concurrently.
+	size_t size() const noexcept
+	{
+		const int64_t b = bottom_.load(std::memory_order_relaxed);
+		const int64_t t = top_.load(std::memory_order_relaxed);
+		return (b > t) ? size_t(b - t) : 0;
+	}
+
+	size_t size_limit() const noexcept
+	{
+		return mask_ + 1;
+	}
+
+	// Owner only. Returns false if the deque is full.
+	bool try_push(T v) noexcept;
+
+	// Owner only. Pops the most recently pushed value.
+	bool try_pop(T& out_v) noexcept;
+
+	// Any thread. Steals the least recently pushed value.
+	bool try_steal(T& out_v) noexcept;
+
+	// Any thread. Steals half (rounded up) of the values but not more than out_count_limit.
+	// The values are stolen one by one and written to p_out in FIFO order. Returns the number of stolen values.
+	size_t try_steal_half(T* p_out, size_t out_count_limit) noexcept;
+
+private:
+
+	alignas(cache_line_byte_count) std::atomic<int64_t>	top_;
+	alignas(cache_line_byte_count) std::atomic<int64_t>	bottom_;
+	alignas(cache_line_byte_count) std::unique_ptr<std::atomic<T>[]> buffer_;
+	size_t mask_;
+};
+
+template<typename T>
+work_stealing_deque<T>::work_stealing_deque(size_t size_limit)
+	: top_(0),
+	bottom_(0),
+	buffer_(new std::atomic<T>[next_power_of_two(size_limit)]),
+	mask_(next_power_of_two(size_limit) - 1)
+{
+	assert(size_limit > 0);
+}
+
+template<typename T>
+bool work_stealing_deque<T>::try_push(T v) noexcept
+{
+	const int64_t b = bottom_.load(std::memory_order_relaxed);
+	const int64_t t = top_.load(std::memory_order_acquire);
+	if (size_t(b - t) > mask_) return false;
+
+	buffer_[b & mask_].store(v, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	bottom_.store(b + 1, std::memory_order_relaxed);
+	return true;
+}
+
+template<typename T>
+bool work_stealing_deque<T>::try_pop(T& out_v) noexcept
+{
+	const int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+	bottom_.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t t = top_.load(std::memory_order_relaxed);
+
+	if (t > b) {
+		// the deque is empty
+		bottom_.store(b + 1, std::memory_order_relaxed);
+		return false;
+	}
+
+	out_v = buffer_[b & mask_].load(std::memory_order_relaxed);
+	if (t < b) return true;
+
+	// The last value, race against thieves.
+	const bool res = top_.compare_exchange_strong(t, t + 1,
+		std::memory_order_seq_cst, std::memory_order_relaxed);
+	bottom_.store(b + 1, std::memory_order_relaxed);
+	return res;
+}
+
+template<typename T>
+bool work_stealing_deque<T>::try_steal(T& out_v) noexcept
+{
+	int64_t t = top_.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	const int64_t b = bottom_.load(std::memory_order_acquire);
+	if (t >= b) return false;
+
+	out_v = buffer_[t & mask_].load(std::memory_order_relaxed);
+	return top_.compare_exchange_strong(t, t + 1,
+		std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+template<typename T>
+size_t work_stealing_deque<T>::try_steal_half(T* p_out, size_t out_count_limit) noexcept
+{
+	assert(p_out);
+	assert(out_count_limit > 0);
+
+	// A batch can't be taken with one CAS of top: the owner pops without a CAS while 2 or more values are left,
+	// between the thief's read of bottom and its CAS it may pop the values the batch covers.
+	// Each value is stolen on its own and contended as usual, the first failure ends the batch.
+	size_t count = (size() + 1) / 2;
+	if (count > out_count_limit) count = out_count_limit;
+
+	size_t stolen_count = 0;
+	while (stolen_count < count && try_steal(p_out[stolen_count]))
+		++stolen_count;
+
+	return stolen_count;
+}
+
+} // namespace ts
+
+#endif // TS_WORK_STEALING_DEQUE_H_
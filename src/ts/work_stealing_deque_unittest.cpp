@@ -0,0 +1,194 @@
+#include "ts/work_stealing_deque.h"
+
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+#include <thread>
+#include <vector>
+#include "CppUnitTest.h"
+
+using ts::work_stealing_deque;
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+
+namespace unittest {
+
+TEST_CLASS(work_stealing_deque_work_stealing_deque) {
+public:
+
+	TEST_METHOD(ctors)
+	{
+		work_stealing_deque<int> deque_0(4);
+		Assert::IsTrue(deque_0.empty());
+		Assert::AreEqual<size_t>(0, deque_0.size());
+		Assert::AreEqual<size_t>(4, deque_0.size_limit());
+
+		// size_limit is rounded up to a power of two
+		work_stealing_deque<int> deque_1(5);
+		Assert::AreEqual<size_t>(8, deque_1.size_limit());
+	}
+
+	TEST_METHOD(try_push_try_pop_try_steal)
+	{
+		work_stealing_deque<int> deque(4);
+
+		Assert::IsTrue(deque.try_push(1));
+		Assert::IsTrue(deque.try_push(2));
+		Assert::IsTrue(deque.try_push(3));
+		Assert::IsTrue(deque.try_push(4));
+		Assert::IsFalse(deque.try_push(42)); // the deque is full
+		Assert::AreEqual<size_t>(4, deque.size());
+
+		int v = 0;
+		// the owner pops the most recent value
+		Assert::IsTrue(deque.try_pop(v));
+		Assert::AreEqual(4, v);
+		// thieves steal the oldest one
+		Assert::IsTrue(deque.try_steal(v));
+		Assert::AreEqual(1, v);
+		Assert::AreEqual<size_t>(2, deque.size());
+
+		Assert::IsTrue(deque.try_pop(v));
+		Assert::AreEqual(3, v);
+		Assert::IsTrue(deque.try_pop(v));
+		Assert::AreEqual(2, v);
+
+		// empty
+		v = 1000;
+		Assert::IsFalse(deque.try_pop(v));
+		Assert::IsFalse(deque.try_steal(v));
+		Assert::AreEqual(1000, v);
+		Assert::IsTrue(deque.empty());
+	}
+
+	TEST_METHOD(try_steal_half)
+	{
+		work_stealing_deque<int> deque(8);
+		for (int i = 0; i < 5; ++i)
+			deque.try_push(i);
+
+		int values[8] = {};
+		// 5 values, half rounded up
+		Assert::AreEqual<size_t>(3, deque.try_steal_half(values, 8));
+		Assert::AreEqual(0, values[0]);
+		Assert::AreEqual(1, values[1]);
+		Assert::AreEqual(2, values[2]);
+
+		// out_count_limit is respected
+		Assert::AreEqual<size_t>(1, deque.try_steal_half(values, 1));
+		Assert::AreEqual(3, values[0]);
+
+		// the last value
+		Assert::AreEqual<size_t>(1, deque.try_steal_half(values, 8));
+		Assert::AreEqual(4, values[0]);
+		Assert::AreEqual<size_t>(0, deque.try_steal_half(values, 8));
+	}
+
+	TEST_METHOD(push_pop_steal_several_threads)
+	{
+		const size_t thief_count = 7;
+		const int value_count = 100000;
+
+		work_stealing_deque<int> deque(64);
+		std::atomic_bool owner_done = false;
+		std::vector<std::vector<int>> stolen_values(thief_count);
+
+		auto thief_func = [&deque, &owner_done](std::vector<int>& out_values) {
+			int values[8];
+			while (!owner_done || !deque.empty()) {
+				const size_t count = deque.try_steal_half(values, 8);
+				out_values.insert(out_values.end(), values, values + count);
+			}
+		};
+
+		std::vector<std::thread> thieves;
+		thieves.reserve(thief_count);
+		for (size_t i = 0; i < thief_count; ++i)
+			thieves.emplace_back(thief_func, std::ref(stolen_values[i]));
+
+		// the owner pushes all the values and pops some of them back
+		std::vector<int> actual_values;
+		for (int i = 0; i < value_count; ++i) {
+			while (!deque.try_push(i)) {
+				int v;
+				if (deque.try_pop(v)) actual_values.push_back(v);
+			}
+
+			int v;
+			if ((i % 3 == 0) && deque.try_pop(v)) actual_values.push_back(v);
+		}
+
+		owner_done = true;
+		for (auto& t : thieves)
+			t.join();
+
+		// each value must be taken exactly once
+		for (const auto& values : stolen_values)
+			actual_values.insert(actual_values.end(), values.cbegin(), values.cend());
+
+		std::vector<int> origin_values(value_count);
+		std::iota(origin_values.begin(), origin_values.end(), 0);
+		std::sort(actual_values.begin(), actual_values.end());
+		Assert::AreEqual(origin_values.size(), actual_values.size());
+		Assert::IsTrue(std::equal(origin_values.cbegin(), origin_values.cend(), actual_values.cbegin()));
+	}
+
+	TEST_METHOD(pop_while_stealing_half)
+	{
+		// The owner pops most of a small batch right away, so its pops meet the thieves' batches.
+		const size_t thief_count = 3;
+		const int round_count = 20000;
+		const int push_count = 16;
+		const int pop_count = 12;
+
+		work_stealing_deque<int> deque(64);
+		std::atomic_bool owner_done = false;
+		std::vector<std::vector<int>> stolen_values(thief_count);
+
+		auto thief_func = [&deque, &owner_done](std::vector<int>& out_values) {
+			int values[8];
+			while (!owner_done || !deque.empty()) {
+				const size_t count = deque.try_steal_half(values, 8);
+				out_values.insert(out_values.end(), values, values + count);
+			}
+		};
+
+		std::vector<std::thread> thieves;
+		thieves.reserve(thief_count);
+		for (size_t i = 0; i < thief_count; ++i)
+			thieves.emplace_back(thief_func, std::ref(stolen_values[i]));
+
+		std::vector<int> actual_values;
+		for (int r = 0; r < round_count; ++r) {
+			int v;
+			for (int i = 0; i < push_count; ++i) {
+				while (!deque.try_push(r * push_count + i)) {
+					if (deque.try_pop(v)) actual_values.push_back(v);
+				}
+			}
+
+			for (int i = 0; i < pop_count && deque.try_pop(v); ++i)
+				actual_values.push_back(v);
+		}
+
+		int v;
+		while (deque.try_pop(v))
+			actual_values.push_back(v);
+
+		owner_done = true;
+		for (auto& t : thieves)
+			t.join();
+
+		// each value must be taken exactly once
+		for (const auto& values : stolen_values)
+			actual_values.insert(actual_values.end(), values.cbegin(), values.cend());
+
+		std::vector<int> origin_values(round_count * push_count);
+		std::iota(origin_values.begin(), origin_values.end(), 0);
+		std::sort(actual_values.begin(), actual_values.end());
+		Assert::AreEqual(origin_values.size(), actual_values.size());
+		Assert::IsTrue(std::equal(origin_values.cbegin(), origin_values.cend(), actual_values.cbegin()));
+	}
+};
+
+} // namespace unittest